@@ -0,0 +1,851 @@
+#include "aot.h"
+#include "chunk.h"
+#include "external/log.h"
+#include "functions.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "verifier.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef ZSPIE_INCLUDE_DIR
+#define ZSPIE_INCLUDE_DIR "src"
+#endif
+
+#ifndef ZSPIE_LIBRARY_DIR
+#define ZSPIE_LIBRARY_DIR "."
+#endif
+
+/*
+ * Writes chars as a C string literal.
+ */
+static void emit_string_literal(FILE *out, const char *chars, size_t length) {
+  fputc('"', out);
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)chars[i];
+    if (c == '"' || c == '\\') {
+      fprintf(out, "\\%c", c);
+    } else if (c < 0x20 || c >= 0x7f || c == '?') {
+      // octal escapes can't swallow the next character like \x does.
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+/*
+ * If every reachable instruction of the chunk can be translated to C.
+ */
+static bool can_translate(Chunk *chunk, int *heights) {
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk, offset)) {
+    if (heights[offset] == -1) {
+      continue;
+    }
+
+    switch (chunk->code[offset]) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NULL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_POP:
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG:
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_LONG:
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_PRINT:
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+    case OP_PEEK:
+    case OP_INLINE_GUARD:
+    case OP_INLINE_RETURN:
+    case OP_CALL:
+    case OP_CALL_LONG:
+    case OP_CALL_0:
+    case OP_CALL_1:
+    case OP_CALL_2:
+    case OP_CALL_3:
+    case OP_RETURN:
+    case OP_FOR_STEP:
+    case OP_CHECK_NUM:
+    case OP_ADD_NN:
+    case OP_SUBTRACT_NN:
+    case OP_MULTIPLY_NN:
+    case OP_DIVIDE_NN:
+    case OP_LESS_NN:
+    case OP_GREATER_NN:
+    case OP_GET_CAPTURE:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE:
+    case OP_ARRAY:
+    case OP_GET_INDEX:
+    case OP_SET_INDEX:
+    case OP_MAP:
+    case OP_CONCAT_N:
+    case OP_MATH:
+    case OP_RETURN_N:
+    case OP_UNPACK:
+    case OP_JUMP_TABLE:
+    case OP_JUMP_MAP:
+      break;
+
+    default:
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Writes a float literal, infinities and NaN by their <math.h> macros.
+ */
+static void emit_number(FILE *out, double number) {
+  if (!isfinite(number)) {
+    fprintf(out, "NUMBER_VAL(%s%s)", signbit(number) ? "-" : "",
+            isnan(number) ? "NAN" : "INFINITY");
+  } else {
+    fprintf(out, "NUMBER_VAL(%a)", number);
+  }
+}
+
+/*
+ * Writes an integer literal, the lowest one as INT64_MIN since its negation
+ * doesn't fit in a signed literal.
+ */
+static void emit_int(FILE *out, int64_t number) {
+  if (number == INT64_MIN) {
+    fprintf(out, "INT_VAL(INT64_MIN)");
+  } else {
+    fprintf(out, "INT_VAL(INT64_C(%" PRId64 "))", number);
+  }
+}
+
+/*
+ * Writes a constant as a C expression, numbers as literals.
+ */
+static void emit_constant(FILE *out, Chunk *chunk, size_t index,
+                          uint32_t constant) {
+  Value value = chunk->constants.values[constant];
+  if (IS_NUMBER(value)) {
+    emit_number(out, AS_NUMBER(value));
+  } else if (IS_INT(value)) {
+    emit_int(out, AS_INT(value));
+  } else {
+    fprintf(out, "constants_%zu[%u]", index, constant);
+  }
+}
+
+/*
+ * Writes the C statements for one instruction. The stack slot at height h
+ * lives in the C local `s<h>`.
+ * @param index - number of the function being translated.
+ * @param h - stack height before the instruction.
+ */
+static void emit_instruction(FILE *out, Chunk *chunk, size_t index,
+                             size_t offset, int h) {
+  uint8_t op = chunk->code[offset];
+  size_t length = instruction_length(chunk, offset);
+  size_t next = offset + length;
+
+  switch (op) {
+  case OP_CONSTANT:
+  case OP_CONSTANT_LONG: {
+    fprintf(out, "  s%d = ", h);
+    emit_constant(out, chunk, index, read_operand(chunk, offset));
+    fprintf(out, ";\n");
+    break;
+  }
+
+  case OP_NULL:
+    fprintf(out, "  s%d = NULL_VAL;\n", h);
+    break;
+
+  case OP_TRUE:
+    fprintf(out, "  s%d = BOOL_VAL(true);\n", h);
+    break;
+
+  case OP_FALSE:
+    fprintf(out, "  s%d = BOOL_VAL(false);\n", h);
+    break;
+
+  case OP_POP:
+    fprintf(out, "  /* pop s%d */;\n", h - 1);
+    break;
+
+  case OP_GET_LOCAL:
+  case OP_GET_LOCAL_LONG:
+    fprintf(out, "  s%d = s%u;\n", h, read_operand(chunk, offset));
+    break;
+
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_LONG:
+    fprintf(out, "  s%u = s%d;\n", read_operand(chunk, offset), h - 1);
+    break;
+
+  case OP_DEFINE_GLOBAL:
+  case OP_DEFINE_GLOBAL_LONG:
+    fprintf(out, "  table_set(&vm.globals, AS_STRING(constants_%zu[%u]), s%d);\n",
+            index, read_operand(chunk, offset), h - 1);
+    break;
+
+  case OP_SET_GLOBAL:
+  case OP_SET_GLOBAL_LONG:
+    fprintf(out,
+            "  if (!aot_set_global(frame, AS_STRING(constants_%zu[%u]), s%d, "
+            "%zu)) return false;\n",
+            index, read_operand(chunk, offset), h - 1, next);
+    break;
+
+  case OP_GET_GLOBAL:
+  case OP_GET_GLOBAL_LONG:
+    fprintf(out,
+            "  if (!aot_get_global(frame, &s%d, AS_STRING(constants_%zu[%u]), "
+            "%zu)) return false;\n",
+            h, index, read_operand(chunk, offset), next);
+    break;
+
+  case OP_EQUAL:
+    fprintf(out, "  s%d = BOOL_VAL(values_equal(s%d, s%d));\n", h - 2, h - 2,
+            h - 1);
+    break;
+
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE: {
+    const char *format =
+        op == OP_GREATER    ? "BOOL_VAL(greater_values(s%d, s%d))"
+        : op == OP_LESS     ? "BOOL_VAL(less_values(s%d, s%d))"
+        : op == OP_SUBTRACT ? "subtract_values(s%d, s%d)"
+        : op == OP_MULTIPLY ? "multiply_values(s%d, s%d)"
+                            : "divide_values(s%d, s%d)";
+    fprintf(out, "  AOT_BINARY(s%d, s%d, s%d, ", h - 2, h - 2, h - 1);
+    fprintf(out, format, h - 2, h - 1);
+    fprintf(out, ", %zu);\n", next);
+    break;
+  }
+
+  case OP_ADD:
+    fprintf(out,
+            "  if (!aot_add(frame, &s%d, s%d, s%d, %d, %zu)) return false;\n",
+            h - 2, h - 2, h - 1, h - 2, next);
+    break;
+
+  case OP_ADD_NN:
+  case OP_SUBTRACT_NN:
+  case OP_MULTIPLY_NN:
+  case OP_DIVIDE_NN:
+  case OP_LESS_NN:
+  case OP_GREATER_NN: {
+    // the compiler knows the operands are numbers.
+    const char *format =
+        op == OP_ADD_NN        ? "add_values(s%d, s%d)"
+        : op == OP_SUBTRACT_NN ? "subtract_values(s%d, s%d)"
+        : op == OP_MULTIPLY_NN ? "multiply_values(s%d, s%d)"
+        : op == OP_DIVIDE_NN   ? "divide_values(s%d, s%d)"
+        : op == OP_LESS_NN     ? "BOOL_VAL(less_values(s%d, s%d))"
+                               : "BOOL_VAL(greater_values(s%d, s%d))";
+    fprintf(out, "  s%d = ", h - 2);
+    fprintf(out, format, h - 2, h - 1);
+    fprintf(out, ";\n");
+    break;
+  }
+
+  case OP_CHECK_NUM:
+    fprintf(out,
+            "  if (!IS_NUMERIC(s%d)) AOT_ERROR(%zu, \"Expected a number.\");\n",
+            h - 1 - chunk->code[offset + 1], next);
+    break;
+
+  case OP_NOT:
+    fprintf(out, "  s%d = BOOL_VAL(is_falsey(s%d));\n", h - 1, h - 1);
+    break;
+
+  // the closure being run is in s0.
+  case OP_GET_CAPTURE:
+    fprintf(out, "  s%d = AS_CLOSURE(s0)->captures[%u];\n", h,
+            chunk->code[offset + 1]);
+    break;
+
+  case OP_GET_UPVALUE:
+    fprintf(out,
+            "  s%d = *((ObjUpvalue *)AS_OBJ(AS_CLOSURE(s0)->captures[%u]))"
+            "->location;\n",
+            h, chunk->code[offset + 1]);
+    break;
+
+  case OP_SET_UPVALUE:
+    fprintf(out,
+            "  *((ObjUpvalue *)AS_OBJ(AS_CLOSURE(s0)->captures[%u]))"
+            "->location = s%d;\n",
+            chunk->code[offset + 1], h - 1);
+    break;
+
+  case OP_ARRAY: {
+    // the elements are in consecutive C locals, copied to an array first.
+    int count = (int)read_operand(chunk, offset);
+    fprintf(out, "  {\n    Value elements[%d];\n", count > 0 ? count : 1);
+    for (int i = 0; i < count; i++) {
+      fprintf(out, "    elements[%d] = s%d;\n", i, h - count + i);
+    }
+    fprintf(out, "    s%d = OBJ_VAL(array_of(elements, %d));\n  }\n",
+            h - count, count);
+    break;
+  }
+
+  case OP_MAP: {
+    int count = (int)read_operand(chunk, offset);
+    fprintf(out, "  {\n    Value pairs[%d];\n", count > 0 ? 2 * count : 1);
+    for (int i = 0; i < 2 * count; i++) {
+      fprintf(out, "    pairs[%d] = s%d;\n", i, h - 2 * count + i);
+    }
+    fprintf(out,
+            "    if (!aot_map(frame, &s%d, pairs, %d, %zu)) return false;\n"
+            "  }\n",
+            h - 2 * count, count, next);
+    break;
+  }
+
+  case OP_CONCAT_N: {
+    int count = chunk->code[offset + 1];
+    fprintf(out, "  {\n    Value parts[%d];\n", count);
+    for (int i = 0; i < count; i++) {
+      fprintf(out, "    parts[%d] = s%d;\n", i, h - count + i);
+    }
+    fprintf(out,
+            "    if (!aot_concat(frame, &s%d, parts, %d, %d, %zu)) return "
+            "false;\n"
+            "  }\n",
+            h - count, count, chunk->code[offset + 2], next);
+    break;
+  }
+
+  case OP_MATH: {
+    MathFunction function = (MathFunction)chunk->code[offset + 1];
+    int arity = math_intrinsics[function].arity;
+    int callee = h - arity - 1;
+    fprintf(out,
+            "  if (is_math_native(s%d, %d)) {\n"
+            "    s%d = aot_math(%d, s%d, s%d);\n"
+            "  } else {\n",
+            callee, function, callee, function, callee + 1, h - 1);
+    // anything else the global holds is called as usual.
+    for (int slot = callee; slot < h; slot++) {
+      fprintf(out, "    frame->slots[%d] = s%d;\n", slot, slot);
+    }
+    fprintf(out,
+            "    if (!aot_call(frame, %d, %d, %u, %zu)) return false;\n"
+            "    s%d = frame->slots[%d];\n"
+            "  }\n",
+            callee, arity, call_cache_index(chunk, offset), next, callee,
+            callee);
+    break;
+  }
+
+  case OP_GET_INDEX:
+    fprintf(out,
+            "  if (!aot_get_index(frame, &s%d, s%d, s%d, %zu)) return false;\n",
+            h - 2, h - 2, h - 1, next);
+    break;
+
+  case OP_SET_INDEX:
+    fprintf(out,
+            "  if (!aot_set_index(frame, s%d, s%d, s%d, %zu)) return false;\n"
+            "  s%d = s%d;\n",
+            h - 3, h - 2, h - 1, next, h - 3, h - 1);
+    break;
+
+  case OP_NEGATE:
+    fprintf(out,
+            "  if (!IS_NUMERIC(s%d)) AOT_ERROR(%zu, \"Operand must be a "
+            "number.\");\n"
+            "  s%d = negate_value(s%d);\n",
+            h - 1, next, h - 1, h - 1);
+    break;
+
+  case OP_PRINT:
+    fprintf(out, "  print_value(s%d);\n  printf(\"\\n\");\n", h - 1);
+    break;
+
+  case OP_JUMP:
+  case OP_JUMP_LONG:
+  case OP_LOOP:
+  case OP_LOOP_LONG:
+    fprintf(out, "  goto L%ld;\n", jump_target(chunk, offset));
+    break;
+
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_FALSE_LONG:
+    fprintf(out, "  if (is_falsey(s%d)) goto L%ld;\n", h - 1,
+            jump_target(chunk, offset));
+    break;
+
+  case OP_PEEK:
+    fprintf(out, "  s%d = s%d;\n", h, h - 1 - chunk->code[offset + 1]);
+    break;
+
+  case OP_INLINE_GUARD:
+    fprintf(out,
+            "  if (values_equal(s%d, constants_%zu[%u])) goto L%ld;\n",
+            h - 1 - chunk->code[offset + 1], index,
+            inline_guard_constant(chunk, offset), jump_target(chunk, offset));
+    break;
+
+  case OP_INLINE_RETURN:
+    fprintf(out, "  s%d = s%d;\n", h - 1 - chunk->code[offset + 1], h - 1);
+    break;
+
+  case OP_CALL:
+  case OP_CALL_LONG:
+  case OP_CALL_0:
+  case OP_CALL_1:
+  case OP_CALL_2:
+  case OP_CALL_3: {
+    // the callee and its arguments go through the vm's stack.
+    int args_count = (int)call_args_count(chunk, offset);
+    int callee = h - args_count - 1;
+    for (int slot = callee; slot < h; slot++) {
+      fprintf(out, "  frame->slots[%d] = s%d;\n", slot, slot);
+    }
+    fprintf(out,
+            "  if (!aot_call(frame, %d, %d, %u, %zu)) return false;\n"
+            "  s%d = frame->slots[%d];\n",
+            callee, args_count, call_cache_index(chunk, offset), next, callee,
+            callee);
+    break;
+  }
+
+  case OP_RETURN:
+    fprintf(out, "  return_from_call(s%d);\n  return true;\n", h - 1);
+    break;
+
+  case OP_RETURN_N: {
+    int count = chunk->code[offset + 1];
+    fprintf(out, "  {\n    Value values[] = {");
+    for (int slot = h - count; slot < h; slot++) {
+      fprintf(out, slot == h - 1 ? "s%d" : "s%d, ", slot);
+    }
+    fprintf(out, "};\n    return_values(values, %d);\n  }\n  return true;\n",
+            count);
+    break;
+  }
+
+  case OP_JUMP_TABLE:
+  case OP_JUMP_MAP: {
+    int count = jump_table_count(chunk, offset);
+    fprintf(out,
+            "  switch (jump_table_index(&frame->function->chunk, %zu, s%d)) "
+            "{\n",
+            offset, h - 1);
+    for (int i = 0; i < count; i++) {
+      fprintf(out, "  case %d: goto L%zu;\n", i,
+              jump_table_target(chunk, offset, i));
+    }
+    fprintf(out, "  default: goto L%zu;\n  }\n",
+            jump_table_target(chunk, offset, count));
+    break;
+  }
+
+  case OP_UNPACK: {
+    // the returned values are still in the vm's stack where the call left
+    // them.
+    int count = chunk->code[offset + 1];
+    fprintf(out, "  unpack_values(&frame->slots[%d], %d);\n", h - 1, count);
+    for (int slot = h - 1; slot < h - 1 + count; slot++) {
+      fprintf(out, "  s%d = frame->slots[%d];\n", slot, slot);
+    }
+    break;
+  }
+
+  case OP_FOR_STEP: {
+    int counter = chunk->code[offset + 1];
+    uint8_t mode = chunk->code[offset + 2];
+    uint8_t limit = chunk->code[offset + 3];
+    fprintf(out,
+            "  if (!IS_NUMERIC(s%d)) AOT_ERROR(%zu, \"Operands must be two "
+            "strings or two numbers.\");\n",
+            counter, next);
+    if (!(mode & FOR_LIMIT_CONSTANT)) {
+      fprintf(out,
+              "  if (!IS_NUMERIC(s%d)) AOT_ERROR(%zu, \"Operands must be "
+              "number.\");\n",
+              limit, next);
+    }
+    fprintf(out, "  if (for_step(&s%d, ", counter);
+    emit_constant(out, chunk, index, chunk->code[offset + 4]);
+    fprintf(out, ", ");
+    if (mode & FOR_LIMIT_CONSTANT) {
+      emit_constant(out, chunk, index, limit);
+    } else {
+      fprintf(out, "s%d", limit);
+    }
+    fprintf(out, ", %d)) goto L%ld;\n", mode, jump_target(chunk, offset));
+    break;
+  }
+  }
+}
+
+/*
+ * Writes the C function for a function whose instructions can all be
+ * translated.
+ */
+static void emit_function(FILE *out, ObjFunction *function, size_t index,
+                          int *heights) {
+  Chunk *chunk = &function->chunk;
+
+  bool *targets = ALLOCATE(bool, chunk->count);
+  memset(targets, 0, chunk->count * sizeof(bool));
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk, offset)) {
+    long target = jump_target(chunk, offset);
+    if (heights[offset] != -1 && target != -1) {
+      targets[target] = true;
+    }
+    uint8_t op = chunk->code[offset];
+    if (heights[offset] != -1 && (op == OP_JUMP_TABLE || op == OP_JUMP_MAP)) {
+      for (int i = 0; i <= jump_table_count(chunk, offset); i++) {
+        targets[jump_table_target(chunk, offset, i)] = true;
+      }
+    }
+  }
+
+  fprintf(out, "static bool zspie_fn_%zu(CallFrame *frame) {\n", index);
+  for (int slot = 0; slot < function->max_stack; slot++) {
+    if (slot <= function->arity) {
+      fprintf(out, "  Value s%d = frame->slots[%d];\n", slot, slot);
+    } else {
+      fprintf(out, "  Value s%d = NULL_VAL;\n", slot);
+    }
+  }
+  // the callee's slot is only read by methods, as `this`.
+  fprintf(out, "  (void)s0;\n\n");
+
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk, offset)) {
+    // unreachable code isn't translated.
+    if (heights[offset] == -1) {
+      continue;
+    }
+
+    if (targets[offset]) {
+      fprintf(out, "L%zu:\n", offset);
+    }
+    emit_instruction(out, chunk, index, offset, heights[offset]);
+  }
+
+  fprintf(out, "}\n\n");
+  FREE_ARRAY(bool, targets, chunk->count);
+}
+
+/*
+ * Writes the static bytecode, line and constant arrays of a function, the
+ * runtime still reads them to report errors and for interpreted functions.
+ */
+static void emit_function_data(FILE *out, ObjFunction *function,
+                               size_t index) {
+  Chunk *chunk = &function->chunk;
+
+  fprintf(out, "static uint8_t code_%zu[] = {", index);
+  for (size_t i = 0; i < chunk->count; i++) {
+    fprintf(out, "%s%u,", i % 16 == 0 ? "\n  " : " ", chunk->code[i]);
+  }
+  fprintf(out, "\n};\n");
+
+  fprintf(out, "static size_t lines_%zu[] = {", index);
+  for (size_t i = 0; i < chunk->count; i++) {
+    fprintf(out, "%s%zu,", i % 16 == 0 ? "\n  " : " ", chunk->lines[i]);
+  }
+  fprintf(out, "\n};\n");
+
+  // zero length arrays aren't standard C.
+  fprintf(out, "static Value constants_%zu[%zu];\n\n", index,
+          chunk->constants.count > 0 ? chunk->constants.count : 1);
+}
+
+/*
+ * Name of the global holding a native, natives only exist as globals.
+ * @return NULL if there's none.
+ */
+static ObjString *native_name(Value native) {
+  for (size_t i = 0; i < vm.globals.capacity; i++) {
+    Entry *entry = &vm.globals.entries[i];
+    if (entry->key != NULL && IS_OBJ(entry->value) &&
+        AS_OBJ(entry->value) == AS_OBJ(native)) {
+      return entry->key;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Writes a constant as a C expression creating it at startup, maps are
+ * created empty and natives are looked up by their global.
+ */
+static void emit_value(FILE *out, FunctionList *list, Value value) {
+  if (IS_NUMBER(value)) {
+    emit_number(out, AS_NUMBER(value));
+  } else if (IS_INT(value)) {
+    emit_int(out, AS_INT(value));
+  } else if (IS_BOOL(value)) {
+    fprintf(out, "BOOL_VAL(%s)", AS_BOOL(value) ? "true" : "false");
+  } else if (IS_STRING(value)) {
+    fprintf(out, "OBJ_VAL(copy_string(");
+    emit_string_literal(out, AS_CSTRING(value), AS_STRING(value)->length);
+    fprintf(out, ", %zu))", AS_STRING(value)->length);
+  } else if (IS_FUNCTION(value)) {
+    fprintf(out, "OBJ_VAL(functions[%ld])",
+            find_function(list, AS_FUNCTION(value)));
+  } else if (IS_MAP(value)) {
+    fprintf(out, "OBJ_VAL(new_map(%d))", AS_MAP(value)->count);
+  } else if (IS_NATIVE(value) && native_name(value) != NULL) {
+    ObjString *name = native_name(value);
+    fprintf(out, "aot_native(");
+    emit_string_literal(out, name->chars, name->length);
+    fprintf(out, ", %zu)", name->length);
+  } else {
+    fprintf(out, "NULL_VAL");
+  }
+}
+
+/*
+ * Writes the statements creating a function object at startup.
+ */
+static void emit_function_setup(FILE *out, FunctionList *list, size_t index,
+                                bool compiled) {
+  ObjFunction *function = list->functions[index];
+  Chunk *chunk = &function->chunk;
+
+  fprintf(out, "  function = functions[%zu];\n", index);
+  fprintf(out, "  function->arity = %d;\n", function->arity);
+  fprintf(out, "  function->max_stack = %d;\n", function->max_stack);
+  if (function->name != NULL) {
+    fprintf(out, "  function->name = copy_string(");
+    emit_string_literal(out, function->name->chars, function->name->length);
+    fprintf(out, ", %zu);\n", function->name->length);
+  }
+  fprintf(out,
+          "  function->chunk.code = code_%zu;\n"
+          "  function->chunk.lines = lines_%zu;\n"
+          "  function->chunk.count = function->chunk.capacity = %zu;\n"
+          "  function->chunk.constants.values = constants_%zu;\n"
+          "  function->chunk.constants.count = "
+          "function->chunk.constants.capacity = %zu;\n"
+          "  function->chunk.packed = true;\n",
+          index, index, chunk->count, index, chunk->constants.count);
+
+  for (size_t i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    fprintf(out, "  constants_%zu[%zu] = ", index, i);
+    emit_value(out, list, constant);
+    fprintf(out, ";\n");
+
+    // the map of an OP_JUMP_MAP.
+    if (IS_MAP(constant)) {
+      ObjMap *map = AS_MAP(constant);
+      for (int entry = 0; entry < map->used; entry++) {
+        if (IS_NULL(map->entries[entry].key)) {
+          continue;
+        }
+        fprintf(out, "  map_set(AS_MAP(constants_%zu[%zu]), ", index, i);
+        emit_value(out, list, map->entries[entry].key);
+        fprintf(out, ", ");
+        emit_value(out, list, map->entries[entry].value);
+        fprintf(out, ");\n");
+      }
+    }
+  }
+
+  fprintf(out, "  init_call_caches(function, %d);\n",
+          function->call_cache_count);
+  fprintf(out, "  init_property_caches(function, %d);\n",
+          function->property_cache_count);
+
+  if (function->memo != NULL) {
+    fprintf(out, "  function->memo = new_memo();\n");
+  }
+
+  if (function->capture_count > 0) {
+    fprintf(out,
+            "  function->captures = ALLOCATE(Capture, %d);\n"
+            "  function->capture_count = %d;\n",
+            function->capture_count, function->capture_count);
+    for (int i = 0; i < function->capture_count; i++) {
+      Capture *capture = &function->captures[i];
+      fprintf(out, "  function->captures[%d] = (Capture){%d, %s, %u};\n", i,
+              capture->source, capture->cell ? "true" : "false",
+              capture->index);
+    }
+  }
+
+  if (compiled) {
+    fprintf(out, "  function->compiled = zspie_fn_%zu;\n", index);
+  }
+  fprintf(out, "\n");
+}
+
+/*
+ * Writes a makefile building the generated C file against libzspie.
+ */
+static bool emit_recipe(const char *output_path) {
+  size_t length = strlen(output_path);
+  // the program is named after the C file without its extension.
+  size_t stem_length = length;
+  if (length > 2 && strcmp(output_path + length - 2, ".c") == 0) {
+    stem_length -= 2;
+  }
+
+  char *recipe_path = ALLOCATE(char, stem_length + 4);
+  memcpy(recipe_path, output_path, stem_length);
+  memcpy(recipe_path + stem_length, ".mk", 4);
+
+  const char *base = strrchr(output_path, '/');
+  base = base == NULL ? output_path : base + 1;
+  int program_length = (int)(stem_length - (size_t)(base - output_path));
+
+  FILE *out = fopen(recipe_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Couldn't open file : '%s'\n", recipe_path);
+    log_error("Couldn't open file : '%s'", recipe_path);
+    FREE_ARRAY(char, recipe_path, stem_length + 4);
+    return false;
+  }
+
+  fprintf(out,
+          "# Generated by zspie --emit-c, builds %.*s against libzspie.\n"
+          "#   make -f %s\n"
+          "\n"
+          "ZSPIE_INCLUDE_DIR ?= %s\n"
+          "ZSPIE_LIBRARY_DIR ?= %s\n"
+          "CFLAGS ?= -O2\n"
+          "\n"
+          "HERE := $(dir $(lastword $(MAKEFILE_LIST)))\n"
+          "\n"
+          "$(HERE)%.*s: $(HERE)%s\n"
+          "\t$(CC) $(CFLAGS) -I$(ZSPIE_INCLUDE_DIR) "
+          "-I$(ZSPIE_INCLUDE_DIR)/external -o $@ $< "
+          "-L$(ZSPIE_LIBRARY_DIR) -lzspie -lm\n",
+          program_length, base, recipe_path, ZSPIE_INCLUDE_DIR,
+          ZSPIE_LIBRARY_DIR, program_length, base, base);
+
+  fclose(out);
+  log_info("wrote build recipe : %s", recipe_path);
+  FREE_ARRAY(char, recipe_path, stem_length + 4);
+  return true;
+}
+
+bool emit_c(ObjFunction *script, const char *source_path,
+            const char *output_path) {
+  log_info("emitting c for %s to %s", source_path, output_path);
+
+  FILE *out = fopen(output_path, "w");
+  if (out == NULL) {
+    fprintf(stderr, "Couldn't open file : '%s'\n", output_path);
+    log_error("Couldn't open file : '%s'", output_path);
+    return false;
+  }
+
+  // a function's index in the list is its number in the generated code.
+  FunctionList list;
+  init_function_list(&list);
+  collect_functions(&list, script);
+
+  fprintf(out,
+          "/*\n"
+          " * Generated by zspie --emit-c from %s, do not edit.\n"
+          " */\n"
+          "#include \"aot.h\"\n"
+          "#include \"external/log.h\"\n"
+          "#include <math.h>\n"
+          "#include <stdio.h>\n"
+          "#include <stdlib.h>\n"
+          "\n"
+          "static ObjFunction *functions[%zu];\n"
+          "\n",
+          source_path, list.count);
+
+  for (size_t i = 0; i < list.count; i++) {
+    emit_function_data(out, list.functions[i], i);
+  }
+
+  // functions which use instructions the backend doesn't know are left to
+  // the interpreter.
+  bool *compiled = ALLOCATE(bool, list.count);
+  for (size_t i = 0; i < list.count; i++) {
+    Chunk *chunk = &list.functions[i]->chunk;
+    int *heights = ALLOCATE(int, chunk->count);
+    int max_stack = 0;
+
+    compiled[i] =
+        analyze_chunk(chunk, list.functions[i]->arity, heights, &max_stack) &&
+        can_translate(chunk, heights);
+    if (compiled[i]) {
+      emit_function(out, list.functions[i], i, heights);
+    } else {
+      log_info("function %zu is left to the interpreter", i);
+    }
+
+    FREE_ARRAY(int, heights, chunk->count);
+  }
+
+  fprintf(out, "static void load_functions() {\n"
+               "  ObjFunction *function;\n"
+               "\n");
+  for (size_t i = 0; i < list.count; i++) {
+    fprintf(out, "  functions[%zu] = new_function();\n", i);
+  }
+  fprintf(out, "\n");
+  for (size_t i = 0; i < list.count; i++) {
+    emit_function_setup(out, &list, i, compiled[i]);
+  }
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "int main(void) {\n"
+               "  log_set_quiet(true);\n"
+               "  init_vm();\n"
+               "  load_functions();\n"
+               "\n"
+               "  InterpretResult result = interpret_function(functions[0]);\n"
+               "  free_vm();\n"
+               "  return result == INTERPRET_RUNTIME_ERROR ? 70 : "
+               "EXIT_SUCCESS;\n"
+               "}\n");
+
+  bool written = !ferror(out);
+  fclose(out);
+
+  FREE_ARRAY(bool, compiled, list.count);
+  free_function_list(&list);
+
+  if (!written) {
+    fprintf(stderr, "Couldn't write file : '%s'\n", output_path);
+    log_error("Couldn't write file : '%s'", output_path);
+    return false;
+  }
+  return emit_recipe(output_path);
+}
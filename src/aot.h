@@ -0,0 +1,164 @@
+#ifndef ZSPIE_AOT_H_
+#define ZSPIE_AOT_H_
+
+/*
+ * Ahead of time compilation of zspie bytecode to C.
+ *
+ * `emit_c` writes a C translation unit with one C function per compiled
+ * ObjFunction, and a makefile to build it against the libzspie runtime.
+ * The rest of this header is the runtime support the generated code uses,
+ * generated functions keep the operand stack in C locals and only go
+ * through the vm's stack to call other functions.
+ */
+
+#include "array.h"
+#include "common.h"
+#include "map.h"
+#include "mathlib.h"
+#include "memo.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * Translates a compiled and verified script, and all functions reachable
+ * from it, to C.
+ * @param script - top level function returned by `compile`.
+ * @param source_path - path of the compiled script, for comments.
+ * @param output_path - path of the C file to write, a makefile with the same
+ * name and a `.mk` extension is written next to it.
+ * @return false if the output couldn't be written.
+ */
+bool emit_c(ObjFunction *script, const char *source_path,
+            const char *output_path);
+
+// sets the frame's ip to just after the current instruction, so runtime
+// errors report the right line.
+#define AOT_AT(next) (frame->ip = frame->function->chunk.code + (next))
+
+/*
+ * Fails the running compiled function with a runtime error.
+ */
+#define AOT_ERROR(next, ...)                                                   \
+  do {                                                                         \
+    AOT_AT(next);                                                              \
+    runtime_error(__VA_ARGS__);                                                \
+    return false;                                                              \
+  } while (false)
+
+// arithmetic and comparison on two numbers, result is computed from a and b.
+#define AOT_BINARY(dst, a, b, result, next)                                    \
+  do {                                                                         \
+    if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {                                    \
+      AOT_ERROR(next, "Operands must be number.");                             \
+    }                                                                          \
+    dst = result;                                                              \
+  } while (false)
+
+/*
+ * `+` on two numbers or two strings, strings are concatenated on the vm's
+ * stack at `height`, where the operands would have been.
+ */
+static inline bool aot_add(CallFrame *frame, Value *dst, Value a, Value b,
+                           int height, size_t next) {
+  if (IS_TEXT(a) && IS_TEXT(b)) {
+    vm.stack_top = frame->slots + height;
+    push(a);
+    push(b);
+    concatenate();
+    *dst = pop();
+    return true;
+  }
+
+  if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+    *dst = add_values(a, b);
+    return true;
+  }
+
+  AOT_AT(next);
+  runtime_error("Operands must be two strings or two numbers.");
+  return false;
+}
+
+static inline bool aot_get_global(CallFrame *frame, Value *dst,
+                                  ObjString *name, size_t next) {
+  if (!table_get(&vm.globals, name, dst)) {
+    AOT_ERROR(next, "Undefined variable '%s'", name->chars);
+  }
+  return true;
+}
+
+// the native init_vm defined as a global named name, natives in constants
+// are guarded calls.
+static inline Value aot_native(const char *name, size_t length) {
+  Value native = NULL_VAL;
+  table_get(&vm.globals, copy_string(name, length), &native);
+  return native;
+}
+
+static inline bool aot_set_global(CallFrame *frame, ObjString *name,
+                                  Value value, size_t next) {
+  if (table_set(&vm.globals, name, value)) {
+    table_delete(&vm.globals, name);
+    AOT_ERROR(next, "Undefined variable '%s'", name->chars);
+  }
+  return true;
+}
+
+static inline bool aot_map(CallFrame *frame, Value *dst, Value *pairs,
+                           int count, size_t next) {
+  const char *error = map_of(pairs, count, dst);
+  if (error != NULL) {
+    AOT_ERROR(next, "%s", error);
+  }
+  return true;
+}
+
+static inline bool aot_concat(CallFrame *frame, Value *dst, Value *parts,
+                              int count, uint8_t mode, size_t next) {
+  const char *error = concatenate_n(parts, count, mode, dst);
+  if (error != NULL) {
+    AOT_ERROR(next, "%s", error);
+  }
+  return true;
+}
+
+// OP_MATH on a and b, unary functions only look at a.
+static inline Value aot_math(MathFunction function, Value a, Value b) {
+  Value args[2] = {a, b};
+  return math_call(function, args);
+}
+
+static inline bool aot_get_index(CallFrame *frame, Value *dst, Value array,
+                                 Value index, size_t next) {
+  const char *error = get_index(array, index, dst);
+  if (error != NULL) {
+    AOT_ERROR(next, "%s", error);
+  }
+  return true;
+}
+
+static inline bool aot_set_index(CallFrame *frame, Value array, Value index,
+                                 Value value, size_t next) {
+  const char *error = set_index(array, index, value);
+  if (error != NULL) {
+    AOT_ERROR(next, "%s", error);
+  }
+  return true;
+}
+
+/*
+ * Calls the callee and arguments spilled to the vm's stack at `height`,
+ * leaving the result in the callee's slot.
+ */
+static inline bool aot_call(CallFrame *frame, int height, int args_count,
+                            uint32_t cache, size_t next) {
+  AOT_AT(next);
+  vm.stack_top = frame->slots + height + args_count + 1;
+  return call_and_run(&frame->function->call_caches[cache],
+                      frame->slots[height], args_count);
+}
+
+#endif // !ZSPIE_AOT_H_
@@ -1,8 +1,13 @@
+#include "aot.h"
+#include "compiler.h"
 #include "external/log.h"
+#include "memory.h"
+#include "verifier.h"
 #include "vm.h"
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static void repl() {
   log_info("starting up repl");
@@ -64,6 +69,11 @@ static void run_file(const char *filepath) {
 
   free(source);
 
+#ifdef ZSPIE_COUNT_INSTRUCTIONS
+  fprintf(stderr, "executed %llu instructions\n",
+          (unsigned long long)vm.instruction_count);
+#endif // ZSPIE_COUNT_INSTRUCTIONS
+
   if (result == INTERPRET_COMPILE_ERROR) {
     log_error("Found compile error exiting exit code with 65");
     exit(65);
@@ -75,26 +85,94 @@ static void run_file(const char *filepath) {
   }
 }
 
-void handle_cli(size_t argc, const char *argv[]) {
+/*
+ * Compiles a file and writes it out as C, see aot.h.
+ * @param output_path - path of the C file, NULL to put it next to the
+ * source with a `.c` extension.
+ */
+static void emit_file(const char *filepath, const char *output_path) {
+  log_debug("emitting c for a file : %s", filepath);
+
+  char *source = read_file(filepath);
+  ObjFunction *function = compile(source);
+  free(source);
+
+  if (function == NULL || !verify_function(function)) {
+    log_error("Found compile error exiting exit code with 65");
+    exit(65);
+  }
+
+  // main.zspie -> main.c
+  char *default_path = NULL;
+  size_t default_length = 0;
+  if (output_path == NULL) {
+    size_t length = strlen(filepath);
+    const char *extension = ".zspie";
+    size_t extension_length = strlen(extension);
+    if (length > extension_length &&
+        strcmp(filepath + length - extension_length, extension) == 0) {
+      length -= extension_length;
+    }
+
+    default_length = length + 3;
+    default_path = ALLOCATE(char, default_length);
+    memcpy(default_path, filepath, length);
+    memcpy(default_path + length, ".c", 3);
+    output_path = default_path;
+  }
+
+  bool written = emit_c(function, filepath, output_path);
+  FREE_ARRAY(char, default_path, default_length);
+
+  if (!written) {
+    exit(74);
+  }
+}
+
+void handle_cli(int argc, const char *argv[]) {
   log_info("Handling cli");
   log_info("arg=%d  argv:", argc);
-  for (size_t i = 0; i < argc; i++) {
+  for (int i = 0; i < argc; i++) {
     log_debug("[ %s ]", argv[i]);
   }
 
-  if (argc == 1) {
+  // flags come before everything else.
+  int first = 1;
+  while (first < argc) {
+    if (strcmp(argv[first], "--no-jit") == 0) {
+      vm.jit_enabled = false;
+    } else if (strcmp(argv[first], "--regvm") == 0) {
+      vm.register_vm = true;
+    } else if (strcmp(argv[first], "--no-regvm") == 0) {
+      vm.register_vm = false;
+    } else {
+      break;
+    }
+    first++;
+  }
+
+  int args_count = argc - first;
+  const char **args = argv + first;
+
+  if (args_count == 0) {
     // run repl.
     repl();
-  } else if (argc == 2) {
+  } else if (args_count == 1 && strncmp(args[0], "--", 2) != 0) {
     // run from file.
-    run_file(argv[1]);
+    run_file(args[0]);
+  } else if ((args_count == 2 || args_count == 3) &&
+             strcmp(args[0], "--emit-c") == 0) {
+    // compile to c.
+    emit_file(args[1], args_count == 3 ? args[2] : NULL);
   } else {
     fprintf(stderr,
             "\033[1mZspie\033[0m - Stack based VM, interpreter, written "
             "completely in C."
             "\n"
             "\n"
-            "\033[1mUsage:\033[0m zspie [filepath]"
+            "\033[1mUsage:\033[0m zspie [--no-jit] [--regvm|--no-regvm] [filepath]"
+            "\n"
+            "       zspie --emit-c filepath [output.c]"
             "\n"
             "\n"
             "\033[1mOptions\033[0m:"
@@ -103,6 +181,15 @@ void handle_cli(size_t argc, const char *argv[]) {
             "open live repl."
             "\n"
             "    filepath - Provide path to a zpe file to compile and run it."
+            "\n"
+            "    --emit-c - Compile a zpe file to C, along with a makefile "
+            "to build it against libzspie."
+            "\n"
+            "    --no-jit - Interpret every function, without compiling hot "
+            "ones to machine code."
+            "\n"
+            "    --regvm - Run on the register machine instead of the stack "
+            "machine, --no-regvm the other way around."
             "\n");
 
     exit(64); //
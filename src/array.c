@@ -0,0 +1,930 @@
+#include "array.h"
+#include "external/log.h"
+#include "map.h"
+#include "mathlib.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ZSPIE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/*
+ * Numeric kernels over unboxed floats, picked for the cpu on first use.
+ * min and max are only called with at least one element.
+ */
+typedef struct {
+  double (*sum)(const double *x, int n);
+  double (*min)(const double *x, int n);
+  double (*max)(const double *x, int n);
+  double (*dot)(const double *x, const double *y, int n);
+  void (*scale)(double *x, int n, double factor);
+  void (*fill)(double *x, int n, double value);
+} FloatKernels;
+
+#ifdef ZSPIE_X86_KERNELS
+
+// sse2 is part of x86-64, so these work everywhere the avx2 ones don't.
+
+static double sum_sse2(const double *x, int n) {
+  __m128d a = _mm_setzero_pd();
+  __m128d b = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    a = _mm_add_pd(a, _mm_loadu_pd(x + i));
+    b = _mm_add_pd(b, _mm_loadu_pd(x + i + 2));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(a, b));
+  double sum = lanes[0] + lanes[1];
+  for (; i < n; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+static double min_sse2(const double *x, int n) {
+  double min = x[0];
+  int i = 0;
+  if (n >= 2) {
+    __m128d m = _mm_loadu_pd(x);
+    for (i = 2; i + 2 <= n; i += 2) {
+      m = _mm_min_pd(_mm_loadu_pd(x + i), m);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    min = lanes[1] < lanes[0] ? lanes[1] : lanes[0];
+  }
+  for (; i < n; i++) {
+    min = x[i] < min ? x[i] : min;
+  }
+  return min;
+}
+
+static double max_sse2(const double *x, int n) {
+  double max = x[0];
+  int i = 0;
+  if (n >= 2) {
+    __m128d m = _mm_loadu_pd(x);
+    for (i = 2; i + 2 <= n; i += 2) {
+      m = _mm_max_pd(_mm_loadu_pd(x + i), m);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, m);
+    max = lanes[1] > lanes[0] ? lanes[1] : lanes[0];
+  }
+  for (; i < n; i++) {
+    max = x[i] > max ? x[i] : max;
+  }
+  return max;
+}
+
+static double dot_sse2(const double *x, const double *y, int n) {
+  __m128d a = _mm_setzero_pd();
+  __m128d b = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    a = _mm_add_pd(a, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    b = _mm_add_pd(
+        b, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(a, b));
+  double dot = lanes[0] + lanes[1];
+  for (; i < n; i++) {
+    dot += x[i] * y[i];
+  }
+  return dot;
+}
+
+static void scale_sse2(double *x, int n, double factor) {
+  __m128d f = _mm_set1_pd(factor);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(x + i, _mm_mul_pd(_mm_loadu_pd(x + i), f));
+  }
+  for (; i < n; i++) {
+    x[i] *= factor;
+  }
+}
+
+static void fill_sse2(double *x, int n, double value) {
+  __m128d v = _mm_set1_pd(value);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(x + i, v);
+  }
+  for (; i < n; i++) {
+    x[i] = value;
+  }
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static double sum_avx2(const double *x, int n) {
+  __m256d a = _mm256_setzero_pd();
+  __m256d b = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    a = _mm256_add_pd(a, _mm256_loadu_pd(x + i));
+    b = _mm256_add_pd(b, _mm256_loadu_pd(x + i + 4));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(a, b));
+  double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  for (; i < n; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+AVX2 static double min_avx2(const double *x, int n) {
+  if (n < 8) {
+    return min_sse2(x, n);
+  }
+  __m256d m = _mm256_loadu_pd(x);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_min_pd(_mm256_loadu_pd(x + i), m);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double min = lanes[0];
+  for (int lane = 1; lane < 4; lane++) {
+    min = lanes[lane] < min ? lanes[lane] : min;
+  }
+  for (; i < n; i++) {
+    min = x[i] < min ? x[i] : min;
+  }
+  return min;
+}
+
+AVX2 static double max_avx2(const double *x, int n) {
+  if (n < 8) {
+    return max_sse2(x, n);
+  }
+  __m256d m = _mm256_loadu_pd(x);
+  int i = 4;
+  for (; i + 4 <= n; i += 4) {
+    m = _mm256_max_pd(_mm256_loadu_pd(x + i), m);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, m);
+  double max = lanes[0];
+  for (int lane = 1; lane < 4; lane++) {
+    max = lanes[lane] > max ? lanes[lane] : max;
+  }
+  for (; i < n; i++) {
+    max = x[i] > max ? x[i] : max;
+  }
+  return max;
+}
+
+AVX2 static double dot_avx2(const double *x, const double *y, int n) {
+  __m256d a = _mm256_setzero_pd();
+  __m256d b = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    a = _mm256_add_pd(
+        a, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    b = _mm256_add_pd(b, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4),
+                                       _mm256_loadu_pd(y + i + 4)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(a, b));
+  double dot = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  for (; i < n; i++) {
+    dot += x[i] * y[i];
+  }
+  return dot;
+}
+
+AVX2 static void scale_avx2(double *x, int n, double factor) {
+  __m256d f = _mm256_set1_pd(factor);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(x + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), f));
+  }
+  for (; i < n; i++) {
+    x[i] *= factor;
+  }
+}
+
+AVX2 static void fill_avx2(double *x, int n, double value) {
+  __m256d v = _mm256_set1_pd(value);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(x + i, v);
+  }
+  for (; i < n; i++) {
+    x[i] = value;
+  }
+}
+
+#undef AVX2
+
+static const FloatKernels sse2_kernels = {sum_sse2, min_sse2,   max_sse2,
+                                          dot_sse2, scale_sse2, fill_sse2};
+static const FloatKernels avx2_kernels = {sum_avx2, min_avx2,   max_avx2,
+                                          dot_avx2, scale_avx2, fill_avx2};
+
+#else
+
+static double sum_scalar(const double *x, int n) {
+  double sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += x[i];
+  }
+  return sum;
+}
+
+static double min_scalar(const double *x, int n) {
+  double min = x[0];
+  for (int i = 1; i < n; i++) {
+    min = x[i] < min ? x[i] : min;
+  }
+  return min;
+}
+
+static double max_scalar(const double *x, int n) {
+  double max = x[0];
+  for (int i = 1; i < n; i++) {
+    max = x[i] > max ? x[i] : max;
+  }
+  return max;
+}
+
+static double dot_scalar(const double *x, const double *y, int n) {
+  double dot = 0;
+  for (int i = 0; i < n; i++) {
+    dot += x[i] * y[i];
+  }
+  return dot;
+}
+
+static void scale_scalar(double *x, int n, double factor) {
+  for (int i = 0; i < n; i++) {
+    x[i] *= factor;
+  }
+}
+
+static void fill_scalar(double *x, int n, double value) {
+  for (int i = 0; i < n; i++) {
+    x[i] = value;
+  }
+}
+
+static const FloatKernels scalar_kernels = {
+    sum_scalar, min_scalar, max_scalar, dot_scalar, scale_scalar, fill_scalar};
+
+#endif // ZSPIE_X86_KERNELS
+
+static const FloatKernels *float_kernels() {
+  static const FloatKernels *kernels = NULL;
+  if (kernels == NULL) {
+#ifdef ZSPIE_X86_KERNELS
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2");
+    log_info("array kernels use %s", avx2 ? "avx2" : "sse2");
+    kernels = avx2 ? &avx2_kernels : &sse2_kernels;
+#else
+    kernels = &scalar_kernels;
+#endif // ZSPIE_X86_KERNELS
+  }
+  return kernels;
+}
+
+/*
+ * Kind of array which holds value unboxed.
+ */
+static ArrayKind kind_of(Value value) {
+  return IS_INT(value)      ? ARRAY_INTS
+         : IS_NUMBER(value) ? ARRAY_FLOATS
+                            : ARRAY_VALUES;
+}
+
+/*
+ * Whether an integer keeps its value as a double, among floats.
+ */
+static bool fits_float(int64_t value) {
+  return value >= -(INT64_C(1) << 53) && value <= (INT64_C(1) << 53);
+}
+
+/*
+ * Kind of array which holds all of values unboxed, integers and floats
+ * together are held as floats while the integers keep their values.
+ */
+static ArrayKind kind_of_all(Value *values, int count) {
+  bool floats = false;
+  bool exact = true;
+  for (int i = 0; i < count; i++) {
+    if (IS_NUMBER(values[i])) {
+      floats = true;
+    } else if (IS_INT(values[i])) {
+      exact = exact && fits_float(AS_INT(values[i]));
+    } else {
+      return ARRAY_VALUES;
+    }
+  }
+  if (!floats) {
+    return ARRAY_INTS;
+  }
+  return exact ? ARRAY_FLOATS : ARRAY_VALUES;
+}
+
+static void free_elements(ObjArray *array) {
+  switch (array->kind) {
+  case ARRAY_INTS:
+    FREE_ARRAY(int64_t, array->as.ints, array->capacity);
+    break;
+  case ARRAY_FLOATS:
+    FREE_ARRAY(double, array->as.floats, array->capacity);
+    break;
+  case ARRAY_VALUES:
+    FREE_ARRAY(Value, array->as.values, array->capacity);
+    break;
+  }
+}
+
+static void store(ObjArray *array, int index, Value value) {
+  switch (array->kind) {
+  case ARRAY_INTS:
+    array->as.ints[index] = AS_INT(value);
+    break;
+  case ARRAY_FLOATS:
+    array->as.floats[index] = AS_FLOAT(value);
+    break;
+  case ARRAY_VALUES:
+    array->as.values[index] = value;
+    break;
+  }
+}
+
+/*
+ * Moves the elements to storage of another kind which can hold all of them,
+ * integers become floats or anything becomes values.
+ */
+static void convert(ObjArray *array, ArrayKind kind) {
+  ObjArray converted = *array;
+  converted.kind = kind;
+  switch (kind) {
+  case ARRAY_INTS:
+    converted.as.ints = ALLOCATE(int64_t, array->capacity);
+    break;
+  case ARRAY_FLOATS:
+    converted.as.floats = ALLOCATE(double, array->capacity);
+    break;
+  case ARRAY_VALUES:
+    converted.as.values = ALLOCATE(Value, array->capacity);
+    break;
+  }
+
+  for (int i = 0; i < array->count; i++) {
+    Value value = array_get(array, i);
+    store(&converted, i, value);
+  }
+
+  free_elements(array);
+  array->kind = kind;
+  array->as = converted.as;
+}
+
+/*
+ * Makes the array able to store value, an empty array takes whichever kind
+ * holds it unboxed. Integers and floats together are held as floats while
+ * the integers keep their values, only other values turn it into values.
+ */
+static void prepare(ObjArray *array, Value value) {
+  ArrayKind kind = kind_of(value);
+  if (array->kind == kind || array->kind == ARRAY_VALUES) {
+    return;
+  }
+  if (array->count == 0) {
+    convert(array, kind);
+    return;
+  }
+
+  if (array->kind == ARRAY_FLOATS && kind == ARRAY_INTS &&
+      fits_float(AS_INT(value))) {
+    return;
+  }
+  bool exact = kind == ARRAY_FLOATS;
+  for (int i = 0; exact && i < array->count; i++) {
+    exact = fits_float(array->as.ints[i]);
+  }
+  convert(array, exact ? ARRAY_FLOATS : ARRAY_VALUES);
+}
+
+ObjArray *array_of(Value *values, int count) {
+  ArrayKind kind = kind_of_all(values, count);
+
+  ObjArray *array = new_array(kind, count);
+  for (int i = 0; i < count; i++) {
+    store(array, i, values[i]);
+  }
+  array->count = count;
+  return array;
+}
+
+Value array_get(ObjArray *array, int index) {
+  switch (array->kind) {
+  case ARRAY_INTS:
+    return INT_VAL(array->as.ints[index]);
+  case ARRAY_FLOATS:
+    return NUMBER_VAL(array->as.floats[index]);
+  case ARRAY_VALUES:
+    return array->as.values[index];
+  }
+  return NULL_VAL; // unreachable.
+}
+
+void array_set(ObjArray *array, int index, Value value) {
+  prepare(array, value);
+  store(array, index, value);
+}
+
+void array_push(ObjArray *array, Value value) {
+  prepare(array, value);
+  if (array->capacity < array->count + 1) {
+    int old_capacity = array->capacity;
+    array->capacity = GROW_CAPACITY(old_capacity);
+    switch (array->kind) {
+    case ARRAY_INTS:
+      array->as.ints =
+          GROW_ARRAY(int64_t, array->as.ints, old_capacity, array->capacity);
+      break;
+    case ARRAY_FLOATS:
+      array->as.floats =
+          GROW_ARRAY(double, array->as.floats, old_capacity, array->capacity);
+      break;
+    case ARRAY_VALUES:
+      array->as.values =
+          GROW_ARRAY(Value, array->as.values, old_capacity, array->capacity);
+      break;
+    }
+  }
+  store(array, array->count++, value);
+}
+
+#define MAP_KEY_ERROR "Map key must be a string, number or boolean."
+
+/*
+ * Checks an index instruction's operands.
+ * @return NULL with the element's position, or the error message.
+ */
+static const char *find_position(Value array, Value index, int *position) {
+  if (!IS_ARRAY(array)) {
+    return "Only arrays and maps can be indexed.";
+  }
+
+  int count = AS_ARRAY(array)->count;
+  if (IS_INT(index)) {
+    if (AS_INT(index) < 0 || AS_INT(index) >= count) {
+      return "Array index out of bounds.";
+    }
+    *position = (int)AS_INT(index);
+    return NULL;
+  }
+
+  // floats with an integral value index too, `n / 2` is a float.
+  if (IS_NUMBER(index)) {
+    double at = AS_NUMBER(index);
+    if (!(at >= 0 && at < count)) {
+      return "Array index out of bounds.";
+    }
+    if (at != (double)(int)at) {
+      return "Array index must be an integer.";
+    }
+    *position = (int)at;
+    return NULL;
+  }
+
+  return "Array index must be an integer.";
+}
+
+const char *get_index(Value array, Value index, Value *result) {
+  if (IS_MAP(array)) {
+    if (!is_map_key(index)) {
+      return MAP_KEY_ERROR;
+    }
+    // missing keys read as null.
+    if (!map_get(AS_MAP(array), index, result)) {
+      *result = NULL_VAL;
+    }
+    return NULL;
+  }
+
+  int position;
+  const char *error = find_position(array, index, &position);
+  if (error == NULL) {
+    *result = array_get(AS_ARRAY(array), position);
+  }
+  return error;
+}
+
+const char *set_index(Value array, Value index, Value value) {
+  if (IS_MAP(array)) {
+    if (!is_map_key(index)) {
+      return MAP_KEY_ERROR;
+    }
+    map_set(AS_MAP(array), index, value);
+    return NULL;
+  }
+
+  int position;
+  const char *error = find_position(array, index, &position);
+  if (error == NULL) {
+    array_set(AS_ARRAY(array), position, value);
+  }
+  return error;
+}
+
+Value array_native(int arg_count, Value *args) {
+  if (arg_count < 1 || arg_count > 2 || !IS_NUMERIC(args[0]) ||
+      !(AS_FLOAT(args[0]) >= 0 && AS_FLOAT(args[0]) <= INT_MAX)) {
+    return NULL_VAL;
+  }
+
+  int count = (int)AS_FLOAT(args[0]);
+  Value value = arg_count == 2 ? args[1] : NULL_VAL;
+  ObjArray *array = new_array(kind_of(value), count);
+  array->count = count;
+  if (array->kind == ARRAY_FLOATS) {
+    float_kernels()->fill(array->as.floats, count, AS_NUMBER(value));
+  } else {
+    for (int i = 0; i < count; i++) {
+      store(array, i, value);
+    }
+  }
+  return OBJ_VAL(array);
+}
+
+Value len_native(int arg_count, Value *args) {
+  if (arg_count != 1) {
+    return NULL_VAL;
+  }
+  if (IS_MAP(args[0])) {
+    return INT_VAL(AS_MAP(args[0])->count);
+  }
+  if (IS_TEXT(args[0])) {
+    return INT_VAL((int64_t)text_length(args[0]));
+  }
+  if (!IS_ARRAY(args[0])) {
+    return NULL_VAL;
+  }
+  return INT_VAL(AS_ARRAY(args[0])->count);
+}
+
+Value push_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_ARRAY(args[0])) {
+    return NULL_VAL;
+  }
+  ObjArray *array = AS_ARRAY(args[0]);
+  array_push(array, args[1]);
+  return INT_VAL(array->count);
+}
+
+Value pop_native(int arg_count, Value *args) {
+  if (arg_count != 1 || !IS_ARRAY(args[0]) || AS_ARRAY(args[0])->count == 0) {
+    return NULL_VAL;
+  }
+  ObjArray *array = AS_ARRAY(args[0]);
+  return array_get(array, --array->count);
+}
+
+Value sum_native(int arg_count, Value *args) {
+  if (arg_count != 1 || !IS_ARRAY(args[0])) {
+    return NULL_VAL;
+  }
+
+  ObjArray *array = AS_ARRAY(args[0]);
+  if (array->kind == ARRAY_FLOATS) {
+    return NUMBER_VAL(float_kernels()->sum(array->as.floats, array->count));
+  }
+
+  if (array->kind == ARRAY_INTS) {
+    int64_t sum = 0;
+    int i = 0;
+    for (; i < array->count; i++) {
+      if (!add_int(sum, array->as.ints[i], &sum)) {
+        break;
+      }
+    }
+    if (i == array->count) {
+      return INT_VAL(sum);
+    }
+  }
+
+  // boxed values, or integers whose sum overflows.
+  Value sum = INT_VAL(0);
+  for (int i = 0; i < array->count; i++) {
+    Value element = array_get(array, i);
+    if (!IS_NUMERIC(element)) {
+      return NULL_VAL;
+    }
+    sum = add_values(sum, element);
+  }
+  return sum;
+}
+
+/*
+ * Smallest or greatest element of a non empty array of numbers.
+ */
+static Value extreme(Value *args, bool greatest) {
+  if (!IS_ARRAY(args[0]) || AS_ARRAY(args[0])->count == 0) {
+    return NULL_VAL;
+  }
+
+  ObjArray *array = AS_ARRAY(args[0]);
+  if (array->kind == ARRAY_FLOATS) {
+    const FloatKernels *kernels = float_kernels();
+    return NUMBER_VAL(greatest ? kernels->max(array->as.floats, array->count)
+                               : kernels->min(array->as.floats, array->count));
+  }
+
+  Value best = array_get(array, 0);
+  if (!IS_NUMERIC(best)) {
+    return NULL_VAL;
+  }
+  for (int i = 1; i < array->count; i++) {
+    Value element = array_get(array, i);
+    if (!IS_NUMERIC(element)) {
+      return NULL_VAL;
+    }
+    if (greatest ? greater_values(element, best) : less_values(element, best)) {
+      best = element;
+    }
+  }
+  return best;
+}
+
+Value min_native(int arg_count, Value *args) {
+  return arg_count == 2 ? math_call(MATH_MIN, args) : extreme(args, false);
+}
+
+Value max_native(int arg_count, Value *args) {
+  return arg_count == 2 ? math_call(MATH_MAX, args) : extreme(args, true);
+}
+
+Value dot_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_ARRAY(args[0]) || !IS_ARRAY(args[1]) ||
+      AS_ARRAY(args[0])->count != AS_ARRAY(args[1])->count) {
+    return NULL_VAL;
+  }
+
+  ObjArray *a = AS_ARRAY(args[0]);
+  ObjArray *b = AS_ARRAY(args[1]);
+  if (a->kind == ARRAY_FLOATS && b->kind == ARRAY_FLOATS) {
+    return NUMBER_VAL(
+        float_kernels()->dot(a->as.floats, b->as.floats, a->count));
+  }
+
+  Value dot = INT_VAL(0);
+  for (int i = 0; i < a->count; i++) {
+    Value x = array_get(a, i);
+    Value y = array_get(b, i);
+    if (!IS_NUMERIC(x) || !IS_NUMERIC(y)) {
+      return NULL_VAL;
+    }
+    dot = add_values(dot, multiply_values(x, y));
+  }
+  return dot;
+}
+
+Value scale_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_ARRAY(args[0]) || !IS_NUMERIC(args[1])) {
+    return NULL_VAL;
+  }
+
+  ObjArray *array = AS_ARRAY(args[0]);
+  Value factor = args[1];
+  // an integer times a float is always a float.
+  if (array->kind == ARRAY_INTS && IS_NUMBER(factor)) {
+    convert(array, ARRAY_FLOATS);
+  }
+  if (array->kind == ARRAY_FLOATS) {
+    float_kernels()->scale(array->as.floats, array->count, AS_FLOAT(factor));
+    return args[0];
+  }
+
+  for (int i = 0; i < array->count; i++) {
+    if (!IS_NUMERIC(array_get(array, i))) {
+      return NULL_VAL;
+    }
+  }
+  // products of integers which overflow turn the array into values.
+  for (int i = 0; i < array->count; i++) {
+    array_set(array, i, multiply_values(array_get(array, i), factor));
+  }
+  return args[0];
+}
+
+Value fill_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_ARRAY(args[0])) {
+    return NULL_VAL;
+  }
+
+  ObjArray *array = AS_ARRAY(args[0]);
+  Value value = args[1];
+  // every element is replaced, so none need converting.
+  ArrayKind kind = kind_of(value);
+  if (array->kind != kind) {
+    int count = array->count;
+    array->count = 0;
+    convert(array, kind);
+    array->count = count;
+  }
+
+  if (array->kind == ARRAY_FLOATS) {
+    float_kernels()->fill(array->as.floats, array->count, AS_NUMBER(value));
+  } else {
+    for (int i = 0; i < array->count; i++) {
+      store(array, i, value);
+    }
+  }
+  return args[0];
+}
+
+static int compare_ints(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a;
+  int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int compare_floats(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+ * Whether a goes before b: the comparator's answer, or without one the
+ * smaller number or the string first in byte order.
+ * @return false after reporting a runtime error.
+ */
+static bool sorts_before(NativeContext *context, Value comparator, Value a,
+                         Value b, bool *before) {
+  if (!IS_NULL(comparator)) {
+    Value pair[] = {a, b};
+    Value answer;
+    if (!native_call(context, comparator, 2, pair, &answer)) {
+      return false;
+    }
+    *before = !is_falsey(answer);
+    return true;
+  }
+
+  if (IS_NUMERIC(a) && IS_NUMERIC(b)) {
+    *before = less_values(a, b);
+    return true;
+  }
+  if (IS_TEXT(a) && IS_TEXT(b)) {
+    size_t length = text_length(a);
+    size_t other = text_length(b);
+    int order = memcmp(text_chars(a), text_chars(b),
+                       length < other ? length : other);
+    *before = order < 0 || (order == 0 && length < other);
+    return true;
+  }
+  runtime_error("Can only sort numbers or strings without a comparator.");
+  return false;
+}
+
+/*
+ * Stable bottom up merge sort of count values, through scratch of the same
+ * size.
+ * @return false after reporting a runtime error.
+ */
+static bool merge_sort(NativeContext *context, Value comparator,
+                       Value *values, Value *scratch, int count) {
+  for (int width = 1; width < count; width *= 2) {
+    for (int low = 0; low < count; low += 2 * width) {
+      int middle = low + width < count ? low + width : count;
+      int high = middle + width < count ? middle + width : count;
+      int left = low;
+      int right = middle;
+      int at = low;
+      while (left < middle && right < high) {
+        // the right one is taken only if it goes strictly before, so equal
+        // elements keep their order.
+        bool before;
+        if (!sorts_before(context, comparator, values[right], values[left],
+                          &before)) {
+          return false;
+        }
+        scratch[at++] = before ? values[right++] : values[left++];
+      }
+      while (left < middle) {
+        scratch[at++] = values[left++];
+      }
+      while (right < high) {
+        scratch[at++] = values[right++];
+      }
+    }
+    memcpy(values, scratch, sizeof(Value) * (size_t)count);
+  }
+  return true;
+}
+
+bool sort_native(NativeContext *context, int arg_count, Value *args,
+                 Value *result) {
+  *result = args[0];
+  if (!IS_ARRAY(args[0])) {
+    *result = NULL_VAL;
+    return true;
+  }
+
+  ObjArray *array = AS_ARRAY(args[0]);
+  // an empty array may have no storage at all.
+  if (array->count == 0) {
+    return true;
+  }
+
+  Value comparator = arg_count == 2 ? args[1] : NULL_VAL;
+  if (IS_NULL(comparator) && array->kind == ARRAY_INTS) {
+    qsort(array->as.ints, (size_t)array->count, sizeof(int64_t),
+          compare_ints);
+    return true;
+  }
+  if (IS_NULL(comparator) && array->kind == ARRAY_FLOATS) {
+    qsort(array->as.floats, (size_t)array->count, sizeof(double),
+          compare_floats);
+    return true;
+  }
+
+  // sorts a copy, the array is left alone if the comparator fails.
+  int count = array->count;
+  Value *values = ALLOCATE(Value, count);
+  Value *scratch = ALLOCATE(Value, count);
+  for (int i = 0; i < count; i++) {
+    values[i] = array_get(array, i);
+  }
+  bool sorted = merge_sort(context, comparator, values, scratch, count);
+  if (sorted && array->count != count) {
+    runtime_error("Array changed size while sorting.");
+    sorted = false;
+  }
+  if (sorted) {
+    for (int i = 0; i < count; i++) {
+      array_set(array, i, values[i]);
+    }
+  }
+  FREE_ARRAY(Value, values, count);
+  FREE_ARRAY(Value, scratch, count);
+  return sorted;
+}
+
+/*
+ * Calls function with every element of an array in turn, which may change
+ * the array, into a new array of the results or of the elements it was true
+ * for.
+ * @return false after reporting a runtime error.
+ */
+static bool each_element(NativeContext *context, Value *args, bool filter,
+                         Value *result) {
+  if (!IS_ARRAY(args[0])) {
+    *result = NULL_VAL;
+    return true;
+  }
+
+  ObjArray *array = AS_ARRAY(args[0]);
+  ObjArray *results = new_array(ARRAY_INTS, 0);
+  for (int i = 0; i < array->count; i++) {
+    Value element = array_get(array, i);
+    Value answer;
+    if (!native_call(context, args[1], 1, &element, &answer)) {
+      return false;
+    }
+    if (!filter) {
+      array_push(results, answer);
+    } else if (!is_falsey(answer)) {
+      array_push(results, element);
+    }
+  }
+  *result = OBJ_VAL(results);
+  return true;
+}
+
+bool transform_native(NativeContext *context, int arg_count, Value *args,
+                      Value *result) {
+  // always 2, the arity is checked by the caller.
+  (void)arg_count;
+  return each_element(context, args, false, result);
+}
+
+bool filter_native(NativeContext *context, int arg_count, Value *args,
+                   Value *result) {
+  (void)arg_count;
+  return each_element(context, args, true, result);
+}
+
+void free_array(ObjArray *array) {
+  free_elements(array);
+  FREE(ObjArray, array);
+}
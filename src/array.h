@@ -0,0 +1,78 @@
+#ifndef ZSPIE_ARRAY_H_
+#define ZSPIE_ARRAY_H_
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+/*
+ * Makes an array of count values, unboxed if they are all integers or all
+ * floats.
+ */
+ObjArray *array_of(Value *values, int count);
+
+/*
+ * Element at a position the caller checked is in bounds, boxed.
+ */
+Value array_get(ObjArray *array, int index);
+
+/*
+ * Stores an element at a position in bounds, turning the array into a
+ * Value array if it can't hold it unboxed.
+ */
+void array_set(ObjArray *array, int index, Value value);
+
+void array_push(ObjArray *array, Value value);
+
+void free_array(ObjArray *array);
+
+/*
+ * `array[index]` of the index instructions, on arrays and maps.
+ * @return NULL, or the message of the runtime error to report.
+ */
+const char *get_index(Value array, Value index, Value *result);
+
+/*
+ * `array[index] = value` of the index instructions, on arrays and maps.
+ * @return NULL, or the message of the runtime error to report.
+ */
+const char *set_index(Value array, Value index, Value value);
+
+/*
+ * Array natives, they return null when given something else than arrays of
+ * numbers. The numeric kernels run on SSE2 or AVX2 on x86-64, whichever the
+ * cpu has, for float arrays.
+ */
+
+// array(n, value) makes an array of n copies of value, null if left out.
+Value array_native(int arg_count, Value *args);
+// len(x) of an array, map or string.
+Value len_native(int arg_count, Value *args);
+// push(array, value) appends value, returns the new length.
+Value push_native(int arg_count, Value *args);
+// pop(array) removes and returns the last element.
+Value pop_native(int arg_count, Value *args);
+Value sum_native(int arg_count, Value *args);
+// min(array) and max(array), min(a, b) and max(a, b) of two numbers.
+Value min_native(int arg_count, Value *args);
+Value max_native(int arg_count, Value *args);
+// dot(a, b) of two arrays of the same length.
+Value dot_native(int arg_count, Value *args);
+// scale(array, factor) multiplies every element in place, returns array.
+Value scale_native(int arg_count, Value *args);
+// fill(array, value) sets every element to value, returns array.
+Value fill_native(int arg_count, Value *args);
+// sort(array, comparator) sorts array in place and returns it. The
+// comparator is called with two elements, and is true if the first goes
+// before the second. Without it numbers and strings sort ascending.
+bool sort_native(NativeContext *context, int arg_count, Value *args,
+                 Value *result);
+// transform(array, function) new array of function called with every
+// element.
+bool transform_native(NativeContext *context, int arg_count, Value *args,
+                      Value *result);
+// filter(array, function) new array of the elements function is true for.
+bool filter_native(NativeContext *context, int arg_count, Value *args,
+                   Value *result);
+
+#endif // !ZSPIE_ARRAY_H_
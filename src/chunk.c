@@ -8,11 +8,18 @@ void init_chunk(Chunk *m_chunk) {
   m_chunk->capacity = 0;
   m_chunk->code = NULL;
   m_chunk->lines = NULL;
+  m_chunk->packed = false;
   init_value_array(&m_chunk->constants);
 }
 
 void free_chunk(Chunk *m_chunk) {
   log_debug("free chunk : %p", m_chunk);
+  // packed chunks are freed along with their code segment.
+  if (m_chunk->packed) {
+    init_chunk(m_chunk);
+    return;
+  }
+
   FREE_ARRAY(uint8_t, m_chunk->code, m_chunk->capacity);
   FREE_ARRAY(size_t, m_chunk->lines, m_chunk->capacity);
   free_value_array(&m_chunk->constants);
@@ -36,6 +43,187 @@ void write_chunk(Chunk *m_chunk, uint8_t m_byte, size_t line) {
   m_chunk->count++;
 }
 
+size_t instruction_length(Chunk *chunk, size_t offset) {
+  switch (chunk->code[offset]) {
+  case OP_PEEK:
+  case OP_CHECK_NUM:
+  case OP_RETURN_N:
+  case OP_UNPACK:
+  case OP_GET_CAPTURE:
+  case OP_GET_UPVALUE:
+  case OP_SET_UPVALUE:
+  case OP_INLINE_RETURN:
+  case OP_CONSTANT:
+  case OP_GET_LOCAL:
+  case OP_SET_LOCAL:
+  case OP_DEFINE_GLOBAL:
+  case OP_SET_GLOBAL:
+  case OP_GET_GLOBAL:
+    return 2;
+
+  case OP_CALL_0:
+  case OP_CALL_1:
+  case OP_CALL_2:
+  case OP_CALL_3:
+  case OP_ARRAY:
+  case OP_MAP:
+  case OP_CONCAT_N:
+  case OP_GET_LOCAL_LONG:
+  case OP_SET_LOCAL_LONG:
+  case OP_JUMP:
+  case OP_JUMP_IF_FALSE:
+  case OP_LOOP:
+    return 3;
+
+  case OP_CALL:
+  case OP_MATH:
+  case OP_CLASS:
+  case OP_METHOD:
+  case OP_GET_SUPER:
+  case OP_CLOSURE:
+  case OP_CONSTANT_LONG:
+  case OP_DEFINE_GLOBAL_LONG:
+  case OP_SET_GLOBAL_LONG:
+  case OP_GET_GLOBAL_LONG:
+  case OP_JUMP_LONG:
+  case OP_JUMP_IF_FALSE_LONG:
+  case OP_LOOP_LONG:
+    return 4;
+
+  case OP_CALL_LONG:
+  case OP_SUPER_INVOKE:
+    return 5;
+
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+    return 6;
+
+  case OP_INLINE_GUARD:
+  case OP_FOR_STEP:
+  case OP_INVOKE:
+  case OP_GET_PROPERTY_LONG:
+  case OP_SET_PROPERTY_LONG:
+    return 7;
+
+  case OP_INVOKE_LONG:
+    return 8;
+
+  case OP_JUMP_TABLE:
+  case OP_JUMP_MAP:
+    // a truncated one is at least longer than what's left.
+    if (offset + 6 > chunk->count) {
+      return 9;
+    }
+    return 9 + 3 * (size_t)jump_table_count(chunk, offset);
+
+  case OP_NULL:
+  case OP_TRUE:
+  case OP_FALSE:
+  case OP_POP:
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_NOT:
+  case OP_NEGATE:
+  case OP_PRINT:
+  case OP_RETURN:
+  case OP_ADD_NN:
+  case OP_SUBTRACT_NN:
+  case OP_MULTIPLY_NN:
+  case OP_DIVIDE_NN:
+  case OP_LESS_NN:
+  case OP_GREATER_NN:
+  case OP_CLOSE_UPVALUE:
+  case OP_GET_INDEX:
+  case OP_SET_INDEX:
+  case OP_INHERIT:
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+uint32_t read_operand(Chunk *chunk, size_t offset) {
+  uint32_t value = 0;
+  size_t length = instruction_length(chunk, offset);
+  for (size_t i = 1; i < length; i++) {
+    value = (value << 8) | chunk->code[offset + i];
+  }
+  return value;
+}
+
+long jump_target(Chunk *chunk, size_t offset) {
+  size_t next = offset + instruction_length(chunk, offset);
+  switch (chunk->code[offset]) {
+  case OP_JUMP:
+  case OP_JUMP_LONG:
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_FALSE_LONG:
+    return (long)(next + read_operand(chunk, offset));
+  case OP_INLINE_GUARD:
+    return (long)(next + (chunk->code[offset + 5] << 8) +
+                  chunk->code[offset + 6]);
+  case OP_LOOP:
+  case OP_LOOP_LONG:
+    return (long)next - (long)read_operand(chunk, offset);
+  case OP_FOR_STEP:
+    return (long)next - (long)((chunk->code[offset + 5] << 8) +
+                               chunk->code[offset + 6]);
+  default:
+    return -1;
+  }
+}
+
+uint8_t call_args_count(Chunk *chunk, size_t offset) {
+  uint8_t op = chunk->code[offset];
+  return op == OP_CALL || op == OP_CALL_LONG ? chunk->code[offset + 1]
+                                             : (uint8_t)(op - OP_CALL_0);
+}
+
+uint32_t call_cache_index(Chunk *chunk, size_t offset) {
+  size_t end = offset + instruction_length(chunk, offset);
+  uint32_t index = (uint32_t)(chunk->code[end - 2] << 8) | chunk->code[end - 1];
+  switch (chunk->code[offset]) {
+  case OP_CALL_LONG:
+  case OP_GET_PROPERTY_LONG:
+  case OP_SET_PROPERTY_LONG:
+  case OP_INVOKE_LONG:
+    index |= (uint32_t)chunk->code[end - 3] << 16;
+    break;
+  }
+  return index;
+}
+
+uint32_t property_cache_index(Chunk *chunk, size_t offset) {
+  // the cache index is the last operand, as for calls.
+  return call_cache_index(chunk, offset);
+}
+
+uint32_t name_operand(Chunk *chunk, size_t offset) {
+  return (uint32_t)(chunk->code[offset + 1] << 16) |
+         (uint32_t)(chunk->code[offset + 2] << 8) | chunk->code[offset + 3];
+}
+
+uint32_t inline_guard_constant(Chunk *chunk, size_t offset) {
+  return (uint32_t)(chunk->code[offset + 2] << 16) |
+         (uint32_t)(chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+}
+
+uint16_t jump_table_count(Chunk *chunk, size_t offset) {
+  return (uint16_t)(chunk->code[offset + 4] << 8) | chunk->code[offset + 5];
+}
+
+size_t jump_table_target(Chunk *chunk, size_t offset, int index) {
+  uint8_t *entry = chunk->code + offset + 6 + 3 * index;
+  return offset + instruction_length(chunk, offset) +
+         ((size_t)entry[0] << 16 | (size_t)entry[1] << 8 | entry[2]);
+}
+
 size_t add_constant_to_chunk(Chunk *chunk, Value value) {
   write_value_array(&chunk->constants, value);
   return chunk->constants.count - 1;
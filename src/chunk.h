@@ -8,8 +8,13 @@
  * the VM.
  */
 typedef enum {
+  // calls with a byte argument count and a 16 bit call cache index.
   OP_CALL,
+  // OP_CALL with a 24 bit call cache index.
+  OP_CALL_LONG,
   OP_CONSTANT,
+  // OP_CONSTANT with a 24 bit constant index.
+  OP_CONSTANT_LONG,
   OP_NULL,
   OP_TRUE,
   OP_FALSE,
@@ -25,16 +30,140 @@ typedef enum {
   OP_NEGATE,
   OP_PRINT,
   OP_SET_LOCAL,
+  // OP_SET_LOCAL with a 16 bit slot.
+  OP_SET_LOCAL_LONG,
   OP_GET_LOCAL,
+  // OP_GET_LOCAL with a 16 bit slot.
+  OP_GET_LOCAL_LONG,
   OP_DEFINE_GLOBAL,
+  // global instructions with a 24 bit constant index.
+  OP_DEFINE_GLOBAL_LONG,
   OP_SET_GLOBAL,
+  OP_SET_GLOBAL_LONG,
   OP_GET_GLOBAL,
+  OP_GET_GLOBAL_LONG,
   OP_JUMP,
+  // jump instructions with a 24 bit offset.
+  OP_JUMP_LONG,
   OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_FALSE_LONG,
   OP_LOOP,
+  OP_LOOP_LONG,
   OP_RETURN,
+  // pushes the value a byte operand of slots below the top, inlined
+  // functions read their arguments with it.
+  OP_PEEK,
+  // guards an inlined call, operands are the argument count, a 24 bit
+  // constant holding the inlined function and a 16 bit offset to its
+  // inlined body. Jumps there if the callee below the arguments is still that
+  // function, otherwise the call after the guard is made. Calls to math
+  // natives with constant arguments guard their computed result the same
+  // way.
+  OP_INLINE_GUARD,
+  // end of an inlined body, drops the byte operand of slots below the
+  // result, its callee and arguments.
+  OP_INLINE_RETURN,
+  // OP_CALL with the argument count in the opcode, only the 16 bit call
+  // cache index is an operand.
+  OP_CALL_0,
+  OP_CALL_1,
+  OP_CALL_2,
+  OP_CALL_3,
+  // closes a counting for loop: adds a step to a local counter and jumps
+  // back while it passes the comparison with its limit. Operands are the
+  // counter's slot, a FOR_* mode byte, the limit's slot or constant index,
+  // the step's constant index and a 16 bit offset back to the loop body.
+  OP_FOR_STEP,
+  // fails with a runtime error unless the value a byte operand of slots
+  // below the top is a number, guards stores to `: num` variables.
+  OP_CHECK_NUM,
+  // arithmetic and comparisons on operands the compiler knows are numbers,
+  // they skip checking their operand types.
+  OP_ADD_NN,
+  OP_SUBTRACT_NN,
+  OP_MULTIPLY_NN,
+  OP_DIVIDE_NN,
+  OP_LESS_NN,
+  OP_GREATER_NN,
+  // makes a closure of the function in a 24 bit constant, capturing the
+  // variables listed in the function's `captures`.
+  OP_CLOSURE,
+  // pushes a copied capture of the running closure, by a byte index.
+  OP_GET_CAPTURE,
+  // read and assign the variable behind a cell capture of the running
+  // closure, by a byte index.
+  OP_GET_UPVALUE,
+  OP_SET_UPVALUE,
+  // pops a local captured through a cell, which keeps its value from then.
+  OP_CLOSE_UPVALUE,
+  // makes an array of the 16 bit operand count of values on top.
+  OP_ARRAY,
+  // `array[index]`, and `array[index] = value` which leaves the value.
+  OP_GET_INDEX,
+  OP_SET_INDEX,
+  // makes a map of the 16 bit operand count of key value pairs on top.
+  OP_MAP,
+  // makes a class named by a 24 bit constant.
+  OP_CLASS,
+  // copies the methods of the superclass below the class on top into it,
+  // pops the class.
+  OP_INHERIT,
+  // pops a method into the class below it, named by a 24 bit constant.
+  OP_METHOD,
+  // operands are a 24 bit name constant and a 16 bit property cache index.
+  // `receiver.name`, and `receiver.name = value` which leaves the value.
+  OP_GET_PROPERTY,
+  OP_SET_PROPERTY,
+  // `receiver.name(args)`, a byte argument count sits between the name and
+  // the cache index.
+  OP_INVOKE,
+  // the property instructions with a 24 bit property cache index.
+  OP_GET_PROPERTY_LONG,
+  OP_SET_PROPERTY_LONG,
+  OP_INVOKE_LONG,
+  // `super.name` of `this` and the superclass on top, by a 24 bit name
+  // constant.
+  OP_GET_SUPER,
+  // `super.name(args)` with the superclass on top of the arguments, operands
+  // are a 24 bit name constant and a byte argument count.
+  OP_SUPER_INVOKE,
+  // joins the byte operand count of values on top into one string, a second
+  // byte operand is the mode, CONCAT_FORMAT or 0.
+  OP_CONCAT_N,
+  // calls to the math natives, operands are the math function and a 16 bit
+  // call cache index. If the callee below the values of the function's arity
+  // on top is its native, applies it on them without a call, null unless
+  // they are numbers. Otherwise calls the callee.
+  OP_MATH,
+  // `return a, b`, returns the byte operand count of values on top. They
+  // only all reach the caller if its next instruction is an OP_UNPACK,
+  // others get the first one.
+  OP_RETURN_N,
+  // spreads the values a call on top returned over the byte operand count
+  // of slots, null for the ones it didn't return. `let a, b = f()`.
+  OP_UNPACK,
+  // `switch` on the value it pops. Operands are a 24 bit constant, a 16 bit
+  // count of cases and count + 1 24 bit offsets from the end of the
+  // instruction, the last one for values matching no case.
+  // dense integer cases, case i is the value of the constant plus i.
+  OP_JUMP_TABLE,
+  // other cases, the constant is a map from case values to their case.
+  OP_JUMP_MAP,
 } OpCode;
 
+// comparisons of OP_FOR_STEP, in the low bits of its mode operand.
+#define FOR_LESS 0
+#define FOR_LESS_EQUAL 1
+#define FOR_GREATER 2
+#define FOR_GREATER_EQUAL 3
+#define FOR_COMPARISON 0x03
+// the limit operand of OP_FOR_STEP is a constant index instead of a slot.
+#define FOR_LIMIT_CONSTANT 0x04
+
+// mode of OP_CONCAT_N for `"${}"`: numbers, booleans and null are written
+// out, without it anything but strings is an error as for `+`.
+#define CONCAT_FORMAT 0x01
+
 /** Dynamic array implementation.
  */
 typedef struct {
@@ -48,6 +177,9 @@ typedef struct {
   ValueArray constants;
   // lines number of each instruction in the same index as the code's array.
   size_t *lines;
+  // code, lines and constants were moved into a read-only CodeSegment and
+  // aren't owned by the chunk anymore.
+  bool packed;
 
 } Chunk;
 
@@ -68,6 +200,64 @@ void free_chunk(Chunk *m_chunk);
  */
 void write_chunk(Chunk *m_chunk, uint8_t m_byte, size_t line);
 
+/*
+ * Length of the instruction at offset including its operands.
+ * @return 0 for an unknown opcode.
+ */
+size_t instruction_length(Chunk *chunk, size_t offset);
+
+/*
+ * Reads the single operand of the instruction at offset, 1 to 3 bytes wide,
+ * as of the constant, local, global and jump instructions.
+ */
+uint32_t read_operand(Chunk *chunk, size_t offset);
+
+/*
+ * Offset the jump, loop, OP_INLINE_GUARD or OP_FOR_STEP instruction at
+ * offset continues at when it jumps.
+ * @return -1 for other instructions.
+ */
+long jump_target(Chunk *chunk, size_t offset);
+
+/*
+ * Argument count of the call instruction at offset.
+ */
+uint8_t call_args_count(Chunk *chunk, size_t offset);
+
+/*
+ * Index of the call cache of the call instruction at offset, into the
+ * function's `call_caches`.
+ */
+uint32_t call_cache_index(Chunk *chunk, size_t offset);
+
+/*
+ * Index of the property cache of a property instruction or OP_INVOKE at
+ * offset, into the function's `property_caches`.
+ */
+uint32_t property_cache_index(Chunk *chunk, size_t offset);
+
+/*
+ * 24 bit name constant of the class and property instruction at offset,
+ * and the table constant of a switch instruction.
+ */
+uint32_t name_operand(Chunk *chunk, size_t offset);
+
+/*
+ * Function or native constant the OP_INLINE_GUARD at offset checks for.
+ */
+uint32_t inline_guard_constant(Chunk *chunk, size_t offset);
+
+/*
+ * Case count of the OP_JUMP_TABLE or OP_JUMP_MAP at offset.
+ */
+uint16_t jump_table_count(Chunk *chunk, size_t offset);
+
+/*
+ * Offset the switch instruction at offset jumps to for case index, the
+ * count of cases for values matching none.
+ */
+size_t jump_table_target(Chunk *chunk, size_t offset, int index);
+
 /* Adds a constant value to the values array in a chunk.
  * @param chunk pointer to the chunk.
  * @parma value the value to write.
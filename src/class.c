@@ -0,0 +1,151 @@
+#include "class.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include <string.h>
+
+int shape_slot(ObjShape *shape, ObjString *name) {
+  // names are interned, and shapes are only walked on cache misses.
+  for (; shape->parent != NULL; shape = shape->parent) {
+    if (shape->name == name) {
+      return shape->field_count - 1;
+    }
+  }
+  return -1;
+}
+
+ObjShape *shape_transition(ObjShape *shape, ObjString *name) {
+  Value child;
+  if (table_get(&shape->transitions, name, &child)) {
+    return (ObjShape *)AS_OBJ(child);
+  }
+
+  ObjShape *created = new_shape(shape, name);
+  table_set(&shape->transitions, name, OBJ_VAL(created));
+  return created;
+}
+
+/*
+ * Adds an entry to a cache with room left.
+ * @return the entry in the cache, or found itself once the cache is full.
+ */
+static PropertyEntry *remember(PropertyCache *cache, PropertyEntry *found) {
+  if (cache->count == PROPERTY_CACHE_WAYS) {
+    return found;
+  }
+  cache->entries[cache->count] = *found;
+  return &cache->entries[cache->count++];
+}
+
+/*
+ * Field or method of an instance through the cache of the site, a miss is
+ * looked up in found.
+ * @return NULL if the instance has neither.
+ */
+static PropertyEntry *lookup(PropertyCache *cache, ObjInstance *instance,
+                             ObjString *name, PropertyEntry *found) {
+  PropertyEntry *entry = cached_property(cache, instance->shape);
+  if (entry != NULL) {
+    return entry;
+  }
+
+  // fields shadow methods.
+  found->shape = instance->shape;
+  found->next = instance->shape;
+  found->slot = shape_slot(instance->shape, name);
+  found->method = NULL_VAL;
+  if (found->slot == -1 &&
+      !table_get(&instance->klass->methods, name, &found->method)) {
+    return NULL;
+  }
+  return remember(cache, found);
+}
+
+bool find_property(PropertyCache *cache, ObjInstance *instance, ObjString *name,
+                   PropertyEntry *entry) {
+  PropertyEntry found;
+  PropertyEntry *property = lookup(cache, instance, name, &found);
+  if (property == NULL) {
+    return false;
+  }
+  *entry = *property;
+  return true;
+}
+
+const char *get_property(PropertyCache *cache, Value receiver, ObjString *name,
+                         Value *result) {
+  if (!IS_INSTANCE(receiver)) {
+    return "Only instances have properties.";
+  }
+
+  ObjInstance *instance = AS_INSTANCE(receiver);
+  PropertyEntry found;
+  PropertyEntry *entry = lookup(cache, instance, name, &found);
+  if (entry == NULL) {
+    return "Undefined property '%s'.";
+  }
+
+  *result = entry->slot >= 0
+                ? instance->fields[entry->slot]
+                : OBJ_VAL(new_bound_method(receiver, entry->method));
+  return NULL;
+}
+
+/*
+ * Moves an instance to the shape with one more field, making room for it.
+ */
+static void add_field(ObjInstance *instance, ObjShape *shape) {
+  if (shape->field_count > instance->capacity) {
+    int old_capacity = instance->capacity;
+    instance->capacity = GROW_CAPACITY(old_capacity);
+    instance->fields = GROW_ARRAY(Value, instance->fields, old_capacity,
+                                  instance->capacity);
+  }
+
+  ObjClass *klass = instance->klass;
+  if (shape->field_count > klass->field_capacity) {
+    klass->field_capacity = shape->field_count;
+  }
+  instance->shape = shape;
+}
+
+const char *set_property(PropertyCache *cache, Value receiver, ObjString *name,
+                         Value value) {
+  if (!IS_INSTANCE(receiver)) {
+    return "Only instances have fields.";
+  }
+
+  ObjInstance *instance = AS_INSTANCE(receiver);
+  PropertyEntry *entry = cached_property(cache, instance->shape);
+  PropertyEntry found;
+  if (entry == NULL) {
+    found.shape = instance->shape;
+    found.next = instance->shape;
+    found.slot = shape_slot(instance->shape, name);
+    found.method = NULL_VAL;
+    if (found.slot == -1) {
+      found.next = shape_transition(instance->shape, name);
+      found.slot = instance->shape->field_count;
+    }
+    entry = remember(cache, &found);
+  }
+
+  if (entry->next != instance->shape) {
+    add_field(instance, entry->next);
+  }
+  instance->fields[entry->slot] = value;
+  return NULL;
+}
+
+void define_method(ObjClass *klass, ObjString *name, Value method) {
+  table_set(&klass->methods, name, method);
+  if (name->length == 4 && memcmp(name->chars, "init", 4) == 0) {
+    klass->initializer = method;
+  }
+}
+
+void inherit(ObjClass *klass, ObjClass *superclass) {
+  table_add_all(&superclass->methods, &klass->methods);
+  klass->initializer = superclass->initializer;
+}
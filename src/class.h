@@ -0,0 +1,68 @@
+#ifndef ZSPIE_CLASS_H_
+#define ZSPIE_CLASS_H_
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+/*
+ * Slot of a field in instances of shape.
+ * @return -1 if they don't have the field.
+ */
+int shape_slot(ObjShape *shape, ObjString *name);
+
+/*
+ * Shape of instances of shape which got one more field, made on first use.
+ */
+ObjShape *shape_transition(ObjShape *shape, ObjString *name);
+
+/*
+ * Entry of a property cache for shape.
+ * @return NULL if the site didn't see the shape yet.
+ */
+static inline PropertyEntry *cached_property(PropertyCache *cache,
+                                             ObjShape *shape) {
+  for (int i = 0; i < cache->count; i++) {
+    if (cache->entries[i].shape == shape) {
+      return &cache->entries[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Finds a field or method of an instance, through the cache of the site
+ * reading it.
+ * @return false if the instance has neither.
+ */
+bool find_property(PropertyCache *cache, ObjInstance *instance, ObjString *name,
+                   PropertyEntry *entry);
+
+/*
+ * `receiver.name` of OP_GET_PROPERTY, methods are read as bound methods.
+ * @return NULL, or the format of the runtime error to report, given the
+ * property's name.
+ */
+const char *get_property(PropertyCache *cache, Value receiver, ObjString *name,
+                         Value *result);
+
+/*
+ * `receiver.name = value` of OP_SET_PROPERTY, adding the field if the
+ * instance doesn't have it.
+ * @return NULL, or the format of the runtime error to report, given the
+ * property's name.
+ */
+const char *set_property(PropertyCache *cache, Value receiver, ObjString *name,
+                         Value value);
+
+/*
+ * Adds a method to a class, what OP_METHOD does.
+ */
+void define_method(ObjClass *klass, ObjString *name, Value method);
+
+/*
+ * Copies the methods of superclass into klass, which defines its own after.
+ */
+void inherit(ObjClass *klass, ObjClass *superclass);
+
+#endif // !ZSPIE_CLASS_H_
@@ -10,5 +10,9 @@
 #include <stdlib.h>
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
+
+// largest operand of the 3 byte wide (*_LONG) instructions.
+#define UINT24_MAX 0xffffff
 
 #endif // ZSPIE_COMMON_H_
@@ -1,12 +1,46 @@
 #include "chunk.h"
 #include "common.h"
 #include "external/log.h"
+#include "map.h"
+#include "mathlib.h"
+#include "memo.h"
 #include "object.h"
+#include "memory.h"
 #include "scanner.h"
+#include "table.h"
 #include "value.h"
+#include "verifier.h"
+#include "vm.h"
+#include <errno.h>
 #include <stdint.h>
 #include <string.h>
 
+/*
+ * What the compiler knows about the type of an expression's value.
+ */
+typedef enum {
+  STATIC_ANY,
+  // an integer or float, from a number literal, arithmetic or a `: num`
+  // local.
+  STATIC_NUM,
+  // a string, from a string literal or joining strings.
+  STATIC_STRING,
+} StaticType;
+
+/*
+ * A value the last compiled expression is known to have at compile time, its
+ * code only loads constants and gets replaced when it's folded.
+ */
+typedef struct {
+  bool known;
+  Value value;
+  // code and constants count of the chunk before the expression.
+  size_t start;
+  size_t pool;
+  // end of its code, the expression isn't a constant once more follows.
+  size_t end;
+} Folding;
+
 /*
  * Struct to store state of our parser.
  */
@@ -19,6 +53,13 @@ typedef struct {
   bool has_error;
   // flag to see if the parser is in panic mode.
   bool panic_mode;
+  // static type of the last compiled expression.
+  StaticType type;
+  // compile time value of the last compiled expression.
+  Folding constant;
+  // compiling the initializer of `let a, b = f()`, calls aren't inlined as
+  // the values they return must reach the OP_UNPACK after them.
+  bool unpacking;
 } Parser;
 
 /*
@@ -58,10 +99,46 @@ typedef struct {
 typedef struct {
   Token name;
   int depth;
+  // declared `: num`, every store to it is checked so reads are numbers.
+  bool numeric;
+  // a closure copied its value.
+  bool captured;
+  // assigned somewhere after its declaration.
+  bool assigned;
+  // closures capture it through an upvalue cell, closed when it's popped.
+  bool cell;
 } Local;
 
+/*
+ * A variable of an enclosing function the function being compiled refers
+ * to.
+ */
+typedef struct {
+  Capture capture;
+  // the captured variable was declared `: num`.
+  bool numeric;
+} Upvalue;
+
+/*
+ * A `const` declaration, its uses compile to its value.
+ */
+typedef struct {
+  Token name;
+  int depth;
+  Value value;
+} NamedConstant;
+
+// longest function body, in bytes of bytecode, which gets inlined.
+#define INLINE_MAX_LENGTH 32
+
 typedef enum {
   TYPE_FUNCTION,
+  // `memo fn` functions, which remember the one value they return.
+  TYPE_MEMO,
+  // methods get their receiver as a hidden first parameter, `this`.
+  TYPE_METHOD,
+  // `init` methods, which return their receiver.
+  TYPE_INITIALIZER,
   TYPE_SCRIPT,
 } FunctionType;
 
@@ -72,18 +149,63 @@ typedef struct Compiler {
   struct Compiler *enclosing;
   ObjFunction *function;
   FunctionType type;
-  Local locals[UINT8_COUNT];
+  // locals are grown on demand, a function can have upto UINT16_COUNT.
+  Local *locals;
   int local_count;
+  int local_capacity;
   int scope_depth;
+  // constants declared in the function, depth 0 ones in the script are
+  // global.
+  NamedConstant *named_constants;
+  int named_constant_count;
+  int named_constant_capacity;
+  // variables captured from enclosing functions, in the order of the
+  // function's `captures`.
+  Upvalue *upvalues;
+  int upvalue_count;
+  int upvalue_capacity;
+  // slot of the local function whose body is being compiled, -1 if none.
+  int declaring;
+  // a local was assigned after a closure copied it, the function must be
+  // recompiled capturing it through a cell.
+  bool recapture;
+  // constant index of every identifier name already in the chunk.
+  Table identifiers;
+  // emit 24 bit forward jumps, set when recompiling a function whose
+  // jumps didn't fit in 16 bits.
+  bool wide_jumps;
+  // a 16 bit forward jump overflowed, the function must be recompiled.
+  bool jump_overflow;
 } Compiler;
 
+/*
+ * A class whose methods are being compiled, for `this` and `super`.
+ */
+typedef struct ClassCompiler {
+  struct ClassCompiler *enclosing;
+  bool has_superclass;
+} ClassCompiler;
+
 // Global module level to avoid passing parser around using parameters and
 // pointers
 Parser parser;
 // Compilation state at runtime.
 Compiler *current_cs = NULL;
+// innermost class being compiled, NULL outside of classes.
+ClassCompiler *current_class = NULL;
 // currently compiling chunk
 Chunk *compiling_chunk;
+// top level functions calls get inlined into, by name.
+Table inline_functions;
+// globals declared `: num`, assignments compiled after their declaration
+// are checked.
+Table numeric_globals;
+// locals found to be assigned after being captured, by the position of
+// their name in the source. They are captured through cells when their
+// function is compiled again.
+const char **boxed_locals = NULL;
+int boxed_count = 0;
+int boxed_capacity = 0;
 
 // little helper function.
 static Chunk *current_chunk() { return &current_cs->function->chunk; }
@@ -91,14 +213,28 @@ static Chunk *current_chunk() { return &current_cs->function->chunk; }
 /*
  * Init a compiler state.
  */
-static void init_compiler(Compiler *compiler, FunctionType type) {
+static void init_compiler(Compiler *compiler, FunctionType type,
+                          bool wide_jumps) {
   log_debug("init compiler state");
 
   compiler->enclosing = current_cs;
   compiler->function = NULL;
   compiler->type = type;
+  compiler->locals = NULL;
   compiler->local_count = 0;
+  compiler->local_capacity = 0;
   compiler->scope_depth = 0;
+  compiler->named_constants = NULL;
+  compiler->named_constant_count = 0;
+  compiler->named_constant_capacity = 0;
+  compiler->upvalues = NULL;
+  compiler->upvalue_count = 0;
+  compiler->upvalue_capacity = 0;
+  compiler->declaring = -1;
+  compiler->recapture = false;
+  init_table(&compiler->identifiers);
+  compiler->wide_jumps = wide_jumps;
+  compiler->jump_overflow = false;
   compiler->function = new_function();
 
   current_cs = compiler;
@@ -108,8 +244,14 @@ static void init_compiler(Compiler *compiler, FunctionType type) {
         copy_string(parser.previous.start, parser.previous.length);
   }
 
+  current_cs->local_capacity = GROW_CAPACITY(0);
+  current_cs->locals = ALLOCATE(Local, current_cs->local_capacity);
   Local *local = &current_cs->locals[current_cs->local_count++];
   local->depth = 0;
+  local->numeric = false;
+  local->captured = false;
+  local->assigned = false;
+  local->cell = false;
   local->name.start = "";
   local->name.length = 0;
 }
@@ -226,42 +368,170 @@ static void emit_bytes(uint8_t byte1, uint8_t byte2) {
 }
 
 /*
- * emits loop instruction;
+ * emits loop instruction, OP_LOOP_LONG if the body doesn't fit in 16 bits.
  */
 static void emit_loop(int loop_start) {
-  emit_byte(OP_LOOP);
-  int offset = current_chunk()->count - loop_start + 2;
-  if (offset > UINT16_MAX) {
+  // +3 for the instruction and its operand.
+  int offset = current_chunk()->count - loop_start + 3;
+  if (offset <= UINT16_MAX) {
+    emit_byte(OP_LOOP);
+    emit_byte((offset >> 8) & 0xff);
+    emit_byte(offset & 0xff);
+    return;
+  }
+
+  offset++;
+  if (offset > UINT24_MAX) {
     error("Loop body too large");
   }
 
+  emit_byte(OP_LOOP_LONG);
+  emit_byte((offset >> 16) & 0xff);
   emit_byte((offset >> 8) & 0xff);
   emit_byte(offset & 0xff);
 }
 
+/*
+ * Emits a call which gets a call cache of its own, the common argument
+ * counts have an opcode each. OP_CALL_LONG once the cache index doesn't fit
+ * in 16 bits.
+ */
+static void emit_call(uint8_t args_count) {
+  ObjFunction *function = current_cs->function;
+  if (function->call_cache_count > UINT24_MAX) {
+    error("Too many calls in one function.");
+    return;
+  }
+
+  uint32_t cache = (uint32_t)function->call_cache_count++;
+  if (cache > UINT16_MAX) {
+    emit_bytes(OP_CALL_LONG, args_count);
+    emit_byte((cache >> 16) & 0xff);
+  } else if (args_count <= 3) {
+    emit_byte((uint8_t)(OP_CALL_0 + args_count));
+  } else {
+    emit_bytes(OP_CALL, args_count);
+  }
+  emit_bytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
+/*
+ * Emits OP_MATH for a math function whose global and arguments were just
+ * emitted, with the call cache of the call it makes when the global holds
+ * something else. A plain call once cache indices don't fit in 16 bits.
+ */
+static void emit_math(MathFunction function) {
+  ObjFunction *current = current_cs->function;
+  if (current->call_cache_count > UINT16_MAX) {
+    emit_call((uint8_t)math_intrinsics[function].arity);
+    return;
+  }
+
+  uint16_t cache = (uint16_t)current->call_cache_count++;
+  emit_bytes(OP_MATH, (uint8_t)function);
+  emit_bytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
 /*
  * Emits OP_RETURN.
  */
 static void emit_return() {
-  emit_byte(OP_NULL);
+  // initializers return their receiver.
+  if (current_cs->type == TYPE_INITIALIZER) {
+    emit_bytes(OP_GET_LOCAL, 1);
+  } else {
+    emit_byte(OP_NULL);
+  }
   emit_byte(OP_RETURN);
 }
 
+/*
+ * Emits an instruction whose first operand is a 24 bit name constant.
+ */
+static void emit_name(uint8_t op, uint32_t name) {
+  emit_byte(op);
+  emit_byte((name >> 16) & 0xff);
+  emit_byte((name >> 8) & 0xff);
+  emit_byte(name & 0xff);
+}
+
+/*
+ * Emits a property access or method call with a new property cache, its
+ * last operand. The *_LONG form once the cache index doesn't fit in 16 bits.
+ * @param args_count of OP_INVOKE, ignored by the others.
+ */
+static void emit_property(uint8_t op, uint32_t name, uint8_t args_count) {
+  ObjFunction *function = current_cs->function;
+  if (function->property_cache_count > UINT24_MAX) {
+    error("Too many property accesses in one function.");
+    return;
+  }
+
+  uint32_t cache = (uint32_t)function->property_cache_count++;
+  bool wide = cache > UINT16_MAX;
+  if (wide) {
+    op = op == OP_GET_PROPERTY   ? OP_GET_PROPERTY_LONG
+         : op == OP_SET_PROPERTY ? OP_SET_PROPERTY_LONG
+                                 : OP_INVOKE_LONG;
+  }
+
+  emit_name(op, name);
+  if (op == OP_INVOKE || op == OP_INVOKE_LONG) {
+    emit_byte(args_count);
+  }
+  if (wide) {
+    emit_byte((cache >> 16) & 0xff);
+  }
+  emit_bytes((cache >> 8) & 0xff, cache & 0xff);
+}
+
 /*
  * creates a new constant, for the Chunk.
  * @param value of the constant.
  * @return index of the constant in stack.
  */
-static uint8_t make_constant(Value value) {
+static uint32_t make_constant(Value value) {
   log_debug("making constant with value=%lf", value);
   size_t constant_index = add_constant_to_chunk(current_chunk(), value);
 
-  if (constant_index > UINT8_MAX) {
+  if (constant_index > UINT24_MAX) {
     error("Too many constants in one chunk.");
     return 0;
   }
 
-  return (uint8_t)constant_index;
+  return (uint32_t)constant_index;
+}
+
+/*
+ * Emits an instruction taking a constant index, uses the 24 bit long
+ * variant only when the index doesn't fit in a byte.
+ */
+static void emit_constant_operand(uint8_t op, uint8_t long_op,
+                                  uint32_t index) {
+  if (index <= UINT8_MAX) {
+    emit_bytes(op, (uint8_t)index);
+    return;
+  }
+
+  emit_byte(long_op);
+  emit_byte((index >> 16) & 0xff);
+  emit_byte((index >> 8) & 0xff);
+  emit_byte(index & 0xff);
+}
+
+/*
+ * Emits an instruction taking a local slot, uses the 16 bit long variant
+ * only when the slot doesn't fit in a byte.
+ */
+static void emit_local_operand(uint8_t op, uint8_t long_op, int slot) {
+  if (slot <= UINT8_MAX) {
+    emit_bytes(op, (uint8_t)slot);
+    return;
+  }
+
+  emit_byte(long_op);
+  emit_byte((slot >> 8) & 0xff);
+  emit_byte(slot & 0xff);
 }
 
 /*
@@ -269,13 +539,68 @@ static uint8_t make_constant(Value value) {
  * @param value - the value to make constant.
  */
 static void emit_constant(Value value) {
-  emit_bytes(OP_CONSTANT, make_constant(value));
+  emit_constant_operand(OP_CONSTANT, OP_CONSTANT_LONG, make_constant(value));
+}
+
+/*
+ * Records the expression just compiled as a constant known at compile time.
+ */
+static void mark_known(Value value) {
+  parser.constant.known = true;
+  parser.constant.value = value;
+  parser.constant.end = current_chunk()->count;
+  parser.type = IS_NUMERIC(value)  ? STATIC_NUM
+                : IS_STRING(value) ? STATIC_STRING
+                                   : STATIC_ANY;
 }
 
 /*
- * emits jump statements.
+ * @return true if the expression just compiled is a known constant.
+ */
+static bool known() {
+  return parser.constant.known &&
+         parser.constant.end == current_chunk()->count;
+}
+
+/*
+ * Emits a load of a value known at compile time.
+ */
+static void emit_known(Value value) {
+  if (IS_BOOL(value)) {
+    emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else if (IS_NULL(value)) {
+    emit_byte(OP_NULL);
+  } else {
+    emit_constant(value);
+  }
+  mark_known(value);
+}
+
+/*
+ * Replaces the code of a constant expression starting where folding does
+ * with a load of its value.
+ */
+static void fold(Folding *folding, Value value) {
+  current_chunk()->count = folding->start;
+  current_chunk()->constants.count = folding->pool;
+  parser.constant = *folding;
+  emit_known(value);
+}
+
+/*
+ * emits jump statements, the 24 bit variant if the function is being
+ * compiled with wide jumps.
+ * @return offset of the jump's operand, to be patched later.
  */
 static int emit_jump(uint8_t instruction) {
+  if (current_cs->wide_jumps) {
+    emit_byte(instruction == OP_JUMP ? OP_JUMP_LONG : OP_JUMP_IF_FALSE_LONG);
+    emit_byte(0xff);
+    emit_byte(0xff);
+    emit_byte(0xff);
+    return current_chunk()->count - 3;
+  }
+
   emit_byte(instruction);
   emit_byte(0xff);
   emit_byte(0xff);
@@ -284,14 +609,34 @@ static int emit_jump(uint8_t instruction) {
 
 /*
  * called after executing chunk for cleanup.
+ * @return the compiled function, NULL if it has to be compiled again, with
+ * wide jumps if a jump overflowed or with cells for locals assigned after
+ * being captured.
  */
 static ObjFunction *end_compiler() {
   emit_return();
   ObjFunction *function = current_cs->function;
+  bool recompile = (current_cs->jump_overflow || current_cs->recapture) &&
+                   !parser.has_error;
+
+  init_call_caches(function, function->call_cache_count);
+  init_property_caches(function, function->property_cache_count);
+
+  function->capture_count = current_cs->upvalue_count;
+  function->captures = ALLOCATE(Capture, function->capture_count);
+  for (int i = 0; i < current_cs->upvalue_count; i++) {
+    function->captures[i] = current_cs->upvalues[i].capture;
+  }
+
+  FREE_ARRAY(Local, current_cs->locals, current_cs->local_capacity);
+  FREE_ARRAY(Upvalue, current_cs->upvalues, current_cs->upvalue_capacity);
+  FREE_ARRAY(NamedConstant, current_cs->named_constants,
+             current_cs->named_constant_capacity);
+  free_table(&current_cs->identifiers);
 
 // some logging .
 #ifdef ZSPIE_DEBUG_MODE
-  if (!parser.has_error) {
+  if (!parser.has_error && !recompile) {
     disassemble_chunk(current_chunk(), function->name != NULL
                                            ? function->name->chars
                                            : "<script>");
@@ -300,7 +645,7 @@ static ObjFunction *end_compiler() {
   //
   current_cs = current_cs->enclosing;
 
-  return function;
+  return recompile ? NULL : function;
 }
 
 /*
@@ -325,9 +670,17 @@ static void end_scope() {
          // 2. from the entire scope.
          current_cs->locals[current_cs->local_count - 1].depth >
              current_cs->scope_depth) {
-    emit_byte(OP_POP);
+    emit_byte(current_cs->locals[current_cs->local_count - 1].cell
+                  ? OP_CLOSE_UPVALUE
+                  : OP_POP);
     current_cs->local_count--;
   }
+
+  while (current_cs->named_constant_count > 0 &&
+         current_cs->named_constants[current_cs->named_constant_count - 1]
+                 .depth > current_cs->scope_depth) {
+    current_cs->named_constant_count--;
+  }
 }
 
 /*
@@ -342,13 +695,32 @@ static void print_statement();
 static void statement();
 static void let_declaration();
 static void declaration();
+static void patch_jump(int offset);
+static bool type_annotation();
+static void named_variable(Token name, bool can_assign);
+static void variable(bool can_assign);
+
+/*
+ * Makes a constant, identifiers are deduplicated so every use of the same
+ * global shares one constant slot.
+ */
+static uint32_t name_constant(ObjString *name) {
+  Value index;
+  if (table_get(&current_cs->identifiers, name, &index)) {
+    return (uint32_t)AS_NUMBER(index);
+  }
+
+  uint32_t constant = make_constant(OBJ_VAL(name));
+  table_set(&current_cs->identifiers, name, NUMBER_VAL((double)constant));
+  return constant;
+}
 
 /*
- * Makes a constant
+ * Makes a constant for an identifier token, see name_constant.
  */
-static uint8_t indentifier_constant(Token *token) {
+static uint32_t indentifier_constant(Token *token) {
   log_trace("making indentifier_constant");
-  return make_constant(OBJ_VAL(copy_string(token->start, token->length)));
+  return name_constant(copy_string(token->start, token->length));
 }
 
 /*
@@ -357,16 +729,32 @@ static uint8_t indentifier_constant(Token *token) {
 static void add_local(Token name) {
   log_trace("adding token=%.*s at line= to locals.", name.length, name.start,
             name.line);
-  if (current_cs->local_count == UINT8_COUNT) {
+  if (current_cs->local_count == UINT16_COUNT) {
     error("Too many local variables in current scope.");
     return;
   }
 
+  if (current_cs->local_capacity < current_cs->local_count + 1) {
+    int old_capacity = current_cs->local_capacity;
+    current_cs->local_capacity = GROW_CAPACITY(old_capacity);
+    current_cs->locals = GROW_ARRAY(Local, current_cs->locals, old_capacity,
+                                    current_cs->local_capacity);
+  }
+
   Local *local = &current_cs->locals[current_cs->local_count++];
   local->name = name;
   // we dont define the depth, it is kindof used as token
   // to mark variables uninitialised.
   local->depth = -1;
+  local->numeric = false;
+  local->captured = false;
+  local->assigned = false;
+  local->cell = false;
+  for (int i = 0; i < boxed_count; i++) {
+    if (boxed_locals[i] == name.start) {
+      local->cell = true;
+    }
+  }
 }
 
 /*
@@ -402,11 +790,156 @@ static int resolve_local(Compiler *compiler_state, Token *name) {
   return -1;
 }
 
+/*
+ * @return true if a constant of that name was declared in the current scope.
+ */
+static bool constant_declared(Token *name) {
+  for (int i = current_cs->named_constant_count - 1; i >= 0; i--) {
+    NamedConstant *constant = &current_cs->named_constants[i];
+    if (constant->depth < current_cs->scope_depth) {
+      break;
+    }
+    if (identifier_equal(name, &constant->name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * Finds the constant a name refers to. Constants of enclosing functions are
+ * visible too, unless a local shadows them.
+ * @param local - slot of the local the name resolved to, -1 if none.
+ * @return NULL if the name isn't a constant.
+ */
+static NamedConstant *resolve_constant(Token *name, int local) {
+  for (Compiler *compiler = current_cs; compiler != NULL;
+       compiler = compiler->enclosing) {
+    if (compiler != current_cs) {
+      local = resolve_local(compiler, name);
+    }
+    for (int i = compiler->named_constant_count - 1; i >= 0; i--) {
+      NamedConstant *constant = &compiler->named_constants[i];
+      if (!identifier_equal(name, &constant->name)) {
+        continue;
+      }
+      // a local in the same or a deeper scope shadows it.
+      if (local != -1 && compiler->locals[local].depth >= constant->depth) {
+        return NULL;
+      }
+      return constant;
+    }
+    if (local != -1) {
+      return NULL;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Records an assignment to a local. If a closure copied the local already it
+ * has to share it instead, the function declaring the local gets compiled
+ * again with the local captured through a cell.
+ */
+static void assign_local(Compiler *compiler, int slot) {
+  Local *local = &compiler->locals[slot];
+  local->assigned = true;
+  if (!local->captured || local->cell) {
+    return;
+  }
+
+  if (boxed_capacity < boxed_count + 1) {
+    int old_capacity = boxed_capacity;
+    boxed_capacity = GROW_CAPACITY(old_capacity);
+    boxed_locals =
+        GROW_ARRAY(const char *, boxed_locals, old_capacity, boxed_capacity);
+  }
+  boxed_locals[boxed_count++] = local->name.start;
+  compiler->recapture = true;
+}
+
+/*
+ * Adds a variable to the captures of the function being compiled by
+ * compiler, unless it's captured already.
+ * @return its index in the captures.
+ */
+static int add_upvalue(Compiler *compiler, CaptureSource source, int index,
+                       bool cell, bool numeric) {
+  for (int i = 0; i < compiler->upvalue_count; i++) {
+    Capture *capture = &compiler->upvalues[i].capture;
+    if (capture->source == source && capture->index == index) {
+      return i;
+    }
+  }
+
+  if (compiler->upvalue_count == UINT8_COUNT) {
+    error("Too many captured variables in function.");
+    return 0;
+  }
+
+  if (compiler->upvalue_capacity < compiler->upvalue_count + 1) {
+    int old_capacity = compiler->upvalue_capacity;
+    compiler->upvalue_capacity = GROW_CAPACITY(old_capacity);
+    compiler->upvalues = GROW_ARRAY(Upvalue, compiler->upvalues, old_capacity,
+                                    compiler->upvalue_capacity);
+  }
+
+  Upvalue *upvalue = &compiler->upvalues[compiler->upvalue_count];
+  upvalue->capture.source = source;
+  upvalue->capture.cell = cell;
+  upvalue->capture.index = (uint16_t)index;
+  upvalue->numeric = numeric;
+  return compiler->upvalue_count++;
+}
+
+/*
+ * Resolves a name to a local of an enclosing function, capturing it in every
+ * function in between. Locals which are never assigned after their
+ * declaration are copied into the closure, others are shared through a
+ * cell.
+ * @param assign - the reference assigns the variable.
+ * @return index in the captures of compiler's function, -1 if no enclosing
+ * function has such a local.
+ */
+static int resolve_upvalue(Compiler *compiler, Token *name, bool assign) {
+  Compiler *enclosing = compiler->enclosing;
+  if (enclosing == NULL) {
+    return -1;
+  }
+
+  int slot = resolve_local(enclosing, name);
+  if (slot != -1) {
+    if (assign) {
+      assign_local(enclosing, slot);
+    }
+    Local *local = &enclosing->locals[slot];
+    local->cell = local->cell || local->assigned;
+    local->captured = !local->cell;
+    // a local function's closure doesn't exist yet when it's made, unless
+    // the cell points at the slot it's pushed to.
+    CaptureSource source = slot == enclosing->declaring && !local->cell
+                               ? CAPTURE_SELF
+                               : CAPTURE_LOCAL;
+    return add_upvalue(compiler, source, slot, local->cell, local->numeric);
+  }
+
+  int outer = resolve_upvalue(enclosing, name, assign);
+  if (outer == -1) {
+    return -1;
+  }
+  Upvalue *upvalue = &enclosing->upvalues[outer];
+  return add_upvalue(compiler, CAPTURE_OUTER, outer, upvalue->capture.cell,
+                     upvalue->numeric);
+}
+
 /*
  * local variables.
  */
 static void declare_variable() {
   log_trace("declarating a local variable.");
+  if (constant_declared(&parser.previous)) {
+    error("Redeclaration of constant.");
+  }
   if (current_cs->scope_depth == 0) {
     log_trace("in global scope returning.");
     return;
@@ -436,7 +969,7 @@ static void declare_variable() {
 /*
  * parses variable indentifier.
  */
-static uint8_t parse_variable(const char *error_message) {
+static uint32_t parse_variable(const char *error_message) {
   log_trace("parsing variable with error message=%d", error_message);
   consume(TOKEN_IDENTIFIER, error_message);
   declare_variable();
@@ -460,16 +993,28 @@ static void mark_initialized() {
       current_cs->scope_depth;
 }
 
+/*
+ * A token for a name the compiler declares itself, `this` and `super`.
+ */
+static Token synthetic_token(const char *text) {
+  Token token;
+  token.type = TOKEN_IDENTIFIER;
+  token.start = text;
+  token.length = strlen(text);
+  token.line = parser.previous.line;
+  return token;
+}
+
 /*
  * Defines a variable
  */
-static void define_variable(uint8_t global) {
-  log_trace("defining variable global=%c", global);
+static void define_variable(uint32_t global) {
+  log_trace("defining variable global=%u", global);
   if (current_cs->scope_depth > 0) {
     mark_initialized();
     return;
   }
-  emit_bytes(OP_DEFINE_GLOBAL, global);
+  emit_constant_operand(OP_DEFINE_GLOBAL, OP_DEFINE_GLOBAL_LONG, global);
 }
 
 /*
@@ -489,6 +1034,10 @@ static void parse_precedence(Precedence precedence) {
 
   // calling prefix ParseFn.
   bool can_assign = precedence <= PREC_ASSIGNMENT;
+  parser.type = STATIC_ANY;
+  parser.constant.known = false;
+  parser.constant.start = current_chunk()->count;
+  parser.constant.pool = current_chunk()->constants.count;
   prefix_rule(can_assign);
 
   // consuming infix expression.
@@ -504,6 +1053,123 @@ static void parse_precedence(Precedence precedence) {
   }
 }
 
+/*
+ * Computes a binary operation on constants at compile time.
+ * @return false if it can't be folded, the operation is compiled then.
+ */
+static bool fold_binary(TokenType operator_type, Value a, Value b,
+                        Value *result) {
+  switch (operator_type) {
+  case TOKEN_EQUAL_EQUAL:
+    *result = BOOL_VAL(values_equal(a, b));
+    return true;
+  case TOKEN_BANG_EQUAL:
+    *result = BOOL_VAL(!values_equal(a, b));
+    return true;
+  default:
+    break;
+  }
+
+  if (operator_type == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+    *result = OBJ_VAL(join_strings(AS_STRING(a), AS_STRING(b)));
+    return true;
+  }
+
+  // anything else is a runtime error unless both are numbers.
+  if (!IS_NUMERIC(a) || !IS_NUMERIC(b)) {
+    return false;
+  }
+  switch (operator_type) {
+  case TOKEN_GREATER:
+    *result = BOOL_VAL(greater_values(a, b));
+    return true;
+  case TOKEN_GREATER_EQUAL:
+    *result = BOOL_VAL(!less_values(a, b));
+    return true;
+  case TOKEN_LESS:
+    *result = BOOL_VAL(less_values(a, b));
+    return true;
+  case TOKEN_LESS_EQUAL:
+    *result = BOOL_VAL(!greater_values(a, b));
+    return true;
+  case TOKEN_PLUS:
+    *result = add_values(a, b);
+    return true;
+  case TOKEN_MINUS:
+    *result = subtract_values(a, b);
+    return true;
+  case TOKEN_STAR:
+    *result = multiply_values(a, b);
+    return true;
+  case TOKEN_SLASH:
+    *result = divide_values(a, b);
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Emits OP_CONCAT_N joining count values.
+ */
+static void emit_concat(int count, uint8_t mode) {
+  emit_bytes(OP_CONCAT_N, (uint8_t)count);
+  emit_byte(mode);
+}
+
+/*
+ * Joins count values already pushed into one once OP_CONCAT_N can take no
+ * more, so another can go on top.
+ * @return how many values there are then.
+ */
+static int make_concat_room(int count, uint8_t mode) {
+  if (count < UINT8_MAX) {
+    return count;
+  }
+  emit_concat(count, mode);
+  return 1;
+}
+
+/*
+ * Joins the last count values of a chain of `+`.
+ */
+static void join_chain(int count) {
+  if (count == 2) {
+    emit_byte(OP_ADD);
+  } else {
+    emit_concat(count, 0);
+  }
+}
+
+/*
+ * Compiles the rest of a chain of `+` whose first two operands were just
+ * compiled, one of them a string. The whole chain can only join strings, so
+ * operands known to be strings are pushed and joined at once. One which may
+ * be something else is joined as soon as it's pushed, `+` fails on it
+ * before the next operand runs.
+ */
+static void concat_chain(StaticType left) {
+  int count = 2;
+  if (left != STATIC_STRING || parser.type != STATIC_STRING) {
+    emit_byte(OP_ADD);
+    count = 1;
+  }
+  while (match(TOKEN_PLUS)) {
+    count = make_concat_room(count, 0);
+    parse_precedence(PREC_FACTOR);
+    count++;
+    if (parser.type != STATIC_STRING) {
+      join_chain(count);
+      count = 1;
+    }
+  }
+
+  if (count > 1) {
+    join_chain(count);
+  }
+  parser.type = STATIC_STRING;
+}
+
 /*
  * Parses binary expressions.
  */
@@ -512,8 +1178,68 @@ static void binary(bool can_assign) {
 
   TokenType operator_type = parser.previous.type;
   ParseRule *rule = get_rule(operator_type);
+  StaticType left = parser.type;
+  Folding left_constant = parser.constant;
+  bool left_known = known();
   parse_precedence((Precedence)(rule->precedence + 1));
 
+  Value folded;
+  if (left_known && known() &&
+      fold_binary(operator_type, left_constant.value, parser.constant.value,
+                  &folded)) {
+    fold(&left_constant, folded);
+    return;
+  }
+
+  // operands known to be numbers use the unchecked instructions, arithmetic
+  // on them is a number again.
+  if (left == STATIC_NUM && parser.type == STATIC_NUM) {
+    switch (operator_type) {
+    case TOKEN_PLUS:
+      emit_byte(OP_ADD_NN);
+      return;
+    case TOKEN_MINUS:
+      emit_byte(OP_SUBTRACT_NN);
+      return;
+    case TOKEN_STAR:
+      emit_byte(OP_MULTIPLY_NN);
+      return;
+    case TOKEN_SLASH:
+      emit_byte(OP_DIVIDE_NN);
+      return;
+    case TOKEN_GREATER:
+      emit_byte(OP_GREATER_NN);
+      parser.type = STATIC_ANY;
+      return;
+    case TOKEN_GREATER_EQUAL:
+      emit_bytes(OP_LESS_NN, OP_NOT);
+      parser.type = STATIC_ANY;
+      return;
+    case TOKEN_LESS:
+      emit_byte(OP_LESS_NN);
+      parser.type = STATIC_ANY;
+      return;
+    case TOKEN_LESS_EQUAL:
+      emit_bytes(OP_GREATER_NN, OP_NOT);
+      parser.type = STATIC_ANY;
+      return;
+    default:
+      break;
+    }
+  }
+
+  if (operator_type == TOKEN_PLUS &&
+      (left == STATIC_STRING || parser.type == STATIC_STRING)) {
+    concat_chain(left);
+    return;
+  }
+
+  // the checked instructions fail on anything else, + also joins strings.
+  parser.type = operator_type == TOKEN_MINUS || operator_type == TOKEN_STAR ||
+                        operator_type == TOKEN_SLASH
+                    ? STATIC_NUM
+                    : STATIC_ANY;
+
   switch (operator_type) {
   case TOKEN_BANG_EQUAL:
     emit_bytes(OP_EQUAL, OP_NOT);
@@ -569,18 +1295,21 @@ static void literal(bool can_assign) {
   case TOKEN_TRUE:
     log_fatal("matched true");
     emit_byte(OP_TRUE);
+    mark_known(BOOL_VAL(true));
     break;
 
   case TOKEN_FALSE:
 
     log_fatal("matched false");
     emit_byte(OP_FALSE);
+    mark_known(BOOL_VAL(false));
     break;
 
   case TOKEN_NULL:
 
     log_fatal("matched null");
     emit_byte(OP_NULL);
+    mark_known(NULL_VAL);
     break;
 
   default:
@@ -588,13 +1317,30 @@ static void literal(bool can_assign) {
   }
 }
 
+/*
+ * Value of a number literal token.
+ */
+static Value number_value(Token *token) {
+  // literals without a fraction are integers, unless they don't fit.
+  if (memchr(token->start, '.', (size_t)token->length) == NULL) {
+    errno = 0;
+    long long integer = strtoll(token->start, NULL, 10);
+    if (errno != ERANGE) {
+      return INT_VAL((int64_t)integer);
+    }
+  }
+
+  return NUMBER_VAL(strtod(token->start, NULL));
+}
+
 /*
  * Parses number literals.
  */
 static void number(bool can_assign) {
   log_trace("parsing number expression");
-  double value = strtod(parser.previous.start, NULL);
-  emit_constant(NUMBER_VAL(value));
+  Value value = number_value(&parser.previous);
+  emit_constant(value);
+  mark_known(value);
 }
 
 /*
@@ -624,15 +1370,268 @@ static uint8_t argument_list() {
 }
 
 /*
- * Parses function calls.
+ * A function gets inlined if its body is short, runs straight to its
+ * return without jumps or assigning locals, and doesn't call itself.
  */
-static void call(bool can_assign) {
-  uint8_t args_count = argument_list();
-  emit_bytes(OP_CALL, args_count);
-}
+static bool inlinable(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  int *heights = ALLOCATE(int, chunk->count);
+  int max_stack = 0;
+  bool valid = analyze_chunk(chunk, function->arity, heights, &max_stack);
+
+  for (size_t offset = 0; valid; offset += instruction_length(chunk, offset)) {
+    if (offset >= INLINE_MAX_LENGTH) {
+      valid = false;
+      break;
+    }
 
-/*
- * Parses 'blocks'
+    int h = heights[offset];
+    uint8_t op = chunk->code[offset];
+    if (op == OP_RETURN) {
+      valid = h - 1 <= UINT8_MAX;
+      break;
+    }
+
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_NULL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_POP:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_PRINT:
+    case OP_CALL:
+    case OP_CALL_LONG:
+    case OP_CALL_0:
+    case OP_CALL_1:
+    case OP_CALL_2:
+    case OP_CALL_3:
+    case OP_CHECK_NUM:
+    case OP_ADD_NN:
+    case OP_SUBTRACT_NN:
+    case OP_MULTIPLY_NN:
+    case OP_DIVIDE_NN:
+    case OP_LESS_NN:
+    case OP_GREATER_NN:
+    case OP_ARRAY:
+    case OP_GET_INDEX:
+    case OP_SET_INDEX:
+    case OP_MAP:
+    case OP_CONCAT_N:
+    case OP_MATH:
+      break;
+
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG:
+      valid = h - 1 - (int)read_operand(chunk, offset) <= UINT8_MAX;
+      break;
+
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+      valid = AS_STRING(chunk->constants.values[read_operand(
+                  chunk, offset)]) != function->name;
+      break;
+
+    default:
+      valid = false;
+      break;
+    }
+  }
+
+  FREE_ARRAY(int, heights, chunk->count);
+  return valid;
+}
+
+/*
+ * Emits the guard in front of code specialized for a callee just emitted
+ * with its arguments, and the call made instead if the callee isn't that
+ * value anymore. The specialized code follows and leaves only its result in
+ * the callee's slot.
+ * @return the jump over it after the call, to be patched.
+ */
+static int emit_call_guard(Value callee, uint8_t args_count) {
+  uint32_t constant = make_constant(callee);
+  emit_bytes(OP_INLINE_GUARD, args_count);
+  emit_byte((constant >> 16) & 0xff);
+  emit_byte((constant >> 8) & 0xff);
+  emit_byte(constant & 0xff);
+  emit_byte(0xff);
+  emit_byte(0xff);
+  int guard = current_chunk()->count - 2;
+
+  emit_call(args_count);
+  int end_jump = emit_jump(OP_JUMP);
+
+  int skip = current_chunk()->count - guard - 2;
+  current_chunk()->code[guard] = (skip >> 8) & 0xff;
+  current_chunk()->code[guard + 1] = skip & 0xff;
+  return end_jump;
+}
+
+/*
+ * Inlines a call whose callee and arguments were just emitted. The body is
+ * copied with the callee's slots read relative to the top of the stack, as
+ * the arguments are where the call would have put the callee's frame.
+ * Behind a guard, if the callee isn't that function anymore the call is
+ * made as usual. Runtime errors in an inlined body are reported at the line
+ * of the call, without the inlined function's frame.
+ */
+static void emit_inline_call(ObjFunction *function, uint8_t args_count) {
+  int end_jump = emit_call_guard(OBJ_VAL(function), args_count);
+
+  Chunk *chunk = &function->chunk;
+  int *heights = ALLOCATE(int, chunk->count);
+  int max_stack = 0;
+  analyze_chunk(chunk, function->arity, heights, &max_stack);
+
+  // the body keeps the line of the call, runtime errors in it report the
+  // caller's frame.
+  size_t offset = 0;
+  for (; chunk->code[offset] != OP_RETURN;
+       offset += instruction_length(chunk, offset)) {
+    int h = heights[offset];
+    uint8_t op = chunk->code[offset];
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+      emit_constant(chunk->constants.values[read_operand(chunk, offset)]);
+      break;
+
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG:
+      emit_bytes(OP_PEEK, (uint8_t)(h - 1 - (int)read_operand(chunk, offset)));
+      break;
+
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+      emit_constant_operand(
+          OP_GET_GLOBAL, OP_GET_GLOBAL_LONG,
+          name_constant(
+              AS_STRING(chunk->constants.values[read_operand(chunk, offset)])));
+      break;
+
+    case OP_CALL:
+    case OP_CALL_LONG:
+    case OP_CALL_0:
+    case OP_CALL_1:
+    case OP_CALL_2:
+    case OP_CALL_3:
+      emit_call(call_args_count(chunk, offset));
+      break;
+
+    case OP_MATH:
+      emit_math((MathFunction)chunk->code[offset + 1]);
+      break;
+
+    default:
+      for (size_t i = 0; i < instruction_length(chunk, offset); i++) {
+        emit_byte(chunk->code[offset + i]);
+      }
+      break;
+    }
+  }
+
+  emit_bytes(OP_INLINE_RETURN, (uint8_t)(heights[offset] - 1));
+  FREE_ARRAY(int, heights, chunk->count);
+  patch_jump(end_jump);
+}
+
+/*
+ * Parses function calls.
+ */
+static void call(bool can_assign) {
+  uint8_t args_count = argument_list();
+  emit_call(args_count);
+  parser.type = STATIC_ANY;
+}
+
+/*
+ * Parses `receiver.name`, assigning to it and calling it as a method.
+ */
+static void dot(bool can_assign) {
+  consume(TOKEN_IDENTIFIER, "Expected property name after '.'.");
+  uint32_t name = indentifier_constant(&parser.previous);
+
+  if (can_assign && match(TOKEN_EQUAL)) {
+    expression();
+    emit_property(OP_SET_PROPERTY, name, 0);
+  } else if (match(TOKEN_LEFT_PAREN)) {
+    emit_property(OP_INVOKE, name, argument_list());
+  } else {
+    emit_property(OP_GET_PROPERTY, name, 0);
+  }
+  parser.type = STATIC_ANY;
+}
+
+/*
+ * Parses array literals.
+ */
+static void array(bool can_assign) {
+  int count = 0;
+  if (!check(TOKEN_RIGHT_BRACKET)) {
+    do {
+      expression();
+      if (count == UINT16_MAX) {
+        error("Cannot have more than 65535 elements in an array literal.");
+      }
+      count++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_BRACKET, "Expected ']' after array elements.");
+  emit_byte(OP_ARRAY);
+  emit_bytes((count >> 8) & 0xff, count & 0xff);
+  parser.type = STATIC_ANY;
+}
+
+/*
+ * Parses map literals, `{key: value, ...}`. A '{' starting a statement is a
+ * block.
+ */
+static void map(bool can_assign) {
+  int count = 0;
+  if (!check(TOKEN_RIGHT_BRACE)) {
+    do {
+      expression();
+      consume(TOKEN_COLON, "Expected ':' after map key.");
+      expression();
+      if (count == UINT16_MAX) {
+        error("Cannot have more than 65535 entries in a map literal.");
+      }
+      count++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_BRACE, "Expected '}' after map entries.");
+  emit_byte(OP_MAP);
+  emit_bytes((count >> 8) & 0xff, count & 0xff);
+  parser.type = STATIC_ANY;
+}
+
+/*
+ * Parses indexing an array or map, and assigning to an element.
+ */
+static void subscript(bool can_assign) {
+  expression();
+  consume(TOKEN_RIGHT_BRACKET, "Expected ']' after index.");
+  if (can_assign && match(TOKEN_EQUAL)) {
+    expression();
+    emit_byte(OP_SET_INDEX);
+  } else {
+    emit_byte(OP_GET_INDEX);
+  }
+  parser.type = STATIC_ANY;
+}
+
+/*
+ * Parses 'blocks'
  */
 static void block() {
   while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
@@ -644,12 +1643,22 @@ static void block() {
 
 /*
  * compiles function signature and body
+ * @param wide_jumps - set when the function has to be compiled again with
+ * wide jumps.
+ * @return the compiled function, NULL if it has to be compiled again.
  */
-static void function(FunctionType type) {
+static ObjFunction *function_body(FunctionType type, bool *wide_jumps) {
   Compiler compiler;
-  init_compiler(&compiler, type);
+  init_compiler(&compiler, type, *wide_jumps);
   begin_scope();
 
+  // the receiver is the first slot after the callee.
+  if (type == TYPE_METHOD || type == TYPE_INITIALIZER) {
+    current_cs->function->arity++;
+    add_local(synthetic_token("this"));
+    mark_initialized();
+  }
+
   consume(TOKEN_LEFT_PAREN, "Expected '(' after function name.");
   // parameters
   if (!check(TOKEN_RIGHT_PAREN)) {
@@ -658,29 +1667,161 @@ static void function(FunctionType type) {
       if (current_cs->function->arity > 255) {
         error_at_current("Cannot have more than 255 function parameters.");
       }
-      uint8_t constant = parse_variable("Expected parameter name.");
+      uint32_t constant = parse_variable("Expected parameter name.");
+      current_cs->locals[current_cs->local_count - 1].numeric =
+          type_annotation();
       define_variable(constant);
     } while (match(TOKEN_COMMA));
   }
 
   consume(TOKEN_RIGHT_PAREN, "Expected ')' after function parameters.");
+
+  // arguments of `: num` parameters are checked once on entry.
+  int arity = current_cs->function->arity;
+  for (int slot = 1; slot <= arity && slot < current_cs->local_count; slot++) {
+    if (current_cs->locals[slot].numeric) {
+      emit_bytes(OP_CHECK_NUM, (uint8_t)(arity - slot));
+    }
+  }
   consume(TOKEN_LEFT_BRACE, "Expected '{' after function signature.");
 
   block();
   ObjFunction *function = end_compiler();
-  emit_bytes(OP_CONSTANT, make_constant(OBJ_VAL(function)));
+  *wide_jumps = *wide_jumps || compiler.jump_overflow;
+  return function;
+}
+
+/*
+ * compiles a function and emits it as a constant, or as a closure if it
+ * captures any variables.
+ * @return the compiled function.
+ */
+static ObjFunction *function(FunctionType type) {
+  Scanner scanner_state = save_scanner();
+  Parser parser_state = parser;
+
+  bool wide_jumps = false;
+  ObjFunction *function;
+  while ((function = function_body(type, &wide_jumps)) == NULL) {
+    // rewind and compile again, with wide jumps or cells for the locals
+    // which turned out to be assigned after being captured.
+    restore_scanner(scanner_state);
+    parser = parser_state;
+  }
+
+  if (function->capture_count == 0) {
+    emit_constant(OBJ_VAL(function));
+    return function;
+  }
+
+  uint32_t constant = make_constant(OBJ_VAL(function));
+  emit_byte(OP_CLOSURE);
+  emit_byte((constant >> 16) & 0xff);
+  emit_byte((constant >> 8) & 0xff);
+  emit_byte(constant & 0xff);
+  return function;
 }
 
 /*
  * compiler functon declaration.
+ * @param memo - declared `memo fn`, calls remember their results by
+ * arguments.
  */
-static void fn_declaration() {
-  uint8_t global = parse_variable("Expected function name.");
+static void fn_declaration(bool memo) {
+  uint32_t global = parse_variable("Expected function name.");
+  Token name = parser.previous;
   mark_initialized();
-  function(TYPE_FUNCTION);
+  int declaring = current_cs->declaring;
+  current_cs->declaring =
+      current_cs->scope_depth > 0 ? current_cs->local_count - 1 : -1;
+  ObjFunction *compiled = function(memo ? TYPE_MEMO : TYPE_FUNCTION);
+  current_cs->declaring = declaring;
+  if (memo) {
+    compiled->memo = new_memo();
+  }
+
+  // calls after a top level function get inlined if it's small, memoized
+  // ones are always called.
+  if (current_cs->scope_depth == 0) {
+    ObjString *key = copy_string(name.start, name.length);
+    if (!parser.has_error && !memo && inlinable(compiled)) {
+      table_set(&inline_functions, key, OBJ_VAL(compiled));
+    } else {
+      table_delete(&inline_functions, key);
+    }
+  }
   define_variable(global);
 }
 
+/*
+ * Compiles a method of the class below it on the stack.
+ */
+static void method() {
+  consume(TOKEN_FN, "Expected 'fn' before method.");
+  consume(TOKEN_IDENTIFIER, "Expected method name.");
+  uint32_t name = indentifier_constant(&parser.previous);
+  FunctionType type = TYPE_METHOD;
+  if (parser.previous.length == 4 &&
+      memcmp(parser.previous.start, "init", 4) == 0) {
+    type = TYPE_INITIALIZER;
+  }
+  function(type);
+  emit_name(OP_METHOD, name);
+}
+
+/*
+ * Compiles class declarations, `class Name < Superclass { fn method() {} }`.
+ */
+static void class_declaration() {
+  consume(TOKEN_IDENTIFIER, "Expected class name.");
+  Token class_name = parser.previous;
+  uint32_t name = indentifier_constant(&class_name);
+  declare_variable();
+
+  emit_name(OP_CLASS, name);
+  define_variable(name);
+  if (current_cs->scope_depth == 0) {
+    ObjString *key = copy_string(class_name.start, class_name.length);
+    table_delete(&inline_functions, key);
+    table_delete(&numeric_globals, key);
+  }
+
+  ClassCompiler class_compiler;
+  class_compiler.enclosing = current_class;
+  class_compiler.has_superclass = false;
+  current_class = &class_compiler;
+
+  if (match(TOKEN_LESS)) {
+    consume(TOKEN_IDENTIFIER, "Expected superclass name.");
+    variable(false);
+    if (identifier_equal(&class_name, &parser.previous)) {
+      error("A class can't inherit from itself.");
+    }
+
+    // methods find the superclass in a local of their enclosing scope.
+    begin_scope();
+    add_local(synthetic_token("super"));
+    define_variable(0);
+
+    named_variable(class_name, false);
+    emit_byte(OP_INHERIT);
+    class_compiler.has_superclass = true;
+  }
+
+  named_variable(class_name, false);
+  consume(TOKEN_LEFT_BRACE, "Expected '{' before class body.");
+  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+    method();
+  }
+  consume(TOKEN_RIGHT_BRACE, "Expected '}' after class body.");
+  emit_byte(OP_POP);
+
+  if (class_compiler.has_superclass) {
+    end_scope();
+  }
+  current_class = current_class->enclosing;
+}
+
 /*
  * Parses unary expression.
  */
@@ -688,9 +1829,22 @@ static void unary(bool can_assign) {
   log_trace("parsing unary expression");
 
   TokenType operator_type = parser.previous.type;
+  Folding constant = parser.constant;
 
   parse_precedence(PREC_UNARY);
 
+  if (known()) {
+    Value value = parser.constant.value;
+    if (operator_type == TOKEN_BANG) {
+      fold(&constant, BOOL_VAL(is_falsey(value)));
+      return;
+    }
+    if (operator_type == TOKEN_MINUS && IS_NUMERIC(value)) {
+      fold(&constant, negate_value(value));
+      return;
+    }
+  }
+
   switch (operator_type) {
   case TOKEN_BANG_EQUAL:
     emit_bytes(OP_EQUAL, OP_NOT);
@@ -727,6 +1881,8 @@ static void unary(bool can_assign) {
   default:
     return; // unreachable.
   }
+  // OP_NEGATE fails on anything but a number.
+  parser.type = operator_type == TOKEN_MINUS ? STATIC_NUM : STATIC_ANY;
 }
 
 /*
@@ -741,15 +1897,77 @@ static void grouping(bool can_assign) {
  * Parses string literals.
  */
 static void string(bool can_assign) {
-  emit_constant(OBJ_VAL(
-      copy_string(parser.previous.start + 1, parser.previous.length - 2)));
+  Value value = OBJ_VAL(
+      copy_string(parser.previous.start + 1, parser.previous.length - 2));
+  emit_constant(value);
+  mark_known(value);
+}
+
+/*
+ * Parses strings with `${expression}` in them, the text and the values of
+ * the expressions are joined by OP_CONCAT_N, one for every UINT8_MAX - 1
+ * parts after the first.
+ */
+static void interpolation(bool can_assign) {
+  int count = 0;
+  do {
+    // the text between the opening quote or `}` and the `${`.
+    if (parser.previous.length > 3) {
+      count = make_concat_room(count, CONCAT_FORMAT);
+      emit_constant(OBJ_VAL(
+          copy_string(parser.previous.start + 1, parser.previous.length - 3)));
+      count++;
+    }
+    // `${}`, the scanner already went back to the string at the `}`.
+    if (parser.current.start[0] == '}' &&
+        (check(TOKEN_STRING) || check(TOKEN_INTERPOLATION))) {
+      Token brace = parser.current;
+      brace.length = 1;
+      for (size_t i = 0; i < parser.current.length; i++) {
+        if (parser.current.start[i] == '\n') {
+          brace.line--;
+        }
+      }
+      error_at(&brace, "Expected expression.");
+    }
+    count = make_concat_room(count, CONCAT_FORMAT);
+    expression();
+    count++;
+  } while (match(TOKEN_INTERPOLATION));
+
+  consume(TOKEN_STRING, "Expected end of string after interpolation.");
+  if (parser.previous.length > 2) {
+    count = make_concat_room(count, CONCAT_FORMAT);
+    emit_constant(OBJ_VAL(
+        copy_string(parser.previous.start + 1, parser.previous.length - 2)));
+    count++;
+  }
+  emit_concat(count, CONCAT_FORMAT);
+  parser.type = STATIC_STRING;
+}
+
+/*
+ * `memo` is only a keyword directly before `fn`, anywhere else it's a name
+ * like any other.
+ * @return if the current token starts a `memo fn` declaration.
+ */
+static bool at_memo_fn() {
+  if (parser.current.type != TOKEN_IDENTIFIER ||
+      parser.current.length != 4 ||
+      memcmp(parser.current.start, "memo", 4) != 0) {
+    return false;
+  }
+  Scanner scanner_state = save_scanner();
+  Token next = scan_token();
+  restore_scanner(scanner_state);
+  return next.type == TOKEN_FN;
 }
 
 static void synchronize() {
   parser.panic_mode = false;
 
   while (parser.current.type != TOKEN_EOF) {
-    if (parser.previous.type == TOKEN_SEMICOLON) {
+    if (parser.previous.type == TOKEN_SEMICOLON || at_memo_fn()) {
       return;
     }
 
@@ -757,40 +1975,216 @@ static void synchronize() {
     case TOKEN_CLASS:
     case TOKEN_FN:
     case TOKEN_LET:
+    case TOKEN_CONST:
     case TOKEN_FOR:
     case TOKEN_IF:
     case TOKEN_WHILE:
+    case TOKEN_SWITCH:
+    case TOKEN_CASE:
+    case TOKEN_DEFAULT:
     case TOKEN_PRINT:
     case TOKEN_RETURN:
       return;
 
     default:;
     }
+
+    advance();
   }
+}
 
-  advance();
+/*
+ * Parses an optional `: type` after a variable or parameter name, `num` is
+ * the only type.
+ * @return if the variable was declared a number.
+ */
+static bool type_annotation() {
+  if (!match(TOKEN_COLON)) {
+    return false;
+  }
+
+  consume(TOKEN_IDENTIFIER, "Expected type name after ':'.");
+  if (parser.previous.length != 3 ||
+      memcmp(parser.previous.start, "num", 3) != 0) {
+    error("Unknown type.");
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Checks the value on top of the stack is a number before it's stored to a
+ * `: num` variable, unless it's known to be one already.
+ */
+static void check_number() {
+  if (parser.type != STATIC_NUM) {
+    emit_bytes(OP_CHECK_NUM, 0);
+  }
+  parser.type = STATIC_NUM;
+}
+
+/*
+ * Finds the math function named like token.
+ * @return -1 if there's none.
+ */
+static int math_function(Token *token) {
+  for (int i = 0; i < MATH_COUNT; i++) {
+    const char *name = math_intrinsics[i].name;
+    if (strlen(name) == token->length &&
+        memcmp(name, token->start, token->length) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Calls to a math function compile to OP_MATH if its global holds its
+ * native.
+ * @return the function, -1 if the call is compiled as usual.
+ */
+static int math_intrinsic(Token *name, ObjString *key, Value *native) {
+  int function = math_function(name);
+  if (function == -1 || !table_get(&vm.globals, key, native) ||
+      !is_math_native(*native, (MathFunction)function)) {
+    return -1;
+  }
+  return function;
+}
+
+/*
+ * Compiles the arguments and the call of a math function. Calls with the
+ * function's arity apply it on the arguments with OP_MATH, which calls the
+ * global as usual if it doesn't hold the native anymore. Pure functions of
+ * constants are computed here, behind a guard on the global. Other argument
+ * counts call the native.
+ */
+static void math_intrinsic_call(MathFunction function, uint32_t global,
+                                Value native) {
+  const MathIntrinsic *intrinsic = &math_intrinsics[function];
+  emit_constant_operand(OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, global);
+
+  Value args[2];
+  bool constant = true;
+  uint8_t args_count = 0;
+  consume(TOKEN_LEFT_PAREN, "Expected '(' after function name.");
+  if (!check(TOKEN_RIGHT_PAREN)) {
+    do {
+      expression();
+      if (args_count < 2) {
+        args[args_count] = parser.constant.value;
+      }
+      constant = constant && known();
+      if (args_count == 255) {
+        error("Cannot have more than 255 arguments in a function call.");
+      }
+      args_count++;
+    } while (match(TOKEN_COMMA));
+  }
+  consume(TOKEN_RIGHT_PAREN, "Expected ')' after arguments.");
+  parser.type = STATIC_ANY;
+
+  if (args_count != intrinsic->arity) {
+    emit_call(args_count);
+    return;
+  }
+
+  if (!intrinsic->pure || !constant) {
+    emit_math(function);
+    return;
+  }
+
+  int end_jump = emit_call_guard(native, args_count);
+  emit_constant(math_call(function, args));
+  emit_bytes(OP_INLINE_RETURN, (uint8_t)(args_count + 1));
+  patch_jump(end_jump);
 }
 
 /*
  * Retrives named variables.
  */
 static void named_variable(Token name, bool can_assign) {
-  uint8_t get_op, set_op;
   int arg = resolve_local(current_cs, &name);
+  NamedConstant *constant = resolve_constant(&name, arg);
+  if (constant != NULL) {
+    if (can_assign && match(TOKEN_EQUAL)) {
+      error("Can't assign to a constant.");
+      expression();
+      return;
+    }
+    emit_known(constant->value);
+    return;
+  }
+
   if (arg != -1) {
-    get_op = OP_GET_LOCAL;
-    set_op = OP_SET_LOCAL;
-  } else {
-    arg = indentifier_constant(&name);
-    get_op = OP_GET_GLOBAL;
-    set_op = OP_SET_GLOBAL;
+    bool numeric = current_cs->locals[arg].numeric;
+    if (can_assign && match(TOKEN_EQUAL)) {
+      assign_local(current_cs, arg);
+      expression();
+      if (numeric) {
+        check_number();
+      }
+      emit_local_operand(OP_SET_LOCAL, OP_SET_LOCAL_LONG, arg);
+    } else {
+      emit_local_operand(OP_GET_LOCAL, OP_GET_LOCAL_LONG, arg);
+      parser.type = numeric ? STATIC_NUM : STATIC_ANY;
+    }
+    return;
   }
 
+  int upvalue =
+      resolve_upvalue(current_cs, &name, can_assign && check(TOKEN_EQUAL));
+  if (upvalue != -1) {
+    bool numeric = current_cs->upvalues[upvalue].numeric;
+    bool cell = current_cs->upvalues[upvalue].capture.cell;
+    if (can_assign && match(TOKEN_EQUAL)) {
+      expression();
+      if (numeric) {
+        check_number();
+      }
+      emit_bytes(OP_SET_UPVALUE, (uint8_t)upvalue);
+    } else {
+      emit_bytes(cell ? OP_GET_UPVALUE : OP_GET_CAPTURE, (uint8_t)upvalue);
+      parser.type = numeric ? STATIC_NUM : STATIC_ANY;
+    }
+    return;
+  }
+
+  uint32_t global = indentifier_constant(&name);
+  ObjString *key = copy_string(name.start, name.length);
   if (can_assign && match(TOKEN_EQUAL)) {
+    // calls compiled after an assignment aren't inlined anymore.
+    table_delete(&inline_functions, key);
     expression();
-    emit_bytes(set_op, (uint8_t)arg);
-  } else {
-    emit_bytes(get_op, (uint8_t)arg);
+    Value numeric;
+    if (table_get(&numeric_globals, key, &numeric)) {
+      check_number();
+    }
+    emit_constant_operand(OP_SET_GLOBAL, OP_SET_GLOBAL_LONG, global);
+    return;
+  }
+
+  Value native;
+  int function =
+      check(TOKEN_LEFT_PAREN) ? math_intrinsic(&name, key, &native) : -1;
+  if (function != -1) {
+    math_intrinsic_call((MathFunction)function, global, native);
+    return;
+  }
+
+  emit_constant_operand(OP_GET_GLOBAL, OP_GET_GLOBAL_LONG, global);
+
+  Value inlined;
+  if (check(TOKEN_LEFT_PAREN) && !parser.unpacking &&
+      table_get(&inline_functions, key, &inlined)) {
+    advance();
+    uint8_t args_count = argument_list();
+    if (args_count == AS_FUNCTION(inlined)->arity) {
+      emit_inline_call(AS_FUNCTION(inlined), args_count);
+    } else {
+      emit_call(args_count);
+    }
+    parser.type = STATIC_ANY;
   }
 }
 
@@ -801,23 +2195,189 @@ static void variable(bool can_assign) {
   named_variable(parser.previous, can_assign);
 }
 
+/*
+ * Parses `this`, the receiver of the method being compiled.
+ */
+static void this_(bool can_assign) {
+  if (current_class == NULL) {
+    error("Can't use 'this' outside of a class.");
+    return;
+  }
+  variable(false);
+}
+
+/*
+ * Parses `super.name` and `super.name(args)`, methods of the superclass
+ * called on `this`.
+ */
+static void super_(bool can_assign) {
+  if (current_class == NULL) {
+    error("Can't use 'super' outside of a class.");
+  } else if (!current_class->has_superclass) {
+    error("Can't use 'super' in a class with no superclass.");
+  }
+
+  consume(TOKEN_DOT, "Expected '.' after 'super'.");
+  consume(TOKEN_IDENTIFIER, "Expected superclass method name.");
+  uint32_t name = indentifier_constant(&parser.previous);
+
+  named_variable(synthetic_token("this"), false);
+  if (match(TOKEN_LEFT_PAREN)) {
+    uint8_t args_count = argument_list();
+    named_variable(synthetic_token("super"), false);
+    emit_name(OP_SUPER_INVOKE, name);
+    emit_byte(args_count);
+  } else {
+    named_variable(synthetic_token("super"), false);
+    emit_name(OP_GET_SUPER, name);
+  }
+  parser.type = STATIC_ANY;
+}
+
+/*
+ * Parses the rest of `let a, b = f();` after the first name, the values the
+ * call returns are spread over the variables, null for the ones it doesn't
+ * return.
+ */
+static void let_several(uint32_t first) {
+  uint32_t globals[UINT8_MAX];
+  globals[0] = first;
+  int count = 1;
+  while (match(TOKEN_COMMA)) {
+    if (count == UINT8_MAX) {
+      error("Can't declare more than 255 variables at once.");
+      break;
+    }
+    globals[count++] = parse_variable("Expected variable name.");
+    if (current_cs->scope_depth == 0) {
+      ObjString *key =
+          copy_string(parser.previous.start, parser.previous.length);
+      table_delete(&inline_functions, key);
+      table_delete(&numeric_globals, key);
+    }
+  }
+
+  if (match(TOKEN_EQUAL)) {
+    parser.unpacking = true;
+    expression();
+    parser.unpacking = false;
+  } else {
+    emit_byte(OP_NULL);
+  }
+  consume(TOKEN_SEMICOLON, "Expected ';' after variable declaration.");
+  emit_bytes(OP_UNPACK, (uint8_t)count);
+
+  if (current_cs->scope_depth > 0) {
+    for (int i = 0; i < count; i++) {
+      current_cs->locals[current_cs->local_count - 1 - i].depth =
+          current_cs->scope_depth;
+    }
+    return;
+  }
+  // the last value is on top.
+  for (int i = count - 1; i >= 0; i--) {
+    define_variable(globals[i]);
+  }
+}
+
 /*
  * parses let variables declaration.
  */
 static void let_declaration() {
-  uint8_t global = parse_variable("Expected variable name.");
+  uint32_t global = parse_variable("Expected variable name.");
+  ObjString *key = NULL;
+  if (current_cs->scope_depth == 0) {
+    key = copy_string(parser.previous.start, parser.previous.length);
+    table_delete(&inline_functions, key);
+  }
+
+  if (check(TOKEN_COMMA)) {
+    if (key != NULL) {
+      table_delete(&numeric_globals, key);
+    }
+    let_several(global);
+    return;
+  }
 
+  bool numeric = type_annotation();
   if (match(TOKEN_EQUAL)) {
     expression();
+    if (numeric) {
+      check_number();
+    }
   } else {
+    if (numeric) {
+      error("Expected an initial value for a ': num' variable.");
+    }
     emit_byte(OP_NULL);
   }
 
   consume(TOKEN_SEMICOLON, "Expected ';' after variable declaration.");
 
+  if (key == NULL) {
+    current_cs->locals[current_cs->local_count - 1].numeric = numeric;
+  } else if (numeric) {
+    table_set(&numeric_globals, key, BOOL_VAL(true));
+  } else {
+    table_delete(&numeric_globals, key);
+  }
   define_variable(global);
 }
 
+/*
+ * parses const declarations, the initialiser must fold to a constant which
+ * every use of the name compiles to.
+ */
+static void const_declaration() {
+  consume(TOKEN_IDENTIFIER, "Expected constant name.");
+  Token name = parser.previous;
+  if (constant_declared(&name)) {
+    error("Redeclaration of constant.");
+  }
+  for (int i = current_cs->local_count - 1;
+       i >= 0 && current_cs->locals[i].depth >= current_cs->scope_depth;
+       i--) {
+    if (identifier_equal(&name, &current_cs->locals[i].name)) {
+      error("Redeclaration of local variable.");
+    }
+  }
+
+  consume(TOKEN_EQUAL, "Expected '=' after constant name.");
+  expression();
+  if (!known()) {
+    error("Expected a constant expression.");
+  }
+  consume(TOKEN_SEMICOLON, "Expected ';' after constant declaration.");
+
+  // the expression is replaced by its value.
+  current_chunk()->count = parser.constant.start;
+  current_chunk()->constants.count = parser.constant.pool;
+  Value value = parser.constant.value;
+  if (current_cs->scope_depth == 0) {
+    // a global too, for functions using it before it's declared and for
+    // later lines of the repl.
+    ObjString *key = copy_string(name.start, name.length);
+    table_delete(&inline_functions, key);
+    table_delete(&numeric_globals, key);
+    emit_constant(value);
+    define_variable(indentifier_constant(&name));
+  }
+
+  if (current_cs->named_constant_capacity <
+      current_cs->named_constant_count + 1) {
+    int old_capacity = current_cs->named_constant_capacity;
+    current_cs->named_constant_capacity = GROW_CAPACITY(old_capacity);
+    current_cs->named_constants =
+        GROW_ARRAY(NamedConstant, current_cs->named_constants, old_capacity,
+                   current_cs->named_constant_capacity);
+  }
+  NamedConstant *constant =
+      &current_cs->named_constants[current_cs->named_constant_count++];
+  constant->name = name;
+  constant->depth = current_cs->scope_depth;
+  constant->value = value;
+}
+
 /*
  * Statement wrapper for expressions.
  */
@@ -848,9 +2408,27 @@ static void return_statement() {
   if (match(TOKEN_SEMICOLON)) {
     emit_return();
   } else {
+    if (current_cs->type == TYPE_INITIALIZER) {
+      error("Can't return a value from an initializer.");
+    }
     expression();
+    int count = 1;
+    while (match(TOKEN_COMMA)) {
+      if (current_cs->type == TYPE_MEMO) {
+        error("Can't return several values from a memo fn.");
+      }
+      if (count == UINT8_MAX) {
+        error("Can't return more than 255 values.");
+      }
+      expression();
+      count++;
+    }
     consume(TOKEN_SEMICOLON, "Expected ';' after expression.");
-    emit_byte(OP_RETURN);
+    if (count == 1) {
+      emit_byte(OP_RETURN);
+    } else {
+      emit_bytes(OP_RETURN_N, (uint8_t)count);
+    }
   }
 }
 
@@ -858,15 +2436,33 @@ static void return_statement() {
  * int patches jump statements.
  */
 static void patch_jump(int offset) {
+  uint8_t *code = current_chunk()->code;
+  uint8_t instruction = code[offset - 1];
+
+  if (instruction == OP_JUMP_LONG || instruction == OP_JUMP_IF_FALSE_LONG) {
+    // -3 for jumping the operand of jump statement.
+    int jump = current_chunk()->count - offset - 3;
+    if (jump > UINT24_MAX) {
+      error("Too much code to jump over.");
+    }
+
+    code[offset] = (jump >> 16) & 0xff;
+    code[offset + 1] = (jump >> 8) & 0xff;
+    code[offset + 2] = jump & 0xff;
+    return;
+  }
+
   // -2 for jumping the operand of jump statement.
   int jump = current_chunk()->count - offset - 2;
 
   if (jump > UINT16_MAX) {
-    error("Too much code to jump over.");
+    // the function gets compiled again using wide jumps.
+    current_cs->jump_overflow = true;
+    return;
   }
 
-  current_chunk()->code[offset] = (jump >> 8) & 0xff;
-  current_chunk()->code[offset + 1] = jump & 0xff;
+  code[offset] = (jump >> 8) & 0xff;
+  code[offset + 1] = jump & 0xff;
 }
 
 /*
@@ -877,6 +2473,7 @@ static void and_(bool can_assign) {
   emit_byte(OP_POP);
   parse_precedence(PREC_AND);
   patch_jump(end_jump);
+  parser.type = STATIC_ANY;
 }
 
 /*
@@ -891,6 +2488,7 @@ static void or_(bool can_assign) {
 
   parse_precedence(PREC_OR);
   patch_jump(end_jump);
+  parser.type = STATIC_ANY;
 }
 
 /*
@@ -919,6 +2517,239 @@ static void if_statement() {
   patch_jump(else_jump);
 }
 
+/*
+ * Cases of a switch statement being compiled.
+ */
+typedef struct {
+  // case values, and the case each one runs.
+  Value *values;
+  int *value_cases;
+  int value_count;
+  int value_capacity;
+  // offset of each case's code from the start of the switch's cases.
+  size_t *starts;
+  // jump to the end of the switch after each case, -1 after the last.
+  int *exits;
+  int count;
+  int capacity;
+  // case of `default`, -1 if none.
+  int default_case;
+} SwitchCases;
+
+// densest integer cases, in table entries per case value, which still get
+// an OP_JUMP_TABLE.
+#define JUMP_TABLE_SPREAD 2
+
+/*
+ * Parses the values of a `case`, constants which get removed from the code.
+ */
+static void case_values(SwitchCases *cases) {
+  Chunk *chunk = current_chunk();
+  do {
+    expression();
+    if (!known()) {
+      error("Expected a constant case value.");
+      continue;
+    }
+    Value value = parser.constant.value;
+    chunk->count = parser.constant.start;
+    chunk->constants.count = parser.constant.pool;
+
+    if (!is_map_key(value)) {
+      error("Expected a number, string or boolean case value.");
+      continue;
+    }
+    for (int i = 0; i < cases->value_count; i++) {
+      if (values_equal(cases->values[i], value)) {
+        error("Duplicate case value.");
+      }
+    }
+
+    if (cases->value_capacity < cases->value_count + 1) {
+      int old_capacity = cases->value_capacity;
+      cases->value_capacity = GROW_CAPACITY(old_capacity);
+      cases->values = GROW_ARRAY(Value, cases->values, old_capacity,
+                                 cases->value_capacity);
+      cases->value_cases = GROW_ARRAY(int, cases->value_cases, old_capacity,
+                                      cases->value_capacity);
+    }
+    cases->values[cases->value_count] = value;
+    cases->value_cases[cases->value_count++] = cases->count;
+  } while (match(TOKEN_COMMA));
+}
+
+/*
+ * The switch instruction dispatching over cases, once they are compiled.
+ * Integer cases whose values are close together index a table, others look
+ * the value up in a map from case values to cases.
+ * @param end - offset of the end of the switch from the start of the cases.
+ * @param code - the instruction's bytes are written to it.
+ * @return length of the instruction.
+ */
+static size_t switch_instruction(SwitchCases *cases, size_t end,
+                                 uint8_t **code) {
+  int64_t low = 0;
+  int64_t high = 0;
+  bool dense = true;
+  for (int i = 0; i < cases->value_count && dense; i++) {
+    Value value = cases->values[i];
+    // dense cases stay within 32 bits, the vm subtracts floats from them.
+    dense = IS_INT(value) && AS_INT(value) >= INT32_MIN &&
+            AS_INT(value) <= INT32_MAX;
+    if (dense && (i == 0 || AS_INT(value) < low)) {
+      low = AS_INT(value);
+    }
+    if (dense && (i == 0 || AS_INT(value) > high)) {
+      high = AS_INT(value);
+    }
+  }
+  dense = dense && high - low < JUMP_TABLE_SPREAD * cases->value_count;
+
+  int64_t count = dense ? high - low + 1 : cases->count;
+  if (count > UINT16_MAX) {
+    error("Too many cases in one switch.");
+    dense = false;
+    count = 0;
+  }
+  size_t *targets = ALLOCATE(size_t, count + 1);
+  size_t otherwise =
+      cases->default_case == -1 ? end : cases->starts[cases->default_case];
+  for (int64_t i = 0; i < count; i++) {
+    targets[i] = dense ? otherwise : cases->starts[i];
+  }
+  targets[count] = otherwise;
+
+  uint32_t constant;
+  if (dense) {
+    for (int i = 0; i < cases->value_count; i++) {
+      targets[AS_INT(cases->values[i]) - low] =
+          cases->starts[cases->value_cases[i]];
+    }
+    constant = make_constant(INT_VAL(low));
+  } else {
+    ObjMap *map = new_map(cases->value_count);
+    for (int i = 0; i < cases->value_count; i++) {
+      map_set(map, cases->values[i], INT_VAL(cases->value_cases[i]));
+    }
+    constant = make_constant(OBJ_VAL(map));
+  }
+
+  size_t length = 9 + 3 * (size_t)count;
+  *code = ALLOCATE(uint8_t, length);
+  uint8_t *bytes = *code;
+  bytes[0] = dense ? OP_JUMP_TABLE : OP_JUMP_MAP;
+  bytes[1] = (constant >> 16) & 0xff;
+  bytes[2] = (constant >> 8) & 0xff;
+  bytes[3] = constant & 0xff;
+  bytes[4] = (count >> 8) & 0xff;
+  bytes[5] = count & 0xff;
+  for (int64_t i = 0; i <= count; i++) {
+    if (targets[i] > UINT24_MAX) {
+      error("Too much code to jump over.");
+    }
+    bytes[6 + 3 * i] = (targets[i] >> 16) & 0xff;
+    bytes[7 + 3 * i] = (targets[i] >> 8) & 0xff;
+    bytes[8 + 3 * i] = targets[i] & 0xff;
+  }
+  FREE_ARRAY(size_t, targets, count + 1);
+  return length;
+}
+
+/*
+ * Parses `switch (value) { case 1, 2: ... default: ... }`. Case values are
+ * constants, the case matching the value runs, or `default` if none does,
+ * and execution goes on after the switch. The cases get compiled first, the
+ * instruction dispatching over them is moved in front of them once their
+ * values are all known.
+ */
+static void switch_statement() {
+  consume(TOKEN_LEFT_PAREN, "Expected '(' after 'switch'.");
+  expression();
+  consume(TOKEN_RIGHT_PAREN, "Expected ')' after switch value.");
+  consume(TOKEN_LEFT_BRACE, "Expected '{' before switch cases.");
+  size_t line = parser.previous.line;
+
+  Chunk *chunk = current_chunk();
+  size_t start = chunk->count;
+  SwitchCases cases = {NULL, NULL, 0, 0, NULL, NULL, 0, 0, -1};
+  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
+    if (!match(TOKEN_CASE) && !match(TOKEN_DEFAULT)) {
+      if (cases.count == 0) {
+        error_at_current("Expected 'case' or 'default' in switch.");
+        break;
+      }
+      declaration();
+      continue;
+    }
+
+    bool is_default = parser.previous.type == TOKEN_DEFAULT;
+    if (cases.count > 0) {
+      end_scope();
+      cases.exits[cases.count - 1] = emit_jump(OP_JUMP);
+    }
+    if (cases.capacity < cases.count + 1) {
+      int old_capacity = cases.capacity;
+      cases.capacity = GROW_CAPACITY(old_capacity);
+      cases.starts =
+          GROW_ARRAY(size_t, cases.starts, old_capacity, cases.capacity);
+      cases.exits = GROW_ARRAY(int, cases.exits, old_capacity, cases.capacity);
+    }
+    cases.starts[cases.count] = chunk->count - start;
+    cases.exits[cases.count] = -1;
+
+    if (!is_default) {
+      case_values(&cases);
+    } else if (cases.default_case != -1) {
+      error("A switch can only have one default.");
+    } else {
+      cases.default_case = cases.count;
+    }
+    consume(TOKEN_COLON, "Expected ':' after case.");
+    cases.count++;
+    begin_scope();
+  }
+  if (cases.count > 0) {
+    end_scope();
+  }
+  consume(TOKEN_RIGHT_BRACE, "Expected '}' after switch cases.");
+
+  // with no values to match the value is only dropped, before the default.
+  uint8_t *code = NULL;
+  uint8_t pop = OP_POP;
+  size_t length = 1;
+  if (cases.value_count > 0) {
+    length = switch_instruction(&cases, chunk->count - start, &code);
+  }
+
+  // moves the cases after the instruction, jumps in them are relative and
+  // stay valid.
+  size_t end = chunk->count;
+  for (size_t i = 0; i < length; i++) {
+    emit_byte(0);
+  }
+  memmove(chunk->code + start + length, chunk->code + start, end - start);
+  memmove(chunk->lines + start + length, chunk->lines + start,
+          (end - start) * sizeof(size_t));
+  memcpy(chunk->code + start, code != NULL ? code : &pop, length);
+  for (size_t i = start; i < start + length; i++) {
+    chunk->lines[i] = line;
+  }
+
+  for (int i = 0; i < cases.count; i++) {
+    if (cases.exits[i] != -1) {
+      patch_jump(cases.exits[i] + (int)length);
+    }
+  }
+
+  if (code != NULL) {
+    FREE_ARRAY(uint8_t, code, length);
+  }
+  FREE_ARRAY(Value, cases.values, cases.value_capacity);
+  FREE_ARRAY(int, cases.value_cases, cases.value_capacity);
+  FREE_ARRAY(size_t, cases.starts, cases.capacity);
+  FREE_ARRAY(int, cases.exits, cases.capacity);
+}
+
 /*
  * parses while statements
  */
@@ -938,7 +2769,131 @@ static void while_statement() {
 }
 
 /*
- * parses for statements
+ * Operands of the OP_FOR_STEP closing a counting for loop.
+ */
+typedef struct {
+  int counter;
+  // FOR_* comparison and limit kind.
+  uint8_t mode;
+  // slot or constant index of the limit.
+  uint32_t limit;
+  uint32_t step;
+} CountingLoop;
+
+/*
+ * Value of a number literal or numeric constant token.
+ * @return false if the token is neither.
+ */
+static bool loop_number(Token *token, Value *value) {
+  if (token->type == TOKEN_NUMBER) {
+    *value = number_value(token);
+    return true;
+  }
+
+  NamedConstant *constant =
+      token->type == TOKEN_IDENTIFIER
+          ? resolve_constant(token, resolve_local(current_cs, token))
+          : NULL;
+  if (constant == NULL || !IS_NUMERIC(constant->value)) {
+    return false;
+  }
+  *value = constant->value;
+  return true;
+}
+
+/*
+ * Looks ahead at the condition and increment of a for loop for the shape
+ * `i < limit; i = i + step)`, where i is a local, limit a local or number,
+ * step a number and the comparison any of < <= > >=. Numbers are literals or
+ * numeric constants.
+ * @return false if the loop has any other shape, nothing is consumed.
+ */
+static bool counting_loop(CountingLoop *loop) {
+  Token tokens[10];
+  Scanner scanner_state = save_scanner();
+  tokens[0] = parser.current;
+  for (int i = 1; i < 10; i++) {
+    tokens[i] = scan_token();
+  }
+  restore_scanner(scanner_state);
+
+  TokenType comparison = tokens[1].type;
+  if (tokens[0].type != TOKEN_IDENTIFIER ||
+      (comparison != TOKEN_LESS && comparison != TOKEN_LESS_EQUAL &&
+       comparison != TOKEN_GREATER && comparison != TOKEN_GREATER_EQUAL) ||
+      (tokens[2].type != TOKEN_IDENTIFIER && tokens[2].type != TOKEN_NUMBER) ||
+      tokens[3].type != TOKEN_SEMICOLON ||
+      tokens[4].type != TOKEN_IDENTIFIER || tokens[5].type != TOKEN_EQUAL ||
+      tokens[6].type != TOKEN_IDENTIFIER ||
+      (tokens[7].type != TOKEN_PLUS && tokens[7].type != TOKEN_MINUS) ||
+      tokens[9].type != TOKEN_RIGHT_PAREN ||
+      !identifier_equal(&tokens[0], &tokens[4]) ||
+      !identifier_equal(&tokens[0], &tokens[6])) {
+    return false;
+  }
+
+  loop->counter = resolve_local(current_cs, &tokens[0]);
+  if (loop->counter == -1 || loop->counter > UINT8_MAX ||
+      resolve_constant(&tokens[0], loop->counter) != NULL) {
+    return false;
+  }
+
+  Value limit_value;
+  Value step;
+  bool constant_limit = loop_number(&tokens[2], &limit_value);
+  if (!loop_number(&tokens[8], &step)) {
+    return false;
+  }
+
+  loop->mode = comparison == TOKEN_LESS         ? FOR_LESS
+               : comparison == TOKEN_LESS_EQUAL ? FOR_LESS_EQUAL
+               : comparison == TOKEN_GREATER    ? FOR_GREATER
+                                                : FOR_GREATER_EQUAL;
+  if (!constant_limit) {
+    int limit = resolve_local(current_cs, &tokens[2]);
+    if (limit == -1 || limit > UINT8_MAX ||
+        resolve_constant(&tokens[2], limit) != NULL) {
+      return false;
+    }
+    loop->limit = (uint32_t)limit;
+  } else {
+    loop->mode |= FOR_LIMIT_CONSTANT;
+    loop->limit = make_constant(limit_value);
+  }
+
+  // `i = i - step` adds the negated step.
+  if (tokens[7].type == TOKEN_MINUS) {
+    step = negate_value(step);
+  }
+  loop->step = make_constant(step);
+  return loop->limit <= UINT8_MAX && loop->step <= UINT8_MAX;
+}
+
+/*
+ * Emits the OP_FOR_STEP jumping back to body_start, with the line of the
+ * increment it stands for.
+ */
+static void emit_for_step(CountingLoop *loop, int body_start, size_t line) {
+  // +7 for the instruction and its operands.
+  int offset = current_chunk()->count - body_start + 7;
+  if (offset > UINT16_MAX) {
+    // the function gets compiled again using wide jumps, which don't use
+    // OP_FOR_STEP.
+    current_cs->jump_overflow = true;
+  }
+
+  size_t body_line = parser.previous.line;
+  parser.previous.line = line;
+  emit_bytes(OP_FOR_STEP, (uint8_t)loop->counter);
+  emit_bytes(loop->mode, (uint8_t)loop->limit);
+  emit_bytes((uint8_t)loop->step, (offset >> 8) & 0xff);
+  emit_byte(offset & 0xff);
+  parser.previous.line = body_line;
+}
+
+/*
+ * parses for statements, counting loops check their condition once up front
+ * and then only run their body and OP_FOR_STEP each iteration.
  */
 static void for_statement() {
   begin_scope();
@@ -956,6 +2911,9 @@ static void for_statement() {
   int loop_start = current_chunk()->count;
   int exit_jump = -1;
 
+  CountingLoop counting;
+  bool counts = !current_cs->wide_jumps && counting_loop(&counting);
+
   if (!match(TOKEN_SEMICOLON)) {
     expression();
     consume(TOKEN_SEMICOLON, "Expected ';' after expression.");
@@ -964,6 +2922,29 @@ static void for_statement() {
     emit_byte(OP_POP);
   }
 
+  if (counts) {
+    // the increment was looked at already, it becomes the OP_FOR_STEP.
+    size_t increment_line = parser.current.line;
+    for (int i = 0; i < 5; i++) {
+      advance();
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expected ')' after for expression");
+
+    // OP_FOR_STEP assigns the counter after the body captured it.
+    assign_local(current_cs, counting.counter);
+    int body_start = current_chunk()->count;
+    statement();
+    emit_for_step(&counting, body_start, increment_line);
+    int end_jump = emit_jump(OP_JUMP);
+
+    patch_jump(exit_jump);
+    emit_byte(OP_POP);
+    patch_jump(end_jump);
+
+    end_scope();
+    return;
+  }
+
   if (!match(TOKEN_RIGHT_PAREN)) {
     int body_jump = emit_jump(OP_JUMP);
     int increment_start = current_chunk()->count;
@@ -1007,6 +2988,8 @@ static void statement() {
     while_statement();
   } else if (match(TOKEN_FOR)) {
     for_statement();
+  } else if (match(TOKEN_SWITCH)) {
+    switch_statement();
   } else {
     expression_statement();
   }
@@ -1017,10 +3000,18 @@ static void statement() {
  */
 
 static void declaration() {
-  if (match(TOKEN_FN)) {
-    fn_declaration();
+  if (match(TOKEN_CLASS)) {
+    class_declaration();
+  } else if (match(TOKEN_FN)) {
+    fn_declaration(false);
+  } else if (at_memo_fn()) {
+    advance();
+    advance();
+    fn_declaration(true);
   } else if (match(TOKEN_LET)) {
     let_declaration();
+  } else if (match(TOKEN_CONST)) {
+    const_declaration();
   } else {
     statement();
   }
@@ -1037,13 +3028,16 @@ static void declaration() {
 ParseRule rules[] = {
     [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {map, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACKET] = {array, subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
-    [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DOT] = {NULL, dot, PREC_CALL},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
     [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
     [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
     [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
     [TOKEN_BANG] = {unary, NULL, PREC_NONE},
@@ -1056,9 +3050,13 @@ ParseRule rules[] = {
     [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
     [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
     [TOKEN_STRING] = {string, NULL, PREC_NONE},
+    [TOKEN_INTERPOLATION] = {interpolation, NULL, PREC_NONE},
     [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
     [TOKEN_AND] = {NULL, and_, PREC_AND},
+    [TOKEN_CASE] = {NULL, NULL, PREC_NONE},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_CONST] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DEFAULT] = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
     [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
@@ -1068,8 +3066,9 @@ ParseRule rules[] = {
     [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
-    [TOKEN_THIS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SUPER] = {super_, NULL, PREC_NONE},
+    [TOKEN_SWITCH] = {NULL, NULL, PREC_NONE},
+    [TOKEN_THIS] = {this_, NULL, PREC_NONE},
     [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
     [TOKEN_LET] = {NULL, NULL, PREC_NONE},
     [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
@@ -1089,20 +3088,37 @@ static ParseRule *get_rule(TokenType type) { return &rules[type]; }
 ObjFunction *compile(const char *source) {
   log_info("compiling source=\n%s", source);
 
-  init_scanner(source);
+  ObjFunction *function = NULL;
+  bool wide_jumps = false;
+  while (function == NULL) {
+    init_scanner(source);
 
-  Compiler compiler;
-  init_compiler(&compiler, TYPE_SCRIPT);
+    Compiler compiler;
+    init_compiler(&compiler, TYPE_SCRIPT, wide_jumps);
+    init_table(&inline_functions);
+    init_table(&numeric_globals);
+    current_class = NULL;
 
-  parser.has_error = false;
-  parser.panic_mode = false;
+    parser.has_error = false;
+    parser.panic_mode = false;
+    parser.unpacking = false;
 
-  advance();
+    advance();
 
-  while (!match(TOKEN_EOF)) {
-    declaration();
+    while (!match(TOKEN_EOF)) {
+      declaration();
+    }
+
+    function = end_compiler();
+    wide_jumps = wide_jumps || compiler.jump_overflow;
+    free_table(&inline_functions);
+    free_table(&numeric_globals);
   }
 
-  ObjFunction *function = end_compiler();
+  FREE_ARRAY(const char *, boxed_locals, boxed_capacity);
+  boxed_locals = NULL;
+  boxed_count = 0;
+  boxed_capacity = 0;
+
   return parser.has_error ? NULL : function;
 }
@@ -1,5 +1,6 @@
 #include "debug.h"
 #include "chunk.h"
+#include "mathlib.h"
 #include "value.h"
 #include <stdint.h>
 
@@ -19,9 +20,21 @@ size_t disassemble_instruction(Chunk *chunk, size_t offset) {
 
   switch (instruction) {
   case OP_CALL:
-    return byte_instruction("OP_CALL", chunk, offset);
+    return call_instruction("OP_CALL", chunk, offset);
+  case OP_CALL_LONG:
+    return call_instruction("OP_CALL_LONG", chunk, offset);
+  case OP_CALL_0:
+    return short_instruction("OP_CALL_0", chunk, offset);
+  case OP_CALL_1:
+    return short_instruction("OP_CALL_1", chunk, offset);
+  case OP_CALL_2:
+    return short_instruction("OP_CALL_2", chunk, offset);
+  case OP_CALL_3:
+    return short_instruction("OP_CALL_3", chunk, offset);
   case OP_CONSTANT:
     return constant_instruction("OP_CONSTANT", chunk, offset);
+  case OP_CONSTANT_LONG:
+    return constant_long_instruction("OP_CONSTANT_LONG", chunk, offset);
   case OP_NULL:
     return simple_instruction("OP_NULL", offset);
   case OP_TRUE:
@@ -29,7 +42,7 @@ size_t disassemble_instruction(Chunk *chunk, size_t offset) {
   case OP_FALSE:
     return simple_instruction("OP_FALSE", offset);
   case OP_POP:
-    return simple_instruction("OP_FALSE", offset);
+    return simple_instruction("OP_POP", offset);
   case OP_EQUAL:
     return simple_instruction("OP_EQUAL", offset);
   case OP_LESS:
@@ -54,20 +67,110 @@ size_t disassemble_instruction(Chunk *chunk, size_t offset) {
     return simple_instruction("OP_RETURN", offset);
   case OP_SET_LOCAL:
     return byte_instruction("OP_SET_LOCAL", chunk, offset);
+  case OP_SET_LOCAL_LONG:
+    return short_instruction("OP_SET_LOCAL_LONG", chunk, offset);
   case OP_GET_LOCAL:
     return byte_instruction("OP_GET_LOCAL", chunk, offset);
+  case OP_GET_LOCAL_LONG:
+    return short_instruction("OP_GET_LOCAL_LONG", chunk, offset);
   case OP_SET_GLOBAL:
     return constant_instruction("OP_SET_GLOBAL", chunk, offset);
+  case OP_SET_GLOBAL_LONG:
+    return constant_long_instruction("OP_SET_GLOBAL_LONG", chunk, offset);
   case OP_DEFINE_GLOBAL:
     return constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+  case OP_DEFINE_GLOBAL_LONG:
+    return constant_long_instruction("OP_DEFINE_GLOBAL_LONG", chunk, offset);
   case OP_GET_GLOBAL:
     return constant_instruction("OP_GET_GLOBAL", chunk, offset);
+  case OP_GET_GLOBAL_LONG:
+    return constant_long_instruction("OP_GET_GLOBAL_LONG", chunk, offset);
   case OP_JUMP:
-    return jump_instruction("OP_JUMP", 1, chunk, offset);
+    return jump_instruction("OP_JUMP", chunk, offset);
+  case OP_JUMP_LONG:
+    return jump_instruction("OP_JUMP_LONG", chunk, offset);
   case OP_JUMP_IF_FALSE:
-    return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    return jump_instruction("OP_JUMP_IF_FALSE", chunk, offset);
+  case OP_JUMP_IF_FALSE_LONG:
+    return jump_instruction("OP_JUMP_IF_FALSE_LONG", chunk, offset);
   case OP_LOOP:
-    return jump_instruction("OP_LOOP", 1, chunk, offset);
+    return jump_instruction("OP_LOOP", chunk, offset);
+  case OP_LOOP_LONG:
+    return jump_instruction("OP_LOOP_LONG", chunk, offset);
+  case OP_PEEK:
+    return byte_instruction("OP_PEEK", chunk, offset);
+  case OP_INLINE_GUARD:
+    return inline_guard_instruction(chunk, offset);
+  case OP_INLINE_RETURN:
+    return byte_instruction("OP_INLINE_RETURN", chunk, offset);
+  case OP_FOR_STEP:
+    return for_step_instruction(chunk, offset);
+  case OP_CHECK_NUM:
+    return byte_instruction("OP_CHECK_NUM", chunk, offset);
+  case OP_ADD_NN:
+    return simple_instruction("OP_ADD_NN", offset);
+  case OP_SUBTRACT_NN:
+    return simple_instruction("OP_SUBTRACT_NN", offset);
+  case OP_MULTIPLY_NN:
+    return simple_instruction("OP_MULTIPLY_NN", offset);
+  case OP_DIVIDE_NN:
+    return simple_instruction("OP_DIVIDE_NN", offset);
+  case OP_LESS_NN:
+    return simple_instruction("OP_LESS_NN", offset);
+  case OP_GREATER_NN:
+    return simple_instruction("OP_GREATER_NN", offset);
+  case OP_CLOSURE:
+    return constant_long_instruction("OP_CLOSURE", chunk, offset);
+  case OP_GET_CAPTURE:
+    return byte_instruction("OP_GET_CAPTURE", chunk, offset);
+  case OP_GET_UPVALUE:
+    return byte_instruction("OP_GET_UPVALUE", chunk, offset);
+  case OP_SET_UPVALUE:
+    return byte_instruction("OP_SET_UPVALUE", chunk, offset);
+  case OP_CLOSE_UPVALUE:
+    return simple_instruction("OP_CLOSE_UPVALUE", offset);
+  case OP_ARRAY:
+    return short_instruction("OP_ARRAY", chunk, offset);
+  case OP_GET_INDEX:
+    return simple_instruction("OP_GET_INDEX", offset);
+  case OP_SET_INDEX:
+    return simple_instruction("OP_SET_INDEX", offset);
+  case OP_MAP:
+    return short_instruction("OP_MAP", chunk, offset);
+  case OP_CLASS:
+    return constant_long_instruction("OP_CLASS", chunk, offset);
+  case OP_INHERIT:
+    return simple_instruction("OP_INHERIT", offset);
+  case OP_CONCAT_N:
+    return concat_instruction(chunk, offset);
+  case OP_METHOD:
+    return constant_long_instruction("OP_METHOD", chunk, offset);
+  case OP_GET_PROPERTY:
+    return property_instruction("OP_GET_PROPERTY", chunk, offset);
+  case OP_SET_PROPERTY:
+    return property_instruction("OP_SET_PROPERTY", chunk, offset);
+  case OP_INVOKE:
+    return invoke_instruction("OP_INVOKE", chunk, offset);
+  case OP_GET_PROPERTY_LONG:
+    return property_instruction("OP_GET_PROPERTY_LONG", chunk, offset);
+  case OP_SET_PROPERTY_LONG:
+    return property_instruction("OP_SET_PROPERTY_LONG", chunk, offset);
+  case OP_INVOKE_LONG:
+    return invoke_instruction("OP_INVOKE_LONG", chunk, offset);
+  case OP_GET_SUPER:
+    return constant_long_instruction("OP_GET_SUPER", chunk, offset);
+  case OP_SUPER_INVOKE:
+    return invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
+  case OP_MATH:
+    return math_instruction(chunk, offset);
+  case OP_RETURN_N:
+    return byte_instruction("OP_RETURN_N", chunk, offset);
+  case OP_UNPACK:
+    return byte_instruction("OP_UNPACK", chunk, offset);
+  case OP_JUMP_TABLE:
+    return jump_table_instruction("OP_JUMP_TABLE", chunk, offset);
+  case OP_JUMP_MAP:
+    return jump_table_instruction("OP_JUMP_MAP", chunk, offset);
   default:
     printf("unknown instruction %hhu", instruction);
     return offset + 1;
@@ -97,16 +200,102 @@ size_t constant_instruction(const char *name, Chunk *chunk, size_t offset) {
   return offset + 2;
 }
 
+size_t constant_long_instruction(const char *name, Chunk *chunk,
+                                 size_t offset) {
+  uint32_t constant = read_operand(chunk, offset);
+  printf("%s      %u   ", name, constant);
+  print_value(chunk->constants.values[constant]);
+  printf("\n");
+  return offset + 4;
+}
+
 size_t byte_instruction(const char *name, Chunk *chunk, size_t offset) {
   uint8_t slot = chunk->code[offset + 1];
   printf("%-16s %4d\n", name, slot);
   return offset + 2;
 }
 
-size_t jump_instruction(const char *name, int sign, Chunk *chunk,
-                        size_t offset) {
-  uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
-  jump |= chunk->code[offset + 2];
-  printf("%-16s %4zu -> %zu\n", name, offset, offset + 3 + sign * jump);
+size_t short_instruction(const char *name, Chunk *chunk, size_t offset) {
+  printf("%-16s %4u\n", name, read_operand(chunk, offset));
+  return offset + 3;
+}
+
+size_t call_instruction(const char *name, Chunk *chunk, size_t offset) {
+  printf("%-16s %4d %4u\n", name, call_args_count(chunk, offset),
+         call_cache_index(chunk, offset));
+  return offset + instruction_length(chunk, offset);
+}
+
+size_t property_instruction(const char *name, Chunk *chunk, size_t offset) {
+  uint32_t constant = name_operand(chunk, offset);
+  printf("%-16s %4u %4u ", name, constant, property_cache_index(chunk, offset));
+  print_value(chunk->constants.values[constant]);
+  printf("\n");
+  return offset + instruction_length(chunk, offset);
+}
+
+size_t invoke_instruction(const char *name, Chunk *chunk, size_t offset) {
+  uint32_t constant = name_operand(chunk, offset);
+  uint8_t args_count = chunk->code[offset + 4];
+  printf("%-16s %4u %4d ", name, constant, args_count);
+  if (chunk->code[offset] != OP_SUPER_INVOKE) {
+    printf("%4u ", property_cache_index(chunk, offset));
+  }
+  print_value(chunk->constants.values[constant]);
+  printf("\n");
+  return offset + instruction_length(chunk, offset);
+}
+
+size_t concat_instruction(Chunk *chunk, size_t offset) {
+  printf("%-16s %4d %4d\n", "OP_CONCAT_N", chunk->code[offset + 1],
+         chunk->code[offset + 2]);
   return offset + 3;
 }
+
+size_t math_instruction(Chunk *chunk, size_t offset) {
+  uint8_t function = chunk->code[offset + 1];
+  printf("%-16s %4d %4u '%s'\n", "OP_MATH", function,
+         call_cache_index(chunk, offset),
+         function < MATH_COUNT ? math_intrinsics[function].name : "?");
+  return offset + 4;
+}
+
+size_t jump_instruction(const char *name, Chunk *chunk, size_t offset) {
+  printf("%-16s %4zu -> %ld\n", name, offset, jump_target(chunk, offset));
+  return offset + instruction_length(chunk, offset);
+}
+
+size_t inline_guard_instruction(Chunk *chunk, size_t offset) {
+  uint8_t args_count = chunk->code[offset + 1];
+  uint32_t constant = inline_guard_constant(chunk, offset);
+  printf("%-16s %4d %4u -> %ld ", "OP_INLINE_GUARD", args_count, constant,
+         jump_target(chunk, offset));
+  print_value(chunk->constants.values[constant]);
+  printf("\n");
+  return offset + 7;
+}
+
+size_t jump_table_instruction(const char *name, Chunk *chunk, size_t offset) {
+  uint32_t constant = name_operand(chunk, offset);
+  int count = jump_table_count(chunk, offset);
+  printf("%-16s %4u ", name, constant);
+  print_value(chunk->constants.values[constant]);
+  printf(" %zu ->", offset);
+  for (int i = 0; i <= count; i++) {
+    printf(" %zu", jump_table_target(chunk, offset, i));
+  }
+  printf("\n");
+  return offset + instruction_length(chunk, offset);
+}
+
+size_t for_step_instruction(Chunk *chunk, size_t offset) {
+  static const char *comparisons[] = {"<", "<=", ">", ">="};
+  uint8_t mode = chunk->code[offset + 2];
+  uint8_t limit = chunk->code[offset + 3];
+  printf("%-16s %4d %s %s%d += ", "OP_FOR_STEP", chunk->code[offset + 1],
+         comparisons[mode & FOR_COMPARISON],
+         mode & FOR_LIMIT_CONSTANT ? "#" : "", limit);
+  print_value(chunk->constants.values[chunk->code[offset + 4]]);
+  printf(" -> %ld\n", jump_target(chunk, offset));
+  return offset + 7;
+}
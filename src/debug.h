@@ -31,15 +31,69 @@ size_t simple_instruction(const char *name, size_t offset);
  */
 size_t constant_instruction(const char *name, Chunk *chunk, size_t offset);
 
+/**
+ * Debug outputs a constant instruction with a 24 bit constant index.
+ * @param chunk
+ * @param offset
+ */
+size_t constant_long_instruction(const char *name, Chunk *chunk,
+                                 size_t offset);
+
 /*
  * Uses to disassemble locals
  */
 size_t byte_instruction(const char *name, Chunk *chunk, size_t offset);
 
 /*
- * used to debug jump op codes.
+ * Uses to disassemble locals with a 16 bit slot.
+ */
+size_t short_instruction(const char *name, Chunk *chunk, size_t offset);
+
+/*
+ * used to debug property accesses, with their name and cache.
+ */
+size_t property_instruction(const char *name, Chunk *chunk, size_t offset);
+
+/*
+ * used to debug method calls, with their name and argument count.
+ */
+size_t invoke_instruction(const char *name, Chunk *chunk, size_t offset);
+
+/*
+ * used to debug string concatenation, with its count and mode.
+ */
+size_t concat_instruction(Chunk *chunk, size_t offset);
+
+/*
+ * used to debug math intrinsics, with their call cache and the name of the
+ * function.
+ */
+size_t math_instruction(Chunk *chunk, size_t offset);
+
+/*
+ * used to debug jump op codes, with the offset they jump to.
+ */
+size_t jump_instruction(const char *name, Chunk *chunk, size_t offset);
+
+/*
+ * used to debug switch instructions, the last target is for values matching
+ * no case.
+ */
+size_t jump_table_instruction(const char *name, Chunk *chunk, size_t offset);
+
+/*
+ * used to debug calls with more than 3 arguments or a 24 bit cache index.
+ */
+size_t call_instruction(const char *name, Chunk *chunk, size_t offset);
+
+/*
+ * used to debug the guard of an inlined call.
+ */
+size_t inline_guard_instruction(Chunk *chunk, size_t offset);
+
+/*
+ * used to debug the step of a counting for loop.
  */
-size_t jump_instruction(const char *name, int sign, Chunk *chunk,
-                        size_t offset);
+size_t for_step_instruction(Chunk *chunk, size_t offset);
 
 #endif // !ZSPIE_DEBUG_H_
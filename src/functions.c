@@ -0,0 +1,85 @@
+#include "functions.h"
+#include "memory.h"
+#include "value.h"
+
+void init_function_list(FunctionList *list) {
+  list->count = 0;
+  list->capacity = 0;
+  list->functions = NULL;
+  list->references = NULL;
+  list->index = NULL;
+}
+
+void free_function_list(FunctionList *list) {
+  FREE_ARRAY(ObjFunction *, list->functions, list->capacity);
+  FREE_ARRAY(size_t, list->references, list->capacity);
+  FREE_ARRAY(long, list->index, list->capacity * 2);
+  init_function_list(list);
+}
+
+/*
+ * Slot of function in the index, or the empty slot to add it in. The index
+ * is at most half full so there always is one.
+ */
+static long *find_slot(FunctionList *list, ObjFunction *function) {
+  size_t mask = list->capacity * 2 - 1;
+  uint64_t bits = (uint64_t)(uintptr_t)function;
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  for (size_t i = (size_t)bits & mask;; i = (i + 1) & mask) {
+    long *slot = &list->index[i];
+    if (*slot == -1 || list->functions[*slot] == function) {
+      return slot;
+    }
+  }
+}
+
+long find_function(FunctionList *list, ObjFunction *function) {
+  if (list->capacity == 0) {
+    return -1;
+  }
+  return *find_slot(list, function);
+}
+
+void add_function(FunctionList *list, ObjFunction *function) {
+  long index = find_function(list, function);
+  if (index != -1) {
+    list->references[index]++;
+    return;
+  }
+
+  if (list->capacity < list->count + 1) {
+    size_t old_capacity = list->capacity;
+    list->capacity = GROW_CAPACITY(old_capacity);
+    list->functions = GROW_ARRAY(ObjFunction *, list->functions, old_capacity,
+                                 list->capacity);
+    list->references =
+        GROW_ARRAY(size_t, list->references, old_capacity, list->capacity);
+
+    FREE_ARRAY(long, list->index, old_capacity * 2);
+    list->index = ALLOCATE(long, list->capacity * 2);
+    for (size_t i = 0; i < list->capacity * 2; i++) {
+      list->index[i] = -1;
+    }
+    for (size_t i = 0; i < list->count; i++) {
+      *find_slot(list, list->functions[i]) = (long)i;
+    }
+  }
+
+  *find_slot(list, function) = (long)list->count;
+  list->functions[list->count] = function;
+  list->references[list->count] = 1;
+  list->count++;
+}
+
+void collect_functions(FunctionList *list, ObjFunction *function) {
+  add_function(list, function);
+  for (size_t i = 0; i < function->chunk.constants.count; i++) {
+    Value constant = function->chunk.constants.values[i];
+    if (IS_FUNCTION(constant) &&
+        find_function(list, AS_FUNCTION(constant)) == -1) {
+      collect_functions(list, AS_FUNCTION(constant));
+    }
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef ZSPIE_FUNCTIONS_H_
+#define ZSPIE_FUNCTIONS_H_
+
+#include "common.h"
+#include "object.h"
+
+/*
+ * Growable list of functions, for the passes working on every function of a
+ * compiled script.
+ */
+typedef struct {
+  size_t count;
+  size_t capacity;
+  ObjFunction **functions;
+  // number of times each function was added.
+  size_t *references;
+  // open addressed table of twice the capacity, holding the positions of
+  // the functions by their address, -1 in empty slots.
+  long *index;
+} FunctionList;
+
+void init_function_list(FunctionList *list);
+void free_function_list(FunctionList *list);
+
+/*
+ * Index of function in the list, -1 if it isn't there. Takes constant time.
+ */
+long find_function(FunctionList *list, ObjFunction *function);
+
+/*
+ * Appends a function, or bumps its reference count if it's already listed.
+ */
+void add_function(FunctionList *list, ObjFunction *function);
+
+/*
+ * Collects every function reachable through the constants of function.
+ */
+void collect_functions(FunctionList *list, ObjFunction *function);
+
+#endif // !ZSPIE_FUNCTIONS_H_
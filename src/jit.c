@@ -0,0 +1,1265 @@
+#include "jit.h"
+#include "array.h"
+#include "chunk.h"
+#include "class.h"
+#include "external/log.h"
+#include "map.h"
+#include "mathlib.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "verifier.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ZSPIE_JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Registers, numbered as in their machine encoding.
+ */
+typedef enum {
+  RAX = 0,
+  RCX = 1,
+  RDX = 2,
+  RBX = 3,
+  RSP = 4,
+  RSI = 6,
+  RDI = 7,
+  R8 = 8,
+  R9 = 9,
+  R12 = 12,
+  R13 = 13,
+} Register;
+
+// register holding the frame's slots for the whole function.
+#define SLOTS RBX
+// register holding the frame.
+#define FRAME R12
+
+// address of a C function or object, as an immediate.
+#define ADDRESS(pointer) ((uint64_t)(uintptr_t)(pointer))
+
+// byte offsets inside a slot.
+#define TYPE_OFFSET ((int32_t)offsetof(Value, type))
+#define PAYLOAD_OFFSET ((int32_t)offsetof(Value, as))
+
+/*
+ * A rel32 operand to patch once its target is known.
+ */
+typedef struct {
+  // position of the rel32 in the code.
+  size_t at;
+  // bytecode offset it jumps to.
+  size_t target;
+} Fixup;
+
+/*
+ * Machine code being generated for one function.
+ */
+typedef struct {
+  uint8_t *code;
+  size_t count;
+  size_t capacity;
+
+  // position of the code for each bytecode offset.
+  size_t *labels;
+  // position of the exit stub for each bytecode offset, 0 if it has none.
+  size_t *exit_stubs;
+  // jumps to bytecode offsets.
+  Fixup *jumps;
+  size_t jump_count;
+  size_t jump_capacity;
+  // jumps to exit stubs, `target` is the exiting instruction.
+  Fixup *exits;
+  size_t exit_count;
+  size_t exit_capacity;
+  // jumps to the epilogue, `target` is unused.
+  Fixup *returns;
+  size_t return_count;
+  size_t return_capacity;
+} Assembler;
+
+static void emit_byte(Assembler *as, uint8_t byte) {
+  if (as->capacity < as->count + 1) {
+    size_t old_capacity = as->capacity;
+    as->capacity = GROW_CAPACITY(old_capacity);
+    as->code = GROW_ARRAY(uint8_t, as->code, old_capacity, as->capacity);
+  }
+  as->code[as->count++] = byte;
+}
+
+static void emit_u32(Assembler *as, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    emit_byte(as, (uint8_t)(value >> (8 * i)));
+  }
+}
+
+static void emit_u64(Assembler *as, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    emit_byte(as, (uint8_t)(value >> (8 * i)));
+  }
+}
+
+static void patch_u32(Assembler *as, size_t at, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    as->code[at + i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+/*
+ * Records a rel32 which is emitted right after.
+ */
+static void add_fixup(Fixup **fixups, size_t *count, size_t *capacity,
+                      size_t at, size_t target) {
+  if (*capacity < *count + 1) {
+    size_t old_capacity = *capacity;
+    *capacity = GROW_CAPACITY(old_capacity);
+    *fixups = GROW_ARRAY(Fixup, *fixups, old_capacity, *capacity);
+  }
+  (*fixups)[*count].at = at;
+  (*fixups)[*count].target = target;
+  (*count)++;
+}
+
+static void emit_rex(Assembler *as, bool wide, int reg, int base) {
+  uint8_t rex = (uint8_t)(0x40 | (wide ? 0x08 : 0) | ((reg >> 3) & 1) << 2 |
+                          ((base >> 3) & 1));
+  if (rex != 0x40) {
+    emit_byte(as, rex);
+  }
+}
+
+/*
+ * ModRM for [base + disp32].
+ */
+static void emit_memory(Assembler *as, int reg, int base, int32_t disp) {
+  emit_byte(as, (uint8_t)(0x80 | (reg & 7) << 3 | (base & 7)));
+  if ((base & 7) == RSP) {
+    emit_byte(as, 0x24);
+  }
+  emit_u32(as, (uint32_t)disp);
+}
+
+/*
+ * `op reg, [base + disp]` for one byte opcodes.
+ */
+static void emit_op_memory(Assembler *as, bool wide, uint8_t op, int reg,
+                           int base, int32_t disp) {
+  emit_rex(as, wide, reg, base);
+  emit_byte(as, op);
+  emit_memory(as, reg, base, disp);
+}
+
+/*
+ * `op xmm, [base + disp]` for sse instructions.
+ */
+static void emit_sse_memory(Assembler *as, uint8_t prefix, uint8_t op,
+                            int xmm, int base, int32_t disp) {
+  emit_byte(as, prefix);
+  emit_rex(as, false, xmm, base);
+  emit_byte(as, 0x0F);
+  emit_byte(as, op);
+  emit_memory(as, xmm, base, disp);
+}
+
+static void emit_mov_imm64(Assembler *as, int reg, uint64_t value) {
+  emit_rex(as, true, 0, reg);
+  emit_byte(as, (uint8_t)(0xB8 + (reg & 7)));
+  emit_u64(as, value);
+}
+
+static void emit_mov_imm32(Assembler *as, int reg, uint32_t value) {
+  emit_byte(as, (uint8_t)(0xB8 + reg));
+  emit_u32(as, value);
+}
+
+/*
+ * Calls a C function, the stack is kept 16 byte aligned by the prologue.
+ */
+static void emit_call(Assembler *as, uint64_t function) {
+  emit_mov_imm64(as, RAX, function);
+  // call rax
+  emit_byte(as, 0xFF);
+  emit_byte(as, 0xD0);
+}
+
+// lea reg, [slots + slot]
+static void emit_slot_address(Assembler *as, int reg, int slot) {
+  emit_op_memory(as, true, 0x8D, reg, SLOTS, slot * (int32_t)sizeof(Value));
+}
+
+// cmp dword [slots + slot].type, type
+static void emit_compare_type(Assembler *as, int slot, ValueType type) {
+  emit_op_memory(as, false, 0x83, 7, SLOTS,
+                 slot * (int32_t)sizeof(Value) + TYPE_OFFSET);
+  emit_byte(as, (uint8_t)type);
+}
+
+// test al, al
+static void emit_test_result(Assembler *as) {
+  emit_byte(as, 0x84);
+  emit_byte(as, 0xC0);
+}
+
+/*
+ * Copies a whole slot through xmm0.
+ */
+static void emit_copy_slot(Assembler *as, int to, int from) {
+  emit_sse_memory(as, 0xF3, 0x6F, 0, SLOTS, from * (int32_t)sizeof(Value));
+  emit_sse_memory(as, 0xF3, 0x7F, 0, SLOTS, to * (int32_t)sizeof(Value));
+}
+
+/*
+ * Stores a value known at compile time into a slot.
+ */
+static void emit_store_value(Assembler *as, int slot, Value value) {
+  uint64_t words[2];
+  memcpy(words, &value, sizeof(words));
+  for (int i = 0; i < 2; i++) {
+    emit_mov_imm64(as, RAX, words[i]);
+    emit_op_memory(as, true, 0x89, RAX, SLOTS,
+                   slot * (int32_t)sizeof(Value) + i * 8);
+  }
+}
+
+/*
+ * Stores al as a boolean into a slot.
+ */
+static void emit_store_bool(Assembler *as, int slot) {
+  // movzx eax, al
+  emit_byte(as, 0x0F);
+  emit_byte(as, 0xB6);
+  emit_byte(as, 0xC0);
+  int32_t disp = slot * (int32_t)sizeof(Value);
+  emit_op_memory(as, false, 0xC7, 0, SLOTS, disp + TYPE_OFFSET);
+  emit_u32(as, VAL_BOOL);
+  emit_op_memory(as, true, 0x89, RAX, SLOTS, disp + PAYLOAD_OFFSET);
+}
+
+/*
+ * Jump with a rel32 to the code of a bytecode offset.
+ * @param condition - second opcode byte of a jcc, 0 for jmp.
+ */
+static void emit_jump_to(Assembler *as, uint8_t condition, size_t target) {
+  if (condition == 0) {
+    emit_byte(as, 0xE9);
+  } else {
+    emit_byte(as, 0x0F);
+    emit_byte(as, condition);
+  }
+  add_fixup(&as->jumps, &as->jump_count, &as->jump_capacity, as->count,
+            target);
+  emit_u32(as, 0);
+}
+
+/*
+ * Leaves the frame to the interpreter at the instruction at offset.
+ */
+static void emit_exit(Assembler *as, uint8_t condition, size_t offset) {
+  if (condition == 0) {
+    emit_byte(as, 0xE9);
+  } else {
+    emit_byte(as, 0x0F);
+    emit_byte(as, condition);
+  }
+  add_fixup(&as->exits, &as->exit_count, &as->exit_capacity, as->count,
+            offset);
+  emit_u32(as, 0);
+}
+
+/*
+ * Returns from the machine code with the result in eax.
+ */
+static void emit_return(Assembler *as, JitResult result) {
+  emit_mov_imm32(as, RAX, result);
+  emit_byte(as, 0xE9);
+  add_fixup(&as->returns, &as->return_count, &as->return_capacity, as->count,
+            0);
+  emit_u32(as, 0);
+}
+
+/*
+ * Local forward jump, patched with `bind_local`.
+ */
+static size_t emit_local_jump(Assembler *as, uint8_t condition) {
+  if (condition == 0) {
+    emit_byte(as, 0xE9);
+  } else {
+    emit_byte(as, 0x0F);
+    emit_byte(as, condition);
+  }
+  emit_u32(as, 0);
+  return as->count - 4;
+}
+
+static void bind_local(Assembler *as, size_t at) {
+  patch_u32(as, at, (uint32_t)(as->count - (at + 4)));
+}
+
+// condition codes, second byte of the jcc rel32 encodings.
+#define JO 0x80
+#define JE 0x84
+#define JNE 0x85
+#define JL 0x8C
+#define JGE 0x8D
+#define JLE 0x8E
+#define JG 0x8F
+
+/*
+ * Runtime helpers called from machine code. They take pointers into the
+ * frame's slots so values never go through registers.
+ */
+
+static bool jit_get_global(Value *slot, ObjString *name) {
+  return table_get(&vm.globals, name, slot);
+}
+
+static bool jit_set_global(Value *slot, ObjString *name) {
+  Value old;
+  if (!table_get(&vm.globals, name, &old)) {
+    return false;
+  }
+  table_set(&vm.globals, name, *slot);
+  return true;
+}
+
+static void jit_define_global(Value *slot, ObjString *name) {
+  table_set(&vm.globals, name, *slot);
+}
+
+static void jit_equal(Value *slot) {
+  slot[0] = BOOL_VAL(values_equal(slot[0], slot[1]));
+}
+
+static bool jit_falsey(Value *slot) { return is_falsey(*slot); }
+
+static void jit_not(Value *slot) { *slot = BOOL_VAL(is_falsey(*slot)); }
+
+// `+` on anything but two numbers.
+static bool jit_add(Value *slot) {
+  if (!IS_TEXT(slot[0]) || !IS_TEXT(slot[1])) {
+    return false;
+  }
+  vm.stack_top = slot + 2;
+  concatenate();
+  return true;
+}
+
+static void jit_print(Value *slot) {
+  print_value(*slot);
+  printf("\n");
+}
+
+static bool jit_call(Value *slot, int args_count, CallFrame *frame,
+                     uint8_t *ip, CallCache *cache) {
+  // the frame's ip is where runtime errors in the callee trace back to.
+  frame->ip = ip;
+  vm.stack_top = slot + args_count + 1;
+  return call_and_run(cache, *slot, args_count);
+}
+
+static void jit_return(Value *slot) { return_from_call(*slot); }
+
+static void jit_return_values(Value *slot, int count) {
+  return_values(slot, count);
+}
+
+static void jit_unpack(Value *slot, int count) { unpack_values(slot, count); }
+
+static uint64_t jit_jump_table(Value *slot, Chunk *chunk, size_t offset) {
+  return (uint64_t)jump_table_index(chunk, offset, *slot);
+}
+
+static bool jit_get_property(Value *slot, PropertyCache *cache,
+                             ObjString *name) {
+  return get_property(cache, *slot, name, slot) == NULL;
+}
+
+static bool jit_set_property(Value *slot, PropertyCache *cache,
+                             ObjString *name) {
+  if (set_property(cache, slot[0], name, slot[1]) != NULL) {
+    return false;
+  }
+  slot[0] = slot[1];
+  return true;
+}
+
+static bool jit_invoke(Value *slot, int args_count, CallFrame *frame,
+                       uint8_t *ip, PropertyCache *cache, ObjString *name) {
+  frame->ip = ip;
+  vm.stack_top = slot + args_count + 1;
+  return invoke_and_run(cache, name, args_count);
+}
+
+static void jit_closure(Value *slot, ObjFunction *function, Value *slots) {
+  *slot = OBJ_VAL(make_closure(function, slots));
+}
+
+static void jit_close_upvalue(Value *slot) { close_upvalues(slot); }
+
+static void jit_array(Value *slot, int count) {
+  *slot = OBJ_VAL(array_of(slot, count));
+}
+
+// errors of these are reported by the interpreter.
+static bool jit_map(Value *slot, int count) {
+  return map_of(slot, count, slot) == NULL;
+}
+
+// count in the low byte of operands, the mode in the next one.
+static bool jit_concat(Value *slot, uint64_t operands) {
+  return concatenate_n(slot, (int)(operands & 0xff), (uint8_t)(operands >> 8),
+                       slot) == NULL;
+}
+
+// OP_MATH on the callee in slot and its arguments, false if the callee
+// isn't the native and has to be called.
+static bool jit_math(Value *slot, MathFunction function) {
+  if (!is_math_native(*slot, function)) {
+    return false;
+  }
+  *slot = math_call(function, slot + 1);
+  return true;
+}
+
+static bool jit_get_index(Value *slot) {
+  return get_index(slot[0], slot[1], &slot[0]) == NULL;
+}
+
+static bool jit_set_index(Value *slot) {
+  if (set_index(slot[0], slot[1], slot[2]) != NULL) {
+    return false;
+  }
+  slot[0] = slot[2];
+  return true;
+}
+
+// OP_FOR_STEP on anything but integers: 1 if the loop goes on, 2 if the
+// interpreter has to report an error.
+static uint8_t jit_for_step(Value *counter, Value *limit, Value *step,
+                            uint8_t mode) {
+  if (!IS_NUMERIC(*counter) || !IS_NUMERIC(*limit)) {
+    return 2;
+  }
+  return for_step(counter, *step, *limit, mode);
+}
+
+/*
+ * Calls helper(&slots[slot], arg) with a constant second argument.
+ */
+static void emit_helper(Assembler *as, uint64_t helper, int slot,
+                        uint64_t arg) {
+  emit_slot_address(as, RDI, slot);
+  emit_mov_imm64(as, RSI, arg);
+  emit_call(as, helper);
+}
+
+// second byte of `imul r64, r/m64`, after 0x0F.
+#define IMUL 0xAF
+
+/*
+ * Loads the address of the value behind a capture of the running closure
+ * into rax, the capture's cell for `cell` ones.
+ */
+static void emit_capture_address(Assembler *as, uint8_t index, bool cell) {
+  int32_t capture = (int32_t)(offsetof(ObjClosure, captures) +
+                              index * sizeof(Value));
+  // mov rax, [slots + payload], the closure in slot 0.
+  emit_op_memory(as, true, 0x8B, RAX, SLOTS, PAYLOAD_OFFSET);
+  if (!cell) {
+    emit_op_memory(as, true, 0x8D, RAX, RAX, capture);
+    return;
+  }
+  emit_op_memory(as, true, 0x8B, RAX, RAX, capture + PAYLOAD_OFFSET);
+  emit_op_memory(as, true, 0x8B, RAX, RAX,
+                 (int32_t)offsetof(ObjUpvalue, location));
+}
+
+/*
+ * Loads a numeric slot into an xmm register as a double, converting
+ * integers.
+ * @return local jump taken if the slot isn't numeric.
+ */
+static size_t emit_load_float(Assembler *as, int xmm, int slot) {
+  int32_t disp = slot * (int32_t)sizeof(Value) + PAYLOAD_OFFSET;
+  emit_compare_type(as, slot, VAL_NUMBER);
+  size_t integer = emit_local_jump(as, JNE);
+  emit_sse_memory(as, 0xF2, 0x10, xmm, SLOTS, disp);
+  size_t done = emit_local_jump(as, 0);
+
+  bind_local(as, integer);
+  emit_compare_type(as, slot, VAL_INT);
+  size_t other = emit_local_jump(as, JNE);
+  // cvtsi2sd xmm, qword [slot]
+  emit_byte(as, 0xF2);
+  emit_rex(as, true, xmm, SLOTS);
+  emit_byte(as, 0x0F);
+  emit_byte(as, 0x2A);
+  emit_memory(as, xmm, SLOTS, disp);
+  bind_local(as, done);
+  return other;
+}
+
+/*
+ * Two integers go through `op rax, b`, falling back to doubles when it
+ * overflows, any other numbers are computed as doubles. Anything else
+ * leaves the frame, or for `+` tries concatenating strings.
+ * @param int_op - opcode of `op r64, r/m64`, 0 to always use doubles.
+ */
+static void emit_arithmetic(Assembler *as, uint8_t sse_op, uint8_t int_op,
+                            int h, size_t offset) {
+  int a = h - 2, b = h - 1;
+  int32_t disp_a = a * (int32_t)sizeof(Value) + PAYLOAD_OFFSET;
+  int32_t disp_b = b * (int32_t)sizeof(Value) + PAYLOAD_OFFSET;
+
+  size_t int_done = 0;
+  if (int_op != 0) {
+    emit_compare_type(as, a, VAL_INT);
+    size_t float_a = emit_local_jump(as, JNE);
+    emit_compare_type(as, b, VAL_INT);
+    size_t float_b = emit_local_jump(as, JNE);
+    // mov rax, a; op rax, b; jo floats; mov a, rax
+    emit_op_memory(as, true, 0x8B, RAX, SLOTS, disp_a);
+    emit_rex(as, true, RAX, SLOTS);
+    if (int_op == IMUL) {
+      emit_byte(as, 0x0F);
+    }
+    emit_byte(as, int_op);
+    emit_memory(as, RAX, SLOTS, disp_b);
+    size_t overflow = emit_local_jump(as, JO);
+    emit_op_memory(as, true, 0x89, RAX, SLOTS, disp_a);
+    int_done = emit_local_jump(as, 0);
+
+    bind_local(as, float_a);
+    bind_local(as, float_b);
+    bind_local(as, overflow);
+  }
+
+  size_t other_a = emit_load_float(as, 0, a);
+  size_t other_b = emit_load_float(as, 1, b);
+  // op xmm0, xmm1; movsd a, xmm0
+  emit_byte(as, 0xF2);
+  emit_byte(as, 0x0F);
+  emit_byte(as, sse_op);
+  emit_byte(as, 0xC1);
+  emit_sse_memory(as, 0xF2, 0x11, 0, SLOTS, disp_a);
+  emit_op_memory(as, false, 0xC7, 0, SLOTS,
+                 a * (int32_t)sizeof(Value) + TYPE_OFFSET);
+  emit_u32(as, VAL_NUMBER);
+  size_t done = emit_local_jump(as, 0);
+
+  bind_local(as, other_a);
+  bind_local(as, other_b);
+  if (sse_op == 0x58) {
+    // strings, anything else is an error reported by the interpreter.
+    emit_helper(as, ADDRESS(jit_add), a, 0);
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+  } else {
+    emit_exit(as, 0, offset);
+  }
+
+  bind_local(as, done);
+  if (int_op != 0) {
+    bind_local(as, int_done);
+  }
+}
+
+/*
+ * Integers are compared with cmp, other numbers as doubles with `a > b`,
+ * `a < b` compiled as `b > a`.
+ */
+static void emit_comparison(Assembler *as, bool less, int h, size_t offset) {
+  int a = h - 2, b = h - 1;
+  emit_compare_type(as, a, VAL_INT);
+  size_t float_a = emit_local_jump(as, JNE);
+  emit_compare_type(as, b, VAL_INT);
+  size_t float_b = emit_local_jump(as, JNE);
+  // mov rax, a; cmp rax, b; setl al or setg al
+  emit_op_memory(as, true, 0x8B, RAX, SLOTS,
+                 a * (int32_t)sizeof(Value) + PAYLOAD_OFFSET);
+  emit_op_memory(as, true, 0x3B, RAX, SLOTS,
+                 b * (int32_t)sizeof(Value) + PAYLOAD_OFFSET);
+  emit_byte(as, 0x0F);
+  emit_byte(as, less ? 0x9C : 0x9F);
+  emit_byte(as, 0xC0);
+  size_t store = emit_local_jump(as, 0);
+
+  bind_local(as, float_a);
+  bind_local(as, float_b);
+  int left = less ? b : a, right = less ? a : b;
+  size_t other_left = emit_load_float(as, 0, left);
+  size_t other_right = emit_load_float(as, 1, right);
+  // ucomisd xmm0, xmm1; seta al
+  emit_byte(as, 0x66);
+  emit_byte(as, 0x0F);
+  emit_byte(as, 0x2E);
+  emit_byte(as, 0xC1);
+  emit_byte(as, 0x0F);
+  emit_byte(as, 0x97);
+  emit_byte(as, 0xC0);
+
+  bind_local(as, store);
+  emit_store_bool(as, a);
+  size_t done = emit_local_jump(as, 0);
+
+  bind_local(as, other_left);
+  bind_local(as, other_right);
+  emit_exit(as, 0, offset);
+  bind_local(as, done);
+}
+
+/*
+ * Integer counters, steps and limits are stepped and compared inline, with
+ * a conditional jump straight back to the loop body. Anything else goes
+ * through jit_for_step.
+ */
+static void emit_for_step(Assembler *as, Chunk *chunk, size_t offset) {
+  int counter = chunk->code[offset + 1];
+  uint8_t mode = chunk->code[offset + 2];
+  uint8_t limit = chunk->code[offset + 3];
+  Value *step = &chunk->constants.values[chunk->code[offset + 4]];
+  size_t target = (size_t)jump_target(chunk, offset);
+  bool constant_limit = mode & FOR_LIMIT_CONSTANT;
+  Value *limit_constant =
+      constant_limit ? &chunk->constants.values[limit] : NULL;
+  int32_t counter_disp = counter * (int32_t)sizeof(Value) + PAYLOAD_OFFSET;
+
+  size_t done = 0;
+  bool integers = IS_INT(*step) && (!constant_limit || IS_INT(*limit_constant));
+  size_t slow[3];
+  int slow_count = 0;
+  if (integers) {
+    emit_compare_type(as, counter, VAL_INT);
+    slow[slow_count++] = emit_local_jump(as, JNE);
+    if (!constant_limit) {
+      emit_compare_type(as, limit, VAL_INT);
+      slow[slow_count++] = emit_local_jump(as, JNE);
+    }
+    // mov rax, counter; mov rcx, step; add rax, rcx; jo slow; mov counter, rax
+    emit_op_memory(as, true, 0x8B, RAX, SLOTS, counter_disp);
+    emit_mov_imm64(as, RCX, (uint64_t)AS_INT(*step));
+    emit_byte(as, 0x48);
+    emit_byte(as, 0x01);
+    emit_byte(as, 0xC8);
+    slow[slow_count++] = emit_local_jump(as, JO);
+    emit_op_memory(as, true, 0x89, RAX, SLOTS, counter_disp);
+
+    if (constant_limit) {
+      // mov rcx, limit; cmp rax, rcx
+      emit_mov_imm64(as, RCX, (uint64_t)AS_INT(*limit_constant));
+      emit_byte(as, 0x48);
+      emit_byte(as, 0x39);
+      emit_byte(as, 0xC8);
+    } else {
+      emit_op_memory(as, true, 0x3B, RAX, SLOTS,
+                     limit * (int32_t)sizeof(Value) + PAYLOAD_OFFSET);
+    }
+    static const uint8_t conditions[] = {JL, JLE, JG, JGE};
+    emit_jump_to(as, conditions[mode & FOR_COMPARISON], target);
+    done = emit_local_jump(as, 0);
+  }
+
+  for (int i = 0; i < slow_count; i++) {
+    bind_local(as, slow[i]);
+  }
+  emit_slot_address(as, RDI, counter);
+  if (constant_limit) {
+    emit_mov_imm64(as, RSI, ADDRESS(limit_constant));
+  } else {
+    emit_slot_address(as, RSI, limit);
+  }
+  emit_mov_imm64(as, RDX, ADDRESS(step));
+  emit_mov_imm32(as, RCX, mode);
+  emit_call(as, ADDRESS(jit_for_step));
+  emit_test_result(as);
+  size_t finished = emit_local_jump(as, JE);
+  // cmp al, 1
+  emit_byte(as, 0x3C);
+  emit_byte(as, 1);
+  emit_jump_to(as, JE, target);
+  emit_exit(as, 0, offset);
+
+  bind_local(as, finished);
+  if (integers) {
+    bind_local(as, done);
+  }
+}
+
+/*
+ * Calls the callee below the args_count arguments on top through the call
+ * cache of the instruction at offset, the result replaces the callee.
+ */
+static void emit_cached_call(Assembler *as, ObjFunction *function,
+                             size_t offset, size_t next, int h,
+                             int args_count) {
+  Chunk *chunk = &function->chunk;
+  emit_slot_address(as, RDI, h - args_count - 1);
+  emit_mov_imm32(as, RSI, (uint32_t)args_count);
+  // mov rdx, r12
+  emit_byte(as, 0x4C);
+  emit_byte(as, 0x89);
+  emit_byte(as, 0xE2);
+  emit_mov_imm64(as, RCX, ADDRESS(chunk->code + next));
+  emit_mov_imm64(as, R8,
+                 ADDRESS(&function->call_caches[call_cache_index(chunk,
+                                                                 offset)]));
+  emit_call(as, ADDRESS(jit_call));
+  emit_test_result(as);
+  size_t ok = emit_local_jump(as, JNE);
+  emit_return(as, JIT_ERROR);
+  bind_local(as, ok);
+}
+
+/*
+ * Emits the template of one instruction.
+ * @param h - stack height before the instruction.
+ */
+static void emit_instruction(Assembler *as, ObjFunction *function,
+                             size_t offset, int h) {
+  Chunk *chunk = &function->chunk;
+  uint8_t op = chunk->code[offset];
+  size_t next = offset + instruction_length(chunk, offset);
+
+  switch (op) {
+  case OP_CONSTANT:
+  case OP_CONSTANT_LONG:
+    emit_store_value(as, h, chunk->constants.values[read_operand(chunk, offset)]);
+    break;
+
+  case OP_NULL:
+    emit_store_value(as, h, NULL_VAL);
+    break;
+
+  case OP_TRUE:
+    emit_store_value(as, h, BOOL_VAL(true));
+    break;
+
+  case OP_FALSE:
+    emit_store_value(as, h, BOOL_VAL(false));
+    break;
+
+  case OP_POP:
+    break;
+
+  case OP_GET_LOCAL:
+  case OP_GET_LOCAL_LONG:
+    emit_copy_slot(as, h, (int)read_operand(chunk, offset));
+    break;
+
+  case OP_SET_LOCAL:
+  case OP_SET_LOCAL_LONG:
+    emit_copy_slot(as, (int)read_operand(chunk, offset), h - 1);
+    break;
+
+  case OP_GET_GLOBAL:
+  case OP_GET_GLOBAL_LONG: {
+    // undefined globals are reported by the interpreter.
+    Value name = chunk->constants.values[read_operand(chunk, offset)];
+    emit_helper(as, ADDRESS(jit_get_global), h, ADDRESS(AS_OBJ(name)));
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+  }
+
+  case OP_SET_GLOBAL:
+  case OP_SET_GLOBAL_LONG: {
+    Value name = chunk->constants.values[read_operand(chunk, offset)];
+    emit_helper(as, ADDRESS(jit_set_global), h - 1,
+                ADDRESS(AS_OBJ(name)));
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+  }
+
+  case OP_DEFINE_GLOBAL:
+  case OP_DEFINE_GLOBAL_LONG: {
+    Value name = chunk->constants.values[read_operand(chunk, offset)];
+    emit_helper(as, ADDRESS(jit_define_global), h - 1,
+                ADDRESS(AS_OBJ(name)));
+    break;
+  }
+
+  case OP_EQUAL:
+    emit_helper(as, ADDRESS(jit_equal), h - 2, 0);
+    break;
+
+  case OP_GREATER:
+  case OP_GREATER_NN:
+    emit_comparison(as, false, h, offset);
+    break;
+
+  case OP_LESS:
+  case OP_LESS_NN:
+    emit_comparison(as, true, h, offset);
+    break;
+
+  case OP_ADD:
+  case OP_ADD_NN:
+    emit_arithmetic(as, 0x58, 0x03, h, offset);
+    break;
+
+  case OP_SUBTRACT:
+  case OP_SUBTRACT_NN:
+    emit_arithmetic(as, 0x5C, 0x2B, h, offset);
+    break;
+
+  case OP_MULTIPLY:
+  case OP_MULTIPLY_NN:
+    emit_arithmetic(as, 0x59, IMUL, h, offset);
+    break;
+
+  case OP_DIVIDE:
+  case OP_DIVIDE_NN:
+    emit_arithmetic(as, 0x5E, 0, h, offset);
+    break;
+
+  case OP_NOT:
+    emit_helper(as, ADDRESS(jit_not), h - 1, 0);
+    break;
+
+  case OP_NEGATE: {
+    int32_t disp = (h - 1) * (int32_t)sizeof(Value) + PAYLOAD_OFFSET;
+    emit_compare_type(as, h - 1, VAL_INT);
+    size_t number = emit_local_jump(as, JNE);
+    // mov rax, slot; neg rax; mov slot, rax, the smallest integer overflows.
+    emit_op_memory(as, true, 0x8B, RAX, SLOTS, disp);
+    emit_byte(as, 0x48);
+    emit_byte(as, 0xF7);
+    emit_byte(as, 0xD8);
+    emit_exit(as, JO, offset);
+    emit_op_memory(as, true, 0x89, RAX, SLOTS, disp);
+    size_t done = emit_local_jump(as, 0);
+
+    bind_local(as, number);
+    emit_compare_type(as, h - 1, VAL_NUMBER);
+    emit_exit(as, JNE, offset);
+    // flips the sign bit: mov rax, slot; btc rax, 63; mov slot, rax
+    emit_op_memory(as, true, 0x8B, RAX, SLOTS, disp);
+    emit_byte(as, 0x48);
+    emit_byte(as, 0x0F);
+    emit_byte(as, 0xBA);
+    emit_byte(as, 0xF8);
+    emit_byte(as, 63);
+    emit_op_memory(as, true, 0x89, RAX, SLOTS, disp);
+    bind_local(as, done);
+    break;
+  }
+
+  case OP_PRINT:
+    emit_helper(as, ADDRESS(jit_print), h - 1, 0);
+    break;
+
+  case OP_JUMP:
+  case OP_JUMP_LONG:
+    emit_jump_to(as, 0, (size_t)jump_target(chunk, offset));
+    break;
+
+  case OP_LOOP:
+  case OP_LOOP_LONG:
+    emit_jump_to(as, 0, (size_t)jump_target(chunk, offset));
+    break;
+
+  case OP_JUMP_IF_FALSE:
+  case OP_JUMP_IF_FALSE_LONG: {
+    size_t target = (size_t)jump_target(chunk, offset);
+    // booleans are tested inline, other values through is_falsey.
+    emit_compare_type(as, h - 1, VAL_BOOL);
+    size_t slow = emit_local_jump(as, JNE);
+    emit_op_memory(as, false, 0x80, 7, SLOTS,
+                   (h - 1) * (int32_t)sizeof(Value) + PAYLOAD_OFFSET);
+    emit_byte(as, 0);
+    emit_jump_to(as, JE, target);
+    size_t done = emit_local_jump(as, 0);
+
+    bind_local(as, slow);
+    emit_helper(as, ADDRESS(jit_falsey), h - 1, 0);
+    emit_test_result(as);
+    emit_jump_to(as, JNE, target);
+    bind_local(as, done);
+    break;
+  }
+
+  case OP_CALL:
+  case OP_CALL_LONG:
+  case OP_CALL_0:
+  case OP_CALL_1:
+  case OP_CALL_2:
+  case OP_CALL_3:
+    emit_cached_call(as, function, offset, next, h,
+                     call_args_count(chunk, offset));
+    break;
+
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+  case OP_GET_PROPERTY_LONG:
+  case OP_SET_PROPERTY_LONG: {
+    Value name = chunk->constants.values[name_operand(chunk, offset)];
+    PropertyCache *cache =
+        &function->property_caches[property_cache_index(chunk, offset)];
+    emit_mov_imm64(as, RDX, ADDRESS(AS_OBJ(name)));
+    if (op == OP_GET_PROPERTY || op == OP_GET_PROPERTY_LONG) {
+      emit_helper(as, ADDRESS(jit_get_property), h - 1, ADDRESS(cache));
+    } else {
+      emit_helper(as, ADDRESS(jit_set_property), h - 2, ADDRESS(cache));
+    }
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+  }
+
+  case OP_INVOKE:
+  case OP_INVOKE_LONG: {
+    int args_count = chunk->code[offset + 4];
+    Value name = chunk->constants.values[name_operand(chunk, offset)];
+    emit_slot_address(as, RDI, h - args_count - 1);
+    emit_mov_imm32(as, RSI, (uint32_t)args_count);
+    // mov rdx, r12
+    emit_byte(as, 0x4C);
+    emit_byte(as, 0x89);
+    emit_byte(as, 0xE2);
+    emit_mov_imm64(as, RCX, ADDRESS(chunk->code + next));
+    emit_mov_imm64(
+        as, R8,
+        ADDRESS(&function->property_caches[property_cache_index(chunk,
+                                                                offset)]));
+    emit_mov_imm64(as, R9, ADDRESS(AS_OBJ(name)));
+    emit_call(as, ADDRESS(jit_invoke));
+    emit_test_result(as);
+    size_t ok = emit_local_jump(as, JNE);
+    emit_return(as, JIT_ERROR);
+    bind_local(as, ok);
+    break;
+  }
+
+  case OP_RETURN:
+    emit_helper(as, ADDRESS(jit_return), h - 1, 0);
+    emit_return(as, JIT_RETURNED);
+    break;
+
+  case OP_RETURN_N: {
+    int count = chunk->code[offset + 1];
+    emit_helper(as, ADDRESS(jit_return_values), h - count, (uint64_t)count);
+    emit_return(as, JIT_RETURNED);
+    break;
+  }
+
+  case OP_UNPACK:
+    emit_helper(as, ADDRESS(jit_unpack), h - 1, chunk->code[offset + 1]);
+    break;
+
+  case OP_JUMP_TABLE:
+  case OP_JUMP_MAP: {
+    emit_slot_address(as, RDI, h - 1);
+    emit_mov_imm64(as, RSI, ADDRESS(chunk));
+    emit_mov_imm64(as, RDX, (uint64_t)offset);
+    emit_call(as, ADDRESS(jit_jump_table));
+    // jumps to entry rax of a table of 5 byte `jmp rel32`, right after.
+    // lea rax, [rax + rax*4]
+    emit_byte(as, 0x48);
+    emit_byte(as, 0x8D);
+    emit_byte(as, 0x04);
+    emit_byte(as, 0x80);
+    // lea rcx, [rip + 5], past the add and the jmp.
+    emit_byte(as, 0x48);
+    emit_byte(as, 0x8D);
+    emit_byte(as, 0x0D);
+    emit_u32(as, 5);
+    // add rcx, rax
+    emit_byte(as, 0x48);
+    emit_byte(as, 0x01);
+    emit_byte(as, 0xC1);
+    // jmp rcx
+    emit_byte(as, 0xFF);
+    emit_byte(as, 0xE1);
+    int count = jump_table_count(chunk, offset);
+    for (int i = 0; i <= count; i++) {
+      emit_jump_to(as, 0, jump_table_target(chunk, offset, i));
+    }
+    break;
+  }
+
+  case OP_PEEK:
+    emit_copy_slot(as, h, h - 1 - chunk->code[offset + 1]);
+    break;
+
+  case OP_INLINE_GUARD: {
+    int callee = h - chunk->code[offset + 1] - 1;
+    uint32_t constant = inline_guard_constant(chunk, offset);
+    size_t target = (size_t)jump_target(chunk, offset);
+    Value function = chunk->constants.values[constant];
+
+    // mov rax, function; cmp rax, [callee payload]; je target
+    emit_compare_type(as, callee, VAL_OBJ);
+    size_t other = emit_local_jump(as, JNE);
+    emit_mov_imm64(as, RAX, ADDRESS(AS_OBJ(function)));
+    emit_op_memory(as, true, 0x3B, RAX, SLOTS,
+                   callee * (int32_t)sizeof(Value) + PAYLOAD_OFFSET);
+    emit_jump_to(as, JE, target);
+    bind_local(as, other);
+    break;
+  }
+
+  case OP_INLINE_RETURN:
+    emit_copy_slot(as, h - 1 - chunk->code[offset + 1], h - 1);
+    break;
+
+  case OP_FOR_STEP:
+    emit_for_step(as, chunk, offset);
+    break;
+
+  case OP_CHECK_NUM: {
+    int slot = h - 1 - chunk->code[offset + 1];
+    emit_compare_type(as, slot, VAL_NUMBER);
+    size_t number = emit_local_jump(as, JE);
+    emit_compare_type(as, slot, VAL_INT);
+    emit_exit(as, JNE, offset);
+    bind_local(as, number);
+    break;
+  }
+
+  case OP_CLOSURE: {
+    Value inner = chunk->constants.values[read_operand(chunk, offset)];
+    // mov rdx, rbx
+    emit_byte(as, 0x48);
+    emit_byte(as, 0x89);
+    emit_byte(as, 0xDA);
+    emit_helper(as, ADDRESS(jit_closure), h, ADDRESS(AS_OBJ(inner)));
+    break;
+  }
+
+  case OP_GET_CAPTURE:
+  case OP_GET_UPVALUE:
+    emit_capture_address(as, chunk->code[offset + 1], op == OP_GET_UPVALUE);
+    emit_sse_memory(as, 0xF3, 0x6F, 0, RAX, 0);
+    emit_sse_memory(as, 0xF3, 0x7F, 0, SLOTS, h * (int32_t)sizeof(Value));
+    break;
+
+  case OP_SET_UPVALUE:
+    emit_capture_address(as, chunk->code[offset + 1], true);
+    emit_sse_memory(as, 0xF3, 0x6F, 0, SLOTS,
+                    (h - 1) * (int32_t)sizeof(Value));
+    emit_sse_memory(as, 0xF3, 0x7F, 0, RAX, 0);
+    break;
+
+  case OP_CLOSE_UPVALUE:
+    emit_helper(as, ADDRESS(jit_close_upvalue), h - 1, 0);
+    break;
+
+  case OP_ARRAY: {
+    int count = (int)read_operand(chunk, offset);
+    emit_helper(as, ADDRESS(jit_array), h - count, (uint64_t)count);
+    break;
+  }
+
+  case OP_MAP: {
+    int count = (int)read_operand(chunk, offset);
+    emit_helper(as, ADDRESS(jit_map), h - 2 * count, (uint64_t)count);
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+  }
+
+  case OP_CONCAT_N: {
+    int count = chunk->code[offset + 1];
+    emit_helper(as, ADDRESS(jit_concat), h - count,
+                (uint64_t)count | (uint64_t)chunk->code[offset + 2] << 8);
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+  }
+
+  case OP_MATH: {
+    MathFunction math = (MathFunction)chunk->code[offset + 1];
+    int arity = math_intrinsics[math].arity;
+    emit_helper(as, ADDRESS(jit_math), h - arity - 1, (uint64_t)math);
+    emit_test_result(as);
+    size_t done = emit_local_jump(as, JNE);
+    emit_cached_call(as, function, offset, next, h, arity);
+    bind_local(as, done);
+    break;
+  }
+
+  case OP_GET_INDEX:
+    emit_helper(as, ADDRESS(jit_get_index), h - 2, 0);
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+
+  case OP_SET_INDEX:
+    emit_helper(as, ADDRESS(jit_set_index), h - 3, 0);
+    emit_test_result(as);
+    emit_exit(as, JE, offset);
+    break;
+
+  default:
+    // no template, the interpreter runs the rest of the call.
+    emit_exit(as, 0, offset);
+    break;
+  }
+}
+
+/*
+ * Emits the stub an exit jumps to: stores the frame's ip and the stack top
+ * for the instruction at offset, and returns to the interpreter.
+ */
+static void emit_exit_stub(Assembler *as, Chunk *chunk, size_t offset, int h) {
+  emit_mov_imm64(as, RAX, ADDRESS(chunk->code + offset));
+  emit_op_memory(as, true, 0x89, RAX, FRAME, (int32_t)offsetof(CallFrame, ip));
+  emit_slot_address(as, RAX, h);
+  emit_mov_imm64(as, RCX, ADDRESS(&vm.stack_top));
+  // mov [rcx], rax
+  emit_byte(as, 0x48);
+  emit_byte(as, 0x89);
+  emit_byte(as, 0x01);
+  emit_return(as, JIT_EXITED);
+}
+
+static void free_assembler(Assembler *as, size_t chunk_count) {
+  FREE_ARRAY(uint8_t, as->code, as->capacity);
+  FREE_ARRAY(size_t, as->labels, chunk_count);
+  FREE_ARRAY(size_t, as->exit_stubs, chunk_count);
+  FREE_ARRAY(Fixup, as->jumps, as->jump_capacity);
+  FREE_ARRAY(Fixup, as->exits, as->exit_capacity);
+  FREE_ARRAY(Fixup, as->returns, as->return_capacity);
+}
+
+/*
+ * Copies finished code into new executable memory.
+ */
+static uint8_t *install_code(Assembler *as) {
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (as->count + page - 1) / page * page;
+
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    log_error("couldn't map %zu bytes for jit code", size);
+    return NULL;
+  }
+
+  memcpy(memory, as->code, as->count);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    log_error("couldn't make jit code executable");
+    munmap(memory, size);
+    return NULL;
+  }
+
+  JitBlock *block = ALLOCATE(JitBlock, 1);
+  block->memory = (uint8_t *)memory;
+  block->size = size;
+  block->next = vm.jit_blocks;
+  vm.jit_blocks = block;
+  return (uint8_t *)memory;
+}
+
+bool jit_compile(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  int *heights = ALLOCATE(int, chunk->count);
+  int max_stack = 0;
+  if (!analyze_chunk(chunk, function->arity, heights, &max_stack)) {
+    FREE_ARRAY(int, heights, chunk->count);
+    return false;
+  }
+
+  Assembler as;
+  memset(&as, 0, sizeof(as));
+  as.labels = ALLOCATE(size_t, chunk->count);
+  as.exit_stubs = ALLOCATE(size_t, chunk->count);
+  memset(as.exit_stubs, 0, chunk->count * sizeof(size_t));
+
+  // prologue: push rbx; push r12; push r13 keeps the stack aligned for
+  // calls, then mov r12, rdi; mov rbx, [rdi + slots].
+  emit_byte(&as, 0x53);
+  emit_byte(&as, 0x41);
+  emit_byte(&as, 0x54);
+  emit_byte(&as, 0x41);
+  emit_byte(&as, 0x55);
+  emit_byte(&as, 0x49);
+  emit_byte(&as, 0x89);
+  emit_byte(&as, 0xFC);
+  emit_op_memory(&as, true, 0x8B, SLOTS, RDI,
+                 (int32_t)offsetof(CallFrame, slots));
+
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk, offset)) {
+    as.labels[offset] = as.count;
+    if (heights[offset] != -1) {
+      emit_instruction(&as, function, offset, heights[offset]);
+    }
+  }
+
+  // one exit stub per exiting instruction.
+  for (size_t i = 0; i < as.exit_count; i++) {
+    size_t offset = as.exits[i].target;
+    if (as.exit_stubs[offset] == 0) {
+      as.exit_stubs[offset] = as.count;
+      emit_exit_stub(&as, chunk, offset, heights[offset]);
+    }
+  }
+
+  // epilogue, eax holds the result.
+  size_t epilogue = as.count;
+  emit_byte(&as, 0x41);
+  emit_byte(&as, 0x5D);
+  emit_byte(&as, 0x41);
+  emit_byte(&as, 0x5C);
+  emit_byte(&as, 0x5B);
+  emit_byte(&as, 0xC3);
+
+  for (size_t i = 0; i < as.jump_count; i++) {
+    Fixup *jump = &as.jumps[i];
+    patch_u32(&as, jump->at,
+              (uint32_t)(as.labels[jump->target] - (jump->at + 4)));
+  }
+  for (size_t i = 0; i < as.exit_count; i++) {
+    Fixup *exit = &as.exits[i];
+    patch_u32(&as, exit->at,
+              (uint32_t)(as.exit_stubs[exit->target] - (exit->at + 4)));
+  }
+  for (size_t i = 0; i < as.return_count; i++) {
+    Fixup *ret = &as.returns[i];
+    patch_u32(&as, ret->at, (uint32_t)(epilogue - (ret->at + 4)));
+  }
+
+  uint8_t *code = install_code(&as);
+  if (code != NULL) {
+    // ISO C has no cast from object to function pointers.
+    void *entry = code;
+    memcpy(&function->jit, &entry, sizeof(function->jit));
+    log_debug("jit compiled %s to %zu bytes",
+              function->name != NULL ? function->name->chars : "<script>",
+              as.count);
+  }
+
+  free_assembler(&as, chunk->count);
+  FREE_ARRAY(int, heights, chunk->count);
+  return code != NULL;
+}
+
+void free_jit() {
+  JitBlock *block = vm.jit_blocks;
+  while (block != NULL) {
+    JitBlock *next = block->next;
+    munmap(block->memory, block->size);
+    FREE(JitBlock, block);
+    block = next;
+  }
+  vm.jit_blocks = NULL;
+}
+
+#else
+
+bool jit_compile(ObjFunction *function) {
+  (void)function;
+  return false;
+}
+
+void free_jit() { vm.jit_blocks = NULL; }
+
+#endif // ZSPIE_JIT_SUPPORTED
@@ -0,0 +1,42 @@
+#ifndef ZSPIE_JIT_H_
+#define ZSPIE_JIT_H_
+
+#include "common.h"
+#include "object.h"
+
+// machine code is only generated for x86-64 linux, everywhere else the jit
+// compiles nothing and functions stay interpreted.
+#if defined(ZSPIE_ENABLE_JIT) && defined(__x86_64__) && defined(__linux__)
+#define ZSPIE_JIT_SUPPORTED
+#endif
+
+// a function gets compiled on this call.
+#define JIT_CALL_THRESHOLD 8
+
+/*
+ * One block of executable memory holding a jit compiled function.
+ */
+typedef struct JitBlock {
+  // next block in the vm's list.
+  struct JitBlock *next;
+  // size of the mapped memory in bytes.
+  size_t size;
+  // start of the mapped memory.
+  uint8_t *memory;
+} JitBlock;
+
+/*
+ * Compiles a verified function to machine code by stitching together a
+ * template for each instruction, and sets its `jit` entry. Instructions
+ * without a template, and type checks which fail at runtime, leave the
+ * frame to the interpreter.
+ * @return true if the function was compiled.
+ */
+bool jit_compile(ObjFunction *function);
+
+/*
+ * Unmaps all the machine code owned by the vm.
+ */
+void free_jit();
+
+#endif // !ZSPIE_JIT_H_
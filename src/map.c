@@ -0,0 +1,263 @@
+#include "map.h"
+#include "array.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Mixes the bits of a 64 bit key into a 32 bit hash.
+ */
+static uint32_t hash_bits(uint64_t bits) {
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdULL;
+  bits ^= bits >> 33;
+  bits *= 0xc4ceb9fe1a85ec53ULL;
+  bits ^= bits >> 33;
+  return (uint32_t)bits;
+}
+
+static uint32_t hash_key(Value key) {
+  switch (key.type) {
+  case VAL_BOOL:
+    return AS_BOOL(key) ? 1231u : 1237u;
+
+  case VAL_INT:
+    return hash_bits((uint64_t)AS_INT(key));
+
+  case VAL_NUMBER: {
+    // 1.0 is the same key as 1, floats with an integral value hash like the
+    // integer.
+    double number = AS_NUMBER(key);
+    if (number >= -9223372036854775808.0 && number < 9223372036854775808.0 &&
+        number == (double)(int64_t)number) {
+      return hash_bits((uint64_t)(int64_t)number);
+    }
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return hash_bits(bits);
+  }
+
+  default:
+    return AS_STRING(key)->hash;
+  }
+}
+
+static inline bool keys_equal(Value a, Value b) {
+  // strings are interned, equal strings are the same object.
+  if (IS_OBJ(a)) {
+    return IS_OBJ(b) && AS_OBJ(a) == AS_OBJ(b);
+  }
+  return values_equal(a, b);
+}
+
+bool is_map_key(Value value) {
+  // NaN equals nothing, not even itself, a map could never find it again.
+  if (IS_NUMBER(value)) {
+    return !isnan(AS_NUMBER(value));
+  }
+  return IS_BOOL(value) || IS_INT(value) || IS_TEXT(value);
+}
+
+/*
+ * Key a map stores for key, the interned string of a slice.
+ * @return false for a slice whose string was never interned, no map can hold
+ * it.
+ */
+static bool lookup_key(Value key, Value *found) {
+  if (!IS_SLICE(key)) {
+    *found = key;
+    return true;
+  }
+  ObjSlice *slice = AS_SLICE(key);
+  ObjString *string =
+      table_find_string(&vm.strings, slice->chars, slice->length,
+                        hash_string(slice->chars, slice->length));
+  *found = OBJ_VAL(string);
+  return string != NULL;
+}
+
+/*
+ * Finds the slot holding key, or the slot to add it in: the first removed
+ * slot on the way, otherwise the empty one ending the probe. The index
+ * always has empty slots.
+ */
+static MapSlot *find_slot(ObjMap *map, Value key, uint32_t hash) {
+  uint32_t mask = (uint32_t)map->slot_capacity - 1;
+  MapSlot *removed = NULL;
+  for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+    MapSlot *slot = &map->slots[index];
+    if (slot->entry == MAP_EMPTY) {
+      return removed != NULL ? removed : slot;
+    }
+    if (slot->entry == MAP_REMOVED) {
+      if (removed == NULL) {
+        removed = slot;
+      }
+    } else if (slot->hash == hash &&
+               keys_equal(map->entries[slot->entry].key, key)) {
+      return slot;
+    }
+  }
+}
+
+bool map_get(ObjMap *map, Value key, Value *value) {
+  if (map->count == 0 || !lookup_key(key, &key)) {
+    return false;
+  }
+  MapSlot *slot = find_slot(map, key, hash_key(key));
+  if (slot->entry < 0) {
+    return false;
+  }
+  *value = map->entries[slot->entry].value;
+  return true;
+}
+
+void map_set(ObjMap *map, Value key, Value value) {
+  if (map->used == map->capacity) {
+    // dropping removed entries may make enough room.
+    resize_map(map, map->count < map->capacity / 2
+                        ? map->capacity
+                        : GROW_CAPACITY(map->capacity));
+  }
+
+  if (IS_SLICE(key)) {
+    key = OBJ_VAL(intern_text(key));
+  }
+  uint32_t hash = hash_key(key);
+  MapSlot *slot = find_slot(map, key, hash);
+  if (slot->entry >= 0) {
+    map->entries[slot->entry].value = value;
+    return;
+  }
+
+  map->entries[map->used] = (MapEntry){key, value};
+  slot->hash = hash;
+  slot->entry = map->used++;
+  map->count++;
+}
+
+bool map_delete(ObjMap *map, Value key) {
+  if (map->count == 0 || !lookup_key(key, &key)) {
+    return false;
+  }
+  MapSlot *slot = find_slot(map, key, hash_key(key));
+  if (slot->entry < 0) {
+    return false;
+  }
+  map->entries[slot->entry] = (MapEntry){NULL_VAL, NULL_VAL};
+  slot->entry = MAP_REMOVED;
+  map->count--;
+  return true;
+}
+
+const char *map_of(Value *pairs, int count, Value *result) {
+  for (int i = 0; i < count; i++) {
+    if (!is_map_key(pairs[2 * i])) {
+      return "Map key must be a string, number or boolean.";
+    }
+  }
+
+  ObjMap *map = new_map(count);
+  for (int i = 0; i < count; i++) {
+    map_set(map, pairs[2 * i], pairs[2 * i + 1]);
+  }
+  *result = OBJ_VAL(map);
+  return NULL;
+}
+
+void resize_map(ObjMap *map, int capacity) {
+  MapEntry *entries = ALLOCATE(MapEntry, capacity);
+  int count = 0;
+  for (int i = 0; i < map->used; i++) {
+    if (!IS_NULL(map->entries[i].key)) {
+      entries[count++] = map->entries[i];
+    }
+  }
+  FREE_ARRAY(MapEntry, map->entries, map->capacity);
+  FREE_ARRAY(MapSlot, map->slots, map->slot_capacity);
+
+  map->entries = entries;
+  map->used = count;
+  map->count = count;
+  map->capacity = capacity;
+
+  int slot_capacity = 8;
+  while ((int64_t)slot_capacity * 3 <= (int64_t)capacity * 4) {
+    slot_capacity *= 2;
+  }
+  map->slots = ALLOCATE(MapSlot, slot_capacity);
+  map->slot_capacity = slot_capacity;
+  for (int i = 0; i < slot_capacity; i++) {
+    map->slots[i].entry = MAP_EMPTY;
+  }
+
+  for (int i = 0; i < count; i++) {
+    uint32_t hash = hash_key(entries[i].key);
+    MapSlot *slot = find_slot(map, entries[i].key, hash);
+    slot->hash = hash;
+    slot->entry = i;
+  }
+}
+
+void free_map(ObjMap *map) {
+  FREE_ARRAY(MapEntry, map->entries, map->capacity);
+  FREE_ARRAY(MapSlot, map->slots, map->slot_capacity);
+  FREE(ObjMap, map);
+}
+
+Value map_native(int arg_count, Value *args) {
+  if (arg_count == 0) {
+    return OBJ_VAL(new_map(0));
+  }
+  if (arg_count != 1 || !IS_NUMERIC(args[0]) ||
+      !(AS_FLOAT(args[0]) >= 0 && AS_FLOAT(args[0]) <= INT_MAX / 2)) {
+    return NULL_VAL;
+  }
+  return OBJ_VAL(new_map((int)AS_FLOAT(args[0])));
+}
+
+/*
+ * Array of the keys or values of a map, in insertion order.
+ */
+static Value map_column(int arg_count, Value *args, bool keys) {
+  if (arg_count != 1 || !IS_MAP(args[0])) {
+    return NULL_VAL;
+  }
+
+  ObjMap *map = AS_MAP(args[0]);
+  ObjArray *array = new_array(ARRAY_INTS, 0);
+  for (int i = 0; i < map->used; i++) {
+    MapEntry *entry = &map->entries[i];
+    if (!IS_NULL(entry->key)) {
+      array_push(array, keys ? entry->key : entry->value);
+    }
+  }
+  return OBJ_VAL(array);
+}
+
+Value keys_native(int arg_count, Value *args) {
+  return map_column(arg_count, args, true);
+}
+
+Value values_native(int arg_count, Value *args) {
+  return map_column(arg_count, args, false);
+}
+
+Value has_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_MAP(args[0]) || !is_map_key(args[1])) {
+    return NULL_VAL;
+  }
+  Value value;
+  return BOOL_VAL(map_get(AS_MAP(args[0]), args[1], &value));
+}
+
+Value remove_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_MAP(args[0]) || !is_map_key(args[1])) {
+    return NULL_VAL;
+  }
+  return BOOL_VAL(map_delete(AS_MAP(args[0]), args[1]));
+}
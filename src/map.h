@@ -0,0 +1,58 @@
+#ifndef ZSPIE_MAP_H_
+#define ZSPIE_MAP_H_
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+/*
+ * @return true if value can be a map key: strings, numbers other than NaN
+ * and booleans.
+ */
+bool is_map_key(Value value);
+
+/*
+ * Looks up a valid key.
+ * @return false if the map doesn't have it.
+ */
+bool map_get(ObjMap *map, Value key, Value *value);
+
+/*
+ * Adds a valid key or replaces its value.
+ */
+void map_set(ObjMap *map, Value key, Value value);
+
+/*
+ * Removes a valid key.
+ * @return false if the map didn't have it.
+ */
+bool map_delete(ObjMap *map, Value key);
+
+/*
+ * Makes the map of a literal from count key value pairs, stored in result.
+ * @return NULL, or the message of the runtime error to report.
+ */
+const char *map_of(Value *pairs, int count, Value *result);
+
+/*
+ * Rebuilds the map with room for capacity entries, dropping removed ones.
+ * Capacity must be at least the map's count.
+ */
+void resize_map(ObjMap *map, int capacity);
+
+void free_map(ObjMap *map);
+
+/*
+ * Map natives, they return null when not given a map or a valid key.
+ */
+
+// map(n) makes an empty map with room for n keys.
+Value map_native(int arg_count, Value *args);
+// keys(map) and values(map) are arrays, in the order the keys were added.
+Value keys_native(int arg_count, Value *args);
+Value values_native(int arg_count, Value *args);
+Value has_native(int arg_count, Value *args);
+// remove(map, key) returns whether the key was there.
+Value remove_native(int arg_count, Value *args);
+
+#endif // !ZSPIE_MAP_H_
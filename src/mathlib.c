@@ -0,0 +1,126 @@
+#include "mathlib.h"
+#include "array.h"
+#include "value.h"
+#include <math.h>
+
+const MathIntrinsic math_intrinsics[MATH_COUNT] = {
+    [MATH_SQRT] = {"sqrt", 1, true, false, sqrt_native},
+    [MATH_FLOOR] = {"floor", 1, true, true, floor_native},
+    [MATH_CEIL] = {"ceil", 1, true, true, ceil_native},
+    [MATH_ABS] = {"abs", 1, true, true, abs_native},
+    [MATH_SIN] = {"sin", 1, true, false, sin_native},
+    [MATH_COS] = {"cos", 1, true, false, cos_native},
+    [MATH_POW] = {"pow", 2, true, false, pow_native},
+    // one argument calls are the array versions.
+    [MATH_MIN] = {"min", 2, true, true, min_native},
+    [MATH_MAX] = {"max", 2, true, true, max_native},
+};
+
+double math_number(MathFunction function, double a, double b) {
+  switch (function) {
+  case MATH_SQRT:
+    return sqrt(a);
+  case MATH_FLOOR:
+    return floor(a);
+  case MATH_CEIL:
+    return ceil(a);
+  case MATH_ABS:
+    return fabs(a);
+  case MATH_SIN:
+    return sin(a);
+  case MATH_COS:
+    return cos(a);
+  case MATH_POW:
+    return pow(a, b);
+  // the first one unless the second is smaller, as `<` compares.
+  case MATH_MIN:
+    return b < a ? b : a;
+  case MATH_MAX:
+    return b > a ? b : a;
+  default:
+    return 0; // unreachable
+  }
+}
+
+bool math_int(MathFunction function, int64_t a, int64_t b, int64_t *result) {
+  switch (function) {
+  case MATH_FLOOR:
+  case MATH_CEIL:
+    *result = a;
+    return true;
+  case MATH_ABS:
+    if (a == INT64_MIN) {
+      return false;
+    }
+    *result = a < 0 ? -a : a;
+    return true;
+  case MATH_MIN:
+    *result = b < a ? b : a;
+    return true;
+  case MATH_MAX:
+    *result = b > a ? b : a;
+    return true;
+  default:
+    return false;
+  }
+}
+
+Value math_call(MathFunction function, Value *args) {
+  const MathIntrinsic *intrinsic = &math_intrinsics[function];
+  for (int i = 0; i < intrinsic->arity; i++) {
+    if (!IS_NUMERIC(args[i])) {
+      return NULL_VAL;
+    }
+  }
+
+  // either argument keeps its type, an integer and a float included.
+  if (function == MATH_MIN) {
+    return less_values(args[1], args[0]) ? args[1] : args[0];
+  }
+  if (function == MATH_MAX) {
+    return greater_values(args[1], args[0]) ? args[1] : args[0];
+  }
+
+  int64_t result;
+  if (intrinsic->integers && IS_INT(args[0]) &&
+      math_int(function, AS_INT(args[0]), 0, &result)) {
+    return INT_VAL(result);
+  }
+  double b = intrinsic->arity == 2 ? AS_FLOAT(args[1]) : 0;
+  return NUMBER_VAL(math_number(function, AS_FLOAT(args[0]), b));
+}
+
+Value sqrt_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_SQRT, args);
+}
+
+Value floor_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_FLOOR, args);
+}
+
+Value ceil_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_CEIL, args);
+}
+
+Value abs_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_ABS, args);
+}
+
+Value sin_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_SIN, args);
+}
+
+Value cos_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_COS, args);
+}
+
+Value pow_native(int arg_count, Value *args) {
+  (void)arg_count;
+  return math_call(MATH_POW, args);
+}
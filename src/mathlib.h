@@ -0,0 +1,80 @@
+#ifndef ZSPIE_MATHLIB_H_
+#define ZSPIE_MATHLIB_H_
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+/*
+ * Math functions. Calls to them with their arity compile to OP_MATH, whose
+ * operand is the function, as long as their global holds their native.
+ */
+typedef enum {
+  MATH_SQRT,
+  MATH_FLOOR,
+  MATH_CEIL,
+  MATH_ABS,
+  MATH_SIN,
+  MATH_COS,
+  MATH_POW,
+  MATH_MIN,
+  MATH_MAX,
+  MATH_COUNT,
+} MathFunction;
+
+typedef struct {
+  const char *name;
+  int arity;
+  // the result only depends on the arguments, calls with constant arguments
+  // are computed by the compiler.
+  bool pure;
+  // integer arguments give an integer result, computed by math_int.
+  bool integers;
+  // native the global holds, calls with another argument count call it.
+  NativeFn native;
+} MathIntrinsic;
+
+extern const MathIntrinsic math_intrinsics[MATH_COUNT];
+
+/*
+ * @return true if value is the native of a math function, OP_MATH calls
+ * anything else as usual.
+ */
+static inline bool is_math_native(Value value, MathFunction function) {
+  return IS_NATIVE(value) &&
+         AS_NATIVE(value)->function == math_intrinsics[function].native;
+}
+
+/*
+ * A math function on the values of its arity from args on.
+ * @return null unless they are all numbers.
+ */
+Value math_call(MathFunction function, Value *args);
+
+/*
+ * A math function on floats, unary ones ignore b.
+ */
+double math_number(MathFunction function, double a, double b);
+
+/*
+ * A math function with an integer form on integers, unary ones ignore b.
+ * @return false if the result doesn't fit in an integer.
+ */
+bool math_int(MathFunction function, int64_t a, int64_t b, int64_t *result);
+
+/*
+ * Math natives, they return null when given something else than numbers.
+ * floor, ceil and abs of an integer are integers, min and max return one of
+ * their arguments. The others return floats.
+ */
+
+Value sqrt_native(int arg_count, Value *args);
+Value floor_native(int arg_count, Value *args);
+Value ceil_native(int arg_count, Value *args);
+Value abs_native(int arg_count, Value *args);
+Value sin_native(int arg_count, Value *args);
+Value cos_native(int arg_count, Value *args);
+// pow(x, y) x to the power of y.
+Value pow_native(int arg_count, Value *args);
+
+#endif // !ZSPIE_MATHLIB_H_
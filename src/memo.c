@@ -0,0 +1,192 @@
+#include "memo.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include <string.h>
+
+// longest key, a type byte and up to 8 bytes for the callee and each
+// argument.
+#define MEMO_KEY_MAX ((UINT8_COUNT + 1) * 9)
+
+Memo *new_memo() {
+  Memo *memo = ALLOCATE(Memo, 1);
+  init_table(&memo->table);
+  memo->entries = NULL;
+  memo->count = 0;
+  memo->capacity = 0;
+  memo->newest = -1;
+  memo->oldest = -1;
+  return memo;
+}
+
+/*
+ * Keys are owned by their memo, they aren't interned or linked into the
+ * vm's objects so evicting them frees them.
+ */
+static ObjString *new_key(const char *chars, size_t length, uint32_t hash) {
+  ObjString *key = ALLOCATE(ObjString, 1);
+  key->obj.type = OBJ_STRING;
+  key->obj.next = NULL;
+  key->chars = ALLOCATE(char, length + 1);
+  memcpy(key->chars, chars, length);
+  key->chars[length] = '\0';
+  key->length = length;
+  key->hash = hash;
+  return key;
+}
+
+void free_memo_key(ObjString *key) {
+  FREE_ARRAY(char, key->chars, key->length + 1);
+  FREE(ObjString, key);
+}
+
+/*
+ * Appends a value to a key, strings and slices by their interned string.
+ * @return false if the value can't be part of a key.
+ */
+static bool pack_value(char *chars, size_t *length, Value value) {
+  chars[(*length)++] = (char)value.type;
+  switch (value.type) {
+  case VAL_NULL:
+    return true;
+
+  case VAL_BOOL:
+    chars[(*length)++] = (char)AS_BOOL(value);
+    return true;
+
+  case VAL_NUMBER:
+  case VAL_INT:
+    memcpy(chars + *length, &value.as, 8);
+    *length += 8;
+    return true;
+
+  case VAL_OBJ: {
+    if (!IS_TEXT(value)) {
+      return false;
+    }
+    ObjString *string = intern_text(value);
+    memcpy(chars + *length, &string, 8);
+    *length += 8;
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+static void unlink_entry(Memo *memo, int index) {
+  MemoEntry *entry = &memo->entries[index];
+  if (entry->newer != -1) {
+    memo->entries[entry->newer].older = entry->older;
+  } else {
+    memo->newest = entry->older;
+  }
+  if (entry->older != -1) {
+    memo->entries[entry->older].newer = entry->newer;
+  } else {
+    memo->oldest = entry->newer;
+  }
+}
+
+static void link_newest(Memo *memo, int index) {
+  MemoEntry *entry = &memo->entries[index];
+  entry->newer = -1;
+  entry->older = memo->newest;
+  if (memo->newest != -1) {
+    memo->entries[memo->newest].newer = index;
+  }
+  memo->newest = index;
+  if (memo->oldest == -1) {
+    memo->oldest = index;
+  }
+}
+
+bool memo_lookup(Memo *memo, Value *slots, int args_count, Value *result,
+                 ObjString **key) {
+  *key = NULL;
+  char chars[MEMO_KEY_MAX];
+  size_t length = 0;
+
+  // closures of one function can capture different values.
+  if (IS_CLOSURE(slots[0])) {
+    memcpy(chars, &slots[0].as, 8);
+    length = 8;
+  }
+  for (int i = 1; i <= args_count; i++) {
+    if (!pack_value(chars, &length, slots[i])) {
+      return false;
+    }
+  }
+
+  uint32_t hash = hash_string(chars, length);
+  ObjString *found = table_find_string(&memo->table, chars, length, hash);
+  if (found == NULL) {
+    *key = new_key(chars, length, hash);
+    return false;
+  }
+
+  Value index;
+  table_get(&memo->table, found, &index);
+  int entry = (int)AS_INT(index);
+  if (entry != memo->newest) {
+    unlink_entry(memo, entry);
+    link_newest(memo, entry);
+  }
+  *result = memo->entries[entry].result;
+  return true;
+}
+
+void memo_store(Memo *memo, ObjString *key, Value result) {
+  // a call with the same arguments may have finished inside this one.
+  ObjString *found =
+      table_find_string(&memo->table, key->chars, key->length, key->hash);
+  if (found != NULL) {
+    Value index;
+    table_get(&memo->table, found, &index);
+    memo->entries[AS_INT(index)].result = result;
+    free_memo_key(key);
+    return;
+  }
+
+  int index;
+  if (memo->count < MEMO_CAPACITY) {
+    if (memo->capacity < memo->count + 1) {
+      int old_capacity = memo->capacity;
+      memo->capacity = GROW_CAPACITY(old_capacity);
+      memo->entries =
+          GROW_ARRAY(MemoEntry, memo->entries, old_capacity, memo->capacity);
+    }
+    index = memo->count++;
+  } else {
+    index = memo->oldest;
+    unlink_entry(memo, index);
+    table_delete(&memo->table, memo->entries[index].key);
+    free_memo_key(memo->entries[index].key);
+  }
+
+  memo->entries[index].key = key;
+  memo->entries[index].result = result;
+  link_newest(memo, index);
+  table_set(&memo->table, key, INT_VAL(index));
+}
+
+void clear_memo(Memo *memo) {
+  for (int i = 0; i < memo->count; i++) {
+    free_memo_key(memo->entries[i].key);
+  }
+  free_table(&memo->table);
+  memo->count = 0;
+  memo->newest = -1;
+  memo->oldest = -1;
+}
+
+void free_memo(Memo *memo) {
+  if (memo == NULL) {
+    return;
+  }
+  clear_memo(memo);
+  FREE_ARRAY(MemoEntry, memo->entries, memo->capacity);
+  FREE(Memo, memo);
+}
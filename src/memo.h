@@ -0,0 +1,72 @@
+#ifndef ZSPIE_MEMO_H_
+#define ZSPIE_MEMO_H_
+
+#include "common.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+
+// most results a `memo fn` keeps, the least recently used one is dropped
+// for a new one after that.
+#define MEMO_CAPACITY 4096
+
+/*
+ * One remembered result, linked into the memo's recency list.
+ */
+typedef struct {
+  // the arguments the result was computed for, owned by the memo.
+  ObjString *key;
+  Value result;
+  // neighbouring entries in the recency list, -1 at its ends.
+  int newer;
+  int older;
+} MemoEntry;
+
+/*
+ * Results of a `memo fn`, by its arguments. The arguments are packed into a
+ * string key, so the lookup is a Table lookup.
+ */
+typedef struct Memo {
+  // packed arguments to the index of their entry.
+  Table table;
+  MemoEntry *entries;
+  int count;
+  int capacity;
+  // ends of the recency list.
+  int newest;
+  int oldest;
+} Memo;
+
+Memo *new_memo();
+
+/*
+ * Looks up the result of a call to a memoized function.
+ * @param slots - the callee followed by its arguments.
+ * @param key - set on a miss to the key to remember the result with, NULL
+ * if the arguments can't be used as a key. Only numbers, booleans, null and
+ * strings can.
+ * @return true if the result was found.
+ */
+bool memo_lookup(Memo *memo, Value *slots, int args_count, Value *result,
+                 ObjString **key);
+
+/*
+ * Remembers a result under the key memo_lookup gave for its call, dropping
+ * the least recently used result when the memo is full.
+ */
+void memo_store(Memo *memo, ObjString *key, Value result);
+
+/*
+ * Frees a key memo_lookup gave for a call which won't return a result, like
+ * one a runtime error unwinds.
+ */
+void free_memo_key(ObjString *key);
+
+/*
+ * Forgets every remembered result.
+ */
+void clear_memo(Memo *memo);
+
+void free_memo(Memo *memo);
+
+#endif // !ZSPIE_MEMO_H_
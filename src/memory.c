@@ -1,6 +1,12 @@
 #include "memory.h"
+#include "array.h"
 #include "chunk.h"
+#include "map.h"
+#include "memo.h"
 #include "object.h"
+#include "re.h"
+#include "regvm.h"
+#include "trace.h"
 #include "vm.h"
 
 void *reallocate(void *m_pointer, size_t m_old_size, size_t m_new_size) {
@@ -22,22 +28,69 @@ void *reallocate(void *m_pointer, size_t m_old_size, size_t m_new_size) {
 
 static void free_object(Obj *obj) {
   switch (obj->type) {
+  case OBJ_ARRAY:
+    free_array((ObjArray *)obj);
+    break;
+  case OBJ_BOUND_METHOD:
+    FREE(ObjBoundMethod, obj);
+    break;
+  case OBJ_CLASS:
+    free_table(&((ObjClass *)obj)->methods);
+    FREE(ObjClass, obj);
+    break;
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)obj;
+    reallocate(obj, sizeof(ObjClosure) + sizeof(Value) * closure->capture_count,
+               0);
+    break;
+  }
   case OBJ_FUNCTION: {
     ObjFunction *function = (ObjFunction *)obj;
     free_chunk(&function->chunk);
+    free_loops(function->loops);
+    free_memo(function->memo);
+    free_register_code(function->registers);
+    FREE_ARRAY(CallCache, function->call_caches, function->call_cache_count);
+    FREE_ARRAY(PropertyCache, function->property_caches,
+               function->property_cache_count);
+    FREE_ARRAY(Capture, function->captures, function->capture_count);
     FREE(ObjFunction, obj);
     break;
   }
+  case OBJ_INSTANCE: {
+    ObjInstance *instance = (ObjInstance *)obj;
+    FREE_ARRAY(Value, instance->fields, instance->capacity);
+    FREE(ObjInstance, obj);
+    break;
+  }
+  case OBJ_MAP:
+    free_map((ObjMap *)obj);
+    break;
   case OBJ_NATIVE: {
     FREE(ObjNative, obj);
     break;
   }
+  case OBJ_REGEX:
+    free_regex((ObjRegex *)obj);
+    break;
+  case OBJ_SHAPE:
+    free_table(&((ObjShape *)obj)->transitions);
+    FREE(ObjShape, obj);
+    break;
+  case OBJ_SLICE:
+    // the characters belong to the owner.
+    FREE(ObjSlice, obj);
+    break;
   case OBJ_STRING: {
     ObjString *obj_string = (ObjString *)obj;
     FREE_ARRAY(char, obj_string->chars, obj_string->length);
     FREE(ObjString, obj_string);
     break;
   }
+  case OBJ_UPVALUE: {
+    FREE(ObjUpvalue, obj);
+    break;
+  }
   }
 }
 
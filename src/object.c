@@ -1,5 +1,7 @@
 #include "object.h"
+#include "array.h"
 #include "chunk.h"
+#include "map.h"
 #include "memory.h"
 #include "stdio.h"
 #include "table.h"
@@ -39,22 +41,170 @@ uint32_t hash_string(const char *key, size_t length) {
   return hash;
 }
 
+ObjArray *new_array(ArrayKind kind, int capacity) {
+  ObjArray *array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+  array->kind = kind;
+  array->count = 0;
+  array->capacity = capacity;
+  switch (kind) {
+  case ARRAY_INTS:
+    array->as.ints = ALLOCATE(int64_t, capacity);
+    break;
+  case ARRAY_FLOATS:
+    array->as.floats = ALLOCATE(double, capacity);
+    break;
+  case ARRAY_VALUES:
+    array->as.values = ALLOCATE(Value, capacity);
+    break;
+  }
+  return array;
+}
+
+ObjMap *new_map(int capacity) {
+  ObjMap *map = ALLOCATE_OBJ(ObjMap, OBJ_MAP);
+  map->entries = NULL;
+  map->used = 0;
+  map->count = 0;
+  map->capacity = 0;
+  map->slots = NULL;
+  map->slot_capacity = 0;
+  if (capacity > 0) {
+    resize_map(map, capacity);
+  }
+  return map;
+}
+
 // allocates memory for new function object.
 ObjFunction *new_function() {
   ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
   function->arity = 0;
+  function->max_stack = 0;
   function->name = NULL;
+  function->compiled = NULL;
+  function->call_count = 0;
+  function->jit = NULL;
+  function->loops = NULL;
+  function->registers = NULL;
+  function->call_caches = NULL;
+  function->call_cache_count = 0;
+  function->property_caches = NULL;
+  function->property_cache_count = 0;
+  function->captures = NULL;
+  function->capture_count = 0;
+  function->memo = NULL;
   init_chunk(&function->chunk);
   return function;
 }
 
+void init_call_caches(ObjFunction *function, int count) {
+  function->call_caches = ALLOCATE(CallCache, count);
+  function->call_cache_count = count;
+  for (int i = 0; i < count; i++) {
+    function->call_caches[i].callee = NULL;
+  }
+}
+
+void init_property_caches(ObjFunction *function, int count) {
+  function->property_caches = ALLOCATE(PropertyCache, count);
+  function->property_cache_count = count;
+  for (int i = 0; i < count; i++) {
+    function->property_caches[i].count = 0;
+  }
+}
+
+ObjShape *new_shape(ObjShape *parent, ObjString *name) {
+  ObjShape *shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+  shape->parent = parent;
+  shape->name = name;
+  shape->field_count = parent == NULL ? 0 : parent->field_count + 1;
+  init_table(&shape->transitions);
+  return shape;
+}
+
+ObjClass *new_class(ObjString *name) {
+  ObjClass *klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+  klass->name = name;
+  init_table(&klass->methods);
+  klass->initializer = NULL_VAL;
+  klass->shape = new_shape(NULL, NULL);
+  klass->field_capacity = 0;
+  return klass;
+}
+
+ObjInstance *new_instance(ObjClass *klass) {
+  ObjInstance *instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+  instance->klass = klass;
+  instance->shape = klass->shape;
+  instance->capacity = klass->field_capacity;
+  instance->fields = ALLOCATE(Value, instance->capacity);
+  return instance;
+}
+
+ObjBoundMethod *new_bound_method(Value receiver, Value method) {
+  ObjBoundMethod *bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+  bound->receiver = receiver;
+  bound->method = method;
+  return bound;
+}
+
+static void init_dfa(Dfa *dfa) {
+  dfa->states = NULL;
+  dfa->state_count = 0;
+  dfa->state_capacity = 0;
+  dfa->transitions = NULL;
+  dfa->state_index = NULL;
+}
+
+ObjRegex *new_regex(ObjString *pattern) {
+  ObjRegex *regex = ALLOCATE_OBJ(ObjRegex, OBJ_REGEX);
+  regex->pattern = pattern;
+  regex->code = NULL;
+  regex->code_count = 0;
+  regex->code_capacity = 0;
+  regex->classes = NULL;
+  regex->class_count = 0;
+  regex->class_capacity = 0;
+  regex->column_count = 0;
+  init_dfa(&regex->dfa);
+  init_dfa(&regex->reverse);
+  regex->preds = NULL;
+  regex->pred_starts = NULL;
+  regex->marks = NULL;
+  regex->generation = 0;
+  regex->stack = NULL;
+  regex->thread_pcs = NULL;
+  regex->thread_starts = NULL;
+  return regex;
+}
+
 // create new C native object.
-ObjNative *new_native(NativeFn function) {
+ObjNative *new_native(NativeFn function, NativeCallFn call, int min_arity,
+                      int max_arity) {
   ObjNative *native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = function;
+  native->call = call;
+  native->min_arity = min_arity;
+  native->max_arity = max_arity;
   return native;
 }
 
+ObjClosure *new_closure(ObjFunction *function) {
+  ObjClosure *closure = (ObjClosure *)allocate_object(
+      sizeof(ObjClosure) + sizeof(Value) * function->capture_count,
+      OBJ_CLOSURE);
+  closure->function = function;
+  closure->capture_count = function->capture_count;
+  return closure;
+}
+
+ObjUpvalue *new_upvalue(Value *slot) {
+  ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
+  upvalue->location = slot;
+  upvalue->closed = NULL_VAL;
+  upvalue->next = NULL;
+  return upvalue;
+}
+
 ObjString *take_string(char *chars, size_t length) {
   uint32_t hash = hash_string(chars, length);
 
@@ -79,6 +229,28 @@ ObjString *copy_string(const char *chars, size_t length) {
   return allocate_string(heap_chars, length, hash);
 }
 
+ObjSlice *new_slice(ObjString *owner, const char *chars, size_t length) {
+  ObjSlice *slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+  slice->owner = owner;
+  slice->chars = chars;
+  slice->length = length;
+  return slice;
+}
+
+ObjString *intern_text(Value text) {
+  if (IS_STRING(text)) {
+    return AS_STRING(text);
+  }
+  return copy_string(AS_SLICE(text)->chars, AS_SLICE(text)->length);
+}
+
+bool texts_equal(Value a, Value b) {
+  if (!IS_TEXT(a) || !IS_TEXT(b) || text_length(a) != text_length(b)) {
+    return false;
+  }
+  return memcmp(text_chars(a), text_chars(b), text_length(a)) == 0;
+}
+
 void print_function(ObjFunction *function) {
   if (function->name == NULL) {
     printf("<script>");
@@ -87,18 +259,96 @@ void print_function(ObjFunction *function) {
   printf("<fn %s>", function->name->chars);
 }
 
+static void print_array(ObjArray *array) {
+  printf("[");
+  for (int i = 0; i < array->count; i++) {
+    if (i > 0) {
+      printf(", ");
+    }
+    print_value(array_get(array, i));
+  }
+  printf("]");
+}
+
+static void print_map(ObjMap *map) {
+  printf("{");
+  bool first = true;
+  for (int i = 0; i < map->used; i++) {
+    MapEntry *entry = &map->entries[i];
+    if (IS_NULL(entry->key)) {
+      continue;
+    }
+    if (!first) {
+      printf(", ");
+    }
+    first = false;
+    print_value(entry->key);
+    printf(": ");
+    print_value(entry->value);
+  }
+  printf("}");
+}
+
+/*
+ * Function of a method, which is a function or a closure.
+ */
+static ObjFunction *method_function(Value method) {
+  return IS_CLOSURE(method) ? AS_CLOSURE(method)->function
+                            : AS_FUNCTION(method);
+}
+
 void print_object(Value value) {
   switch (OBJ_TYPE(value)) {
+  case OBJ_ARRAY:
+    print_array(AS_ARRAY(value));
+    break;
+
+  case OBJ_BOUND_METHOD:
+    print_function(method_function(AS_BOUND_METHOD(value)->method));
+    break;
+
+  case OBJ_CLASS:
+    printf("<class %s>", AS_CLASS(value)->name->chars);
+    break;
+
+  case OBJ_INSTANCE:
+    printf("<%s instance>", AS_INSTANCE(value)->klass->name->chars);
+    break;
+
+  case OBJ_REGEX:
+    printf("<regex %s>", AS_REGEX(value)->pattern->chars);
+    break;
+
+  case OBJ_SHAPE:
+    printf("<shape>");
+    break;
+
   case OBJ_STRING:
     printf("\"%s\"", AS_CSTRING(value));
     break;
 
+  case OBJ_SLICE:
+    printf("\"%.*s\"", (int)AS_SLICE(value)->length, AS_SLICE(value)->chars);
+    break;
+
+  case OBJ_CLOSURE:
+    print_function(AS_CLOSURE(value)->function);
+    break;
+
   case OBJ_FUNCTION:
     print_function(AS_FUNCTION(value));
     break;
 
+  case OBJ_MAP:
+    print_map(AS_MAP(value));
+    break;
+
   case OBJ_NATIVE:
     printf("<native fn>");
     break;
+
+  case OBJ_UPVALUE:
+    printf("<upvalue>");
+    break;
   }
 }
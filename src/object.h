@@ -3,23 +3,52 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
+#define IS_ARRAY(value) isObjectType(value, OBJ_ARRAY)
+#define IS_BOUND_METHOD(value) isObjectType(value, OBJ_BOUND_METHOD)
+#define IS_CLASS(value) isObjectType(value, OBJ_CLASS)
+#define IS_CLOSURE(value) isObjectType(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value) isObjectType(value, OBJ_FUNCTION)
+#define IS_INSTANCE(value) isObjectType(value, OBJ_INSTANCE)
+#define IS_MAP(value) isObjectType(value, OBJ_MAP)
 #define IS_NATIVE(value) isObjectType(value, OBJ_NATIVE)
+#define IS_REGEX(value) isObjectType(value, OBJ_REGEX)
+#define IS_SLICE(value) isObjectType(value, OBJ_SLICE)
 #define IS_STRING(value) isObjectType(value, OBJ_STRING)
+// strings and slices of them, which behave the same.
+#define IS_TEXT(value) (IS_STRING(value) || IS_SLICE(value))
 
+#define AS_ARRAY(value) ((ObjArray *)AS_OBJ(value))
+#define AS_BOUND_METHOD(value) ((ObjBoundMethod *)AS_OBJ(value))
+#define AS_CLASS(value) ((ObjClass *)AS_OBJ(value))
+#define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
 #define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
-#define AS_NATIVE(value) (((ObjNative *)AS_OBJ(value))->function)
+#define AS_INSTANCE(value) ((ObjInstance *)AS_OBJ(value))
+#define AS_MAP(value) ((ObjMap *)AS_OBJ(value))
+#define AS_NATIVE(value) ((ObjNative *)AS_OBJ(value))
+#define AS_REGEX(value) ((ObjRegex *)AS_OBJ(value))
+#define AS_SLICE(value) ((ObjSlice *)AS_OBJ(value))
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
 
 typedef enum {
+  OBJ_ARRAY,
+  OBJ_BOUND_METHOD,
+  OBJ_CLASS,
+  OBJ_CLOSURE,
   OBJ_FUNCTION,
+  OBJ_INSTANCE,
+  OBJ_MAP,
   OBJ_NATIVE,
+  OBJ_REGEX,
+  OBJ_SHAPE,
+  OBJ_SLICE,
   OBJ_STRING,
+  OBJ_UPVALUE,
 } ObjType;
 
 struct Obj {
@@ -27,18 +56,378 @@ struct Obj {
   struct Obj *next;
 };
 
+struct CallFrame;
+struct LoopTable;
+struct Memo;
+struct ObjShape;
+struct RegisterCode;
+
+/*
+ * Last callee of a call site, calls to the same callee skip checking its
+ * type and arity again.
+ */
+typedef struct {
+  // NULL until the call site made a call.
+  Obj *callee;
+  ObjType kind;
+} CallCache;
+
+// shapes a property cache holds entries for, a site which sees more looks
+// the others up every time.
+#define PROPERTY_CACHE_WAYS 4
+
+/*
+ * Where a property instruction found its property on instances of one shape.
+ */
+typedef struct {
+  // NULL for an unused entry.
+  struct ObjShape *shape;
+  // shape an assignment adding the field moves the instance to, otherwise
+  // the same shape.
+  struct ObjShape *next;
+  // slot of the field, -1 if the property is a method.
+  int slot;
+  Value method;
+} PropertyEntry;
+
+/*
+ * Inline cache of a property instruction, monomorphic while the site has
+ * seen one shape and polymorphic up to PROPERTY_CACHE_WAYS of them.
+ */
+typedef struct {
+  PropertyEntry entries[PROPERTY_CACHE_WAYS];
+  int count;
+} PropertyCache;
+
+/*
+ * Native code a function was compiled to ahead of time. It's called with the
+ * function's frame already pushed and runs it to completion, returning false
+ * after reporting a runtime error.
+ */
+typedef bool (*CompiledFn)(struct CallFrame *frame);
+
+/*
+ * Outcome of running a function's jit compiled machine code.
+ */
+typedef enum {
+  // the function returned and its frame was popped.
+  JIT_RETURNED,
+  // the frame is left to the interpreter, to resume at its ip.
+  JIT_EXITED,
+  // a runtime error was reported.
+  JIT_ERROR,
+} JitResult;
+
+/*
+ * Machine code the jit compiled a function to, called with the function's
+ * frame already pushed.
+ */
+typedef JitResult (*JitFn)(struct CallFrame *frame);
+
+// where OP_CLOSURE takes a captured variable from.
+typedef enum {
+  // a local of the function creating the closure.
+  CAPTURE_LOCAL,
+  // a capture of the closure creating the closure.
+  CAPTURE_OUTER,
+  // the closure itself, a local function referring to its own name.
+  CAPTURE_SELF,
+} CaptureSource;
+
+/*
+ * A variable of an enclosing function a function refers to.
+ */
+typedef struct {
+  CaptureSource source;
+  // the closure shares the variable through an ObjUpvalue cell because it
+  // is assigned somewhere, otherwise the closure holds a copy of its value.
+  bool cell;
+  // slot of the local or index of the enclosing closure's capture.
+  uint16_t index;
+} Capture;
+
 typedef struct {
   Obj obj;
   int arity;
+  // maximum stack height of a frame running this function, computed by the
+  // bytecode verifier.
+  int max_stack;
   Chunk chunk;
   ObjString *name;
+  // native code for the function, NULL if it's interpreted.
+  CompiledFn compiled;
+  // calls so far, the jit compiles a function once it gets hot.
+  int call_count;
+  // jit compiled machine code, NULL until then.
+  JitFn jit;
+  // hot loop counters and traces, NULL until a loop jumps back.
+  struct LoopTable *loops;
+  // register machine code, NULL until the function is first called there.
+  struct RegisterCode *registers;
+  // one cache for each call site in the chunk, indexed by the call's operand.
+  CallCache *call_caches;
+  int call_cache_count;
+  // one cache for each property instruction, indexed by its operand.
+  PropertyCache *property_caches;
+  int property_cache_count;
+  // variables the function captures, it's only ever called through an
+  // ObjClosure holding them when there are any.
+  Capture *captures;
+  int capture_count;
+  // results by arguments of a `memo fn`, NULL for other functions.
+  struct Memo *memo;
 } ObjFunction;
 
+/*
+ * A captured variable which is assigned after being captured. It points at
+ * the variable's stack slot while that is alive, and holds the value itself
+ * once the slot is popped.
+ */
+typedef struct ObjUpvalue {
+  Obj obj;
+  Value *location;
+  Value closed;
+  // next open upvalue, further down the stack.
+  struct ObjUpvalue *next;
+} ObjUpvalue;
+
+/*
+ * A function together with the variables it captured, only made for
+ * functions which capture any. Captured values are copied in, assigned
+ * variables are held as ObjUpvalue cells.
+ */
+typedef struct {
+  Obj obj;
+  ObjFunction *function;
+  int capture_count;
+  Value captures[];
+} ObjClosure;
+
+/*
+ * Hidden class of instances: the fields they have, in the order of their
+ * slots. Instances which got the same fields in the same order share a shape,
+ * adding a field moves an instance to a child shape.
+ */
+typedef struct ObjShape {
+  Obj obj;
+  // shape without the last field, NULL for a class's empty shape.
+  struct ObjShape *parent;
+  // name of the last field, its slot is field_count - 1.
+  ObjString *name;
+  int field_count;
+  // child shapes by the name of the field they add.
+  Table transitions;
+} ObjShape;
+
+typedef struct {
+  Obj obj;
+  ObjString *name;
+  Table methods;
+  // the `init` method, null if there's none.
+  Value initializer;
+  // shape of new instances, without fields.
+  ObjShape *shape;
+  // most fields an instance got so far, new instances get room for as many.
+  int field_capacity;
+} ObjClass;
+
+/*
+ * An object of a class, its fields are a flat array laid out by its shape.
+ */
+typedef struct {
+  Obj obj;
+  ObjClass *klass;
+  ObjShape *shape;
+  Value *fields;
+  int capacity;
+} ObjInstance;
+
+/*
+ * A method read off an instance, calling it calls the method with the
+ * instance as `this`.
+ */
+typedef struct {
+  Obj obj;
+  Value receiver;
+  // the method's ObjFunction or ObjClosure.
+  Value method;
+} ObjBoundMethod;
+
+/*
+ * How an array stores its elements. Arrays of only integers or only floats
+ * keep them unboxed, storing anything else turns them into a Value array.
+ */
+typedef enum {
+  ARRAY_INTS,
+  ARRAY_FLOATS,
+  ARRAY_VALUES,
+} ArrayKind;
+
+typedef struct {
+  Obj obj;
+  ArrayKind kind;
+  int count;
+  int capacity;
+  union {
+    int64_t *ints;
+    double *floats;
+    Value *values;
+  } as;
+} ObjArray;
+
+// position of a map slot which never held an entry.
+#define MAP_EMPTY -1
+// position of a map slot whose entry was removed, probing continues past it.
+#define MAP_REMOVED -2
+
+/*
+ * A key and its value, entries are kept in the order they were added. A
+ * removed entry is left with a null key until the map is rebuilt.
+ */
+typedef struct {
+  Value key;
+  Value value;
+} MapEntry;
+
+/*
+ * A slot of a map's hash index. The key's hash is kept inline so probing
+ * only touches entries whose hash matches.
+ */
+typedef struct {
+  uint32_t hash;
+  // position in the entries, MAP_EMPTY or MAP_REMOVED.
+  int32_t entry;
+} MapSlot;
+
+/*
+ * Hash map with string, number and boolean keys. Entries are a dense array
+ * in insertion order, which is also the order they are iterated in, and a
+ * separate open addressed index finds them by key.
+ */
+typedef struct {
+  Obj obj;
+  MapEntry *entries;
+  // entries used, including removed ones.
+  int used;
+  // keys in the map.
+  int count;
+  int capacity;
+  MapSlot *slots;
+  // a power of two, kept above capacity so the index is at most 3/4 full.
+  int slot_capacity;
+} ObjMap;
+
+/*
+ * Instructions of a compiled regular expression, see re.c.
+ */
+typedef enum {
+  // consumes a byte of the set a.
+  REGEX_CLASS,
+  // continues at a and at b, a being preferred.
+  REGEX_SPLIT,
+  // continues at a.
+  REGEX_JUMP,
+  // continues only at the start of the subject, `^`.
+  REGEX_START,
+  // continues only at the end of the subject, `$`.
+  REGEX_END,
+  REGEX_MATCH,
+} RegexOp;
+
+typedef struct {
+  RegexOp op;
+  int a;
+  int b;
+} RegexInst;
+
+// 256 bits, one for every byte.
+typedef struct {
+  uint8_t bits[32];
+} ByteSet;
+
+/*
+ * State of a regex's dfa, the set of instructions its threads are at.
+ */
+typedef struct {
+  // REGEX_CLASS, REGEX_END and REGEX_MATCH instructions, sorted.
+  int *pcs;
+  int count;
+  // a match ends here.
+  bool accepting;
+  // a match ends here if the subject does.
+  bool accepting_at_end;
+} DfaState;
+
+/*
+ * States of a dfa, built lazily while matching.
+ */
+typedef struct {
+  DfaState *states;
+  int state_count;
+  int state_capacity;
+  // next state for every state and column, -1 until first needed.
+  int *transitions;
+  // hash index of the states by their sets, -1 for empty slots.
+  int *state_index;
+} Dfa;
+
+/*
+ * Regular expression compiled to a program for the pike vm, and the states
+ * of the dfas built from it while matching.
+ */
+typedef struct {
+  Obj obj;
+  ObjString *pattern;
+  RegexInst *code;
+  int code_count;
+  int code_capacity;
+  ByteSet *classes;
+  int class_count;
+  int class_capacity;
+  // bytes which every class either holds or lacks together share a column
+  // of the dfa's transitions.
+  uint8_t byte_columns[256];
+  // a byte of every column.
+  uint8_t column_bytes[256];
+  int column_count;
+  // finds whether there is a match, reading the subject forwards.
+  Dfa dfa;
+  // finds where a match can still go on to, reading the subject backwards.
+  // Its states are the REGEX_CLASS instructions from which a match is
+  // reached.
+  Dfa reverse;
+  // instructions which continue to every instruction without reading a
+  // byte, those of pc from pred_starts[pc] to pred_starts[pc + 1].
+  int *preds;
+  int *pred_starts;
+  // scratch of the matchers, code_count or more each.
+  int *marks;
+  int generation;
+  int *stack;
+  int *thread_pcs;
+  size_t *thread_starts;
+} ObjRegex;
+
 typedef Value (*NativeFn)(int arg_count, Value *args);
 
+// what a NativeCallFn gets to call back into zspie with, see vm.h.
+typedef struct NativeContext NativeContext;
+
+/*
+ * Natives which can fail or call zspie functions.
+ * @return false after reporting a runtime error, leaving result unset.
+ */
+typedef bool (*NativeCallFn)(NativeContext *context, int arg_count,
+                             Value *args, Value *result);
+
 typedef struct {
   Obj obj;
+  // one of the two is set, the other is NULL.
   NativeFn function;
+  NativeCallFn call;
+  // fewest and most arguments it takes, -1 most for any number.
+  int min_arity;
+  int max_arity;
 } ObjNative;
 
 struct ObjString {
@@ -48,15 +437,87 @@ struct ObjString {
   uint32_t hash;
 };
 
+/*
+ * Part of a string, pointing into the characters of the string instead of
+ * copying them. Slices aren't interned, they are turned into strings where
+ * identity matters, like map keys.
+ */
+typedef struct {
+  Obj obj;
+  // the string the characters belong to, never a slice.
+  ObjString *owner;
+  const char *chars;
+  size_t length;
+} ObjSlice;
+
+/*
+ * Allocates an empty array with room for capacity elements of kind.
+ */
+ObjArray *new_array(ArrayKind kind, int capacity);
+/*
+ * Allocates an empty map with room for capacity keys before it grows.
+ */
+ObjMap *new_map(int capacity);
 ObjFunction *new_function();
-ObjNative *new_native(NativeFn function);
+ObjNative *new_native(NativeFn function, NativeCallFn call, int min_arity,
+                      int max_arity);
+/*
+ * Allocates a closure of function with room for its captures, which the
+ * caller fills in.
+ */
+ObjClosure *new_closure(ObjFunction *function);
+ObjUpvalue *new_upvalue(Value *slot);
+/*
+ * Allocates count empty call caches for the call sites of a function.
+ */
+void init_call_caches(ObjFunction *function, int count);
+/*
+ * Allocates count empty property caches for the property instructions of a
+ * function.
+ */
+void init_property_caches(ObjFunction *function, int count);
+ObjShape *new_shape(ObjShape *parent, ObjString *name);
+ObjClass *new_class(ObjString *name);
+/*
+ * Allocates an instance without fields, with room for as many as other
+ * instances of its class got.
+ */
+ObjInstance *new_instance(ObjClass *klass);
+ObjBoundMethod *new_bound_method(Value receiver, Value method);
+/*
+ * Allocates a regex of pattern without a program, re.c compiles it.
+ */
+ObjRegex *new_regex(ObjString *pattern);
 ObjString *take_string(char *chars, size_t length);
+uint32_t hash_string(const char *key, size_t length);
 ObjString *copy_string(const char *chars, size_t length);
+/*
+ * Slice of length characters of owner from chars on, which the caller
+ * checked are inside it.
+ */
+ObjSlice *new_slice(ObjString *owner, const char *chars, size_t length);
+/*
+ * Interned string with the characters of a string or slice.
+ */
+ObjString *intern_text(Value text);
+/*
+ * Whether two objects, one of them a slice, are strings or slices with the
+ * same characters.
+ */
+bool texts_equal(Value a, Value b);
 
 static inline bool isObjectType(Value value, ObjType obj_type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == obj_type;
 }
 
+static inline const char *text_chars(Value text) {
+  return IS_STRING(text) ? AS_STRING(text)->chars : AS_SLICE(text)->chars;
+}
+
+static inline size_t text_length(Value text) {
+  return IS_STRING(text) ? AS_STRING(text)->length : AS_SLICE(text)->length;
+}
+
 void print_object(Value value);
 
 #endif // !ZSPIE_OBJECT_H_
@@ -0,0 +1,1108 @@
+#include "re.h"
+#include "array.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "text.h"
+#include "value.h"
+#include "vm.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+// largest bound of a repetition.
+#define REPEAT_MAX 1000
+// deepest nesting of groups and repetitions.
+#define NESTING_MAX 200
+// most instructions of a program.
+#define CODE_MAX 65536
+// most states of a dfa, searches needing more run on the pike vm. They
+// must fit in a uint16_t.
+#define DFA_STATES_MAX 512
+// slots of the index of a dfa's states, at least twice as many as states.
+#define DFA_INDEX_SIZE 1024
+
+/*
+ * Parsed patterns are trees of nodes. Concatenations and alternations are
+ * lists, linked through right, so long patterns don't nest deeply.
+ */
+typedef enum {
+  NODE_EMPTY,
+  // left is the set.
+  NODE_CLASS,
+  NODE_START,
+  NODE_END,
+  // left is the first part, right the rest of the list or -1.
+  NODE_CONCAT,
+  NODE_ALTERNATE,
+  // left repeated min to max times, max -1 for no bound.
+  NODE_REPEAT,
+} NodeKind;
+
+typedef struct {
+  NodeKind kind;
+  int left;
+  int right;
+  int min;
+  int max;
+  bool greedy;
+} Node;
+
+typedef struct {
+  const char *current;
+  const char *end;
+  Node *nodes;
+  int node_count;
+  int node_capacity;
+  ByteSet *classes;
+  int class_count;
+  int class_capacity;
+  RegexInst *code;
+  int code_count;
+  int code_capacity;
+  // message of the first error, NULL while there is none.
+  const char *error;
+} Parser;
+
+static inline bool in_set(const ByteSet *set, uint8_t byte) {
+  return set->bits[byte >> 3] & (1 << (byte & 7));
+}
+
+static void add_range(ByteSet *set, int low, int high) {
+  for (int byte = low; byte <= high; byte++) {
+    set->bits[byte >> 3] |= (uint8_t)(1 << (byte & 7));
+  }
+}
+
+static void invert_set(ByteSet *set) {
+  for (int i = 0; i < 32; i++) {
+    set->bits[i] = (uint8_t)~set->bits[i];
+  }
+}
+
+static int add_node(Parser *parser, NodeKind kind, int left, int right) {
+  if (parser->node_count == parser->node_capacity) {
+    int old_capacity = parser->node_capacity;
+    parser->node_capacity = GROW_CAPACITY(old_capacity);
+    parser->nodes =
+        GROW_ARRAY(Node, parser->nodes, old_capacity, parser->node_capacity);
+  }
+  parser->nodes[parser->node_count] = (Node){kind, left, right, 0, 0, true};
+  return parser->node_count++;
+}
+
+static int add_class(Parser *parser, const ByteSet *set) {
+  if (parser->class_count == parser->class_capacity) {
+    int old_capacity = parser->class_capacity;
+    parser->class_capacity = GROW_CAPACITY(old_capacity);
+    parser->classes = GROW_ARRAY(ByteSet, parser->classes, old_capacity,
+                                 parser->class_capacity);
+  }
+  parser->classes[parser->class_count] = *set;
+  return add_node(parser, NODE_CLASS, parser->class_count++, -1);
+}
+
+static int fail(Parser *parser, const char *message) {
+  if (parser->error == NULL) {
+    parser->error = message;
+  }
+  return -1;
+}
+
+static bool at_end(Parser *parser) { return parser->current == parser->end; }
+
+static bool match(Parser *parser, char expected) {
+  if (at_end(parser) || *parser->current != expected) {
+    return false;
+  }
+  parser->current++;
+  return true;
+}
+
+/*
+ * Adds the bytes of the class escapes `\d \w \s` and their negations.
+ * @return false for any other escape.
+ */
+static bool class_escape(char escape, ByteSet *set) {
+  ByteSet bytes = {{0}};
+  switch (tolower((unsigned char)escape)) {
+  case 'd':
+    add_range(&bytes, '0', '9');
+    break;
+  case 'w':
+    add_range(&bytes, '0', '9');
+    add_range(&bytes, 'a', 'z');
+    add_range(&bytes, 'A', 'Z');
+    add_range(&bytes, '_', '_');
+    break;
+  case 's':
+    add_range(&bytes, ' ', ' ');
+    add_range(&bytes, '\t', '\r');
+    break;
+  default:
+    return false;
+  }
+  if (isupper((unsigned char)escape)) {
+    invert_set(&bytes);
+  }
+  for (int i = 0; i < 32; i++) {
+    set->bits[i] |= bytes.bits[i];
+  }
+  return true;
+}
+
+/*
+ * Byte of an escape standing for a single byte, punctuation stands for
+ * itself.
+ * @return -1 for letters and digits without a meaning.
+ */
+static int escaped_byte(char escape) {
+  switch (escape) {
+  case 'n':
+    return '\n';
+  case 't':
+    return '\t';
+  case 'r':
+    return '\r';
+  case 'f':
+    return '\f';
+  case 'v':
+    return '\v';
+  default:
+    return isalnum((unsigned char)escape) ? -1 : (uint8_t)escape;
+  }
+}
+
+/*
+ * Reads a byte of a `[]` class, which may be escaped.
+ * @return -1 after an error.
+ */
+static int class_byte(Parser *parser, char c) {
+  if (c != '\\') {
+    return (uint8_t)c;
+  }
+  if (at_end(parser)) {
+    return fail(parser, "Missing ']'.");
+  }
+  int byte = escaped_byte(*parser->current++);
+  return byte == -1 ? fail(parser, "Unknown escape in class.") : byte;
+}
+
+// parses the class after its '['.
+static int parse_class(Parser *parser) {
+  ByteSet set = {{0}};
+  bool negated = match(parser, '^');
+  // a ']' first is part of the class.
+  bool first = true;
+  for (;;) {
+    if (at_end(parser)) {
+      return fail(parser, "Missing ']'.");
+    }
+    char c = *parser->current++;
+    if (c == ']' && !first) {
+      break;
+    }
+    first = false;
+    if (c == '\\' && !at_end(parser) &&
+        class_escape(*parser->current, &set)) {
+      parser->current++;
+      continue;
+    }
+
+    int low = class_byte(parser, c);
+    int high = low;
+    if (parser->end - parser->current >= 2 && parser->current[0] == '-' &&
+        parser->current[1] != ']') {
+      parser->current++;
+      high = class_byte(parser, *parser->current++);
+    }
+    if (low == -1 || high == -1) {
+      return -1;
+    }
+    if (high < low) {
+      return fail(parser, "Range out of order in class.");
+    }
+    add_range(&set, low, high);
+  }
+  if (negated) {
+    invert_set(&set);
+  }
+  return add_class(parser, &set);
+}
+
+static int parse_alternation(Parser *parser, int depth);
+
+static int parse_atom(Parser *parser, int depth) {
+  ByteSet set = {{0}};
+  char c = *parser->current++;
+  switch (c) {
+  case '(': {
+    if (depth >= NESTING_MAX) {
+      return fail(parser, "Pattern nests too deeply.");
+    }
+    if (parser->end - parser->current >= 2 && parser->current[0] == '?' &&
+        parser->current[1] == ':') {
+      parser->current += 2;
+    }
+    int group = parse_alternation(parser, depth + 1);
+    if (!match(parser, ')')) {
+      return fail(parser, "Missing ')'.");
+    }
+    return group;
+  }
+  case '[':
+    return parse_class(parser);
+  case '.':
+    add_range(&set, '\n', '\n');
+    invert_set(&set);
+    return add_class(parser, &set);
+  case '^':
+    return add_node(parser, NODE_START, -1, -1);
+  case '$':
+    return add_node(parser, NODE_END, -1, -1);
+  case '\\': {
+    if (at_end(parser)) {
+      return fail(parser, "Pattern ends with '\\'.");
+    }
+    char escape = *parser->current++;
+    if (!class_escape(escape, &set)) {
+      int byte = escaped_byte(escape);
+      if (byte == -1) {
+        return fail(parser, "Unknown escape.");
+      }
+      add_range(&set, byte, byte);
+    }
+    return add_class(parser, &set);
+  }
+  case '*':
+  case '+':
+  case '?':
+  case '{':
+    return fail(parser, "Nothing to repeat.");
+  default:
+    add_range(&set, (uint8_t)c, (uint8_t)c);
+    return add_class(parser, &set);
+  }
+}
+
+// reads the digits of a `{m,n}` bound, -1 if there are none.
+static int parse_bound(Parser *parser) {
+  if (at_end(parser) || !isdigit((unsigned char)*parser->current)) {
+    return -1;
+  }
+  int bound = 0;
+  while (!at_end(parser) && isdigit((unsigned char)*parser->current)) {
+    bound = bound * 10 + (*parser->current++ - '0');
+    if (bound > REPEAT_MAX) {
+      return REPEAT_MAX + 1;
+    }
+  }
+  return bound;
+}
+
+static int parse_repeat(Parser *parser, int depth) {
+  int node = parse_atom(parser, depth);
+  while (node != -1 && !at_end(parser)) {
+    char c = *parser->current;
+    if (c != '*' && c != '+' && c != '?' && c != '{') {
+      break;
+    }
+    parser->current++;
+
+    int min = c == '+' ? 1 : 0;
+    int max = c == '?' ? 1 : -1;
+    if (c == '{') {
+      min = parse_bound(parser);
+      max = match(parser, ',') ? parse_bound(parser) : min;
+      if (min == -1 || !match(parser, '}')) {
+        return fail(parser, "Expected '{m}', '{m,}' or '{m,n}'.");
+      }
+      if (min > REPEAT_MAX || max > REPEAT_MAX || (max != -1 && max < min)) {
+        return fail(parser, "Repetition bounds out of range.");
+      }
+    }
+
+    // every repetition nests the node once more.
+    if (++depth > NESTING_MAX) {
+      return fail(parser, "Pattern nests too deeply.");
+    }
+    node = add_node(parser, NODE_REPEAT, node, -1);
+    parser->nodes[node].min = min;
+    parser->nodes[node].max = max;
+    parser->nodes[node].greedy = !match(parser, '?');
+  }
+  return node;
+}
+
+static int parse_concatenation(Parser *parser, int depth) {
+  int head = -1;
+  int tail = -1;
+  while (!at_end(parser) && *parser->current != '|' &&
+         *parser->current != ')') {
+    int part = parse_repeat(parser, depth);
+    if (part == -1) {
+      return -1;
+    }
+    int link = add_node(parser, NODE_CONCAT, part, -1);
+    if (tail == -1) {
+      head = link;
+    } else {
+      parser->nodes[tail].right = link;
+    }
+    tail = link;
+  }
+  return head == -1 ? add_node(parser, NODE_EMPTY, -1, -1) : head;
+}
+
+static int parse_alternation(Parser *parser, int depth) {
+  int first = parse_concatenation(parser, depth);
+  if (first == -1 || at_end(parser) || *parser->current != '|') {
+    return first;
+  }
+
+  int head = add_node(parser, NODE_ALTERNATE, first, -1);
+  int tail = head;
+  while (match(parser, '|')) {
+    int alternative = parse_concatenation(parser, depth);
+    if (alternative == -1) {
+      return -1;
+    }
+    int link = add_node(parser, NODE_ALTERNATE, alternative, -1);
+    parser->nodes[tail].right = link;
+    tail = link;
+  }
+  return head;
+}
+
+static int emit(Parser *parser, RegexOp op, int a, int b) {
+  if (parser->code_count == parser->code_capacity) {
+    int old_capacity = parser->code_capacity;
+    parser->code_capacity = GROW_CAPACITY(old_capacity);
+    parser->code = GROW_ARRAY(RegexInst, parser->code, old_capacity,
+                              parser->code_capacity);
+  }
+  parser->code[parser->code_count] = (RegexInst){op, a, b};
+  return parser->code_count++;
+}
+
+static bool emit_node(Parser *parser, int index);
+
+/*
+ * Emits the optional or unbounded repetition of a node, a split either
+ * entering the node or skipping it.
+ */
+static bool emit_optional(Parser *parser, Node *node, bool loop) {
+  int split = emit(parser, REGEX_SPLIT, 0, 0);
+  if (!emit_node(parser, node->left)) {
+    return false;
+  }
+  if (loop) {
+    emit(parser, REGEX_JUMP, split, 0);
+  }
+  int body = split + 1;
+  int skip = parser->code_count;
+  parser->code[split].a = node->greedy ? body : skip;
+  parser->code[split].b = node->greedy ? skip : body;
+  return true;
+}
+
+static bool emit_node(Parser *parser, int index) {
+  if (parser->code_count > CODE_MAX) {
+    fail(parser, "Pattern is too large.");
+    return false;
+  }
+
+  Node *node = &parser->nodes[index];
+  switch (node->kind) {
+  case NODE_EMPTY:
+    return true;
+
+  case NODE_CLASS:
+    emit(parser, REGEX_CLASS, node->left, 0);
+    return true;
+
+  case NODE_START:
+    emit(parser, REGEX_START, 0, 0);
+    return true;
+
+  case NODE_END:
+    emit(parser, REGEX_END, 0, 0);
+    return true;
+
+  case NODE_CONCAT:
+    for (int link = index; link != -1; link = parser->nodes[link].right) {
+      if (!emit_node(parser, parser->nodes[link].left)) {
+        return false;
+      }
+    }
+    return true;
+
+  case NODE_ALTERNATE: {
+    // jumps to the end, chained through their targets until patched.
+    int jumps = -1;
+    for (int link = index; link != -1; link = parser->nodes[link].right) {
+      if (parser->nodes[link].right == -1) {
+        if (!emit_node(parser, parser->nodes[link].left)) {
+          return false;
+        }
+        break;
+      }
+      int split = emit(parser, REGEX_SPLIT, parser->code_count + 1, 0);
+      if (!emit_node(parser, parser->nodes[link].left)) {
+        return false;
+      }
+      jumps = emit(parser, REGEX_JUMP, jumps, 0);
+      parser->code[split].b = parser->code_count;
+    }
+    while (jumps != -1) {
+      int next = parser->code[jumps].a;
+      parser->code[jumps].a = parser->code_count;
+      jumps = next;
+    }
+    return true;
+  }
+
+  case NODE_REPEAT:
+    for (int i = 0; i < node->min; i++) {
+      if (!emit_node(parser, node->left)) {
+        return false;
+      }
+    }
+    if (node->max == -1) {
+      return emit_optional(parser, node, true);
+    }
+    for (int i = node->min; i < node->max; i++) {
+      if (!emit_optional(parser, node, false)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false; // unreachable.
+}
+
+/*
+ * Splits the bytes into the columns of the dfa, refining them by every
+ * class in turn.
+ */
+static void build_columns(ObjRegex *regex) {
+  memset(regex->byte_columns, 0, sizeof(regex->byte_columns));
+  regex->column_count = 1;
+  for (int i = 0; i < regex->class_count; i++) {
+    int inside[256];
+    int outside[256];
+    memset(inside, -1, sizeof(inside));
+    memset(outside, -1, sizeof(outside));
+    int count = 0;
+    for (int byte = 0; byte < 256; byte++) {
+      int *columns = in_set(&regex->classes[i], (uint8_t)byte) ? inside
+                                                               : outside;
+      int column = regex->byte_columns[byte];
+      if (columns[column] == -1) {
+        columns[column] = count++;
+      }
+      regex->byte_columns[byte] = (uint8_t)columns[column];
+    }
+    regex->column_count = count;
+  }
+  for (int byte = 255; byte >= 0; byte--) {
+    regex->column_bytes[regex->byte_columns[byte]] = (uint8_t)byte;
+  }
+}
+
+static int next_generation(ObjRegex *regex) {
+  if (regex->generation == INT_MAX) {
+    memset(regex->marks, 0, sizeof(int) * (size_t)regex->code_count);
+    regex->generation = 0;
+  }
+  return ++regex->generation;
+}
+
+/*
+ * Follows the jumps and splits from the first depth instructions of the
+ * stack, depth first so earlier alternatives come first. The instructions
+ * waiting for a byte and the matches are put into out, and the `$` not at
+ * the end of the subject if keep_ends. Instructions already marked with
+ * generation are skipped.
+ * @return how many instructions were put into out.
+ */
+static int follow(ObjRegex *regex, int depth, int generation, bool at_start,
+                  bool at_end, bool keep_ends, int *out) {
+  int *stack = regex->stack;
+  int count = 0;
+  while (depth > 0) {
+    int pc = stack[--depth];
+    if (regex->marks[pc] == generation) {
+      continue;
+    }
+    regex->marks[pc] = generation;
+
+    RegexInst *inst = &regex->code[pc];
+    switch (inst->op) {
+    case REGEX_JUMP:
+      stack[depth++] = inst->a;
+      break;
+    case REGEX_SPLIT:
+      stack[depth++] = inst->b;
+      stack[depth++] = inst->a;
+      break;
+    case REGEX_START:
+      if (at_start) {
+        stack[depth++] = pc + 1;
+      }
+      break;
+    case REGEX_END:
+      if (at_end) {
+        stack[depth++] = pc + 1;
+      } else if (keep_ends) {
+        out[count++] = pc;
+      }
+      break;
+    default:
+      out[count++] = pc;
+      break;
+    }
+  }
+  return count;
+}
+
+static int compare_pcs(const void *a, const void *b) {
+  return *(const int *)a - *(const int *)b;
+}
+
+static uint32_t hash_pcs(const int *pcs, int count) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < count; i++) {
+    hash ^= (uint32_t)pcs[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+/*
+ * State of a dfa of the regex for a set of instructions, added if it's new.
+ * The initial state is never shared, `^` only holds in the forward one and
+ * `$` in the reverse one.
+ * @return -1 once the dfa has as many states as it may.
+ */
+static int find_state(ObjRegex *regex, Dfa *dfa, int *pcs, int count,
+                      bool initial) {
+  qsort(pcs, (size_t)count, sizeof(int), compare_pcs);
+  uint32_t mask = DFA_INDEX_SIZE - 1;
+  uint32_t slot = hash_pcs(pcs, count) & mask;
+  for (; !initial && dfa->state_index[slot] != -1; slot = (slot + 1) & mask) {
+    DfaState *state = &dfa->states[dfa->state_index[slot]];
+    if (state->count == count &&
+        (count == 0 ||
+         memcmp(state->pcs, pcs, sizeof(int) * (size_t)count) == 0)) {
+      return dfa->state_index[slot];
+    }
+  }
+  if (dfa->state_count == DFA_STATES_MAX) {
+    return -1;
+  }
+
+  if (dfa->state_count == dfa->state_capacity) {
+    int old_capacity = dfa->state_capacity;
+    dfa->state_capacity = GROW_CAPACITY(old_capacity);
+    dfa->states = GROW_ARRAY(DfaState, dfa->states, old_capacity,
+                             dfa->state_capacity);
+    dfa->transitions =
+        GROW_ARRAY(int, dfa->transitions, old_capacity * regex->column_count,
+                   dfa->state_capacity * regex->column_count);
+    for (int i = old_capacity * regex->column_count;
+         i < dfa->state_capacity * regex->column_count; i++) {
+      dfa->transitions[i] = -1;
+    }
+  }
+
+  DfaState *state = &dfa->states[dfa->state_count];
+  // the dead state has no threads and no array.
+  state->pcs = NULL;
+  if (count > 0) {
+    state->pcs = ALLOCATE(int, count);
+    memcpy(state->pcs, pcs, sizeof(int) * (size_t)count);
+  }
+  state->count = count;
+  state->accepting = false;
+  // the `$` waiting in the state pass if the subject ends here.
+  int ends = 0;
+  for (int i = 0; i < count; i++) {
+    if (regex->code[pcs[i]].op == REGEX_MATCH) {
+      state->accepting = true;
+    } else if (regex->code[pcs[i]].op == REGEX_END) {
+      regex->stack[ends++] = pcs[i] + 1;
+    }
+  }
+  state->accepting_at_end = state->accepting;
+  if (ends > 0) {
+    int *reached = regex->thread_pcs + regex->code_count;
+    int reached_count = follow(regex, ends, next_generation(regex), initial,
+                               true, false, reached);
+    for (int i = 0; i < reached_count; i++) {
+      if (regex->code[reached[i]].op == REGEX_MATCH) {
+        state->accepting_at_end = true;
+      }
+    }
+  }
+
+  if (!initial) {
+    dfa->state_index[slot] = dfa->state_count;
+  }
+  return dfa->state_count++;
+}
+
+/*
+ * State the forward dfa moves to from state on a byte of column.
+ * @return -1 if it's a new state and the dfa is full.
+ */
+static int build_transition(ObjRegex *regex, int state, int column) {
+  uint8_t byte = regex->column_bytes[column];
+  Dfa *dfa = &regex->dfa;
+  DfaState *from = &dfa->states[state];
+  int seeds = 0;
+  for (int i = 0; i < from->count; i++) {
+    RegexInst *inst = &regex->code[from->pcs[i]];
+    if (inst->op == REGEX_CLASS && in_set(&regex->classes[inst->a], byte)) {
+      regex->stack[seeds++] = from->pcs[i] + 1;
+    }
+  }
+  // a match may start after every byte.
+  regex->stack[seeds++] = 0;
+
+  int *pcs = regex->thread_pcs;
+  int count =
+      follow(regex, seeds, next_generation(regex), false, false, true, pcs);
+  int next = find_state(regex, dfa, pcs, count, false);
+  if (next != -1) {
+    dfa->transitions[state * regex->column_count + column] = next;
+  }
+  return next;
+}
+
+/*
+ * Whether the regex matches somewhere in chars, on the forward dfa. It reads
+ * every byte once and stops at the first match.
+ * @return -1 if the dfa got full before it could tell.
+ */
+static int dfa_search(ObjRegex *regex, const char *chars, size_t length) {
+  Dfa *dfa = &regex->dfa;
+  int state = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (dfa->states[state].accepting) {
+      return 1;
+    }
+    int column = regex->byte_columns[(uint8_t)chars[i]];
+    int next = dfa->transitions[state * regex->column_count + column];
+    if (next == -1) {
+      next = build_transition(regex, state, column);
+      if (next == -1) {
+        return -1;
+      }
+    }
+    state = next;
+    if (dfa->states[state].count == 0) {
+      return 0;
+    }
+  }
+  return dfa->states[state].accepting_at_end;
+}
+
+/*
+ * State the reverse dfa moves to from state, the one of the position after
+ * a byte of column, to the position of the byte. A REGEX_CLASS instruction
+ * is in it if it takes the byte to an instruction from which a match is
+ * reached without reading another, or by going on to one of state's.
+ * @return -1 if it's a new state and the dfa is full.
+ */
+static int build_reverse_transition(ObjRegex *regex, int state, int column) {
+  uint8_t byte = regex->column_bytes[column];
+  Dfa *dfa = &regex->reverse;
+  DfaState *from = &dfa->states[state];
+  int *stack = regex->stack;
+  // the match is the last instruction.
+  int depth = 0;
+  stack[depth++] = regex->code_count - 1;
+  for (int i = 0; i < from->count; i++) {
+    stack[depth++] = from->pcs[i];
+  }
+
+  int generation = next_generation(regex);
+  while (depth > 0) {
+    int pc = stack[--depth];
+    if (regex->marks[pc] == generation) {
+      continue;
+    }
+    regex->marks[pc] = generation;
+    for (int i = regex->pred_starts[pc]; i < regex->pred_starts[pc + 1];
+         i++) {
+      int pred = regex->preds[i];
+      // `$` only passes at the end of the subject, the initial state's.
+      if (regex->code[pred].op != REGEX_END || state == 0) {
+        stack[depth++] = pred;
+      }
+    }
+  }
+
+  int *pcs = regex->thread_pcs;
+  int count = 0;
+  for (int pc = 0; pc < regex->code_count; pc++) {
+    RegexInst *inst = &regex->code[pc];
+    if (inst->op == REGEX_CLASS && regex->marks[pc + 1] == generation &&
+        in_set(&regex->classes[inst->a], byte)) {
+      pcs[count++] = pc;
+    }
+  }
+  int next = find_state(regex, dfa, pcs, count, false);
+  if (next != -1) {
+    dfa->transitions[state * regex->column_count + column] = next;
+  }
+  return next;
+}
+
+/*
+ * Runs the reverse dfa over chars from their end back to their start.
+ * @return the state at every position, NULL if the dfa got full.
+ */
+static uint16_t *reverse_states(ObjRegex *regex, const char *chars,
+                                size_t length) {
+  Dfa *dfa = &regex->reverse;
+  uint16_t *states = ALLOCATE(uint16_t, length);
+  int state = 0;
+  for (size_t i = length; i-- > 0;) {
+    int column = regex->byte_columns[(uint8_t)chars[i]];
+    int next = dfa->transitions[state * regex->column_count + column];
+    if (next == -1) {
+      next = build_reverse_transition(regex, state, column);
+      if (next == -1) {
+        FREE_ARRAY(uint16_t, states, length);
+        return NULL;
+      }
+    }
+    state = next;
+    states[i] = (uint16_t)state;
+  }
+  return states;
+}
+
+/*
+ * Whether state of the reverse dfa has the instruction at pc.
+ */
+static bool state_has(const DfaState *state, int pc) {
+  int low = 0;
+  int high = state->count;
+  while (low < high) {
+    int middle = low + (high - low) / 2;
+    if (state->pcs[middle] < pc) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low < state->count && state->pcs[low] == pc;
+}
+
+/*
+ * Adds a thread at pc and the threads it splits into to a list of the pike
+ * vm, all starting their match at start.
+ * @return the new length of the list.
+ */
+static int add_thread(ObjRegex *regex, int *pcs, size_t *starts, int count,
+                      int pc, size_t start, int generation, bool at_start,
+                      bool at_end) {
+  regex->stack[0] = pc;
+  int added = follow(regex, 1, generation, at_start, at_end, false,
+                     pcs + count);
+  for (int i = 0; i < added; i++) {
+    starts[count + i] = start;
+  }
+  return count + added;
+}
+
+/*
+ * Leftmost match in chars starting at from or later, on the pike vm. Every
+ * thread of the program steps through the subject together, so it never
+ * backtracks, and the threads are kept in order of preference: earlier
+ * alternatives and longer greedy repetitions win. Given the states of the
+ * reverse dfa, threads which can't reach a match are dropped, so the search
+ * stops at the end of the match instead of going on to see whether a
+ * preferred thread matches later.
+ * @return false if there is none.
+ */
+static bool pike_search(ObjRegex *regex, const char *chars, size_t length,
+                        const uint16_t *reverse, size_t from, size_t *start,
+                        size_t *end) {
+  int *current = regex->thread_pcs;
+  size_t *current_starts = regex->thread_starts;
+  int *next = regex->thread_pcs + regex->code_count;
+  size_t *next_starts = regex->thread_starts + regex->code_count;
+  int count = 0;
+  bool matched = false;
+  int generation = next_generation(regex);
+
+  for (size_t at = from;; at++) {
+    if (!matched) {
+      // a match starting here is preferred less than those already going.
+      count = add_thread(regex, current, current_starts, count, 0, at,
+                         generation, at == 0, at == length);
+    }
+    if (count == 0) {
+      break;
+    }
+
+    int next_count = 0;
+    generation = next_generation(regex);
+    for (int i = 0; i < count; i++) {
+      RegexInst *inst = &regex->code[current[i]];
+      if (inst->op == REGEX_MATCH) {
+        // threads after this one are preferred less, they are dropped.
+        matched = true;
+        *start = current_starts[i];
+        *end = at;
+        break;
+      }
+      if (at < length &&
+          (reverse == NULL
+               ? in_set(&regex->classes[inst->a], (uint8_t)chars[at])
+               : state_has(&regex->reverse.states[reverse[at]], current[i]))) {
+        next_count =
+            add_thread(regex, next, next_starts, next_count, current[i] + 1,
+                       current_starts[i], generation, false, at + 1 == length);
+      }
+    }
+    if (at == length) {
+      break;
+    }
+
+    int *pcs = current;
+    current = next;
+    next = pcs;
+    size_t *starts = current_starts;
+    current_starts = next_starts;
+    next_starts = starts;
+    count = next_count;
+  }
+  return matched;
+}
+
+/*
+ * Instructions the one at pc continues to without reading a byte, for the
+ * reverse dfa. `^` is left out, it never passes after the first byte.
+ * @return how many there are, two at most.
+ */
+static int continues_to(ObjRegex *regex, int pc, int *targets) {
+  RegexInst *inst = &regex->code[pc];
+  switch (inst->op) {
+  case REGEX_JUMP:
+    targets[0] = inst->a;
+    return 1;
+  case REGEX_SPLIT:
+    targets[0] = inst->a;
+    targets[1] = inst->b;
+    return 2;
+  case REGEX_END:
+    targets[0] = pc + 1;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/*
+ * Lists the instructions continuing to each instruction, the reverse of
+ * continues_to.
+ */
+static void build_preds(ObjRegex *regex) {
+  int size = regex->code_count;
+  int targets[2];
+  regex->pred_starts = ALLOCATE(int, size + 1);
+  memset(regex->pred_starts, 0, sizeof(int) * (size_t)(size + 1));
+  regex->preds = ALLOCATE(int, 2 * size);
+
+  // counted after the start of the next instruction's, they add up to it.
+  for (int pc = 0; pc < size; pc++) {
+    int count = continues_to(regex, pc, targets);
+    for (int i = 0; i < count; i++) {
+      regex->pred_starts[targets[i] + 1]++;
+    }
+  }
+  for (int pc = 0; pc < size; pc++) {
+    regex->pred_starts[pc + 1] += regex->pred_starts[pc];
+  }
+
+  int *placed = regex->thread_pcs;
+  memset(placed, 0, sizeof(int) * (size_t)size);
+  for (int pc = 0; pc < size; pc++) {
+    int count = continues_to(regex, pc, targets);
+    for (int i = 0; i < count; i++) {
+      int target = targets[i];
+      regex->preds[regex->pred_starts[target] + placed[target]++] = pc;
+    }
+  }
+}
+
+static void free_parser(Parser *parser) {
+  FREE_ARRAY(Node, parser->nodes, parser->node_capacity);
+  FREE_ARRAY(ByteSet, parser->classes, parser->class_capacity);
+  FREE_ARRAY(RegexInst, parser->code, parser->code_capacity);
+}
+
+/*
+ * Compiles a pattern to a regex with the initial state of its dfa.
+ * @return NULL if the pattern is invalid.
+ */
+static ObjRegex *compile_regex(ObjString *pattern) {
+  Parser parser = {0};
+  parser.current = pattern->chars;
+  parser.end = pattern->chars + pattern->length;
+  int root = parse_alternation(&parser, 0);
+  if (root != -1 && !at_end(&parser)) {
+    fail(&parser, "Unmatched ')'.");
+  }
+  if (parser.error == NULL && emit_node(&parser, root)) {
+    emit(&parser, REGEX_MATCH, 0, 0);
+  }
+  if (parser.error != NULL || parser.code_count > CODE_MAX) {
+    free_parser(&parser);
+    return NULL;
+  }
+
+  ObjRegex *regex = new_regex(pattern);
+  regex->code = parser.code;
+  regex->code_count = parser.code_count;
+  regex->code_capacity = parser.code_capacity;
+  regex->classes = parser.classes;
+  regex->class_count = parser.class_count;
+  regex->class_capacity = parser.class_capacity;
+  FREE_ARRAY(Node, parser.nodes, parser.node_capacity);
+
+  int size = regex->code_count;
+  regex->marks = ALLOCATE(int, size);
+  memset(regex->marks, 0, sizeof(int) * (size_t)size);
+  // seeds of a transition, and two pushes for every instruction.
+  regex->stack = ALLOCATE(int, 3 * size + 1);
+  regex->thread_pcs = ALLOCATE(int, 2 * size);
+  regex->thread_starts = ALLOCATE(size_t, 2 * size);
+  build_preds(regex);
+  regex->dfa.state_index = ALLOCATE(int, DFA_INDEX_SIZE);
+  memset(regex->dfa.state_index, -1, sizeof(int) * DFA_INDEX_SIZE);
+  regex->reverse.state_index = ALLOCATE(int, DFA_INDEX_SIZE);
+  memset(regex->reverse.state_index, -1, sizeof(int) * DFA_INDEX_SIZE);
+  build_columns(regex);
+
+  regex->stack[0] = 0;
+  int *pcs = regex->thread_pcs;
+  int count =
+      follow(regex, 1, next_generation(regex), true, false, true, pcs);
+  find_state(regex, &regex->dfa, pcs, count, true);
+  // no instruction reads a byte at the end of the subject.
+  find_state(regex, &regex->reverse, pcs, 0, true);
+  return regex;
+}
+
+static void free_dfa(ObjRegex *regex, Dfa *dfa) {
+  for (int i = 0; i < dfa->state_count; i++) {
+    FREE_ARRAY(int, dfa->states[i].pcs, dfa->states[i].count);
+  }
+  FREE_ARRAY(DfaState, dfa->states, dfa->state_capacity);
+  FREE_ARRAY(int, dfa->transitions,
+             dfa->state_capacity * regex->column_count);
+  FREE_ARRAY(int, dfa->state_index, DFA_INDEX_SIZE);
+}
+
+void free_regex(ObjRegex *regex) {
+  free_dfa(regex, &regex->dfa);
+  free_dfa(regex, &regex->reverse);
+  FREE_ARRAY(int, regex->preds, 2 * regex->code_count);
+  FREE_ARRAY(int, regex->pred_starts, regex->code_count + 1);
+  FREE_ARRAY(RegexInst, regex->code, regex->code_capacity);
+  FREE_ARRAY(ByteSet, regex->classes, regex->class_capacity);
+  FREE_ARRAY(int, regex->marks, regex->code_count);
+  FREE_ARRAY(int, regex->stack, 3 * regex->code_count + 1);
+  FREE_ARRAY(int, regex->thread_pcs, 2 * regex->code_count);
+  FREE_ARRAY(size_t, regex->thread_starts, 2 * regex->code_count);
+  FREE(ObjRegex, regex);
+}
+
+/*
+ * Regex of a native's argument, patterns are compiled on first use.
+ * @return NULL if it's neither a regex nor a valid pattern.
+ */
+static ObjRegex *regex_argument(Value value) {
+  if (IS_REGEX(value)) {
+    return AS_REGEX(value);
+  }
+  if (!IS_TEXT(value)) {
+    return NULL;
+  }
+
+  ObjString *pattern = intern_text(value);
+  Value compiled;
+  if (table_get(&vm.regexes, pattern, &compiled)) {
+    return AS_REGEX(compiled);
+  }
+  ObjRegex *regex = compile_regex(pattern);
+  if (regex != NULL) {
+    table_set(&vm.regexes, pattern, OBJ_VAL(regex));
+  }
+  return regex;
+}
+
+Value re_compile_native(int arg_count, Value *args) {
+  if (arg_count != 1 || !IS_TEXT(args[0])) {
+    return NULL_VAL;
+  }
+  ObjRegex *regex = regex_argument(args[0]);
+  return regex == NULL ? NULL_VAL : OBJ_VAL(regex);
+}
+
+Value re_match_native(int arg_count, Value *args) {
+  ObjRegex *regex;
+  if (arg_count != 2 || !IS_TEXT(args[1]) ||
+      (regex = regex_argument(args[0])) == NULL) {
+    return NULL_VAL;
+  }
+
+  const char *chars = text_chars(args[1]);
+  size_t length = text_length(args[1]);
+  int found = dfa_search(regex, chars, length);
+  if (found == -1) {
+    size_t start;
+    size_t end;
+    found = pike_search(regex, chars, length, NULL, 0, &start, &end);
+  }
+  return BOOL_VAL(found);
+}
+
+Value re_find_all_native(int arg_count, Value *args) {
+  ObjRegex *regex;
+  if (arg_count != 2 || !IS_TEXT(args[1]) ||
+      (regex = regex_argument(args[0])) == NULL) {
+    return NULL_VAL;
+  }
+
+  const char *chars = text_chars(args[1]);
+  size_t length = text_length(args[1]);
+  ObjArray *matches = new_array(ARRAY_VALUES, 0);
+  // the dfa rules out subjects without a match before positions are tracked.
+  if (dfa_search(regex, chars, length) == 0) {
+    return OBJ_VAL(matches);
+  }
+
+  // without it a search would read on to the end of the subject whenever a
+  // preferred thread might still match, every search.
+  uint16_t *reverse =
+      length == 0 ? NULL : reverse_states(regex, chars, length);
+  size_t at = 0;
+  size_t start;
+  size_t end;
+  while (at <= length &&
+         pike_search(regex, chars, length, reverse, at, &start, &end)) {
+    array_push(matches, slice_of(args[1], start, end - start));
+    // an empty match moves on by a byte, or it would be found again.
+    at = end > start ? end : end + 1;
+  }
+  FREE_ARRAY(uint16_t, reverse, length);
+  return OBJ_VAL(matches);
+}
@@ -0,0 +1,32 @@
+#ifndef ZSPIE_RE_H_
+#define ZSPIE_RE_H_
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+void free_regex(ObjRegex *regex);
+
+/*
+ * Regular expression natives. Patterns have literals, `.`, classes like
+ * `[a-z_]` or `[^0-9]`, the escapes `\d \w \s \D \W \S`, groups, `|`, the
+ * repetitions `* + ? {m} {m,} {m,n}`, lazy with a trailing `?`, and the
+ * anchors `^` and `$` for the start and end of the subject. Matching takes
+ * time linear in the subject, it never backtracks. re_find_all is linear
+ * too unless the pattern's reverse dfa outgrows its states, then it may
+ * take time quadratic in the subject.
+ *
+ * The natives take a regex or a pattern, patterns are compiled once and
+ * remembered by their string. They return null when given something else,
+ * or a pattern which doesn't compile.
+ */
+
+// re_compile(pattern) regex of pattern.
+Value re_compile_native(int arg_count, Value *args);
+// re_match(regex, s) whether the regex matches somewhere in s.
+Value re_match_native(int arg_count, Value *args);
+// re_find_all(regex, s) array of the matches in s, from left to right
+// without overlapping.
+Value re_find_all_native(int arg_count, Value *args);
+
+#endif // !ZSPIE_RE_H_
@@ -0,0 +1,914 @@
+#include "regvm.h"
+#include "array.h"
+#include "chunk.h"
+#include "external/log.h"
+#include "map.h"
+#include "mathlib.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "verifier.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * State of translating one function.
+ */
+typedef struct {
+  RegisterCode *code;
+  // register holding the value of each slot, slots which are copies of
+  // another slot read it instead until one of them gets written.
+  uint32_t *sources;
+  int register_count;
+  // first instruction of the current basic block.
+  size_t block_start;
+} Translator;
+
+void free_register_code(RegisterCode *code) {
+  if (code == NULL) {
+    return;
+  }
+  FREE_ARRAY(RegInstruction, code->code, code->capacity);
+  FREE_ARRAY(size_t, code->offsets, code->capacity);
+  FREE(RegisterCode, code);
+}
+
+static RegInstruction *emit(Translator *translator, size_t offset,
+                            RegOpCode op, uint32_t a, uint32_t b,
+                            uint32_t c) {
+  RegisterCode *code = translator->code;
+  if (code->capacity < code->count + 1) {
+    size_t old_capacity = code->capacity;
+    code->capacity = GROW_CAPACITY(old_capacity);
+    code->code = GROW_ARRAY(RegInstruction, code->code, old_capacity,
+                            code->capacity);
+    code->offsets =
+        GROW_ARRAY(size_t, code->offsets, old_capacity, code->capacity);
+  }
+
+  RegInstruction *instruction = &code->code[code->count];
+  code->offsets[code->count++] = offset;
+  instruction->op = (uint8_t)op;
+  instruction->a = (uint16_t)a;
+  instruction->b = b;
+  instruction->c = c;
+  return instruction;
+}
+
+int next_copy(const uint32_t *sources, int count, uint32_t reg, int from) {
+  for (int i = from; i < count; i++) {
+    if ((uint32_t)i != reg && sources[i] == reg) {
+      return i;
+    }
+  }
+  return count;
+}
+
+/*
+ * Called before register gets written, see next_copy().
+ */
+static void define(Translator *translator, size_t offset, uint32_t reg) {
+  uint32_t *sources = translator->sources;
+  int count = translator->register_count;
+  for (int i = next_copy(sources, count, reg, 0); i < count;
+       i = next_copy(sources, count, reg, i + 1)) {
+    emit(translator, offset, REG_MOVE, (uint32_t)i, reg, 0);
+    sources[i] = (uint32_t)i;
+  }
+  sources[reg] = reg;
+}
+
+/*
+ * Makes the first `height` slots hold their own values, for the slots at or
+ * above `from` and the ones copied from there.
+ */
+static void materialize(Translator *translator, size_t offset, int height,
+                        uint32_t from) {
+  uint32_t *sources = translator->sources;
+  for (int i = 0; i < height; i++) {
+    if (sources[i] != (uint32_t)i && ((uint32_t)i >= from || sources[i] >= from)) {
+      emit(translator, offset, REG_MOVE, (uint32_t)i, sources[i], 0);
+      sources[i] = (uint32_t)i;
+    }
+  }
+}
+
+/*
+ * @return true if the instruction's `a` operand is its destination.
+ */
+static bool writes_register(RegOpCode op) {
+  switch (op) {
+  case REG_MOVE:
+  case REG_CONSTANT:
+  case REG_NULL:
+  case REG_TRUE:
+  case REG_FALSE:
+  case REG_GET_GLOBAL:
+  case REG_EQUAL:
+  case REG_GREATER:
+  case REG_LESS:
+  case REG_ADD:
+  case REG_SUBTRACT:
+  case REG_MULTIPLY:
+  case REG_DIVIDE:
+  case REG_NOT:
+  case REG_NEGATE:
+  case REG_ADD_NN:
+  case REG_SUBTRACT_NN:
+  case REG_MULTIPLY_NN:
+  case REG_DIVIDE_NN:
+  case REG_LESS_NN:
+  case REG_GREATER_NN:
+  case REG_GET_INDEX:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/*
+ * Stores the top of the stack in a local slot.
+ */
+static void set_local(Translator *translator, size_t offset, uint32_t slot,
+                      int height) {
+  uint32_t *sources = translator->sources;
+  uint32_t top = (uint32_t)(height - 1);
+  uint32_t source = sources[top];
+  if (source == slot) {
+    return;
+  }
+
+  // the value was just computed into a temporary, compute it straight into
+  // the local instead.
+  RegisterCode *code = translator->code;
+  if (source == top && code->count > translator->block_start) {
+    RegInstruction *last = &code->code[code->count - 1];
+    bool aliased = false;
+    for (int i = 0; i < translator->register_count; i++) {
+      if ((uint32_t)i != slot && (uint32_t)i != top &&
+          (sources[i] == slot || sources[i] == top)) {
+        aliased = true;
+      }
+    }
+
+    if (writes_register((RegOpCode)last->op) && last->a == top && !aliased) {
+      last->a = (uint16_t)slot;
+      sources[slot] = slot;
+      sources[top] = slot;
+      return;
+    }
+  }
+
+  define(translator, offset, slot);
+  sources[slot] = source;
+}
+
+#ifdef ZSPIE_DEBUG_MODE
+static void disassemble_registers(ObjFunction *function) {
+  static const char *names[] = {
+      "MOVE",      "CONSTANT", "NULL",          "TRUE",     "FALSE",
+      "GET_GLOBAL", "SET_GLOBAL", "DEFINE_GLOBAL", "EQUAL",  "GREATER",
+      "LESS",      "ADD",      "SUBTRACT",      "MULTIPLY", "DIVIDE",
+      "NOT",       "NEGATE",   "ADD_NN",        "SUBTRACT_NN", "MULTIPLY_NN",
+      "DIVIDE_NN", "LESS_NN",  "GREATER_NN",    "CHECK_NUM", "PRINT",
+      "JUMP",      "JUMP_IF_FALSE", "INLINE_GUARD", "FOR_STEP", "CALL",
+      "RETURN",    "ARRAY",    "GET_INDEX",     "SET_INDEX", "MAP",
+      "CONCAT",    "MATH",
+  };
+
+  RegisterCode *code = function->registers;
+  printf("== %s registers ==\n",
+         function->name != NULL ? function->name->chars : "<script>");
+  for (size_t i = 0; i < code->count; i++) {
+    RegInstruction *instruction = &code->code[i];
+    printf("%04zu REG_%-14s %5u %5u %5u\n", i, names[instruction->op],
+           instruction->a, instruction->b, instruction->c);
+  }
+}
+#endif // ZSPIE_DEBUG_MODE
+
+/*
+ * Translates a function's stack bytecode, the stack height before each
+ * instruction gives the slot it works on. Instructions which jump, and the
+ * ones jumped to, see every slot in its own register.
+ */
+static void translate(ObjFunction *function) {
+  Chunk *chunk = &function->chunk;
+  RegisterCode *code = ALLOCATE(RegisterCode, 1);
+  code->valid = false;
+  code->count = 0;
+  code->capacity = 0;
+  code->code = NULL;
+  code->offsets = NULL;
+  function->registers = code;
+
+  int *heights = ALLOCATE(int, chunk->count);
+  int max_stack = 0;
+  if (!analyze_chunk(chunk, function->arity, heights, &max_stack)) {
+    FREE_ARRAY(int, heights, chunk->count);
+    return;
+  }
+
+  bool *targets = ALLOCATE(bool, chunk->count + 1);
+  size_t *indices = ALLOCATE(size_t, chunk->count + 1);
+  memset(targets, 0, sizeof(bool) * (chunk->count + 1));
+  for (size_t offset = 0; offset < chunk->count; offset++) {
+    if (heights[offset] >= 0 && jump_target(chunk, offset) >= 0) {
+      targets[jump_target(chunk, offset)] = true;
+    }
+  }
+
+  Translator translator;
+  translator.code = code;
+  translator.register_count = max_stack;
+  translator.sources = ALLOCATE(uint32_t, max_stack);
+  translator.block_start = 0;
+  uint32_t *sources = translator.sources;
+  for (int i = 0; i < max_stack; i++) {
+    sources[i] = (uint32_t)i;
+  }
+
+  bool valid = true;
+  for (size_t offset = 0; offset < chunk->count && valid;) {
+    int h = heights[offset];
+    if (h < 0) {
+      offset++;
+      continue;
+    }
+
+    if (targets[offset]) {
+      materialize(&translator, offset, h, 0);
+      translator.block_start = code->count;
+    }
+    indices[offset] = code->count;
+
+    uint8_t op = chunk->code[offset];
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+      define(&translator, offset, (uint32_t)h);
+      emit(&translator, offset, REG_CONSTANT, (uint32_t)h,
+           read_operand(chunk, offset), 0);
+      break;
+
+    case OP_NULL:
+    case OP_TRUE:
+    case OP_FALSE:
+      define(&translator, offset, (uint32_t)h);
+      emit(&translator, offset,
+           op == OP_NULL   ? REG_NULL
+           : op == OP_TRUE ? REG_TRUE
+                           : REG_FALSE,
+           (uint32_t)h, 0, 0);
+      break;
+
+    case OP_POP:
+      sources[h - 1] = (uint32_t)(h - 1);
+      break;
+
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG: {
+      uint32_t source = sources[read_operand(chunk, offset)];
+      define(&translator, offset, (uint32_t)h);
+      sources[h] = source;
+      break;
+    }
+
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_LONG:
+      set_local(&translator, offset, read_operand(chunk, offset), h);
+      break;
+
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+      define(&translator, offset, (uint32_t)h);
+      emit(&translator, offset, REG_GET_GLOBAL, (uint32_t)h,
+           read_operand(chunk, offset), 0);
+      break;
+
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+      emit(&translator, offset, REG_SET_GLOBAL, sources[h - 1],
+           read_operand(chunk, offset), 0);
+      break;
+
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+      emit(&translator, offset, REG_DEFINE_GLOBAL, sources[h - 1],
+           read_operand(chunk, offset), 0);
+      sources[h - 1] = (uint32_t)(h - 1);
+      break;
+
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE: {
+      RegOpCode reg_op = op == OP_EQUAL      ? REG_EQUAL
+                         : op == OP_GREATER  ? REG_GREATER
+                         : op == OP_LESS     ? REG_LESS
+                         : op == OP_ADD      ? REG_ADD
+                         : op == OP_SUBTRACT ? REG_SUBTRACT
+                         : op == OP_MULTIPLY ? REG_MULTIPLY
+                                             : REG_DIVIDE;
+      uint32_t a = sources[h - 2], b = sources[h - 1];
+      define(&translator, offset, (uint32_t)(h - 2));
+      emit(&translator, offset, reg_op, (uint32_t)(h - 2), a, b);
+      sources[h - 1] = (uint32_t)(h - 1);
+      break;
+    }
+
+    case OP_ADD_NN:
+    case OP_SUBTRACT_NN:
+    case OP_MULTIPLY_NN:
+    case OP_DIVIDE_NN:
+    case OP_LESS_NN:
+    case OP_GREATER_NN: {
+      RegOpCode reg_op = op == OP_ADD_NN        ? REG_ADD_NN
+                         : op == OP_SUBTRACT_NN ? REG_SUBTRACT_NN
+                         : op == OP_MULTIPLY_NN ? REG_MULTIPLY_NN
+                         : op == OP_DIVIDE_NN   ? REG_DIVIDE_NN
+                         : op == OP_LESS_NN     ? REG_LESS_NN
+                                                : REG_GREATER_NN;
+      uint32_t a = sources[h - 2], b = sources[h - 1];
+      define(&translator, offset, (uint32_t)(h - 2));
+      emit(&translator, offset, reg_op, (uint32_t)(h - 2), a, b);
+      sources[h - 1] = (uint32_t)(h - 1);
+      break;
+    }
+
+    case OP_CHECK_NUM:
+      emit(&translator, offset, REG_CHECK_NUM,
+           sources[h - 1 - chunk->code[offset + 1]], 0, 0);
+      break;
+
+    case OP_NOT:
+    case OP_NEGATE: {
+      uint32_t a = sources[h - 1];
+      define(&translator, offset, (uint32_t)(h - 1));
+      emit(&translator, offset, op == OP_NOT ? REG_NOT : REG_NEGATE,
+           (uint32_t)(h - 1), a, 0);
+      break;
+    }
+
+    case OP_PRINT:
+      emit(&translator, offset, REG_PRINT, sources[h - 1], 0, 0);
+      sources[h - 1] = (uint32_t)(h - 1);
+      break;
+
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      materialize(&translator, offset, h, 0);
+      // patched to the index of the target below.
+      emit(&translator, offset, REG_JUMP, 0,
+           (uint32_t)jump_target(chunk, offset), 0);
+      translator.block_start = code->count;
+      break;
+
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG: {
+      uint32_t condition = sources[h - 1];
+      materialize(&translator, offset, h, 0);
+      emit(&translator, offset, REG_JUMP_IF_FALSE, condition,
+           (uint32_t)jump_target(chunk, offset), 0);
+      translator.block_start = code->count;
+      break;
+    }
+
+    case OP_PEEK: {
+      uint32_t source = sources[h - 1 - chunk->code[offset + 1]];
+      define(&translator, offset, (uint32_t)h);
+      sources[h] = source;
+      break;
+    }
+
+    case OP_INLINE_GUARD: {
+      uint32_t callee = (uint32_t)(h - 1 - chunk->code[offset + 1]);
+      uint32_t constant = inline_guard_constant(chunk, offset);
+      materialize(&translator, offset, h, 0);
+      emit(&translator, offset, REG_INLINE_GUARD, callee, constant,
+           (uint32_t)jump_target(chunk, offset));
+      translator.block_start = code->count;
+      break;
+    }
+
+    case OP_FOR_STEP: {
+      materialize(&translator, offset, h, 0);
+      uint32_t operands = (uint32_t)((chunk->code[offset + 2] << 16) |
+                                     (chunk->code[offset + 3] << 8) |
+                                     chunk->code[offset + 4]);
+      emit(&translator, offset, REG_FOR_STEP, chunk->code[offset + 1],
+           operands, (uint32_t)jump_target(chunk, offset));
+      translator.block_start = code->count;
+      break;
+    }
+
+    case OP_INLINE_RETURN: {
+      // the result replaces the callee, the slots above it are dead.
+      int result = h - 1 - chunk->code[offset + 1];
+      set_local(&translator, offset, (uint32_t)result, h);
+      for (int i = result + 1; i < h; i++) {
+        sources[i] = (uint32_t)i;
+      }
+      break;
+    }
+
+    case OP_CALL:
+    case OP_CALL_LONG:
+    case OP_CALL_0:
+    case OP_CALL_1:
+    case OP_CALL_2:
+    case OP_CALL_3: {
+      uint32_t args_count = call_args_count(chunk, offset);
+      uint32_t base = (uint32_t)h - args_count - 1;
+      // the callee's frame starts at base and overwrites everything above.
+      materialize(&translator, offset, h, base);
+      emit(&translator, offset, REG_CALL, base, args_count,
+           call_cache_index(chunk, offset));
+      translator.block_start = code->count;
+      break;
+    }
+
+    case OP_RETURN:
+      emit(&translator, offset, REG_RETURN, sources[h - 1], 0, 0);
+      break;
+
+    case OP_ARRAY: {
+      uint32_t count = read_operand(chunk, offset);
+      uint32_t base = (uint32_t)h - count;
+      // the elements are read from their own slots.
+      materialize(&translator, offset, h, base);
+      define(&translator, offset, base);
+      emit(&translator, offset, REG_ARRAY, base, count, 0);
+      break;
+    }
+
+    case OP_MAP: {
+      uint32_t count = read_operand(chunk, offset);
+      uint32_t base = (uint32_t)h - 2 * count;
+      materialize(&translator, offset, h, base);
+      define(&translator, offset, base);
+      emit(&translator, offset, REG_MAP, base, count, 0);
+      break;
+    }
+
+    case OP_CONCAT_N: {
+      uint32_t count = chunk->code[offset + 1];
+      uint32_t base = (uint32_t)h - count;
+      materialize(&translator, offset, h, base);
+      define(&translator, offset, base);
+      emit(&translator, offset, REG_CONCAT, base, count,
+           chunk->code[offset + 2]);
+      break;
+    }
+
+    case OP_MATH: {
+      uint32_t function = chunk->code[offset + 1];
+      uint32_t arity = (uint32_t)math_intrinsics[function].arity;
+      uint32_t base = (uint32_t)h - arity - 1;
+      // the arguments are in their own slots for the call made when the
+      // callee isn't the native.
+      materialize(&translator, offset, h, base);
+      emit(&translator, offset, REG_MATH, base, base + 1,
+           function << 16 | (uint32_t)(h - 1));
+      emit(&translator, offset, REG_CALL, base, arity,
+           call_cache_index(chunk, offset));
+      translator.block_start = code->count;
+      break;
+    }
+
+    case OP_GET_INDEX: {
+      uint32_t array = sources[h - 2], index = sources[h - 1];
+      define(&translator, offset, (uint32_t)(h - 2));
+      emit(&translator, offset, REG_GET_INDEX, (uint32_t)(h - 2), array,
+           index);
+      sources[h - 1] = (uint32_t)(h - 1);
+      break;
+    }
+
+    case OP_SET_INDEX: {
+      // the assigned value is the result, left where the array was.
+      uint32_t value = sources[h - 1];
+      emit(&translator, offset, REG_SET_INDEX, sources[h - 3], sources[h - 2],
+           value);
+      define(&translator, offset, (uint32_t)(h - 3));
+      sources[h - 3] = value;
+      sources[h - 2] = (uint32_t)(h - 2);
+      if (value != (uint32_t)(h - 1)) {
+        sources[h - 1] = (uint32_t)(h - 1);
+      }
+      break;
+    }
+
+    default:
+      // no register form, the function stays on the stack interpreter.
+      valid = false;
+      break;
+    }
+
+    offset += instruction_length(chunk, offset);
+  }
+
+  if (valid) {
+    for (size_t i = 0; i < code->count; i++) {
+      RegInstruction *instruction = &code->code[i];
+      if (instruction->op == REG_JUMP ||
+          instruction->op == REG_JUMP_IF_FALSE) {
+        instruction->b = (uint32_t)indices[instruction->b];
+      } else if (instruction->op == REG_INLINE_GUARD ||
+                 instruction->op == REG_FOR_STEP) {
+        instruction->c = (uint32_t)indices[instruction->c];
+      }
+    }
+  }
+  code->valid = valid;
+
+#ifdef ZSPIE_DEBUG_MODE
+  if (valid) {
+    disassemble_registers(function);
+  }
+#endif // ZSPIE_DEBUG_MODE
+
+  FREE_ARRAY(uint32_t, translator.sources, max_stack);
+  FREE_ARRAY(size_t, indices, chunk->count + 1);
+  FREE_ARRAY(bool, targets, chunk->count + 1);
+  FREE_ARRAY(int, heights, chunk->count);
+}
+
+/*
+ * @return the function's register code, NULL if it has none.
+ */
+static RegisterCode *registers_for(ObjFunction *function) {
+  // calls to a `memo fn` go through its memo on the stack machine.
+  if (function->memo != NULL) {
+    return NULL;
+  }
+  if (function->registers == NULL) {
+    translate(function);
+  }
+  return function->registers->valid ? function->registers : NULL;
+}
+
+/*
+ * Points the frame's ip past the stack instruction an instruction was
+ * translated from, which is where runtime errors look up line numbers and
+ * where OP_RETURN_N looks for its caller's OP_UNPACK.
+ */
+static void sync_ip(CallFrame *frame, RegInstruction *instruction) {
+  RegisterCode *code = frame->function->registers;
+  Chunk *chunk = &frame->function->chunk;
+  size_t offset = code->offsets[instruction - code->code];
+  frame->ip = chunk->code + offset + instruction_length(chunk, offset);
+}
+
+/*
+ * Heart of the register machine, runs until the top level frame returns.
+ */
+static InterpretResult run_registers(CallFrame *frame) {
+  // registers of the current frame.
+  Value *r = frame->slots;
+  Value *constants = frame->function->chunk.constants.values;
+  RegInstruction *pc = frame->pc;
+
+#define ERROR(...)                                                             \
+  do {                                                                         \
+    sync_ip(frame, instruction);                                               \
+    runtime_error(__VA_ARGS__);                                                \
+    return INTERPRET_RUNTIME_ERROR;                                            \
+  } while (false)
+
+// result is computed from the operands b and c.
+#define BINARY_OP(result)                                                      \
+  do {                                                                         \
+    Value b = r[instruction->b];                                               \
+    Value c = r[instruction->c];                                               \
+    if (!IS_NUMERIC(b) || !IS_NUMERIC(c)) {                                    \
+      ERROR("Operands must be number.");                                       \
+    }                                                                          \
+    r[instruction->a] = result;                                                \
+  } while (false)
+
+  while (true) {
+    RegInstruction *instruction = pc++;
+    COUNT_INSTRUCTION();
+#ifdef ZSPIE_DEBUG_MODE
+    log_trace("register instruction=%d a=%d b=%d c=%d", instruction->op,
+              instruction->a, instruction->b, instruction->c);
+#endif // ZSPIE_DEBUG_MODE
+
+    switch (instruction->op) {
+    case REG_MOVE:
+      r[instruction->a] = r[instruction->b];
+      break;
+
+    case REG_CONSTANT:
+      r[instruction->a] = constants[instruction->b];
+      break;
+
+    case REG_NULL:
+      r[instruction->a] = NULL_VAL;
+      break;
+
+    case REG_TRUE:
+      r[instruction->a] = BOOL_VAL(true);
+      break;
+
+    case REG_FALSE:
+      r[instruction->a] = BOOL_VAL(false);
+      break;
+
+    case REG_GET_GLOBAL: {
+      ObjString *name = AS_STRING(constants[instruction->b]);
+      if (!table_get(&vm.globals, name, &r[instruction->a])) {
+        ERROR("Undefined variable '%s'", name->chars);
+      }
+      break;
+    }
+
+    case REG_SET_GLOBAL: {
+      ObjString *name = AS_STRING(constants[instruction->b]);
+      if (table_set(&vm.globals, name, r[instruction->a])) {
+        table_delete(&vm.globals, name);
+        ERROR("Undefined variable '%s'", name->chars);
+      }
+      break;
+    }
+
+    case REG_DEFINE_GLOBAL:
+      table_set(&vm.globals, AS_STRING(constants[instruction->b]),
+                r[instruction->a]);
+      break;
+
+    case REG_EQUAL:
+      r[instruction->a] =
+          BOOL_VAL(values_equal(r[instruction->b], r[instruction->c]));
+      break;
+
+    case REG_GREATER:
+      BINARY_OP(BOOL_VAL(greater_values(b, c)));
+      break;
+
+    case REG_LESS:
+      BINARY_OP(BOOL_VAL(less_values(b, c)));
+      break;
+
+    case REG_ADD: {
+      Value b = r[instruction->b];
+      Value c = r[instruction->c];
+      if (IS_NUMERIC(b) && IS_NUMERIC(c)) {
+        r[instruction->a] = add_values(b, c);
+      } else if (IS_TEXT(b) && IS_TEXT(c)) {
+        Value parts[] = {b, c};
+        concatenate_n(parts, 2, 0, &r[instruction->a]);
+      } else {
+        ERROR("Operands must be two strings or two numbers.");
+      }
+      break;
+    }
+
+    case REG_SUBTRACT:
+      BINARY_OP(subtract_values(b, c));
+      break;
+
+    case REG_MULTIPLY:
+      BINARY_OP(multiply_values(b, c));
+      break;
+
+    case REG_DIVIDE:
+      BINARY_OP(divide_values(b, c));
+      break;
+
+    case REG_NOT:
+      r[instruction->a] = BOOL_VAL(is_falsey(r[instruction->b]));
+      break;
+
+    case REG_NEGATE: {
+      Value b = r[instruction->b];
+      if (!IS_NUMERIC(b)) {
+        ERROR("Operand must be a number.");
+      }
+      r[instruction->a] = negate_value(b);
+      break;
+    }
+
+    case REG_ADD_NN:
+      r[instruction->a] = add_values(r[instruction->b], r[instruction->c]);
+      break;
+
+    case REG_SUBTRACT_NN:
+      r[instruction->a] =
+          subtract_values(r[instruction->b], r[instruction->c]);
+      break;
+
+    case REG_MULTIPLY_NN:
+      r[instruction->a] =
+          multiply_values(r[instruction->b], r[instruction->c]);
+      break;
+
+    case REG_DIVIDE_NN:
+      r[instruction->a] = divide_values(r[instruction->b], r[instruction->c]);
+      break;
+
+    case REG_LESS_NN:
+      r[instruction->a] =
+          BOOL_VAL(less_values(r[instruction->b], r[instruction->c]));
+      break;
+
+    case REG_GREATER_NN:
+      r[instruction->a] =
+          BOOL_VAL(greater_values(r[instruction->b], r[instruction->c]));
+      break;
+
+    case REG_CHECK_NUM:
+      if (!IS_NUMERIC(r[instruction->a])) {
+        ERROR("Expected a number.");
+      }
+      break;
+
+    case REG_PRINT:
+      print_value(r[instruction->a]);
+      printf("\n");
+      break;
+
+    case REG_JUMP:
+      pc = frame->function->registers->code + instruction->b;
+      break;
+
+    case REG_JUMP_IF_FALSE:
+      if (is_falsey(r[instruction->a])) {
+        pc = frame->function->registers->code + instruction->b;
+      }
+      break;
+
+    case REG_INLINE_GUARD:
+      if (values_equal(r[instruction->a], constants[instruction->b])) {
+        pc = frame->function->registers->code + instruction->c;
+      }
+      break;
+
+    case REG_FOR_STEP: {
+      uint8_t mode = (uint8_t)(instruction->b >> 16);
+      uint8_t limit_operand = (uint8_t)(instruction->b >> 8);
+      Value *counter = &r[instruction->a];
+      Value limit = mode & FOR_LIMIT_CONSTANT ? constants[limit_operand]
+                                              : r[limit_operand];
+      if (!IS_NUMERIC(*counter)) {
+        ERROR("Operands must be two strings or two numbers.");
+      }
+      if (!IS_NUMERIC(limit)) {
+        ERROR("Operands must be number.");
+      }
+      if (for_step(counter, constants[instruction->b & 0xff], limit, mode)) {
+        pc = frame->function->registers->code + instruction->c;
+      }
+      break;
+    }
+
+    case REG_CALL: {
+      Value *base = r + instruction->a;
+      int args_count = (int)instruction->b;
+      Value callee = base[0];
+      CallCache *cache = &frame->function->call_caches[instruction->c];
+      sync_ip(frame, instruction);
+
+      // the cached callee already had its type and arity checked.
+      bool cached = IS_OBJ(callee) && AS_OBJ(callee) == cache->callee;
+      bool function_call =
+          cached ? cache->kind == OBJ_FUNCTION : IS_FUNCTION(callee);
+      RegisterCode *code =
+          function_call ? registers_for(AS_FUNCTION(callee)) : NULL;
+      if (code == NULL) {
+        // natives and functions without register code run on the stack,
+        // their result lands in base just the same.
+        vm.stack_top = base + args_count + 1;
+        if (!call_and_run(cache, callee, args_count)) {
+          return INTERPRET_RUNTIME_ERROR;
+        }
+        break;
+      }
+
+      ObjFunction *function = AS_FUNCTION(callee);
+      if (!cached) {
+        if (args_count != function->arity) {
+          ERROR("Expected %d arguments got %d.", function->arity, args_count);
+        }
+        cache->callee = AS_OBJ(callee);
+        cache->kind = OBJ_FUNCTION;
+      }
+      if (vm.frame_count == FRAMES_MAX ||
+          base + function->max_stack > vm.stack + MAX_STACK_SIZE) {
+        ERROR("Stack overflow.");
+      }
+
+      frame->pc = pc;
+      frame = &vm.frames[vm.frame_count++];
+      frame->function = function;
+      frame->ip = function->chunk.code;
+      frame->slots = base;
+      frame->memo_key = NULL;
+      r = base;
+      constants = function->chunk.constants.values;
+      pc = code->code;
+      break;
+    }
+
+    case REG_ARRAY:
+      r[instruction->a] =
+          OBJ_VAL(array_of(&r[instruction->a], (int)instruction->b));
+      break;
+
+    case REG_MAP: {
+      const char *error = map_of(&r[instruction->a], (int)instruction->b,
+                                 &r[instruction->a]);
+      if (error != NULL) {
+        ERROR("%s", error);
+      }
+      break;
+    }
+
+    case REG_CONCAT: {
+      const char *error =
+          concatenate_n(&r[instruction->a], (int)instruction->b,
+                        (uint8_t)instruction->c, &r[instruction->a]);
+      if (error != NULL) {
+        ERROR("%s", error);
+      }
+      break;
+    }
+
+    case REG_MATH: {
+      MathFunction function = (MathFunction)(instruction->c >> 16);
+      if (is_math_native(r[instruction->a], function)) {
+        Value args[2] = {r[instruction->b], r[instruction->c & 0xffff]};
+        r[instruction->a] = math_call(function, args);
+        pc++;
+      }
+      break;
+    }
+
+    case REG_GET_INDEX: {
+      const char *error =
+          get_index(r[instruction->b], r[instruction->c], &r[instruction->a]);
+      if (error != NULL) {
+        ERROR("%s", error);
+      }
+      break;
+    }
+
+    case REG_SET_INDEX: {
+      const char *error = set_index(r[instruction->a], r[instruction->b],
+                                    r[instruction->c]);
+      if (error != NULL) {
+        ERROR("%s", error);
+      }
+      break;
+    }
+
+    case REG_RETURN: {
+      Value result = r[instruction->a];
+      vm.frame_count--;
+      if (vm.frame_count == 0) {
+        vm.stack_top = vm.stack;
+        return INTERPRET_OK;
+      }
+
+      r[0] = result;
+      frame = &vm.frames[vm.frame_count - 1];
+      r = frame->slots;
+      constants = frame->function->chunk.constants.values;
+      pc = frame->pc;
+      break;
+    }
+    }
+  }
+
+#undef ERROR
+#undef BINARY_OP
+}
+
+InterpretResult interpret_registers(ObjFunction *function) {
+  RegisterCode *code = registers_for(function);
+  if (code == NULL) {
+    return interpret_function(function);
+  }
+
+  push(OBJ_VAL(function));
+  CallFrame *frame = &vm.frames[vm.frame_count++];
+  frame->function = function;
+  frame->ip = function->chunk.code;
+  frame->slots = vm.stack_top - 1;
+  frame->memo_key = NULL;
+  frame->pc = code->code;
+
+  if (frame->slots + function->max_stack > vm.stack + MAX_STACK_SIZE) {
+    runtime_error("Stack overflow.");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  return run_registers(frame);
+}
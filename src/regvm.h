@@ -0,0 +1,123 @@
+#ifndef ZSPIE_REGVM_H_
+#define ZSPIE_REGVM_H_
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+/*
+ * Instructions of the register machine. Operands name frame slots directly,
+ * `a` is the destination and `b`, `c` the sources unless noted otherwise.
+ */
+typedef enum {
+  // a = b.
+  REG_MOVE,
+  // a = constant b.
+  REG_CONSTANT,
+  REG_NULL,
+  REG_TRUE,
+  REG_FALSE,
+  // a = global named by constant b.
+  REG_GET_GLOBAL,
+  // global named by constant b = a.
+  REG_SET_GLOBAL,
+  REG_DEFINE_GLOBAL,
+  REG_EQUAL,
+  REG_GREATER,
+  REG_LESS,
+  REG_ADD,
+  REG_SUBTRACT,
+  REG_MULTIPLY,
+  REG_DIVIDE,
+  REG_NOT,
+  REG_NEGATE,
+  // arithmetic and comparisons of the *_NN instructions, without checking
+  // their operands are numbers.
+  REG_ADD_NN,
+  REG_SUBTRACT_NN,
+  REG_MULTIPLY_NN,
+  REG_DIVIDE_NN,
+  REG_LESS_NN,
+  REG_GREATER_NN,
+  // fails unless a is a number.
+  REG_CHECK_NUM,
+  // prints a.
+  REG_PRINT,
+  // continues at instruction b.
+  REG_JUMP,
+  // continues at instruction b if a is falsey.
+  REG_JUMP_IF_FALSE,
+  // continues at instruction c if a holds the function constant b.
+  REG_INLINE_GUARD,
+  // OP_FOR_STEP on counter a, b packs its mode, limit and step operands as
+  // in the bytecode, a byte each from the top. Continues at instruction c
+  // while the loop goes on.
+  REG_FOR_STEP,
+  // calls a with the b arguments after it through call cache c, the result
+  // replaces a.
+  REG_CALL,
+  // returns a.
+  REG_RETURN,
+  // a = array of the b values starting at a.
+  REG_ARRAY,
+  // a = b[c].
+  REG_GET_INDEX,
+  // a[b] = c.
+  REG_SET_INDEX,
+  // a = map of the b key value pairs starting at a.
+  REG_MAP,
+  // a = string joining the b values starting at a, in OP_CONCAT_N mode c.
+  REG_CONCAT,
+  // if a holds the native of math function c >> 16, a = it of b, and of
+  // c & 0xffff for the binary ones, skipping the REG_CALL after it.
+  REG_MATH,
+} RegOpCode;
+
+/*
+ * One fixed width register instruction.
+ */
+typedef struct RegInstruction {
+  uint8_t op;
+  uint16_t a;
+  uint32_t b;
+  uint32_t c;
+} RegInstruction;
+
+/*
+ * Register code of a function, translated from its verified stack bytecode.
+ */
+typedef struct RegisterCode {
+  // false if the function uses an instruction without a register form, it
+  // is run by the stack interpreter then.
+  bool valid;
+  size_t count;
+  size_t capacity;
+  RegInstruction *code;
+  // offset of the stack instruction each instruction was translated from,
+  // for line numbers in runtime errors.
+  size_t *offsets;
+} RegisterCode;
+
+/*
+ * Runs a verified top level function on the register machine. Each function
+ * gets translated on its first call, from its stack bytecode using the
+ * stack heights the verifier computes: locals keep the slots the compiler
+ * resolved them to and temporaries get the slots above them. Moves between
+ * slots are propagated, so `a = b + c` becomes a single `ADD a, b, c`.
+ */
+InterpretResult interpret_registers(ObjFunction *function);
+
+/*
+ * Frees the register code of a function.
+ */
+void free_register_code(RegisterCode *code);
+
+/*
+ * Moves propagated into `sources` leave register i reading register
+ * sources[i]. Before a register gets written, the registers which are still
+ * copies of it need their copy made first: this returns the next of them at
+ * or after `from`, or `count` when there is none left.
+ */
+int next_copy(const uint32_t *sources, int count, uint32_t reg, int from);
+
+#endif // !ZSPIE_REGVM_H_
@@ -2,18 +2,6 @@
 #include "external/log.h"
 #include <string.h>
 
-/*
- * Our scanner struct. holds state of the scanner.
- */
-typedef struct {
-  // pointer to start of the current scanning token.
-  const char *start;
-  // pointer to current checking character.
-  const char *current;
-  // current line number we're scanning.
-  size_t line;
-} Scanner;
-
 // creating one module global scanner to avoid passing around scanner.
 Scanner scanner;
 
@@ -22,8 +10,13 @@ void init_scanner(const char *source) {
   scanner.start = source;
   scanner.current = source;
   scanner.line = 1;
+  scanner.interpolation_depth = 0;
 }
 
+Scanner save_scanner() { return scanner; }
+
+void restore_scanner(Scanner state) { scanner = state; }
+
 /*
  * module function to check if reached the end of the source code.
  */
@@ -170,6 +163,15 @@ static Token scan_string() {
     if (peek() == '\n') {
       scanner.line++;
     }
+    if (peek() == '$' && peek_next() == '{') {
+      if (scanner.interpolation_depth == INTERPOLATION_MAX) {
+        return error_token("Interpolation nested too deeply.");
+      }
+      advance();
+      advance();
+      scanner.braces[scanner.interpolation_depth++] = 0;
+      return make_token(TOKEN_INTERPOLATION);
+    }
     advance();
   }
 
@@ -197,6 +199,7 @@ static Token scan_number() {
 
   // the floating point part.
   if (peek() == '.' && is_digit(peek_next())) {
+    advance();
     while (is_digit(peek())) {
       advance();
     }
@@ -240,9 +243,29 @@ static TokenType identifier_type() {
   case 'a':
     return match_keyword(1, 2, "nd", TOKEN_AND);
 
-    // class
-  case 'c':
-    return match_keyword(1, 4, "lass", TOKEN_CLASS);
+  // c
+  case 'c': {
+    if (scanner.current - scanner.start > 1) {
+      switch (scanner.start[1]) {
+      // case
+      case 'a':
+        return match_keyword(2, 2, "se", TOKEN_CASE);
+
+      // class
+      case 'l':
+        return match_keyword(2, 3, "ass", TOKEN_CLASS);
+
+      // const
+      case 'o':
+        return match_keyword(2, 3, "nst", TOKEN_CONST);
+      }
+    }
+    break;
+  }
+
+    // default
+  case 'd':
+    return match_keyword(1, 6, "efault", TOKEN_DEFAULT);
 
     // else
   case 'e':
@@ -287,9 +310,21 @@ static TokenType identifier_type() {
   case 'r':
     return match_keyword(1, 5, "eturn", TOKEN_RETURN);
 
-    // super
-  case 's':
-    return match_keyword(1, 4, "uper", TOKEN_SUPER);
+  // s
+  case 's': {
+    if (scanner.current - scanner.start > 1) {
+      switch (scanner.start[1]) {
+      // super
+      case 'u':
+        return match_keyword(2, 3, "per", TOKEN_SUPER);
+
+      // switch
+      case 'w':
+        return match_keyword(2, 4, "itch", TOKEN_SWITCH);
+      }
+    }
+    break;
+  }
 
   case 't': {
     if (scanner.current - scanner.start > 1) {
@@ -371,16 +406,39 @@ Token scan_token() {
 
   // {
   case '{':
+    if (scanner.interpolation_depth > 0) {
+      scanner.braces[scanner.interpolation_depth - 1]++;
+    }
     return make_token(TOKEN_LEFT_BRACE);
 
-  // }
+  // }, or the end of an interpolation going back to its string.
   case '}':
+    if (scanner.interpolation_depth > 0) {
+      int *braces = &scanner.braces[scanner.interpolation_depth - 1];
+      if (*braces == 0) {
+        scanner.interpolation_depth--;
+        return scan_string();
+      }
+      (*braces)--;
+    }
     return make_token(TOKEN_RIGHT_BRACE);
 
+  // [
+  case '[':
+    return make_token(TOKEN_LEFT_BRACKET);
+
+  // ]
+  case ']':
+    return make_token(TOKEN_RIGHT_BRACKET);
+
   // ;
   case ';':
     return make_token(TOKEN_SEMICOLON);
 
+  // :
+  case ':':
+    return make_token(TOKEN_COLON);
+
   // ,
   case ',':
     return make_token(TOKEN_COMMA);
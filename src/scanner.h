@@ -12,11 +12,14 @@ typedef enum {
   TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE,
   TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET,
+  TOKEN_RIGHT_BRACKET,
   TOKEN_COMMA,
   TOKEN_DOT,
   TOKEN_MINUS,
   TOKEN_PLUS,
   TOKEN_SEMICOLON,
+  TOKEN_COLON,
   TOKEN_SLASH,
   TOKEN_STAR,
 
@@ -33,11 +36,16 @@ typedef enum {
   // Literals.
   TOKEN_IDENTIFIER,
   TOKEN_STRING,
+  // the text of a string up to a `${`, the interpolated expression follows.
+  TOKEN_INTERPOLATION,
   TOKEN_NUMBER,
 
   // Keywords.
   TOKEN_AND,
+  TOKEN_CASE,
   TOKEN_CLASS,
+  TOKEN_CONST,
+  TOKEN_DEFAULT,
   TOKEN_ELSE,
   TOKEN_FALSE,
   TOKEN_FOR,
@@ -48,6 +56,7 @@ typedef enum {
   TOKEN_PRINT,
   TOKEN_RETURN,
   TOKEN_SUPER,
+  TOKEN_SWITCH,
   TOKEN_THIS,
   TOKEN_TRUE,
   TOKEN_LET,
@@ -71,6 +80,25 @@ typedef struct {
   size_t line;
 } Token;
 
+// how deep `${}` in strings can nest.
+#define INTERPOLATION_MAX 8
+
+/*
+ * Our scanner struct. holds state of the scanner.
+ */
+typedef struct {
+  // pointer to start of the current scanning token.
+  const char *start;
+  // pointer to current checking character.
+  const char *current;
+  // current line number we're scanning.
+  size_t line;
+  // braces opened inside each `${` being scanned, the innermost last. The
+  // `}` closing an interpolation continues its string.
+  int braces[INTERPOLATION_MAX];
+  int interpolation_depth;
+} Scanner;
+
 /*
  * Initiliases a scanner and its fields.
  */
@@ -81,4 +109,15 @@ void init_scanner(const char *source);
  */
 Token scan_token();
 
+/*
+ * Returns a copy of the scanner's current state, so the compiler can rewind
+ * and scan the same source again.
+ */
+Scanner save_scanner();
+
+/*
+ * Rewinds the scanner to a state returned by `save_scanner`.
+ */
+void restore_scanner(Scanner state);
+
 #endif // !ZSPIE_SCANNER_H_
@@ -0,0 +1,271 @@
+#include "segment.h"
+#include "chunk.h"
+#include "external/log.h"
+#include "functions.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define ZSPIE_USE_MMAP
+#endif
+
+// rounds size up to a multiple of align, align must be a power of 2.
+#define ALIGN_UP(size, align) (((size) + (align) - 1) & ~((size_t)(align) - 1))
+
+/*
+ * Maps global names to the functions they are defined with, by looking for
+ * `OP_CONSTANT <function>` followed by `OP_DEFINE_GLOBAL <name>`.
+ */
+static void find_definitions(FunctionList *all, Table *definitions) {
+  for (size_t i = 0; i < all->count; i++) {
+    Chunk *chunk = &all->functions[i]->chunk;
+    Value previous = NULL_VAL;
+
+    for (size_t offset = 0; offset < chunk->count;
+         offset += instruction_length(chunk, offset)) {
+      uint8_t op = chunk->code[offset];
+      Value *constants = chunk->constants.values;
+      if ((op == OP_DEFINE_GLOBAL || op == OP_DEFINE_GLOBAL_LONG) &&
+          IS_FUNCTION(previous)) {
+        table_set(definitions,
+                  AS_STRING(constants[read_operand(chunk, offset)]),
+                  previous);
+      }
+
+      bool is_constant = op == OP_CONSTANT || op == OP_CONSTANT_LONG;
+      previous =
+          is_constant ? constants[read_operand(chunk, offset)] : NULL_VAL;
+    }
+  }
+}
+
+/*
+ * A callee of the function being ordered, with the number of times the
+ * function refers to it and its position among the callees.
+ */
+typedef struct {
+  ObjFunction *function;
+  size_t references;
+  size_t position;
+} Callee;
+
+/*
+ * Most referenced callees first, the first found of equally referenced ones.
+ */
+static int compare_callees(const void *a, const void *b) {
+  const Callee *left = a;
+  const Callee *right = b;
+  if (left->references != right->references) {
+    return left->references > right->references ? -1 : 1;
+  }
+  return left->position < right->position ? -1 : 1;
+}
+
+/*
+ * Appends function and then its callees depth first, most referenced
+ * callee first.
+ */
+static void order_functions(FunctionList *order, Table *definitions,
+                            ObjFunction *function) {
+  add_function(order, function);
+
+  FunctionList callees;
+  init_function_list(&callees);
+
+  Chunk *chunk = &function->chunk;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk, offset)) {
+    uint8_t op = chunk->code[offset];
+    Value callee = NULL_VAL;
+
+    Value *constants = chunk->constants.values;
+    if (op == OP_GET_GLOBAL || op == OP_GET_GLOBAL_LONG) {
+      table_get(definitions,
+                AS_STRING(constants[read_operand(chunk, offset)]), &callee);
+    } else if (op == OP_CONSTANT || op == OP_CONSTANT_LONG) {
+      callee = constants[read_operand(chunk, offset)];
+    }
+
+    if (IS_FUNCTION(callee) && AS_FUNCTION(callee) != function) {
+      add_function(&callees, AS_FUNCTION(callee));
+    }
+  }
+
+  if (callees.count > 0) {
+    Callee *sorted = ALLOCATE(Callee, callees.count);
+    for (size_t i = 0; i < callees.count; i++) {
+      sorted[i] = (Callee){callees.functions[i], callees.references[i], i};
+    }
+    qsort(sorted, callees.count, sizeof(Callee), compare_callees);
+
+    // callees placed by an earlier callee's recursion stay where they are.
+    for (size_t i = 0; i < callees.count; i++) {
+      if (find_function(order, sorted[i].function) == -1) {
+        order_functions(order, definitions, sorted[i].function);
+      }
+    }
+    FREE_ARRAY(Callee, sorted, callees.count);
+  }
+
+  free_function_list(&callees);
+}
+
+/*
+ * Maps read-write memory for a new segment.
+ */
+static uint8_t *map_segment(size_t size) {
+#if defined(_WIN32)
+  void *memory =
+      VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+  return memory == NULL ? NULL : (uint8_t *)memory;
+#elif defined(ZSPIE_USE_MMAP)
+  void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return memory == MAP_FAILED ? NULL : (uint8_t *)memory;
+#else
+  return (uint8_t *)malloc(size);
+#endif
+}
+
+/*
+ * Makes a filled segment read-only.
+ */
+static void protect_segment(uint8_t *memory, size_t size) {
+#if defined(_WIN32)
+  DWORD old_protection;
+  VirtualProtect(memory, size, PAGE_READONLY, &old_protection);
+#elif defined(ZSPIE_USE_MMAP)
+  mprotect(memory, size, PROT_READ);
+#else
+  (void)memory;
+  (void)size;
+#endif
+}
+
+static void unmap_segment(uint8_t *memory, size_t size) {
+#if defined(_WIN32)
+  (void)size;
+  VirtualFree(memory, 0, MEM_RELEASE);
+#elif defined(ZSPIE_USE_MMAP)
+  munmap(memory, size);
+#else
+  (void)size;
+  free(memory);
+#endif
+}
+
+void pack_functions(ObjFunction *script) {
+  FunctionList all;
+  init_function_list(&all);
+  collect_functions(&all, script);
+
+  Table definitions;
+  init_table(&definitions);
+  find_definitions(&all, &definitions);
+
+  FunctionList order;
+  init_function_list(&order);
+  order_functions(&order, &definitions, script);
+
+  // functions only reachable through constants nobody calls by name.
+  for (size_t i = 0; i < all.count; i++) {
+    if (find_function(&order, all.functions[i]) == -1) {
+      order_functions(&order, &definitions, all.functions[i]);
+    }
+  }
+
+  // hot code first, then constants, then the line numbers which are only
+  // read when reporting errors.
+  size_t code_size = 0, constants_size = 0, lines_size = 0, slack = 0;
+  for (size_t i = 0; i < order.count; i++) {
+    Chunk *chunk = &order.functions[i]->chunk;
+    code_size += chunk->count;
+    constants_size += chunk->constants.count * sizeof(Value);
+    lines_size += chunk->count * sizeof(size_t);
+    slack += (chunk->capacity - chunk->count) * (1 + sizeof(size_t)) +
+             (chunk->constants.capacity - chunk->constants.count) *
+                 sizeof(Value);
+  }
+
+  size_t constants_offset = ALIGN_UP(code_size, 16);
+  size_t lines_offset =
+      ALIGN_UP(constants_offset + constants_size, sizeof(size_t));
+  size_t size = lines_offset + lines_size;
+
+  uint8_t *memory = map_segment(size);
+  if (memory == NULL) {
+    // keep the chunks where they are, packing is only an optimisation.
+    log_error("couldn't map a code segment of %zu bytes", size);
+    free_table(&definitions);
+    free_function_list(&order);
+    free_function_list(&all);
+    return;
+  }
+
+  size_t code_at = 0, constants_at = constants_offset, lines_at = lines_offset;
+  for (size_t i = 0; i < order.count; i++) {
+    Chunk *chunk = &order.functions[i]->chunk;
+    ValueArray *constants = &chunk->constants;
+
+    uint8_t *code = memory + code_at;
+    size_t *lines = (size_t *)(memory + lines_at);
+    Value *values =
+        constants->count > 0 ? (Value *)(memory + constants_at) : NULL;
+
+    memcpy(code, chunk->code, chunk->count);
+    memcpy(lines, chunk->lines, chunk->count * sizeof(size_t));
+    if (values != NULL) {
+      memcpy(values, constants->values, constants->count * sizeof(Value));
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(size_t, chunk->lines, chunk->capacity);
+    FREE_ARRAY(Value, constants->values, constants->capacity);
+
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->capacity = chunk->count;
+    constants->values = values;
+    constants->capacity = constants->count;
+    chunk->packed = true;
+
+    code_at += chunk->count;
+    constants_at += constants->count * sizeof(Value);
+    lines_at += chunk->count * sizeof(size_t);
+  }
+
+  protect_segment(memory, size);
+
+  CodeSegment *segment = ALLOCATE(CodeSegment, 1);
+  segment->memory = memory;
+  segment->size = size;
+  segment->next = vm.segments;
+  vm.segments = segment;
+
+  log_debug("packed %zu functions into a %zu byte segment, %zu bytes of "
+            "slack freed",
+            order.count, size, slack);
+
+  free_table(&definitions);
+  free_function_list(&order);
+  free_function_list(&all);
+}
+
+void free_segments() {
+  CodeSegment *segment = vm.segments;
+  while (segment != NULL) {
+    CodeSegment *next = segment->next;
+    unmap_segment(segment->memory, segment->size);
+    FREE(CodeSegment, segment);
+    segment = next;
+  }
+  vm.segments = NULL;
+}
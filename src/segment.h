@@ -0,0 +1,33 @@
+#ifndef ZSPIE_SEGMENT_H_
+#define ZSPIE_SEGMENT_H_
+
+#include "common.h"
+#include "object.h"
+
+/*
+ * One block of read-only memory holding the bytecode, constants and line
+ * numbers of every function of a compiled script, laid out contiguously.
+ */
+typedef struct CodeSegment {
+  // next segment in the vm's list.
+  struct CodeSegment *next;
+  // size of the mapped memory in bytes.
+  size_t size;
+  // start of the mapped memory.
+  uint8_t *memory;
+} CodeSegment;
+
+/*
+ * Shrinks every chunk reachable from the script to fit and relocates them
+ * into one new read-only code segment. Functions are ordered by call graph
+ * proximity, so callers and their callees share cache lines and pages.
+ * @param script - the top level function returned by `compile`.
+ */
+void pack_functions(ObjFunction *script);
+
+/*
+ * Unmaps all the code segments owned by the vm.
+ */
+void free_segments();
+
+#endif // !ZSPIE_SEGMENT_H_
@@ -1,5 +1,6 @@
 #include "table.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 #include <string.h>
 
@@ -85,7 +86,7 @@ bool table_set(Table *table, ObjString *key, Value value) {
 void table_add_all(Table *from, Table *to) {
   for (size_t i = 0; i < from->capacity; i++) {
     Entry *entry = &from->entries[i];
-    if (entry->key == NULL) {
+    if (entry->key != NULL) {
       table_set(to, entry->key, entry->value);
     }
   }
@@ -3,7 +3,6 @@
 
 #include "common.h"
 #include "memory.h"
-#include "object.h"
 #include "value.h"
 #include <stdint.h>
 
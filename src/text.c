@@ -0,0 +1,146 @@
+#include "text.h"
+#include "array.h"
+#include "object.h"
+#include "value.h"
+#include <ctype.h>
+#include <string.h>
+
+Value slice_of(Value text, size_t start, size_t length) {
+  if (start == 0 && length == text_length(text)) {
+    return text;
+  }
+  ObjString *owner = IS_STRING(text) ? AS_STRING(text) : AS_SLICE(text)->owner;
+  return OBJ_VAL(new_slice(owner, text_chars(text) + start, length));
+}
+
+/*
+ * Reads a whole number from 0 to limit.
+ * @return false if value is anything else.
+ */
+static bool read_position(Value value, size_t limit, size_t *position) {
+  if (!IS_NUMERIC(value)) {
+    return false;
+  }
+  double number = AS_FLOAT(value);
+  if (!(number >= 0 && number <= (double)limit) ||
+      number != (double)(size_t)number) {
+    return false;
+  }
+  *position = (size_t)number;
+  return true;
+}
+
+/*
+ * First needle in chars, memchr skips to the candidates.
+ * @return NULL if there is none.
+ */
+static const char *search(const char *chars, size_t length, const char *needle,
+                          size_t needle_length) {
+  if (needle_length == 0) {
+    return chars;
+  }
+  const char *end = chars + length;
+  while ((size_t)(end - chars) >= needle_length) {
+    const char *found =
+        memchr(chars, needle[0], (size_t)(end - chars) - needle_length + 1);
+    if (found == NULL) {
+      return NULL;
+    }
+    if (memcmp(found + 1, needle + 1, needle_length - 1) == 0) {
+      return found;
+    }
+    chars = found + 1;
+  }
+  return NULL;
+}
+
+Value substr_native(int arg_count, Value *args) {
+  if (arg_count < 2 || arg_count > 3 || !IS_TEXT(args[0])) {
+    return NULL_VAL;
+  }
+  size_t length = text_length(args[0]);
+  size_t start;
+  if (!read_position(args[1], length, &start)) {
+    return NULL_VAL;
+  }
+  size_t count = length - start;
+  if (arg_count == 3) {
+    if (!IS_NUMERIC(args[2]) || !(AS_FLOAT(args[2]) >= 0)) {
+      return NULL_VAL;
+    }
+    if (AS_FLOAT(args[2]) < (double)count) {
+      count = (size_t)AS_FLOAT(args[2]);
+    }
+  }
+  return slice_of(args[0], start, count);
+}
+
+Value find_native(int arg_count, Value *args) {
+  if (arg_count < 2 || arg_count > 3 || !IS_TEXT(args[0]) ||
+      !IS_TEXT(args[1])) {
+    return NULL_VAL;
+  }
+  const char *chars = text_chars(args[0]);
+  size_t length = text_length(args[0]);
+  size_t from = 0;
+  if (arg_count == 3 && !read_position(args[2], length, &from)) {
+    return NULL_VAL;
+  }
+
+  const char *found = search(chars + from, length - from, text_chars(args[1]),
+                             text_length(args[1]));
+  return INT_VAL(found == NULL ? -1 : (int64_t)(found - chars));
+}
+
+Value split_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_TEXT(args[0]) || !IS_TEXT(args[1]) ||
+      text_length(args[1]) == 0) {
+    return NULL_VAL;
+  }
+  const char *chars = text_chars(args[0]);
+  const char *end = chars + text_length(args[0]);
+  const char *separator = text_chars(args[1]);
+  size_t separator_length = text_length(args[1]);
+
+  ObjArray *parts = new_array(ARRAY_VALUES, 0);
+  const char *part = chars;
+  for (;;) {
+    const char *found =
+        search(part, (size_t)(end - part), separator, separator_length);
+    if (found == NULL) {
+      break;
+    }
+    array_push(parts, slice_of(args[0], (size_t)(part - chars),
+                               (size_t)(found - part)));
+    part = found + separator_length;
+  }
+  array_push(parts,
+             slice_of(args[0], (size_t)(part - chars), (size_t)(end - part)));
+  return OBJ_VAL(parts);
+}
+
+Value starts_with_native(int arg_count, Value *args) {
+  if (arg_count != 2 || !IS_TEXT(args[0]) || !IS_TEXT(args[1])) {
+    return NULL_VAL;
+  }
+  size_t length = text_length(args[1]);
+  return BOOL_VAL(text_length(args[0]) >= length &&
+                  memcmp(text_chars(args[0]), text_chars(args[1]), length) ==
+                      0);
+}
+
+Value trim_native(int arg_count, Value *args) {
+  if (arg_count != 1 || !IS_TEXT(args[0])) {
+    return NULL_VAL;
+  }
+  const char *chars = text_chars(args[0]);
+  size_t start = 0;
+  size_t end = text_length(args[0]);
+  while (start < end && isspace((unsigned char)chars[start])) {
+    start++;
+  }
+  while (end > start && isspace((unsigned char)chars[end - 1])) {
+    end--;
+  }
+  return slice_of(args[0], start, end - start);
+}
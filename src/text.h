@@ -0,0 +1,32 @@
+#ifndef ZSPIE_TEXT_H_
+#define ZSPIE_TEXT_H_
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+/*
+ * Slice of length characters of a string or slice from start on, the text
+ * itself when that's all of it.
+ */
+Value slice_of(Value text, size_t start, size_t length);
+
+/*
+ * String natives, they work on strings and slices and return null when given
+ * something else. Parts of a string they return are slices sharing its
+ * characters, not copies.
+ */
+
+// substr(s, start, length) of at most length characters, to the end if left
+// out.
+Value substr_native(int arg_count, Value *args);
+// find(s, needle, from) index of the first needle at or after from, -1 if
+// there is none.
+Value find_native(int arg_count, Value *args);
+// split(s, separator) array of the parts between separators.
+Value split_native(int arg_count, Value *args);
+Value starts_with_native(int arg_count, Value *args);
+// trim(s) without leading and trailing whitespace.
+Value trim_native(int arg_count, Value *args);
+
+#endif // !ZSPIE_TEXT_H_
@@ -0,0 +1,1163 @@
+#include "trace.h"
+#include "chunk.h"
+#include "external/log.h"
+#include "mathlib.h"
+#include "memory.h"
+#include "object.h"
+#include "regvm.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+#include <string.h>
+
+/*
+ * Static type of a stack slot inside a trace. Numbers, integers and booleans
+ * live unboxed in the trace's registers, other values are never touched.
+ */
+typedef enum {
+  SLOT_OTHER,
+  SLOT_NUMBER,
+  SLOT_BOOL,
+  SLOT_INT,
+  // a function or native known while compiling the trace, it has no
+  // register.
+  SLOT_FUNCTION,
+} SlotType;
+
+/*
+ * Unboxed value of a slot, booleans are the numbers 0 and 1.
+ */
+typedef union {
+  double number;
+  int64_t integer;
+} TraceRegister;
+
+/*
+ * Instructions of a compiled trace, they work on unboxed registers, one per
+ * stack slot of the frame.
+ */
+typedef enum {
+  // r[a] = value
+  TRACE_CONSTANT,
+  // r[a] = r[b]
+  TRACE_MOVE,
+  // r[a] = r[b] op r[c]
+  TRACE_ADD,
+  TRACE_SUBTRACT,
+  TRACE_MULTIPLY,
+  TRACE_DIVIDE,
+  TRACE_LESS,
+  TRACE_GREATER,
+  TRACE_EQUAL,
+  // r[a] = r[b] op r[c] on integers, arithmetic leaves through `exit` when
+  // it overflows.
+  TRACE_ADD_INT,
+  TRACE_SUBTRACT_INT,
+  TRACE_MULTIPLY_INT,
+  TRACE_LESS_INT,
+  TRACE_GREATER_INT,
+  TRACE_EQUAL_INT,
+  // r[a] = op r[b]
+  TRACE_NOT,
+  TRACE_NEGATE,
+  TRACE_NOT_INT,
+  // leaves through `exit` for the smallest integer.
+  TRACE_NEGATE_INT,
+  // r[a] = integer r[b] as a double.
+  TRACE_TO_NUMBER,
+  // r[a] = math function `value` of r[b], and r[c] for the binary ones.
+  TRACE_MATH,
+  // TRACE_MATH on integers, leaves through `exit` when the result isn't
+  // one.
+  TRACE_MATH_INT,
+  // leaves through exit c unless r[a] is truthy, or falsey. b is set if r[a]
+  // is an integer.
+  TRACE_GUARD_TRUE,
+  TRACE_GUARD_FALSE,
+  // r[a] = global name, leaves through exit c unless it has type b.
+  TRACE_GET_GLOBAL,
+  // global name = r[a] of type b, leaves through exit c if it's undefined.
+  TRACE_SET_GLOBAL,
+  // leaves through exit c unless global name still holds object.
+  TRACE_GUARD_GLOBAL,
+  // back to the start of the trace.
+  TRACE_LOOP,
+} TraceOp;
+
+typedef struct {
+  TraceOp op;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  uint32_t exit;
+  TraceRegister value;
+  ObjString *name;
+  Obj *object;
+} TraceInstruction;
+
+/*
+ * How a stack slot is written back when a trace leaves.
+ */
+typedef struct {
+  SlotType type;
+  // register holding the slot's value.
+  uint32_t source;
+  // value of a SLOT_FUNCTION slot.
+  Obj *object;
+} ExitSlot;
+
+/*
+ * Where the interpreter resumes when a trace leaves.
+ */
+typedef struct {
+  // bytecode offset to resume at.
+  size_t offset;
+  // stack height at that offset.
+  int height;
+  // start of the live slots in `exit_slots`.
+  size_t slots;
+} TraceExit;
+
+struct Trace {
+  TraceInstruction *code;
+  size_t count;
+  size_t capacity;
+
+  TraceExit *exits;
+  size_t exit_count;
+  size_t exit_capacity;
+
+  // stack slots of each exit, back to back.
+  ExitSlot *exit_slots;
+  size_t exit_slots_count;
+  size_t exit_slots_capacity;
+
+  // stack height and slot types the trace was recorded with.
+  int entry_height;
+  uint8_t *entry_types;
+
+  // unboxed stack slots while the trace runs.
+  int register_count;
+  TraceRegister *registers;
+};
+
+/*
+ * Outcome of one conditional jump while recording.
+ */
+typedef struct {
+  size_t offset;
+  bool taken;
+} Branch;
+
+/*
+ * The iteration being recorded, there is at most one at a time.
+ */
+static struct {
+  struct CallFrame *frame;
+  ObjFunction *function;
+  // header of the loop, loops are looked up again as the table may grow.
+  size_t header;
+  int entry_height;
+  uint8_t *entry_types;
+  Branch *branches;
+  size_t branch_count;
+  size_t branch_capacity;
+} recorder;
+
+static SlotType type_of(Value value) {
+  if (IS_NUMBER(value)) {
+    return SLOT_NUMBER;
+  }
+  if (IS_BOOL(value)) {
+    return SLOT_BOOL;
+  }
+  if (IS_INT(value)) {
+    return SLOT_INT;
+  }
+  return SLOT_OTHER;
+}
+
+static TraceRegister unbox(Value value) {
+  TraceRegister unboxed;
+  if (IS_INT(value)) {
+    unboxed.integer = AS_INT(value);
+  } else {
+    unboxed.number = IS_NUMBER(value) ? AS_NUMBER(value) : AS_BOOL(value);
+  }
+  return unboxed;
+}
+
+static Value box(TraceRegister unboxed, SlotType type) {
+  switch (type) {
+  case SLOT_INT:
+    return INT_VAL(unboxed.integer);
+  case SLOT_BOOL:
+    return BOOL_VAL(unboxed.number != 0);
+  default:
+    return NUMBER_VAL(unboxed.number);
+  }
+}
+
+static Loop *find_loop(ObjFunction *function, size_t header) {
+  if (function->loops == NULL) {
+    function->loops = ALLOCATE(LoopTable, 1);
+    function->loops->count = 0;
+    function->loops->capacity = 0;
+    function->loops->loops = NULL;
+  }
+
+  LoopTable *table = function->loops;
+  for (size_t i = 0; i < table->count; i++) {
+    if (table->loops[i].header == header) {
+      return &table->loops[i];
+    }
+  }
+
+  if (table->capacity < table->count + 1) {
+    size_t old_capacity = table->capacity;
+    table->capacity = GROW_CAPACITY(old_capacity);
+    table->loops =
+        GROW_ARRAY(Loop, table->loops, old_capacity, table->capacity);
+  }
+
+  Loop *loop = &table->loops[table->count++];
+  loop->header = header;
+  loop->hits = 0;
+  loop->blacklisted = false;
+  loop->trace = NULL;
+  return loop;
+}
+
+static void free_trace(Trace *trace) {
+  FREE_ARRAY(TraceInstruction, trace->code, trace->capacity);
+  FREE_ARRAY(TraceExit, trace->exits, trace->exit_capacity);
+  FREE_ARRAY(ExitSlot, trace->exit_slots, trace->exit_slots_capacity);
+  FREE_ARRAY(uint8_t, trace->entry_types, trace->entry_height);
+  FREE_ARRAY(TraceRegister, trace->registers, trace->register_count);
+  FREE(Trace, trace);
+}
+
+void free_loops(LoopTable *loops) {
+  if (loops == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < loops->count; i++) {
+    if (loops->loops[i].trace != NULL) {
+      free_trace(loops->loops[i].trace);
+    }
+  }
+  FREE_ARRAY(Loop, loops->loops, loops->capacity);
+  FREE(LoopTable, loops);
+}
+
+static void stop_recording() {
+  FREE_ARRAY(uint8_t, recorder.entry_types, recorder.entry_height);
+  FREE_ARRAY(Branch, recorder.branches, recorder.branch_capacity);
+  memset(&recorder, 0, sizeof(recorder));
+  vm.recording = false;
+}
+
+static void start_recording(CallFrame *frame, Loop *loop) {
+  recorder.frame = frame;
+  recorder.function = frame->function;
+  recorder.header = loop->header;
+  recorder.entry_height = (int)(vm.stack_top - frame->slots);
+  recorder.entry_types = ALLOCATE(uint8_t, recorder.entry_height);
+  for (int i = 0; i < recorder.entry_height; i++) {
+    recorder.entry_types[i] = (uint8_t)type_of(frame->slots[i]);
+  }
+  recorder.branches = NULL;
+  recorder.branch_count = 0;
+  recorder.branch_capacity = 0;
+  vm.recording = true;
+}
+
+void trace_branch(CallFrame *frame, uint8_t *branch, bool taken) {
+  if (frame != recorder.frame || frame->function != recorder.function) {
+    return;
+  }
+
+  // an inner loop kept going, the iteration is too long to trace.
+  if (recorder.branch_count == TRACE_MAX_LENGTH) {
+    find_loop(recorder.function, recorder.header)->blacklisted = true;
+    stop_recording();
+    return;
+  }
+
+  if (recorder.branch_capacity < recorder.branch_count + 1) {
+    size_t old_capacity = recorder.branch_capacity;
+    recorder.branch_capacity = GROW_CAPACITY(old_capacity);
+    recorder.branches = GROW_ARRAY(Branch, recorder.branches, old_capacity,
+                                   recorder.branch_capacity);
+  }
+  Branch *record = &recorder.branches[recorder.branch_count++];
+  record->offset = (size_t)(branch - frame->function->chunk.code);
+  record->taken = taken;
+}
+
+static TraceInstruction *emit(Trace *trace, TraceOp op, uint32_t a,
+                              uint32_t b, uint32_t c) {
+  if (trace->capacity < trace->count + 1) {
+    size_t old_capacity = trace->capacity;
+    trace->capacity = GROW_CAPACITY(old_capacity);
+    trace->code = GROW_ARRAY(TraceInstruction, trace->code, old_capacity,
+                             trace->capacity);
+  }
+  TraceInstruction *instruction = &trace->code[trace->count++];
+  instruction->op = op;
+  instruction->a = a;
+  instruction->b = b;
+  instruction->c = c;
+  instruction->exit = 0;
+  instruction->value.integer = 0;
+  instruction->name = NULL;
+  instruction->object = NULL;
+  return instruction;
+}
+
+/*
+ * Adds an exit resuming at offset with the current slot types and sources.
+ * @return index of the exit.
+ */
+static uint32_t add_exit(Trace *trace, size_t offset, int height,
+                         uint8_t *types, uint32_t *sources, Obj **objects) {
+  if (trace->exit_capacity < trace->exit_count + 1) {
+    size_t old_capacity = trace->exit_capacity;
+    trace->exit_capacity = GROW_CAPACITY(old_capacity);
+    trace->exits = GROW_ARRAY(TraceExit, trace->exits, old_capacity,
+                              trace->exit_capacity);
+  }
+
+  while (trace->exit_slots_capacity <
+         trace->exit_slots_count + (size_t)height) {
+    size_t old_capacity = trace->exit_slots_capacity;
+    trace->exit_slots_capacity = GROW_CAPACITY(old_capacity);
+    trace->exit_slots = GROW_ARRAY(ExitSlot, trace->exit_slots, old_capacity,
+                                   trace->exit_slots_capacity);
+  }
+
+  TraceExit *exit = &trace->exits[trace->exit_count];
+  exit->offset = offset;
+  exit->height = height;
+  exit->slots = trace->exit_slots_count;
+  for (int i = 0; i < height; i++) {
+    ExitSlot *slot = &trace->exit_slots[trace->exit_slots_count++];
+    slot->type = (SlotType)types[i];
+    slot->source = sources[i];
+    slot->object = objects[i];
+  }
+  return (uint32_t)trace->exit_count++;
+}
+
+static bool numeric(uint8_t type) {
+  return type == SLOT_NUMBER || type == SLOT_INT;
+}
+
+/*
+ * Called before register gets written, see next_copy().
+ */
+static void define(Trace *trace, uint32_t *sources, int count,
+                   uint32_t reg) {
+  for (int i = next_copy(sources, count, reg, 0); i < count;
+       i = next_copy(sources, count, reg, i + 1)) {
+    emit(trace, TRACE_MOVE, (uint32_t)i, reg, 0);
+    sources[i] = (uint32_t)i;
+  }
+  sources[reg] = reg;
+}
+
+/*
+ * Converts an integer operand about to be consumed into a double, in the
+ * register of its slot.
+ */
+static void to_number(Trace *trace, uint32_t *sources, int count,
+                      uint8_t *types, int slot) {
+  if (types[slot] != SLOT_INT) {
+    return;
+  }
+  uint32_t source = sources[slot];
+  define(trace, sources, count, (uint32_t)slot);
+  emit(trace, TRACE_TO_NUMBER, (uint32_t)slot, source, 0);
+  types[slot] = SLOT_NUMBER;
+}
+
+/*
+ * The checked instruction an unchecked *_NN one does the same as, the trace
+ * knows the types of the operands either way.
+ */
+static uint8_t checked_op(uint8_t op) {
+  switch (op) {
+  case OP_ADD_NN:
+    return OP_ADD;
+  case OP_SUBTRACT_NN:
+    return OP_SUBTRACT;
+  case OP_MULTIPLY_NN:
+    return OP_MULTIPLY;
+  case OP_DIVIDE_NN:
+    return OP_DIVIDE;
+  case OP_LESS_NN:
+    return OP_LESS;
+  case OP_GREATER_NN:
+    return OP_GREATER;
+  default:
+    return op;
+  }
+}
+
+/*
+ * Ends the trace with the jump back to its start.
+ * @return why the loop can't be traced, NULL if it can.
+ */
+static const char *close_trace(Trace *trace, uint8_t *types,
+                               uint32_t *sources, int h) {
+  // slots must come around with the types the trace starts with.
+  if (memcmp(types, recorder.entry_types, (size_t)h) != 0) {
+    return "slot types change across iterations";
+  }
+  // the next iteration starts with every slot in its own register.
+  for (int i = 0; i < h; i++) {
+    if (sources[i] != (uint32_t)i) {
+      emit(trace, TRACE_MOVE, (uint32_t)i, sources[i], 0);
+      sources[i] = (uint32_t)i;
+    }
+  }
+  emit(trace, TRACE_LOOP, 0, 0, 0);
+  return NULL;
+}
+
+/*
+ * Loads a numeric slot, or constant if slot is -1, into register scratch as
+ * a double.
+ */
+static void load_number(Trace *trace, uint32_t *sources, uint8_t *types,
+                        int slot, Value constant, uint32_t scratch) {
+  if (slot == -1) {
+    emit(trace, TRACE_CONSTANT, scratch, 0, 0)->value.number =
+        AS_FLOAT(constant);
+  } else if (types[slot] == SLOT_INT) {
+    emit(trace, TRACE_TO_NUMBER, scratch, sources[slot], 0);
+  } else {
+    emit(trace, TRACE_MOVE, scratch, sources[slot], 0);
+  }
+}
+
+/*
+ * Compiles the increment and comparison of an OP_FOR_STEP, the result of
+ * the comparison is left in register h. Registers h and h + 1 are free, the
+ * verifier counts them into the function's stack.
+ * @return why the loop can't be traced, NULL if it can.
+ */
+static const char *step_counter(Trace *trace, Chunk *chunk, size_t offset,
+                                uint8_t *types, uint32_t *sources,
+                                Obj **objects, int h) {
+  int count = trace->register_count;
+  int counter = chunk->code[offset + 1];
+  uint8_t mode = chunk->code[offset + 2];
+  uint8_t limit_operand = chunk->code[offset + 3];
+  Value step = chunk->constants.values[chunk->code[offset + 4]];
+  int limit = mode & FOR_LIMIT_CONSTANT ? -1 : limit_operand;
+  Value limit_constant = mode & FOR_LIMIT_CONSTANT
+                             ? chunk->constants.values[limit_operand]
+                             : NULL_VAL;
+  uint8_t limit_type =
+      limit == -1 ? (uint8_t)type_of(limit_constant) : types[limit];
+  if (!numeric(types[counter]) || !numeric(limit_type)) {
+    return "for loop counter isn't a number";
+  }
+
+  uint32_t first = (uint32_t)h, second = (uint32_t)h + 1;
+  define(trace, sources, count, first);
+  define(trace, sources, count, second);
+
+  uint32_t source = sources[counter];
+  if (types[counter] == SLOT_INT && IS_INT(step)) {
+    // an overflow leaves before the instruction, which the interpreter
+    // redoes in floating point.
+    uint32_t exit = add_exit(trace, offset, h, types, sources, objects);
+    emit(trace, TRACE_CONSTANT, second, 0, 0)->value = unbox(step);
+    define(trace, sources, count, (uint32_t)counter);
+    emit(trace, TRACE_ADD_INT, (uint32_t)counter, source, second)->exit =
+        exit;
+  } else {
+    load_number(trace, sources, types, counter, NULL_VAL, first);
+    load_number(trace, sources, types, -1, step, second);
+    define(trace, sources, count, (uint32_t)counter);
+    emit(trace, TRACE_ADD, (uint32_t)counter, first, second);
+    types[counter] = SLOT_NUMBER;
+  }
+
+  int comparison = mode & FOR_COMPARISON;
+  bool less = comparison == FOR_LESS || comparison == FOR_GREATER_EQUAL;
+  if (types[counter] == SLOT_INT && limit_type == SLOT_INT) {
+    uint32_t right = second;
+    if (limit == -1) {
+      emit(trace, TRACE_CONSTANT, second, 0, 0)->value =
+          unbox(limit_constant);
+    } else {
+      right = sources[limit];
+    }
+    emit(trace, less ? TRACE_LESS_INT : TRACE_GREATER_INT, first,
+         sources[counter], right);
+  } else {
+    load_number(trace, sources, types, counter, NULL_VAL, first);
+    load_number(trace, sources, types, limit, limit_constant, second);
+    emit(trace, less ? TRACE_LESS : TRACE_GREATER, first, first, second);
+  }
+  // <= and >= are the negated > and <, as the compiler emits them.
+  if (comparison == FOR_LESS_EQUAL || comparison == FOR_GREATER_EQUAL) {
+    emit(trace, TRACE_NOT, first, first, 0);
+  }
+  return NULL;
+}
+
+/*
+ * Compiles the recorded iteration: walks the bytecode from the loop header
+ * along the recorded branch outcomes, tracking the static type of every
+ * slot. Fails on anything which isn't numeric or boolean.
+ *
+ * Moves between slots aren't emitted, a slot which is a copy of another
+ * register reads that register instead until one of them is written.
+ * @return the trace, NULL if the loop can't be traced.
+ */
+static Trace *compile_trace() {
+  ObjFunction *function = recorder.function;
+  Chunk *chunk = &function->chunk;
+
+  Trace *trace = ALLOCATE(Trace, 1);
+  memset(trace, 0, sizeof(Trace));
+  trace->entry_height = recorder.entry_height;
+  trace->entry_types = ALLOCATE(uint8_t, recorder.entry_height);
+  memcpy(trace->entry_types, recorder.entry_types,
+         (size_t)recorder.entry_height);
+  trace->register_count = function->max_stack;
+  trace->registers = ALLOCATE(TraceRegister, function->max_stack);
+
+  uint8_t *types = ALLOCATE(uint8_t, function->max_stack);
+  memset(types, SLOT_OTHER, (size_t)function->max_stack);
+  memcpy(types, recorder.entry_types, (size_t)recorder.entry_height);
+
+  // register holding the value of each slot.
+  int count = function->max_stack;
+  uint32_t *sources = ALLOCATE(uint32_t, count);
+  for (int i = 0; i < count; i++) {
+    sources[i] = (uint32_t)i;
+  }
+
+  // function held by each SLOT_FUNCTION slot.
+  Obj **objects = ALLOCATE(Obj *, count);
+  memset(objects, 0, sizeof(Obj *) * (size_t)count);
+
+  size_t offset = recorder.header;
+  int h = recorder.entry_height;
+  size_t branch = 0;
+  bool closed = false;
+  const char *failure = NULL;
+
+  for (int length = 0; !closed && failure == NULL; length++) {
+    if (length == TRACE_MAX_LENGTH) {
+      failure = "trace too long";
+      break;
+    }
+
+    uint8_t op = checked_op(chunk->code[offset]);
+    size_t next = offset + instruction_length(chunk, offset);
+
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG: {
+      Value value = chunk->constants.values[read_operand(chunk, offset)];
+      if (!IS_NUMERIC(value)) {
+        failure = "non numeric constant";
+        break;
+      }
+      define(trace, sources, count, (uint32_t)h);
+      emit(trace, TRACE_CONSTANT, (uint32_t)h, 0, 0)->value = unbox(value);
+      types[h++] = (uint8_t)type_of(value);
+      break;
+    }
+
+    case OP_TRUE:
+    case OP_FALSE:
+      define(trace, sources, count, (uint32_t)h);
+      emit(trace, TRACE_CONSTANT, (uint32_t)h, 0, 0)->value.number =
+          op == OP_TRUE ? 1 : 0;
+      types[h++] = SLOT_BOOL;
+      break;
+
+    case OP_POP:
+      h--;
+      break;
+
+    case OP_GET_LOCAL:
+    case OP_GET_LOCAL_LONG: {
+      uint32_t slot = read_operand(chunk, offset);
+      if (types[slot] == SLOT_OTHER) {
+        failure = "local isn't a number or boolean";
+        break;
+      }
+      uint32_t source = sources[slot];
+      define(trace, sources, count, (uint32_t)h);
+      sources[h] = source;
+      objects[h] = objects[slot];
+      types[h++] = types[slot];
+      break;
+    }
+
+    case OP_SET_LOCAL:
+    case OP_SET_LOCAL_LONG: {
+      uint32_t slot = read_operand(chunk, offset);
+      uint32_t source = sources[h - 1];
+      if (source != slot) {
+        define(trace, sources, count, slot);
+        sources[slot] = source;
+      }
+      types[slot] = types[h - 1];
+      objects[slot] = objects[h - 1];
+      break;
+    }
+
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG: {
+      // speculates the global keeps the type it has now.
+      ObjString *name =
+          AS_STRING(chunk->constants.values[read_operand(chunk, offset)]);
+      Value value;
+      if (!table_get(&vm.globals, name, &value)) {
+        failure = "global isn't defined";
+        break;
+      }
+      if (IS_FUNCTION(value) || IS_NATIVE(value)) {
+        // only inlined and math calls are traced, which know their callee.
+        uint32_t exit = add_exit(trace, offset, h, types, sources, objects);
+        define(trace, sources, count, (uint32_t)h);
+        TraceInstruction *guard = emit(trace, TRACE_GUARD_GLOBAL, 0, 0, exit);
+        guard->name = name;
+        guard->object = AS_OBJ(value);
+        objects[h] = AS_OBJ(value);
+        types[h++] = SLOT_FUNCTION;
+        break;
+      }
+      if (type_of(value) == SLOT_OTHER) {
+        failure = "global isn't a number or boolean";
+        break;
+      }
+      uint32_t exit = add_exit(trace, offset, h, types, sources, objects);
+      define(trace, sources, count, (uint32_t)h);
+      emit(trace, TRACE_GET_GLOBAL, (uint32_t)h, type_of(value), exit)->name =
+          name;
+      types[h++] = (uint8_t)type_of(value);
+      break;
+    }
+
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG: {
+      ObjString *name =
+          AS_STRING(chunk->constants.values[read_operand(chunk, offset)]);
+      uint32_t exit = add_exit(trace, offset, h, types, sources, objects);
+      emit(trace, TRACE_SET_GLOBAL, sources[h - 1], types[h - 1], exit)
+          ->name = name;
+      break;
+    }
+
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_LESS:
+    case OP_GREATER: {
+      if (!numeric(types[h - 2]) || !numeric(types[h - 1])) {
+        failure = "operands aren't numbers";
+        break;
+      }
+      bool comparison = op == OP_LESS || op == OP_GREATER;
+
+      if (types[h - 2] == SLOT_INT && types[h - 1] == SLOT_INT &&
+          op != OP_DIVIDE) {
+        TraceOp trace_op = op == OP_ADD        ? TRACE_ADD_INT
+                           : op == OP_SUBTRACT ? TRACE_SUBTRACT_INT
+                           : op == OP_MULTIPLY ? TRACE_MULTIPLY_INT
+                           : op == OP_LESS     ? TRACE_LESS_INT
+                                               : TRACE_GREATER_INT;
+        // an overflow leaves before the instruction, which the interpreter
+        // redoes in floating point.
+        uint32_t exit =
+            comparison ? 0 : add_exit(trace, offset, h, types, sources, objects);
+        uint32_t a = sources[h - 2], b = sources[h - 1];
+        define(trace, sources, count, (uint32_t)(h - 2));
+        emit(trace, trace_op, (uint32_t)(h - 2), a, b)->exit = exit;
+        h--;
+        types[h - 1] = comparison ? SLOT_BOOL : SLOT_INT;
+        break;
+      }
+
+      TraceOp trace_op = op == OP_ADD        ? TRACE_ADD
+                         : op == OP_SUBTRACT ? TRACE_SUBTRACT
+                         : op == OP_MULTIPLY ? TRACE_MULTIPLY
+                         : op == OP_DIVIDE   ? TRACE_DIVIDE
+                         : op == OP_LESS     ? TRACE_LESS
+                                             : TRACE_GREATER;
+      to_number(trace, sources, count, types, h - 1);
+      to_number(trace, sources, count, types, h - 2);
+      uint32_t a = sources[h - 2], b = sources[h - 1];
+      define(trace, sources, count, (uint32_t)(h - 2));
+      emit(trace, trace_op, (uint32_t)(h - 2), a, b);
+      h--;
+      types[h - 1] = comparison ? SLOT_BOOL : SLOT_NUMBER;
+      break;
+    }
+
+    case OP_EQUAL: {
+      if (types[h - 2] == SLOT_INT && types[h - 1] == SLOT_INT) {
+        uint32_t a = sources[h - 2], b = sources[h - 1];
+        define(trace, sources, count, (uint32_t)(h - 2));
+        emit(trace, TRACE_EQUAL_INT, (uint32_t)(h - 2), a, b);
+      } else if (numeric(types[h - 2]) && numeric(types[h - 1])) {
+        to_number(trace, sources, count, types, h - 1);
+        to_number(trace, sources, count, types, h - 2);
+        uint32_t a = sources[h - 2], b = sources[h - 1];
+        define(trace, sources, count, (uint32_t)(h - 2));
+        emit(trace, TRACE_EQUAL, (uint32_t)(h - 2), a, b);
+      } else if (types[h - 2] == types[h - 1]) {
+        uint32_t a = sources[h - 2], b = sources[h - 1];
+        define(trace, sources, count, (uint32_t)(h - 2));
+        emit(trace, TRACE_EQUAL, (uint32_t)(h - 2), a, b);
+      } else {
+        // a number never equals a boolean.
+        define(trace, sources, count, (uint32_t)(h - 2));
+        emit(trace, TRACE_CONSTANT, (uint32_t)(h - 2), 0, 0);
+      }
+      h--;
+      types[h - 1] = SLOT_BOOL;
+      break;
+    }
+
+    case OP_NOT: {
+      uint32_t a = sources[h - 1];
+      define(trace, sources, count, (uint32_t)(h - 1));
+      emit(trace, types[h - 1] == SLOT_INT ? TRACE_NOT_INT : TRACE_NOT,
+           (uint32_t)(h - 1), a, 0);
+      types[h - 1] = SLOT_BOOL;
+      break;
+    }
+
+    case OP_NEGATE: {
+      if (!numeric(types[h - 1])) {
+        failure = "operand isn't a number";
+        break;
+      }
+      uint32_t exit = types[h - 1] == SLOT_INT
+                          ? add_exit(trace, offset, h, types, sources, objects)
+                          : 0;
+      uint32_t a = sources[h - 1];
+      define(trace, sources, count, (uint32_t)(h - 1));
+      emit(trace, types[h - 1] == SLOT_INT ? TRACE_NEGATE_INT : TRACE_NEGATE,
+           (uint32_t)(h - 1), a, 0)
+          ->exit = exit;
+      break;
+    }
+
+    case OP_MATH: {
+      MathFunction function = (MathFunction)chunk->code[offset + 1];
+      int arity = math_intrinsics[function].arity;
+      int callee = h - arity - 1;
+      int first = h - arity;
+      // the global it was loaded from is guarded, it stays the native.
+      if (types[callee] != SLOT_FUNCTION ||
+          !is_math_native(OBJ_VAL(objects[callee]), function)) {
+        failure = "callee isn't the math native";
+        break;
+      }
+      if (!numeric(types[first]) || !numeric(types[h - 1])) {
+        failure = "math arguments aren't numbers";
+        break;
+      }
+
+      bool integers = types[first] == SLOT_INT && types[h - 1] == SLOT_INT;
+      if (integers && !math_intrinsics[function].integers) {
+        integers = false;
+      } else if (!integers && (function == MATH_MIN || function == MATH_MAX) &&
+                 types[first] != types[h - 1]) {
+        // the result has the type of whichever argument it is.
+        failure = "min or max of an integer and a float";
+        break;
+      }
+
+      // the result replaces the callee.
+      if (integers) {
+        uint32_t a = sources[first], b = sources[h - 1];
+        define(trace, sources, count, (uint32_t)callee);
+        // floor and ceil of an integer are the integer itself.
+        if (function == MATH_FLOOR || function == MATH_CEIL) {
+          sources[callee] = a;
+        } else {
+          uint32_t exit = add_exit(trace, offset, h, types, sources, objects);
+          TraceInstruction *instruction =
+              emit(trace, TRACE_MATH_INT, (uint32_t)callee, a, b);
+          instruction->exit = exit;
+          instruction->value.integer = function;
+        }
+        types[callee] = SLOT_INT;
+        h = callee + 1;
+        break;
+      }
+
+      to_number(trace, sources, count, types, h - 1);
+      to_number(trace, sources, count, types, first);
+      uint32_t a = sources[first], b = sources[h - 1];
+      define(trace, sources, count, (uint32_t)callee);
+      emit(trace, TRACE_MATH, (uint32_t)callee, a, b)->value.integer =
+          function;
+      h = callee + 1;
+      types[callee] = SLOT_NUMBER;
+      break;
+    }
+
+    case OP_CHECK_NUM:
+      // settled by the recorded type, a trace never sees it fail.
+      if (!numeric(types[h - 1 - chunk->code[offset + 1]])) {
+        failure = "checked value isn't a number";
+      }
+      break;
+
+    case OP_PEEK: {
+      uint32_t slot = (uint32_t)(h - 1 - chunk->code[offset + 1]);
+      if (!numeric(types[slot]) && types[slot] != SLOT_BOOL) {
+        failure = "argument isn't a number or boolean";
+        break;
+      }
+      uint32_t source = sources[slot];
+      define(trace, sources, count, (uint32_t)h);
+      sources[h] = source;
+      types[h++] = types[slot];
+      break;
+    }
+
+    case OP_INLINE_GUARD: {
+      // the callee is known, the guard is settled here.
+      uint8_t argc = chunk->code[offset + 1];
+      Value callee =
+          chunk->constants.values[inline_guard_constant(chunk, offset)];
+      if (types[h - 1 - argc] != SLOT_FUNCTION ||
+          objects[h - 1 - argc] != AS_OBJ(callee)) {
+        failure = "callee isn't known";
+        break;
+      }
+      next = (size_t)jump_target(chunk, offset);
+      break;
+    }
+
+    case OP_INLINE_RETURN: {
+      uint32_t slot = (uint32_t)(h - 1 - chunk->code[offset + 1]);
+      uint32_t source = sources[h - 1];
+      if (source != slot) {
+        define(trace, sources, count, slot);
+        sources[slot] = source;
+      }
+      types[slot] = types[h - 1];
+      objects[slot] = objects[h - 1];
+      h = (int)slot + 1;
+      break;
+    }
+
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+      next = (size_t)jump_target(chunk, offset);
+      break;
+
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG: {
+      if (branch == recorder.branch_count ||
+          recorder.branches[branch].offset != offset) {
+        failure = "branch wasn't recorded";
+        break;
+      }
+
+      // guards the recorded direction, the other one leaves the trace.
+      size_t target = (size_t)jump_target(chunk, offset);
+      if (recorder.branches[branch++].taken) {
+        uint32_t exit = add_exit(trace, next, h, types, sources, objects);
+        emit(trace, TRACE_GUARD_FALSE, sources[h - 1],
+             types[h - 1] == SLOT_INT, exit);
+        next = target;
+      } else {
+        uint32_t exit = add_exit(trace, target, h, types, sources, objects);
+        emit(trace, TRACE_GUARD_TRUE, sources[h - 1],
+             types[h - 1] == SLOT_INT, exit);
+      }
+      break;
+    }
+
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      // other back edges are followed like jumps.
+      if ((size_t)jump_target(chunk, offset) != recorder.header) {
+        next = (size_t)jump_target(chunk, offset);
+        break;
+      }
+      failure = close_trace(trace, types, sources, h);
+      closed = true;
+      break;
+
+    case OP_FOR_STEP: {
+      if (branch == recorder.branch_count ||
+          recorder.branches[branch].offset != offset) {
+        failure = "branch wasn't recorded";
+        break;
+      }
+      failure = step_counter(trace, chunk, offset, types, sources, objects, h);
+      if (failure != NULL) {
+        break;
+      }
+
+      // guards the recorded direction like a conditional jump, on the
+      // comparison step_counter left in slot h.
+      size_t target = (size_t)jump_target(chunk, offset);
+      if (recorder.branches[branch++].taken) {
+        uint32_t exit = add_exit(trace, next, h, types, sources, objects);
+        emit(trace, TRACE_GUARD_TRUE, (uint32_t)h, 0, exit);
+        if (target == recorder.header) {
+          failure = close_trace(trace, types, sources, h);
+          closed = true;
+        }
+        next = target;
+      } else {
+        uint32_t exit = add_exit(trace, target, h, types, sources, objects);
+        emit(trace, TRACE_GUARD_FALSE, (uint32_t)h, 0, exit);
+      }
+      break;
+    }
+
+    default:
+      failure = "unsupported instruction";
+      break;
+    }
+
+    offset = next;
+  }
+
+  FREE_ARRAY(uint32_t, sources, count);
+  FREE_ARRAY(Obj *, objects, count);
+  FREE_ARRAY(uint8_t, types, function->max_stack);
+
+  if (failure != NULL) {
+    log_debug("couldn't trace loop at %zu: %s", recorder.header,
+              failure);
+    free_trace(trace);
+    return NULL;
+  }
+
+  log_debug("traced loop at %zu: %zu instructions, %zu exits",
+            recorder.header, trace->count, trace->exit_count);
+  return trace;
+}
+
+/*
+ * Runs a trace from the loop header until it leaves.
+ * @return false if the frame doesn't have the types the trace expects, in
+ * which case nothing ran.
+ */
+static bool run_trace(Trace *trace, CallFrame *frame) {
+  TraceRegister *r = trace->registers;
+  Value *slots = frame->slots;
+
+  for (int i = 0; i < trace->entry_height; i++) {
+    uint8_t type = trace->entry_types[i];
+    if (type == SLOT_OTHER) {
+      continue;
+    }
+    if (type_of(slots[i]) != (SlotType)type) {
+      return false;
+    }
+    r[i] = unbox(slots[i]);
+  }
+
+  TraceInstruction *ip = trace->code;
+  uint32_t exit;
+  while (true) {
+    switch (ip->op) {
+    case TRACE_CONSTANT:
+      r[ip->a] = ip->value;
+      break;
+    case TRACE_MOVE:
+      r[ip->a] = r[ip->b];
+      break;
+    case TRACE_ADD:
+      r[ip->a].number = r[ip->b].number + r[ip->c].number;
+      break;
+    case TRACE_SUBTRACT:
+      r[ip->a].number = r[ip->b].number - r[ip->c].number;
+      break;
+    case TRACE_MULTIPLY:
+      r[ip->a].number = r[ip->b].number * r[ip->c].number;
+      break;
+    case TRACE_DIVIDE:
+      r[ip->a].number = r[ip->b].number / r[ip->c].number;
+      break;
+    case TRACE_LESS:
+      r[ip->a].number = r[ip->b].number < r[ip->c].number;
+      break;
+    case TRACE_GREATER:
+      r[ip->a].number = r[ip->b].number > r[ip->c].number;
+      break;
+    case TRACE_EQUAL:
+      r[ip->a].number = r[ip->b].number == r[ip->c].number;
+      break;
+    // the result is only written without an overflow, the exit still sees
+    // the operands.
+    case TRACE_ADD_INT:
+    case TRACE_SUBTRACT_INT:
+    case TRACE_MULTIPLY_INT: {
+      int64_t b = r[ip->b].integer, c = r[ip->c].integer, result;
+      bool fits = ip->op == TRACE_ADD_INT        ? add_int(b, c, &result)
+                  : ip->op == TRACE_SUBTRACT_INT ? subtract_int(b, c, &result)
+                                                 : multiply_int(b, c, &result);
+      if (!fits) {
+        exit = ip->exit;
+        goto leave;
+      }
+      r[ip->a].integer = result;
+      break;
+    }
+    case TRACE_LESS_INT:
+      r[ip->a].number = r[ip->b].integer < r[ip->c].integer;
+      break;
+    case TRACE_GREATER_INT:
+      r[ip->a].number = r[ip->b].integer > r[ip->c].integer;
+      break;
+    case TRACE_EQUAL_INT:
+      r[ip->a].number = r[ip->b].integer == r[ip->c].integer;
+      break;
+    // numbers and booleans are both falsey when they are 0.
+    case TRACE_NOT:
+      r[ip->a].number = r[ip->b].number == 0;
+      break;
+    case TRACE_NEGATE:
+      r[ip->a].number = -r[ip->b].number;
+      break;
+    case TRACE_NOT_INT:
+      r[ip->a].number = r[ip->b].integer == 0;
+      break;
+    case TRACE_NEGATE_INT:
+      if (r[ip->b].integer == INT64_MIN) {
+        exit = ip->exit;
+        goto leave;
+      }
+      r[ip->a].integer = -r[ip->b].integer;
+      break;
+    case TRACE_TO_NUMBER:
+      r[ip->a].number = (double)r[ip->b].integer;
+      break;
+    case TRACE_MATH:
+      r[ip->a].number = math_number((MathFunction)ip->value.integer,
+                                    r[ip->b].number, r[ip->c].number);
+      break;
+    case TRACE_MATH_INT: {
+      int64_t result;
+      if (!math_int((MathFunction)ip->value.integer, r[ip->b].integer,
+                    r[ip->c].integer, &result)) {
+        exit = ip->exit;
+        goto leave;
+      }
+      r[ip->a].integer = result;
+      break;
+    }
+    case TRACE_GUARD_TRUE:
+      if (ip->b ? r[ip->a].integer == 0 : r[ip->a].number == 0) {
+        exit = ip->c;
+        goto leave;
+      }
+      break;
+    case TRACE_GUARD_FALSE:
+      if (ip->b ? r[ip->a].integer != 0 : r[ip->a].number != 0) {
+        exit = ip->c;
+        goto leave;
+      }
+      break;
+    case TRACE_GET_GLOBAL: {
+      Value value;
+      if (!table_get(&vm.globals, ip->name, &value) ||
+          type_of(value) != (SlotType)ip->b) {
+        exit = ip->c;
+        goto leave;
+      }
+      r[ip->a] = unbox(value);
+      break;
+    }
+    case TRACE_SET_GLOBAL: {
+      // undefined globals are reported by the interpreter.
+      if (table_set(&vm.globals, ip->name, box(r[ip->a], (SlotType)ip->b))) {
+        table_delete(&vm.globals, ip->name);
+        exit = ip->c;
+        goto leave;
+      }
+      break;
+    }
+    case TRACE_GUARD_GLOBAL: {
+      Value value;
+      if (!table_get(&vm.globals, ip->name, &value) || !IS_OBJ(value) ||
+          AS_OBJ(value) != ip->object) {
+        exit = ip->c;
+        goto leave;
+      }
+      break;
+    }
+    case TRACE_LOOP:
+      ip = trace->code;
+      continue;
+    }
+    ip++;
+  }
+
+leave:;
+  // boxes the unboxed slots back into the frame.
+  TraceExit *target = &trace->exits[exit];
+  ExitSlot *exit_slots = trace->exit_slots + target->slots;
+  for (int i = 0; i < target->height; i++) {
+    switch (exit_slots[i].type) {
+    case SLOT_OTHER:
+      break;
+    case SLOT_FUNCTION:
+      slots[i] = OBJ_VAL(exit_slots[i].object);
+      break;
+    default:
+      slots[i] = box(r[exit_slots[i].source], exit_slots[i].type);
+      break;
+    }
+  }
+  frame->ip = frame->function->chunk.code + target->offset;
+  vm.stack_top = slots + target->height;
+  return true;
+}
+
+void trace_loop(CallFrame *frame) {
+  ObjFunction *function = frame->function;
+  size_t header = (size_t)(frame->ip - function->chunk.code);
+
+  if (vm.recording) {
+    Loop *recorded = find_loop(recorder.function, recorder.header);
+    if (recorder.frame != frame || recorder.function != function) {
+      // left the frame being recorded, the loop is given up on.
+      recorded->blacklisted = true;
+      stop_recording();
+    } else if (recorder.header == header) {
+      // one whole iteration has been recorded.
+      recorded->trace = compile_trace();
+      recorded->blacklisted = recorded->trace == NULL;
+      stop_recording();
+    } else {
+      // some other back edge inside the iteration, like the jump from the
+      // increment of a for loop back to its condition.
+      return;
+    }
+  }
+
+  Loop *loop = find_loop(function, header);
+  if (loop->trace != NULL) {
+    run_trace(loop->trace, frame);
+    return;
+  }
+
+  if (!loop->blacklisted && ++loop->hits == TRACE_HOT_LOOP) {
+    start_recording(frame, loop);
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef ZSPIE_TRACE_H_
+#define ZSPIE_TRACE_H_
+
+#include "common.h"
+#include "object.h"
+
+struct CallFrame;
+
+// a loop gets traced after jumping back this many times.
+#define TRACE_HOT_LOOP 64
+
+// longest path through a loop body which gets traced, in instructions.
+#define TRACE_MAX_LENGTH 512
+
+typedef struct Trace Trace;
+
+/*
+ * Tracing state of one loop, found by the offset of its header.
+ */
+typedef struct {
+  // offset the loop's OP_LOOP jumps back to.
+  size_t header;
+  // times the loop jumped back while it had no trace.
+  int hits;
+  // loops which couldn't be traced aren't tried again.
+  bool blacklisted;
+  // compiled trace of the loop body, NULL if there is none yet.
+  Trace *trace;
+} Loop;
+
+/*
+ * Side table of the loops of a function, kept out of the read-only bytecode.
+ */
+typedef struct LoopTable {
+  size_t count;
+  size_t capacity;
+  Loop *loops;
+} LoopTable;
+
+/*
+ * Called by the interpreter right after an OP_LOOP jumped back to the loop
+ * header. Counts iterations of the loop, records one iteration of the body
+ * once it's hot and then runs the compiled trace. A trace runs until one of
+ * its guards fails, after which the frame's ip and the stack are left for
+ * the interpreter to carry on from.
+ */
+void trace_loop(struct CallFrame *frame);
+
+/*
+ * Records the outcome of an OP_JUMP_IF_FALSE while an iteration is being
+ * recorded, only called when `vm.recording` is set.
+ * @param branch - the jump instruction.
+ * @param taken - if the jump was taken.
+ */
+void trace_branch(struct CallFrame *frame, uint8_t *branch, bool taken);
+
+/*
+ * Frees a function's loop table and its traces.
+ */
+void free_loops(LoopTable *loops);
+
+#endif // !ZSPIE_TRACE_H_
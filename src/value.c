@@ -2,12 +2,14 @@
 #include "external/log.h"
 #include "memory.h"
 #include "object.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
 bool values_equal(Value a, Value b) {
   if (a.type != b.type) {
-    return false;
+    // 1 == 1.0
+    return IS_NUMERIC(a) && IS_NUMERIC(b) && AS_FLOAT(a) == AS_FLOAT(b);
   }
 
   switch (a.type) {
@@ -18,7 +20,11 @@ bool values_equal(Value a, Value b) {
   case VAL_NUMBER:
     return AS_NUMBER(a) == AS_NUMBER(b);
   case VAL_OBJ:
-    return AS_OBJ(a) == AS_OBJ(b);
+    // strings are interned, only slices need their characters compared.
+    return AS_OBJ(a) == AS_OBJ(b) ||
+           ((IS_SLICE(a) || IS_SLICE(b)) && texts_equal(a, b));
+  case VAL_INT:
+    return AS_INT(a) == AS_INT(b);
   default:
     return false; // unreachable.
   }
@@ -71,6 +77,10 @@ void print_value(Value value) {
     printf("'%g'", AS_NUMBER(value));
     break;
 
+  case VAL_INT:
+    printf("'%" PRId64 "'", AS_INT(value));
+    break;
+
   case VAL_OBJ:
     print_object(value);
     break;
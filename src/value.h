@@ -18,6 +18,8 @@ typedef enum {
   VAL_NUMBER,
   // objects like strings, functions, classes.
   VAL_OBJ,
+  // 64 bit integers, numbers written without a fraction.
+  VAL_INT,
 } ValueType;
 
 /**
@@ -29,6 +31,7 @@ typedef struct {
     bool boolean;
     double number;
     Obj *obj;
+    int64_t integer;
   } as;
 } Value;
 
@@ -40,17 +43,123 @@ bool values_equal(Value a, Value b);
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}}) // for number
 #define OBJ_VAL(object)                                                        \
   ((Value){VAL_OBJ, {.obj = (Obj *)object}}) // for objects.
+#define INT_VAL(value) ((Value){VAL_INT, {.integer = value}}) // for integers
 
 // Some helpers to unpack Zspie's value into C types.
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
 #define AS_OBJ(value) ((value).as.obj)
+#define AS_INT(value) ((value).as.integer)
+// an integer or a number as a double.
+#define AS_FLOAT(value)                                                        \
+  (IS_INT(value) ? (double)AS_INT(value) : AS_NUMBER(value))
 
 // helpers macros to check to check type of a Value.
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_NULL(value) ((value).type == VAL_NULL)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_INT(value) ((value).type == VAL_INT)
+// integers and numbers both take part in arithmetic.
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
+
+/*
+ * Overflow checked integer arithmetic.
+ * @return false if the result doesn't fit in 64 bits.
+ */
+static inline bool add_int(int64_t a, int64_t b, int64_t *result) {
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_add_overflow(a, b, result);
+#else
+  if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) {
+    return false;
+  }
+  *result = a + b;
+  return true;
+#endif
+}
+
+static inline bool subtract_int(int64_t a, int64_t b, int64_t *result) {
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_sub_overflow(a, b, result);
+#else
+  if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) {
+    return false;
+  }
+  *result = a - b;
+  return true;
+#endif
+}
+
+static inline bool multiply_int(int64_t a, int64_t b, int64_t *result) {
+#if defined(__GNUC__) || defined(__clang__)
+  return !__builtin_mul_overflow(a, b, result);
+#else
+  // bounds of a for the product to fit, the quotients round towards zero
+  // which is the right way for both signs of b.
+  if (b > 0 ? a > INT64_MAX / b || a < INT64_MIN / b
+      : b < -1 ? a < INT64_MAX / b || a > INT64_MIN / b
+               : b == -1 && a == INT64_MIN) {
+    return false;
+  }
+  *result = a * b;
+  return true;
+#endif
+}
+
+/*
+ * Arithmetic on numeric values. Two integers give an integer unless it
+ * overflows, everything else is done on doubles. Division always gives a
+ * double.
+ */
+static inline Value add_values(Value a, Value b) {
+  int64_t result;
+  if (IS_INT(a) && IS_INT(b) && add_int(AS_INT(a), AS_INT(b), &result)) {
+    return INT_VAL(result);
+  }
+  return NUMBER_VAL(AS_FLOAT(a) + AS_FLOAT(b));
+}
+
+static inline Value subtract_values(Value a, Value b) {
+  int64_t result;
+  if (IS_INT(a) && IS_INT(b) && subtract_int(AS_INT(a), AS_INT(b), &result)) {
+    return INT_VAL(result);
+  }
+  return NUMBER_VAL(AS_FLOAT(a) - AS_FLOAT(b));
+}
+
+static inline Value multiply_values(Value a, Value b) {
+  int64_t result;
+  if (IS_INT(a) && IS_INT(b) && multiply_int(AS_INT(a), AS_INT(b), &result)) {
+    return INT_VAL(result);
+  }
+  return NUMBER_VAL(AS_FLOAT(a) * AS_FLOAT(b));
+}
+
+static inline Value divide_values(Value a, Value b) {
+  return NUMBER_VAL(AS_FLOAT(a) / AS_FLOAT(b));
+}
+
+static inline Value negate_value(Value a) {
+  if (IS_INT(a) && AS_INT(a) != INT64_MIN) {
+    return INT_VAL(-AS_INT(a));
+  }
+  return NUMBER_VAL(-AS_FLOAT(a));
+}
+
+static inline bool less_values(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    return AS_INT(a) < AS_INT(b);
+  }
+  return AS_FLOAT(a) < AS_FLOAT(b);
+}
+
+static inline bool greater_values(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    return AS_INT(a) > AS_INT(b);
+  }
+  return AS_FLOAT(a) > AS_FLOAT(b);
+}
 
 /* ValueArray
  * This holds a dynamic array of values present in a chunk of instructions.
@@ -0,0 +1,717 @@
+#include "verifier.h"
+#include "chunk.h"
+#include "external/log.h"
+#include "mathlib.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Decoded shape of one instruction.
+ */
+typedef struct {
+  // total length of the instruction including its operands.
+  size_t length;
+  // values popped from the stack.
+  int pops;
+  // values pushed on the stack after popping.
+  int pushes;
+  // operand naming a local slot, -1 if none.
+  int slot;
+  // second operand naming a local slot, -1 if none.
+  int other_slot;
+  // slots above the stack the instruction works in, as the instructions it
+  // stands for would have pushed there.
+  int scratch;
+  // if the instruction may jump to `jump`.
+  bool jumps;
+  // offset the instruction may jump to.
+  long jump;
+  // cases of a switch instruction, which jumps to one of them or to `jump`.
+  int cases;
+  // if execution can continue to the next instruction.
+  bool falls_through;
+} Instruction;
+
+// last error found by analyze_chunk.
+static const char *error_message = NULL;
+// offset of the instruction with the error.
+static size_t error_offset = 0;
+// call caches used by the chunk analyze_chunk last looked at, one past the
+// highest index.
+static uint32_t call_caches_used = 0;
+// property caches used by that chunk, one past the highest index.
+static uint32_t property_caches_used = 0;
+
+/*
+ * Records an error and fails the analysis.
+ */
+static bool fail(size_t offset, const char *message) {
+  error_message = message;
+  error_offset = offset;
+  return false;
+}
+
+/*
+ * Checks a constant index operand, and that it names a string if `string`.
+ */
+static bool check_constant(Chunk *chunk, size_t offset, uint32_t index,
+                           bool string) {
+  if (index >= chunk->constants.count) {
+    return fail(offset, "Constant index out of range.");
+  }
+
+  if (string && !IS_STRING(chunk->constants.values[index])) {
+    return fail(offset, "Expected a string constant.");
+  }
+
+  return true;
+}
+
+/*
+ * Checks the map of an OP_JUMP_MAP takes its keys to one of count cases.
+ */
+static bool check_jump_map(Value table, int count) {
+  if (!IS_MAP(table)) {
+    return false;
+  }
+  ObjMap *map = AS_MAP(table);
+  for (int i = 0; i < map->used; i++) {
+    MapEntry *entry = &map->entries[i];
+    if (IS_NULL(entry->key)) {
+      continue;
+    }
+    if (!IS_INT(entry->value) || AS_INT(entry->value) < 0 ||
+        AS_INT(entry->value) >= count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Continues the analysis at target with height values on the stack, the
+ * first time it's reached.
+ * @return false if target isn't an instruction or was reached with another
+ * height.
+ */
+static bool flow_to(size_t offset, long target, int height_at, int *height,
+                    size_t *worklist, size_t *worklist_count, size_t count) {
+  if (target < 0 || (size_t)target >= count || height[target] == -1) {
+    return fail(offset, "Jump target is not an instruction.");
+  }
+  if (height[target] == -2) {
+    height[target] = height_at;
+    worklist[(*worklist_count)++] = (size_t)target;
+  } else if (height[target] != height_at) {
+    return fail(offset, "Inconsistent stack height at jump target.");
+  }
+  return true;
+}
+
+/*
+ * Decodes the instruction at offset, checking everything which doesn't
+ * depend on the stack height.
+ */
+static bool decode(Chunk *chunk, size_t offset, Instruction *ins) {
+  uint8_t op = chunk->code[offset];
+
+  ins->pops = 0;
+  ins->pushes = 0;
+  ins->slot = -1;
+  ins->other_slot = -1;
+  ins->scratch = 0;
+  ins->jumps = false;
+  ins->jump = 0;
+  ins->cases = 0;
+  ins->falls_through = true;
+
+  ins->length = instruction_length(chunk, offset);
+  if (ins->length == 0) {
+    return fail(offset, "Unknown opcode.");
+  }
+
+  if (offset + ins->length > chunk->count) {
+    return fail(offset, "Truncated instruction.");
+  }
+
+  switch (op) {
+  case OP_CALL:
+  case OP_CALL_LONG:
+  case OP_CALL_0:
+  case OP_CALL_1:
+  case OP_CALL_2:
+  case OP_CALL_3:
+    ins->pops = (int)call_args_count(chunk, offset) + 1;
+    ins->pushes = 1;
+    if (call_cache_index(chunk, offset) + 1 > call_caches_used) {
+      call_caches_used = call_cache_index(chunk, offset) + 1;
+    }
+    break;
+
+  case OP_CONSTANT:
+    ins->pushes = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), false);
+
+  case OP_CONSTANT_LONG:
+    ins->pushes = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), false);
+
+  case OP_NULL:
+  case OP_TRUE:
+  case OP_FALSE:
+    ins->pushes = 1;
+    break;
+
+  case OP_POP:
+  case OP_PRINT:
+    ins->pops = 1;
+    break;
+
+  case OP_EQUAL:
+  case OP_GREATER:
+  case OP_LESS:
+  case OP_ADD:
+  case OP_SUBTRACT:
+  case OP_MULTIPLY:
+  case OP_DIVIDE:
+  case OP_ADD_NN:
+  case OP_SUBTRACT_NN:
+  case OP_MULTIPLY_NN:
+  case OP_DIVIDE_NN:
+  case OP_LESS_NN:
+  case OP_GREATER_NN:
+    ins->pops = 2;
+    ins->pushes = 1;
+    break;
+
+  case OP_NOT:
+  case OP_NEGATE:
+    ins->pops = 1;
+    ins->pushes = 1;
+    break;
+
+  case OP_GET_LOCAL:
+    ins->slot = (int)read_operand(chunk, offset);
+    ins->pushes = 1;
+    break;
+
+  case OP_GET_LOCAL_LONG:
+    ins->slot = (int)read_operand(chunk, offset);
+    ins->pushes = 1;
+    break;
+
+  case OP_SET_LOCAL:
+    ins->slot = (int)read_operand(chunk, offset);
+    ins->pops = 1;
+    ins->pushes = 1;
+    break;
+
+  case OP_SET_LOCAL_LONG:
+    ins->slot = (int)read_operand(chunk, offset);
+    ins->pops = 1;
+    ins->pushes = 1;
+    break;
+
+  case OP_DEFINE_GLOBAL:
+    ins->pops = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), true);
+
+  case OP_DEFINE_GLOBAL_LONG:
+    ins->pops = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), true);
+
+  case OP_SET_GLOBAL:
+    ins->pops = 1;
+    ins->pushes = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), true);
+
+  case OP_SET_GLOBAL_LONG:
+    ins->pops = 1;
+    ins->pushes = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), true);
+
+  case OP_GET_GLOBAL:
+    ins->pushes = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), true);
+
+  case OP_GET_GLOBAL_LONG:
+    ins->pushes = 1;
+    return check_constant(chunk, offset, read_operand(chunk, offset), true);
+
+  case OP_JUMP:
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    ins->falls_through = false;
+    break;
+
+  case OP_JUMP_LONG:
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    ins->falls_through = false;
+    break;
+
+  case OP_JUMP_IF_FALSE:
+    // the condition is left on the stack on both paths.
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    break;
+
+  case OP_JUMP_IF_FALSE_LONG:
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    break;
+
+  case OP_LOOP:
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    ins->falls_through = false;
+    break;
+
+  case OP_LOOP_LONG:
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    ins->falls_through = false;
+    break;
+
+  case OP_RETURN:
+    ins->pops = 1;
+    ins->falls_through = false;
+    break;
+
+  case OP_JUMP_TABLE:
+  case OP_JUMP_MAP: {
+    uint32_t constant = name_operand(chunk, offset);
+    if (!check_constant(chunk, offset, constant, false)) {
+      return false;
+    }
+    Value table = chunk->constants.values[constant];
+    ins->cases = (int)jump_table_count(chunk, offset);
+    if (op == OP_JUMP_TABLE ? !IS_INT(table)
+                            : !check_jump_map(table, ins->cases)) {
+      return fail(offset, "Expected a jump table constant.");
+    }
+    ins->pops = 1;
+    ins->jump = (long)jump_table_target(chunk, offset, ins->cases);
+    ins->jumps = true;
+    ins->falls_through = false;
+    break;
+  }
+
+  case OP_RETURN_N:
+    ins->pops = read_operand(chunk, offset);
+    if (ins->pops == 0) {
+      return fail(offset, "Expected at least one value to return.");
+    }
+    ins->falls_through = false;
+    break;
+
+  case OP_UNPACK:
+    ins->pops = 1;
+    ins->pushes = read_operand(chunk, offset);
+    if (ins->pushes == 0) {
+      return fail(offset, "Expected at least one slot to unpack into.");
+    }
+    break;
+
+  case OP_PEEK: {
+    // pops and pushes back everything down to the peeked slot.
+    int distance = (int)read_operand(chunk, offset);
+    ins->pops = distance + 1;
+    ins->pushes = distance + 2;
+    break;
+  }
+
+  case OP_CHECK_NUM: {
+    // looks at the checked slot without popping it.
+    int distance = (int)read_operand(chunk, offset);
+    ins->pops = distance + 1;
+    ins->pushes = distance + 1;
+    break;
+  }
+
+  case OP_INLINE_GUARD: {
+    // looks at the callee and its arguments without popping them.
+    int args_count = (int)chunk->code[offset + 1];
+    uint32_t index = inline_guard_constant(chunk, offset);
+    ins->pops = args_count + 1;
+    ins->pushes = args_count + 1;
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    if (index >= chunk->constants.count ||
+        (!IS_FUNCTION(chunk->constants.values[index]) &&
+         !IS_NATIVE(chunk->constants.values[index]))) {
+      return fail(offset, "Expected a function or native constant.");
+    }
+    break;
+  }
+
+  case OP_INLINE_RETURN:
+    ins->pops = (int)read_operand(chunk, offset) + 1;
+    ins->pushes = 1;
+    break;
+
+  case OP_CLOSURE: {
+    uint32_t index = read_operand(chunk, offset);
+    ins->pushes = 1;
+    if (index >= chunk->constants.count ||
+        !IS_FUNCTION(chunk->constants.values[index]) ||
+        AS_FUNCTION(chunk->constants.values[index])->capture_count == 0) {
+      return fail(offset, "Expected a function constant with captures.");
+    }
+    break;
+  }
+
+  case OP_GET_CAPTURE:
+  case OP_GET_UPVALUE:
+    ins->pushes = 1;
+    break;
+
+  case OP_SET_UPVALUE:
+    ins->pops = 1;
+    ins->pushes = 1;
+    break;
+
+  case OP_CLOSE_UPVALUE:
+    ins->pops = 1;
+    break;
+
+  case OP_ARRAY:
+    ins->pops = (int)read_operand(chunk, offset);
+    ins->pushes = 1;
+    break;
+
+  case OP_MAP:
+    ins->pops = 2 * (int)read_operand(chunk, offset);
+    ins->pushes = 1;
+    break;
+
+  case OP_CONCAT_N:
+    ins->pops = (int)chunk->code[offset + 1];
+    ins->pushes = 1;
+    if (ins->pops == 0) {
+      return fail(offset, "Expected at least one value to concatenate.");
+    }
+    if (chunk->code[offset + 2] > CONCAT_FORMAT) {
+      return fail(offset, "Unknown concatenation mode.");
+    }
+    break;
+
+  case OP_MATH: {
+    uint8_t function = chunk->code[offset + 1];
+    if (function >= MATH_COUNT) {
+      return fail(offset, "Unknown math function.");
+    }
+    // the callee below the arguments is replaced by the result.
+    ins->pops = math_intrinsics[function].arity + 1;
+    ins->pushes = 1;
+    if (call_cache_index(chunk, offset) + 1 > call_caches_used) {
+      call_caches_used = call_cache_index(chunk, offset) + 1;
+    }
+    break;
+  }
+
+  case OP_GET_INDEX:
+    ins->pops = 2;
+    ins->pushes = 1;
+    break;
+
+  case OP_CLASS:
+    ins->pushes = 1;
+    return check_constant(chunk, offset, name_operand(chunk, offset), true);
+
+  case OP_INHERIT:
+    ins->pops = 2;
+    ins->pushes = 1;
+    break;
+
+  case OP_METHOD:
+    ins->pops = 1;
+    return check_constant(chunk, offset, name_operand(chunk, offset), true);
+
+  case OP_GET_PROPERTY:
+  case OP_SET_PROPERTY:
+  case OP_INVOKE:
+  case OP_GET_PROPERTY_LONG:
+  case OP_SET_PROPERTY_LONG:
+  case OP_INVOKE_LONG:
+    if (op == OP_INVOKE || op == OP_INVOKE_LONG) {
+      // the called method moves the arguments up one slot.
+      ins->pops = (int)chunk->code[offset + 4] + 1;
+      ins->scratch = 1;
+    } else {
+      ins->pops = op == OP_GET_PROPERTY || op == OP_GET_PROPERTY_LONG ? 1 : 2;
+    }
+    ins->pushes = 1;
+    if (property_cache_index(chunk, offset) + 1 > property_caches_used) {
+      property_caches_used = property_cache_index(chunk, offset) + 1;
+    }
+    return check_constant(chunk, offset, name_operand(chunk, offset), true);
+
+  case OP_GET_SUPER:
+  case OP_SUPER_INVOKE:
+    ins->pops = op == OP_GET_SUPER ? 2 : (int)chunk->code[offset + 4] + 2;
+    ins->pushes = 1;
+    return check_constant(chunk, offset, name_operand(chunk, offset), true);
+
+  case OP_SET_INDEX:
+    ins->pops = 3;
+    ins->pushes = 1;
+    break;
+
+  case OP_FOR_STEP: {
+    // computes the step and the comparison in two slots above the stack.
+    uint8_t mode = chunk->code[offset + 2];
+    uint32_t limit = chunk->code[offset + 3];
+    uint32_t step = chunk->code[offset + 4];
+    ins->slot = (int)chunk->code[offset + 1];
+    ins->scratch = 2;
+    ins->jump = jump_target(chunk, offset);
+    ins->jumps = true;
+    if (mode > (FOR_COMPARISON | FOR_LIMIT_CONSTANT)) {
+      return fail(offset, "Unknown for loop mode.");
+    }
+    if (mode & FOR_LIMIT_CONSTANT) {
+      if (limit >= chunk->constants.count ||
+          !IS_NUMERIC(chunk->constants.values[limit])) {
+        return fail(offset, "Expected a number constant.");
+      }
+    } else {
+      ins->other_slot = (int)limit;
+    }
+    if (step >= chunk->constants.count ||
+        !IS_NUMERIC(chunk->constants.values[step])) {
+      return fail(offset, "Expected a number constant.");
+    }
+    break;
+  }
+  }
+
+  return true;
+}
+
+bool analyze_chunk(Chunk *chunk, int arity, int *heights, int *max_stack) {
+  log_debug("analyzing chunk : %p", chunk);
+  error_message = NULL;
+  call_caches_used = 0;
+  property_caches_used = 0;
+
+  if (chunk->count == 0) {
+    return fail(0, "Empty chunk.");
+  }
+
+  bool valid = true;
+  int *height = ALLOCATE(int, chunk->count);
+  size_t *worklist = ALLOCATE(size_t, chunk->count);
+  size_t worklist_count = 0;
+
+  // linear sweep, marks instruction starts with -2.
+  for (size_t offset = 0; offset < chunk->count;) {
+    Instruction ins;
+    if (!decode(chunk, offset, &ins)) {
+      valid = false;
+      break;
+    }
+    height[offset] = -2;
+    for (size_t i = offset + 1; i < offset + ins.length; i++) {
+      height[i] = -1;
+    }
+    offset += ins.length;
+  }
+
+  // the frame starts with the callee and its arguments.
+  int max = arity + 1;
+  if (valid) {
+    height[0] = arity + 1;
+    worklist[worklist_count++] = 0;
+  }
+
+  while (valid && worklist_count > 0) {
+    size_t offset = worklist[--worklist_count];
+    int h = height[offset];
+
+    Instruction ins;
+    decode(chunk, offset, &ins);
+
+    if (ins.slot >= h || ins.other_slot >= h) {
+      valid = fail(offset, "Local slot out of range.");
+      break;
+    }
+
+    // slot 0 holds the callee, it's never popped by the function.
+    if (h - ins.pops < 1) {
+      valid = fail(offset, "Stack underflow.");
+      break;
+    }
+
+    int next = h - ins.pops + ins.pushes;
+    if (next > max) {
+      max = next;
+    }
+    if (h + ins.scratch > max) {
+      max = h + ins.scratch;
+    }
+
+    if (ins.falls_through) {
+      if (offset + ins.length >= chunk->count) {
+        valid = fail(offset, "Execution falls off the end of the chunk.");
+        break;
+      }
+      valid = flow_to(offset, (long)(offset + ins.length), next, height,
+                      worklist, &worklist_count, chunk->count);
+    }
+
+    if (valid && ins.jumps) {
+      valid = flow_to(offset, ins.jump, next, height, worklist,
+                      &worklist_count, chunk->count);
+    }
+
+    for (int i = 0; valid && i < ins.cases; i++) {
+      valid = flow_to(offset, (long)jump_table_target(chunk, offset, i), next,
+                      height, worklist, &worklist_count, chunk->count);
+    }
+  }
+
+  if (valid) {
+    *max_stack = max;
+    if (heights != NULL) {
+      for (size_t i = 0; i < chunk->count; i++) {
+        heights[i] = height[i] < 0 ? -1 : height[i];
+      }
+    }
+  }
+
+  FREE_ARRAY(size_t, worklist, chunk->count);
+  FREE_ARRAY(int, height, chunk->count);
+  return valid;
+}
+
+/*
+ * Checks the instructions working with captures against the captures of the
+ * function and of the closures it makes. Functions with captures must only
+ * be called through their closures, so they are never loaded as constants.
+ * @param heights - stack heights found by analyze_chunk.
+ */
+static bool check_captures(ObjFunction *function, int *heights) {
+  Chunk *chunk = &function->chunk;
+  for (size_t offset = 0; offset < chunk->count;
+       offset += instruction_length(chunk, offset)) {
+    uint8_t op = chunk->code[offset];
+    int h = heights[offset];
+    if (h == -1) {
+      continue;
+    }
+
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_INLINE_GUARD: {
+      uint32_t index = op == OP_INLINE_GUARD
+                           ? inline_guard_constant(chunk, offset)
+                           : read_operand(chunk, offset);
+      Value constant = chunk->constants.values[index];
+      if (IS_FUNCTION(constant) && AS_FUNCTION(constant)->capture_count > 0) {
+        return fail(offset, "Function with captures loaded without closure.");
+      }
+      break;
+    }
+
+    case OP_GET_CAPTURE:
+    case OP_GET_UPVALUE:
+    case OP_SET_UPVALUE: {
+      uint32_t index = read_operand(chunk, offset);
+      if (index >= (uint32_t)function->capture_count) {
+        return fail(offset, "Capture index out of range.");
+      }
+      if (function->captures[index].cell != (op != OP_GET_CAPTURE)) {
+        return fail(offset, "Capture used as the wrong kind.");
+      }
+      break;
+    }
+
+    case OP_CLOSURE: {
+      ObjFunction *inner =
+          AS_FUNCTION(chunk->constants.values[read_operand(chunk, offset)]);
+      for (int i = 0; i < inner->capture_count; i++) {
+        Capture *capture = &inner->captures[i];
+        bool valid;
+        switch (capture->source) {
+        case CAPTURE_LOCAL:
+          // a cell can point at the slot the closure is pushed to.
+          valid = capture->index < h + (capture->cell ? 1 : 0);
+          break;
+        case CAPTURE_OUTER:
+          valid = capture->index < function->capture_count &&
+                  function->captures[capture->index].cell == capture->cell;
+          break;
+        case CAPTURE_SELF:
+          valid = !capture->cell;
+          break;
+        default:
+          valid = false;
+          break;
+        }
+        if (!valid) {
+          return fail(offset, "Invalid capture.");
+        }
+      }
+      break;
+    }
+    }
+  }
+  return true;
+}
+
+bool verify_function(ObjFunction *function) {
+  const char *name =
+      function->name != NULL ? function->name->chars : "<script>";
+  log_debug("verifying function %s", name);
+
+  int max_stack = 0;
+  int *heights = ALLOCATE(int, function->chunk.count);
+  bool valid = analyze_chunk(&function->chunk, function->arity, heights,
+                             &max_stack) &&
+               check_captures(function, heights);
+  FREE_ARRAY(int, heights, function->chunk.count);
+  if (!valid) {
+    fprintf(stderr, "[offset %zu] Bytecode error in %s: %s\n", error_offset,
+            name, error_message);
+    log_error("[offset %zu] Bytecode error in %s: %s", error_offset, name,
+              error_message);
+    return false;
+  }
+  function->max_stack = max_stack;
+
+  // calling it could only overflow the stack.
+  if (max_stack > MAX_STACK_SIZE) {
+    fprintf(stderr, "Bytecode error in %s: Needs more stack than there is.\n",
+            name);
+    log_error("Bytecode error in %s: Needs more stack than there is.", name);
+    return false;
+  }
+
+  if (call_caches_used > (uint32_t)function->call_cache_count) {
+    fprintf(stderr, "Bytecode error in %s: Call cache out of range.\n", name);
+    log_error("Bytecode error in %s: Call cache out of range.", name);
+    return false;
+  }
+
+  if (property_caches_used > (uint32_t)function->property_cache_count) {
+    fprintf(stderr, "Bytecode error in %s: Property cache out of range.\n",
+            name);
+    log_error("Bytecode error in %s: Property cache out of range.", name);
+    return false;
+  }
+
+  for (size_t i = 0; i < function->chunk.constants.count; i++) {
+    Value constant = function->chunk.constants.values[i];
+    if (IS_FUNCTION(constant) && !verify_function(AS_FUNCTION(constant))) {
+      return false;
+    }
+  }
+
+  return true;
+}
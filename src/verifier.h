@@ -0,0 +1,29 @@
+#ifndef ZSPIE_VERIFIER_H_
+#define ZSPIE_VERIFIER_H_
+
+#include "chunk.h"
+#include "common.h"
+#include "object.h"
+
+/*
+ * Statically checks a chunk's bytecode: every opcode is known, operands are
+ * in range, jumps land on instruction boundaries and the stack height is the
+ * same on every path reaching an instruction.
+ * @param chunk - the chunk to analyze.
+ * @param arity - number of parameters, the frame starts with arity + 1 slots.
+ * @param heights - optional, filled with the stack height before each
+ * instruction, -1 for bytes which aren't a reachable instruction start.
+ * Must have room for `chunk->count` entries.
+ * @param max_stack - set to the maximum stack height of the chunk.
+ * @return true if the chunk is valid.
+ */
+bool analyze_chunk(Chunk *chunk, int arity, int *heights, int *max_stack);
+
+/*
+ * Verifies a function and every function in its constants, storing their
+ * maximum stack heights in `max_stack`. Reports errors to stderr.
+ * @return true if all the functions are valid.
+ */
+bool verify_function(ObjFunction *function);
+
+#endif // !ZSPIE_VERIFIER_H_
@@ -1,11 +1,22 @@
 #include "vm.h"
+#include "array.h"
 #include "chunk.h"
+#include "class.h"
 #include "compiler.h"
 #include "external/log.h"
+#include "map.h"
+#include "mathlib.h"
+#include "memo.h"
 #include "memory.h"
 #include "object.h"
+#include "re.h"
+#include "regvm.h"
 #include "table.h"
+#include "text.h"
+#include "trace.h"
 #include "value.h"
+#include "verifier.h"
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -16,6 +27,22 @@ static Value clock_native(int argCount, Value *args) {
   return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+// clears the results remembered by a `memo fn`, false for anything else.
+static Value clear_memo_native(int argCount, Value *args) {
+  if (argCount != 1) {
+    return BOOL_VAL(false);
+  }
+  Value callee = args[0];
+  ObjFunction *function = IS_CLOSURE(callee)    ? AS_CLOSURE(callee)->function
+                          : IS_FUNCTION(callee) ? AS_FUNCTION(callee)
+                                                : NULL;
+  if (function == NULL || function->memo == NULL) {
+    return BOOL_VAL(false);
+  }
+  clear_memo(function->memo);
+  return BOOL_VAL(true);
+}
+
 /*
  * Global, static VM object for our interpreter.
  */
@@ -25,12 +52,14 @@ VM vm;
 void reset_vm_stack() {
   vm.stack_top = vm.stack;
   vm.frame_count = 0;
+  vm.open_upvalues = NULL;
+  vm.returned = NULL;
 }
 
 /*
  * Reports a runtime error
  */
-static void runtime_error(const char *format, ...) {
+void runtime_error(const char *format, ...) {
   // report error.
   va_list args;
   va_start(args, format);
@@ -49,6 +78,9 @@ static void runtime_error(const char *format, ...) {
   for (int i = vm.frame_count - 1; i >= 0; i--) {
     CallFrame *frame = &vm.frames[i];
     ObjFunction *function = frame->function;
+    if (frame->memo_key != NULL) {
+      free_memo_key(frame->memo_key);
+    }
     size_t instruction = frame->ip - function->chunk.code - 1;
     fprintf(stderr, "[line %zu] in ", function->chunk.lines[instruction]);
     if (function->name == NULL) {
@@ -62,51 +94,137 @@ static void runtime_error(const char *format, ...) {
 }
 
 /*
- * Defines Native function
+ * Defines a global holding a native.
  */
-static void define_native(const char *name, NativeFn function) {
+static void define_global_native(const char *name, ObjNative *native) {
   push(OBJ_VAL(copy_string(name, (int)strlen(name))));
-  push(OBJ_VAL(new_native(function)));
+  push(OBJ_VAL(native));
   table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
   pop();
   pop();
 }
 
+/*
+ * Defines Native function, taking min_arity to max_arity arguments, -1
+ * max_arity for any number.
+ */
+static void define_native(const char *name, int min_arity, int max_arity,
+                          NativeFn function) {
+  define_global_native(name,
+                       new_native(function, NULL, min_arity, max_arity));
+}
+
+static void define_native_call(const char *name, int min_arity,
+                               int max_arity, NativeCallFn call) {
+  define_global_native(name, new_native(NULL, call, min_arity, max_arity));
+}
+
 void init_vm() {
   reset_vm_stack();
   vm.objects = NULL;
+  vm.segments = NULL;
+  vm.jit_enabled = true;
+  vm.jit_blocks = NULL;
+  vm.recording = false;
+#ifdef ZSPIE_REGISTER_VM
+  vm.register_vm = true;
+#else
+  vm.register_vm = false;
+#endif // ZSPIE_REGISTER_VM
+#ifdef ZSPIE_COUNT_INSTRUCTIONS
+  vm.instruction_count = 0;
+#endif // ZSPIE_COUNT_INSTRUCTIONS
   init_table(&vm.globals);
   init_table(&vm.strings);
-  define_native("clock", clock_native);
+  init_table(&vm.regexes);
+  define_native("clock", 0, 0, clock_native);
+  define_native("clear_memo", 1, 1, clear_memo_native);
+  define_native("array", 1, 2, array_native);
+  define_native("len", 1, 1, len_native);
+  define_native("push", 2, 2, push_native);
+  define_native("pop", 1, 1, pop_native);
+  define_native("sum", 1, 1, sum_native);
+  define_native("min", 1, 2, min_native);
+  define_native("max", 1, 2, max_native);
+  define_native("dot", 2, 2, dot_native);
+  define_native("scale", 2, 2, scale_native);
+  define_native("fill", 2, 2, fill_native);
+  define_native_call("sort", 1, 2, sort_native);
+  define_native_call("transform", 2, 2, transform_native);
+  define_native_call("filter", 2, 2, filter_native);
+  define_native("map", 0, 1, map_native);
+  define_native("keys", 1, 1, keys_native);
+  define_native("values", 1, 1, values_native);
+  define_native("has", 2, 2, has_native);
+  define_native("remove", 2, 2, remove_native);
+  define_native("substr", 2, 3, substr_native);
+  define_native("find", 2, 3, find_native);
+  define_native("split", 2, 2, split_native);
+  define_native("starts_with", 2, 2, starts_with_native);
+  define_native("trim", 1, 1, trim_native);
+  define_native("re_compile", 1, 1, re_compile_native);
+  define_native("re_match", 2, 2, re_match_native);
+  define_native("re_find_all", 2, 2, re_find_all_native);
+  define_native("sqrt", 1, 1, sqrt_native);
+  define_native("floor", 1, 1, floor_native);
+  define_native("ceil", 1, 1, ceil_native);
+  define_native("abs", 1, 1, abs_native);
+  define_native("sin", 1, 1, sin_native);
+  define_native("cos", 1, 1, cos_native);
+  define_native("pow", 2, 2, pow_native);
 }
 
 void free_vm() {
   free_table(&vm.globals);
   free_table(&vm.strings);
+  free_table(&vm.regexes);
   free_objects();
+  free_segments();
+  free_jit();
 }
 
+// no bounds check here, call() makes sure the verified maximum stack height
+// of a function fits before pushing its frame.
 void push(Value value) {
-  log_trace("pushing value=%lf to stack.");
+#ifdef ZSPIE_DEBUG_MODE
+  if (vm.stack_top >= vm.stack + MAX_STACK_SIZE) {
+    log_fatal("pushing past the end of the stack.");
+  }
+#endif // ZSPIE_DEBUG_MODE
   *vm.stack_top = value;
   vm.stack_top++;
 }
 
 Value pop() {
   vm.stack_top--;
-  log_trace("poping value=%lf from stack.", *vm.stack_top);
   return *vm.stack_top;
 }
 
 Value peek(size_t distance) { return vm.stack_top[-1 - distance]; }
 
-static bool call(ObjFunction *function, int args_count) {
-  if (args_count != function->arity) {
-    runtime_error("Expected %d arguments got %d.", function->arity, args_count);
-    return false;
+/*
+ * Pushes the frame of a function whose arity matches the call.
+ */
+static inline bool enter(ObjFunction *function, int args_count) {
+  // a remembered result of a `memo fn` takes the place of the call.
+  ObjString *memo_key = NULL;
+  if (function->memo != NULL) {
+    Value result;
+    if (memo_lookup(function->memo, vm.stack_top - args_count - 1, args_count,
+                    &result, &memo_key)) {
+      vm.stack_top -= args_count + 1;
+      push(result);
+      return true;
+    }
   }
 
-  if (vm.frame_count == FRAMES_MAX) {
+  // the only stack check for the whole frame.
+  if (vm.frame_count == FRAMES_MAX ||
+      vm.stack_top - args_count - 1 + function->max_stack >
+          vm.stack + MAX_STACK_SIZE) {
+    if (memo_key != NULL) {
+      free_memo_key(memo_key);
+    }
     runtime_error("Stack overflow.");
     return false;
   }
@@ -115,23 +233,130 @@ static bool call(ObjFunction *function, int args_count) {
   frame->function = function;
   frame->ip = function->chunk.code;
   frame->slots = vm.stack_top - args_count - 1;
+  frame->memo_key = memo_key;
+
+  if (function->compiled != NULL) {
+    return function->compiled(frame);
+  }
+
+  if (function->jit == NULL && vm.jit_enabled &&
+      function->call_count < JIT_CALL_THRESHOLD &&
+      ++function->call_count == JIT_CALL_THRESHOLD) {
+    jit_compile(function);
+  }
+
+  // an exit leaves the frame for the interpreter to carry on with.
+  if (function->jit != NULL) {
+    return function->jit(frame) != JIT_ERROR;
+  }
+  return true;
+}
+
+static bool call(ObjFunction *function, int args_count) {
+  if (args_count != function->arity) {
+    runtime_error("Expected %d arguments got %d.", function->arity, args_count);
+    return false;
+  }
+  return enter(function, args_count);
+}
+
+/*
+ * Checks the number of arguments passed to a native.
+ * @return false after reporting a runtime error.
+ */
+static bool check_native_arity(ObjNative *native, int args_count) {
+  if (args_count >= native->min_arity &&
+      (native->max_arity == -1 || args_count <= native->max_arity)) {
+    return true;
+  }
+
+  if (native->min_arity == native->max_arity) {
+    runtime_error("Expected %d arguments got %d.", native->min_arity,
+                  args_count);
+  } else if (native->max_arity == -1) {
+    runtime_error("Expected at least %d arguments got %d.",
+                  native->min_arity, args_count);
+  } else {
+    runtime_error("Expected %d to %d arguments got %d.", native->min_arity,
+                  native->max_arity, args_count);
+  }
+  return false;
+}
+
+static inline bool call_native(ObjNative *native, int args_count) {
+  Value *args = vm.stack_top - args_count;
+  Value result;
+  if (native->call != NULL) {
+    NativeContext context = {{NULL, OBJ_NATIVE}};
+    if (!native->call(&context, args_count, args, &result)) {
+      return false;
+    }
+  } else {
+    result = native->function(args_count, args);
+  }
+  vm.stack_top = args - 1;
+  push(result);
   return true;
 }
 
-static bool call_value(Value callee, int args_count) {
+/*
+ * Calls a method with its receiver and arguments on top of the stack. The
+ * receiver becomes the method's first slot after its callee, moving the
+ * arguments up one.
+ */
+static bool call_method(Value method, int args_count) {
+  ObjFunction *function = IS_CLOSURE(method) ? AS_CLOSURE(method)->function
+                                             : AS_FUNCTION(method);
+  if (args_count != function->arity - 1) {
+    runtime_error("Expected %d arguments got %d.", function->arity - 1,
+                  args_count);
+    return false;
+  }
+
+  if (vm.stack_top == vm.stack + MAX_STACK_SIZE) {
+    runtime_error("Stack overflow.");
+    return false;
+  }
+
+  Value *receiver = vm.stack_top - args_count - 1;
+  memmove(receiver + 1, receiver, sizeof(Value) * (size_t)(args_count + 1));
+  *receiver = method;
+  vm.stack_top++;
+  return enter(function, args_count + 1);
+}
+
+bool call_value(Value callee, int args_count) {
   if (IS_OBJ(callee)) {
     switch (OBJ_TYPE(callee)) {
-    case OBJ_FUNCTION:
-      return call(AS_FUNCTION(callee), args_count);
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod *bound = AS_BOUND_METHOD(callee);
+      vm.stack_top[-args_count - 1] = bound->receiver;
+      return call_method(bound->method, args_count);
+    }
 
-    case OBJ_NATIVE: {
-      NativeFn native = AS_NATIVE(callee);
-      Value result = native(args_count, vm.stack_top - args_count);
-      vm.stack_top -= args_count + 1;
-      push(result);
+    case OBJ_CLASS: {
+      ObjClass *klass = AS_CLASS(callee);
+      vm.stack_top[-args_count - 1] = OBJ_VAL(new_instance(klass));
+      if (!IS_NULL(klass->initializer)) {
+        return call_method(klass->initializer, args_count);
+      }
+      if (args_count != 0) {
+        runtime_error("Expected 0 arguments got %d.", args_count);
+        return false;
+      }
       return true;
     }
 
+    case OBJ_CLOSURE:
+      return call(AS_CLOSURE(callee)->function, args_count);
+
+    case OBJ_FUNCTION:
+      return call(AS_FUNCTION(callee), args_count);
+
+    case OBJ_NATIVE:
+      return check_native_arity(AS_NATIVE(callee), args_count) &&
+             call_native(AS_NATIVE(callee), args_count);
+
     default:
       break;
     }
@@ -141,6 +366,122 @@ static bool call_value(Value callee, int args_count) {
   return false;
 }
 
+bool call_cached(CallCache *cache, Value callee, int args_count) {
+  // a call site passes the same number of arguments every time, so a cached
+  // function already had its arity checked.
+  if (IS_OBJ(callee) && AS_OBJ(callee) == cache->callee) {
+    if (cache->kind == OBJ_FUNCTION) {
+      return enter((ObjFunction *)cache->callee, args_count);
+    }
+    if (cache->kind == OBJ_CLOSURE) {
+      return enter(((ObjClosure *)cache->callee)->function, args_count);
+    }
+    return call_native((ObjNative *)cache->callee, args_count);
+  }
+
+  if (!call_value(callee, args_count)) {
+    return false;
+  }
+  // classes and bound methods go through call_value every time.
+  ObjType kind = OBJ_TYPE(callee);
+  if (kind == OBJ_FUNCTION || kind == OBJ_CLOSURE || kind == OBJ_NATIVE) {
+    cache->callee = AS_OBJ(callee);
+    cache->kind = kind;
+  }
+  return true;
+}
+
+bool invoke(PropertyCache *cache, ObjString *name, int args_count) {
+  Value receiver = peek(args_count);
+  if (!IS_INSTANCE(receiver)) {
+    runtime_error("Only instances have methods.");
+    return false;
+  }
+
+  ObjInstance *instance = AS_INSTANCE(receiver);
+  PropertyEntry entry;
+  if (!find_property(cache, instance, name, &entry)) {
+    runtime_error("Undefined property '%s'.", name->chars);
+    return false;
+  }
+
+  // a field holding a function is called like any other value.
+  if (entry.slot >= 0) {
+    Value field = instance->fields[entry.slot];
+    vm.stack_top[-args_count - 1] = field;
+    return call_value(field, args_count);
+  }
+  return call_method(entry.method, args_count);
+}
+
+/*
+ * Method named name of the superclass of a `super` access.
+ * @return false after reporting a runtime error.
+ */
+static bool super_method(ObjClass *superclass, ObjString *name, Value *method) {
+  if (!table_get(&superclass->methods, name, method)) {
+    runtime_error("Undefined property '%s'.", name->chars);
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Finds or makes the upvalue pointing at a stack slot.
+ */
+static ObjUpvalue *capture_upvalue(Value *slot) {
+  ObjUpvalue *previous = NULL;
+  ObjUpvalue *upvalue = vm.open_upvalues;
+  while (upvalue != NULL && upvalue->location > slot) {
+    previous = upvalue;
+    upvalue = upvalue->next;
+  }
+  if (upvalue != NULL && upvalue->location == slot) {
+    return upvalue;
+  }
+
+  ObjUpvalue *created = new_upvalue(slot);
+  created->next = upvalue;
+  if (previous == NULL) {
+    vm.open_upvalues = created;
+  } else {
+    previous->next = created;
+  }
+  return created;
+}
+
+ObjClosure *make_closure(ObjFunction *function, Value *slots) {
+  ObjClosure *closure = new_closure(function);
+  for (int i = 0; i < function->capture_count; i++) {
+    Capture *capture = &function->captures[i];
+    switch (capture->source) {
+    case CAPTURE_LOCAL:
+      closure->captures[i] =
+          capture->cell ? OBJ_VAL(capture_upvalue(&slots[capture->index]))
+                        : slots[capture->index];
+      break;
+
+    case CAPTURE_OUTER:
+      closure->captures[i] = AS_CLOSURE(slots[0])->captures[capture->index];
+      break;
+
+    case CAPTURE_SELF:
+      closure->captures[i] = OBJ_VAL(closure);
+      break;
+    }
+  }
+  return closure;
+}
+
+void close_upvalues(Value *last) {
+  while (vm.open_upvalues != NULL && vm.open_upvalues->location >= last) {
+    ObjUpvalue *upvalue = vm.open_upvalues;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    vm.open_upvalues = upvalue->next;
+  }
+}
+
 bool is_falsey(Value value) {
   switch (value.type) {
   case VAL_BOOL:
@@ -155,6 +496,9 @@ bool is_falsey(Value value) {
     // all non zero numbers are true and 0 is false.
     return AS_NUMBER(value) == 0;
 
+  case VAL_INT:
+    return AS_INT(value) == 0;
+
   case VAL_OBJ:
     // all objects are true.
     return false;
@@ -164,25 +508,91 @@ bool is_falsey(Value value) {
   }
 }
 
-void concatenate() {
-
-  ObjString *b = AS_STRING(pop());
-  ObjString *a = AS_STRING(pop());
-
+ObjString *join_strings(ObjString *a, ObjString *b) {
   size_t new_length = a->length + b->length;
   char *new_chars = ALLOCATE(char, new_length + 1);
   memcpy(new_chars, a->chars, a->length);
   memcpy(new_chars + a->length, b->chars, b->length);
   new_chars[new_length] = '\0';
 
-  ObjString *new_obj = take_string(new_chars, new_length);
-  push(OBJ_VAL(new_obj));
+  return take_string(new_chars, new_length);
+}
+
+void concatenate() {
+  Value result;
+  concatenate_n(vm.stack_top - 2, 2, 0, &result);
+  vm.stack_top -= 2;
+  push(result);
+}
+
+/*
+ * Writes a number, boolean or null the way `"${}"` shows it, snprintf
+ * style.
+ * @return its length, -1 for values which aren't written out.
+ */
+static int format_part(char *buffer, size_t size, Value value) {
+  switch (value.type) {
+  case VAL_BOOL:
+    return snprintf(buffer, size, "%s", AS_BOOL(value) ? "true" : "false");
+  case VAL_NULL:
+    return snprintf(buffer, size, "null");
+  case VAL_NUMBER:
+    return snprintf(buffer, size, "%g", AS_NUMBER(value));
+  case VAL_INT:
+    return snprintf(buffer, size, "%" PRId64, AS_INT(value));
+  default:
+    return -1;
+  }
+}
+
+const char *concatenate_n(Value *parts, int count, uint8_t mode,
+                          Value *result) {
+  // measures every part first, the result is allocated and hashed once.
+  size_t length = 0;
+  for (int i = 0; i < count; i++) {
+    if (IS_TEXT(parts[i])) {
+      length += text_length(parts[i]);
+      continue;
+    }
+    int part = mode & CONCAT_FORMAT ? format_part(NULL, 0, parts[i]) : -1;
+    if (part < 0) {
+      return mode & CONCAT_FORMAT
+                 ? "Only strings, numbers, booleans and null can be "
+                   "interpolated."
+                 : "Operands must be two strings or two numbers.";
+    }
+    length += (size_t)part;
+  }
+
+  char *chars = ALLOCATE(char, length + 1);
+  size_t at = 0;
+  for (int i = 0; i < count; i++) {
+    if (IS_TEXT(parts[i])) {
+      memcpy(chars + at, text_chars(parts[i]), text_length(parts[i]));
+      at += text_length(parts[i]);
+    } else {
+      at += (size_t)format_part(chars + at, length + 1 - at, parts[i]);
+    }
+  }
+  chars[length] = '\0';
+
+  *result = OBJ_VAL(take_string(chars, length));
+  return NULL;
+}
+
+/*
+ * Stores the result of a returning `memo fn` frame in its memo.
+ */
+static inline void remember_result(CallFrame *frame, Value result) {
+  if (frame->function->memo != NULL && frame->memo_key != NULL) {
+    memo_store(frame->function->memo, frame->memo_key, result);
+  }
 }
 
 /*
  * Heart of our interpreter execution logic.
  */
-static InterpretResult run() {
+static InterpretResult run(int base_frame) {
   // current stack frame
   CallFrame *frame = &vm.frames[vm.frame_count - 1];
 
@@ -193,34 +603,57 @@ static InterpretResult run() {
 #define READ_SHORT()                                                           \
   (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 
+// reads 24 bits, operand of the *_LONG instructions.
+#define READ_LONG()                                                            \
+  (frame->ip += 3, (uint32_t)((frame->ip[-3] << 16) | (frame->ip[-2] << 8) |  \
+                              frame->ip[-1]))
+
 // reads a constant from the chunk
 #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
 
+// reads a constant from the chunk using a 24 bit index.
+#define READ_CONSTANT_LONG()                                                   \
+  (frame->function->chunk.constants.values[READ_LONG()])
+
 // reads next constant and converts it to strings.
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 
-// macros for solving binary operations
-#define BINARY_OP(value_type, op)                                              \
+// reads next constant using a 24 bit index and converts it to strings.
+#define READ_STRING_LONG() AS_STRING(READ_CONSTANT_LONG())
+
+// macros for solving binary operations, result is computed from a and b.
+#define BINARY_OP(result)                                                      \
   do {                                                                         \
-    if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {                          \
+    if (!IS_NUMERIC(peek(0)) || !IS_NUMERIC(peek(1))) {                        \
       runtime_error("Operands must be number.");                               \
       return INTERPRET_RUNTIME_ERROR;                                          \
     }                                                                          \
-    double b = AS_NUMBER(pop());                                               \
-    double a = AS_NUMBER(pop());                                               \
-    push(value_type(a op b));                                                  \
+    Value b = pop();                                                           \
+    Value a = pop();                                                           \
+    push(result);                                                              \
+  } while (false)
+
+// BINARY_OP on operands the compiler knows are numbers.
+#define NUMERIC_OP(result)                                                     \
+  do {                                                                         \
+    Value b = pop();                                                           \
+    Value a = vm.stack_top[-1];                                                \
+    vm.stack_top[-1] = result;                                                 \
   } while (false)
 
   // previous instruction which ran.
   uint8_t instruction = 0;
   // goes forever.
   while (true) {
+#ifdef ZSPIE_DEBUG_MODE
     log_trace("current state of the stack:");
     for (Value *slot = vm.stack; slot < vm.stack_top; slot++) {
       log_trace("[ type=%d, value=%d ]", slot->type, slot->as);
     }
     log_trace("previous instruction=%d", instruction);
+#endif // ZSPIE_DEBUG_MODE
 
+    COUNT_INSTRUCTION();
     switch (instruction = READ_BYTE()) {
     // op_constant instruction.
     case OP_CONSTANT: {
@@ -229,6 +662,12 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_CONSTANT_LONG: {
+      Value constant = READ_CONSTANT_LONG();
+      push(constant);
+      break;
+    }
+
     case OP_NULL: {
       push(NULL_VAL);
       break;
@@ -255,12 +694,24 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_GET_LOCAL_LONG: {
+      uint16_t slot = READ_SHORT();
+      push(frame->slots[slot]);
+      break;
+    }
+
     case OP_SET_LOCAL: {
       uint8_t slot = READ_BYTE();
       frame->slots[slot] = peek(0);
       break;
     }
 
+    case OP_SET_LOCAL_LONG: {
+      uint16_t slot = READ_SHORT();
+      frame->slots[slot] = peek(0);
+      break;
+    }
+
     case OP_SET_GLOBAL: {
       ObjString *name = READ_STRING();
       if (table_set(&vm.globals, name, peek(0))) {
@@ -271,6 +722,16 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_SET_GLOBAL_LONG: {
+      ObjString *name = READ_STRING_LONG();
+      if (table_set(&vm.globals, name, peek(0))) {
+        table_delete(&vm.globals, name);
+        runtime_error("Undefined variable '%s'", name->chars);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
+    }
+
     case OP_GET_GLOBAL: {
       ObjString *name = READ_STRING();
       Value value;
@@ -282,6 +743,17 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_GET_GLOBAL_LONG: {
+      ObjString *name = READ_STRING_LONG();
+      Value value;
+      if (!table_get(&vm.globals, name, &value)) {
+        runtime_error("Undefined variable '%s'", name->chars);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      push(value);
+      break;
+    }
+
     case OP_DEFINE_GLOBAL: {
       ObjString *name = READ_STRING();
       table_set(&vm.globals, name, peek(0));
@@ -289,6 +761,13 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_DEFINE_GLOBAL_LONG: {
+      ObjString *name = READ_STRING_LONG();
+      table_set(&vm.globals, name, peek(0));
+      pop();
+      break;
+    }
+
     case OP_EQUAL: {
       Value b = pop();
       Value a = pop();
@@ -297,45 +776,43 @@ static InterpretResult run() {
     }
 
     case OP_GREATER: {
-      BINARY_OP(BOOL_VAL, >);
+      BINARY_OP(BOOL_VAL(greater_values(a, b)));
       break;
     }
 
     case OP_LESS: {
-      BINARY_OP(BOOL_VAL, <);
+      BINARY_OP(BOOL_VAL(less_values(a, b)));
       break;
     }
 
     // binary operation +
     case OP_ADD: {
-      if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+      if (IS_TEXT(peek(0)) && IS_TEXT(peek(1))) {
         concatenate();
-      } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-        double a = AS_NUMBER(pop());
-        double b = AS_NUMBER(pop());
-        push(NUMBER_VAL(a + b));
+      } else if (IS_NUMERIC(peek(0)) && IS_NUMERIC(peek(1))) {
+        Value b = pop();
+        Value a = pop();
+        push(add_values(a, b));
       } else {
         runtime_error("Operands must be two strings or two numbers.");
         return INTERPRET_RUNTIME_ERROR;
       }
       break;
     }
-      BINARY_OP(NUMBER_VAL, +);
-      break;
 
     // binary operation -
     case OP_SUBTRACT:
-      BINARY_OP(NUMBER_VAL, -);
+      BINARY_OP(subtract_values(a, b));
       break;
 
     // binary operation *
     case OP_MULTIPLY:
-      BINARY_OP(NUMBER_VAL, *);
+      BINARY_OP(multiply_values(a, b));
       break;
 
     // binary operation /
     case OP_DIVIDE:
-      BINARY_OP(NUMBER_VAL, /);
+      BINARY_OP(divide_values(a, b));
       break;
 
       // not operation !
@@ -345,11 +822,11 @@ static InterpretResult run() {
 
     // op_negate instruction.
     case OP_NEGATE: {
-      if (!IS_NUMBER(peek(0))) {
+      if (!IS_NUMERIC(peek(0))) {
         runtime_error("Operand must be a number.");
         return INTERPRET_RUNTIME_ERROR;
       }
-      push(NUMBER_VAL(-AS_NUMBER(pop())));
+      push(negate_value(pop()));
       break;
     }
 
@@ -364,9 +841,31 @@ static InterpretResult run() {
       break;
     }
 
+    case OP_JUMP_LONG: {
+      uint32_t offset = READ_LONG();
+      frame->ip += offset;
+      break;
+    }
+
     case OP_JUMP_IF_FALSE: {
       uint16_t offset = READ_SHORT();
-      if (is_falsey(peek(0))) {
+      bool falsey = is_falsey(peek(0));
+      if (vm.recording) {
+        trace_branch(frame, frame->ip - 3, falsey);
+      }
+      if (falsey) {
+        frame->ip += offset;
+      }
+      break;
+    }
+
+    case OP_JUMP_IF_FALSE_LONG: {
+      uint32_t offset = READ_LONG();
+      bool falsey = is_falsey(peek(0));
+      if (vm.recording) {
+        trace_branch(frame, frame->ip - 4, falsey);
+      }
+      if (falsey) {
         frame->ip += offset;
       }
       break;
@@ -375,21 +874,340 @@ static InterpretResult run() {
     case OP_LOOP: {
       uint16_t offset = READ_SHORT();
       frame->ip -= offset;
+      if (vm.jit_enabled) {
+        trace_loop(frame);
+      }
+      break;
+    }
+
+    case OP_LOOP_LONG: {
+      uint32_t offset = READ_LONG();
+      frame->ip -= offset;
+      if (vm.jit_enabled) {
+        trace_loop(frame);
+      }
+      break;
+    }
+
+    case OP_FOR_STEP: {
+      Value *counter = &frame->slots[READ_BYTE()];
+      uint8_t mode = READ_BYTE();
+      uint8_t limit_operand = READ_BYTE();
+      Value step = READ_CONSTANT();
+      uint16_t offset = READ_SHORT();
+      Value limit = mode & FOR_LIMIT_CONSTANT
+                        ? frame->function->chunk.constants.values[limit_operand]
+                        : frame->slots[limit_operand];
+      if (!IS_NUMERIC(*counter)) {
+        runtime_error("Operands must be two strings or two numbers.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      if (!IS_NUMERIC(limit)) {
+        runtime_error("Operands must be number.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+
+      bool loops = for_step(counter, step, limit, mode);
+      if (vm.recording) {
+        trace_branch(frame, frame->ip - 7, loops);
+      }
+      if (loops) {
+        frame->ip -= offset;
+        if (vm.jit_enabled) {
+          trace_loop(frame);
+        }
+      }
+      break;
+    }
+
+    case OP_CHECK_NUM: {
+      Value value = peek(READ_BYTE());
+      if (!IS_NUMERIC(value)) {
+        runtime_error("Expected a number.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
+    }
+
+    case OP_ADD_NN:
+      NUMERIC_OP(add_values(a, b));
+      break;
+
+    case OP_SUBTRACT_NN:
+      NUMERIC_OP(subtract_values(a, b));
+      break;
+
+    case OP_MULTIPLY_NN:
+      NUMERIC_OP(multiply_values(a, b));
+      break;
+
+    case OP_DIVIDE_NN:
+      NUMERIC_OP(divide_values(a, b));
+      break;
+
+    case OP_LESS_NN:
+      NUMERIC_OP(BOOL_VAL(less_values(a, b)));
+      break;
+
+    case OP_GREATER_NN:
+      NUMERIC_OP(BOOL_VAL(greater_values(a, b)));
+      break;
+
+    case OP_CLOSURE: {
+      ObjFunction *function = AS_FUNCTION(READ_CONSTANT_LONG());
+      push(OBJ_VAL(make_closure(function, frame->slots)));
+      break;
+    }
+
+    case OP_GET_CAPTURE: {
+      uint8_t index = READ_BYTE();
+      push(AS_CLOSURE(frame->slots[0])->captures[index]);
+      break;
+    }
+
+    case OP_GET_UPVALUE: {
+      uint8_t index = READ_BYTE();
+      Value cell = AS_CLOSURE(frame->slots[0])->captures[index];
+      push(*((ObjUpvalue *)AS_OBJ(cell))->location);
+      break;
+    }
+
+    case OP_SET_UPVALUE: {
+      uint8_t index = READ_BYTE();
+      Value cell = AS_CLOSURE(frame->slots[0])->captures[index];
+      *((ObjUpvalue *)AS_OBJ(cell))->location = peek(0);
+      break;
+    }
+
+    case OP_CLOSE_UPVALUE:
+      close_upvalues(vm.stack_top - 1);
+      pop();
+      break;
+
+    case OP_ARRAY: {
+      uint16_t count = READ_SHORT();
+      ObjArray *array = array_of(vm.stack_top - count, count);
+      vm.stack_top -= count;
+      push(OBJ_VAL(array));
+      break;
+    }
+
+    case OP_MAP: {
+      uint16_t count = READ_SHORT();
+      Value *pairs = vm.stack_top - 2 * count;
+      const char *error = map_of(pairs, count, pairs);
+      if (error != NULL) {
+        runtime_error("%s", error);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      vm.stack_top = pairs + 1;
+      break;
+    }
+
+    case OP_CONCAT_N: {
+      uint8_t count = READ_BYTE();
+      uint8_t mode = READ_BYTE();
+      Value *parts = vm.stack_top - count;
+      const char *error = concatenate_n(parts, count, mode, parts);
+      if (error != NULL) {
+        runtime_error("%s", error);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      vm.stack_top = parts + 1;
+      break;
+    }
+
+    case OP_MATH: {
+      MathFunction function = (MathFunction)READ_BYTE();
+      CallCache *cache = &frame->function->call_caches[READ_SHORT()];
+      int arity = math_intrinsics[function].arity;
+      Value *callee = vm.stack_top - arity - 1;
+      if (is_math_native(*callee, function)) {
+        *callee = math_call(function, callee + 1);
+        vm.stack_top = callee + 1;
+        break;
+      }
+      // the global holds something else now, it's called as usual.
+      if (!call_cached(cache, *callee, arity)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      break;
+    }
+
+    case OP_GET_INDEX: {
+      const char *error = get_index(peek(1), peek(0), &vm.stack_top[-2]);
+      if (error != NULL) {
+        runtime_error("%s", error);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      pop();
+      break;
+    }
+
+    case OP_SET_INDEX: {
+      const char *error = set_index(peek(2), peek(1), peek(0));
+      if (error != NULL) {
+        runtime_error("%s", error);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      Value value = pop();
+      vm.stack_top -= 2;
+      push(value);
+      break;
+    }
+
+    case OP_CLASS: {
+      push(OBJ_VAL(new_class(READ_STRING_LONG())));
+      break;
+    }
+
+    case OP_INHERIT: {
+      if (!IS_CLASS(peek(1))) {
+        runtime_error("Superclass must be a class.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      inherit(AS_CLASS(peek(0)), AS_CLASS(peek(1)));
+      pop();
+      break;
+    }
+
+    case OP_METHOD: {
+      ObjString *name = READ_STRING_LONG();
+      define_method(AS_CLASS(peek(1)), name, peek(0));
+      pop();
+      break;
+    }
+
+    case OP_GET_PROPERTY:
+    case OP_GET_PROPERTY_LONG: {
+      ObjString *name = READ_STRING_LONG();
+      uint32_t index = instruction == OP_GET_PROPERTY ? READ_SHORT() : READ_LONG();
+      PropertyCache *cache = &frame->function->property_caches[index];
+      const char *error =
+          get_property(cache, peek(0), name, &vm.stack_top[-1]);
+      if (error != NULL) {
+        runtime_error(error, name->chars);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      break;
+    }
+
+    case OP_SET_PROPERTY:
+    case OP_SET_PROPERTY_LONG: {
+      ObjString *name = READ_STRING_LONG();
+      uint32_t index = instruction == OP_SET_PROPERTY ? READ_SHORT() : READ_LONG();
+      PropertyCache *cache = &frame->function->property_caches[index];
+      const char *error = set_property(cache, peek(1), name, peek(0));
+      if (error != NULL) {
+        runtime_error(error, name->chars);
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      Value value = pop();
+      vm.stack_top[-1] = value;
+      break;
+    }
+
+    case OP_INVOKE:
+    case OP_INVOKE_LONG: {
+      ObjString *name = READ_STRING_LONG();
+      int args_count = READ_BYTE();
+      uint32_t index = instruction == OP_INVOKE ? READ_SHORT() : READ_LONG();
+      PropertyCache *cache = &frame->function->property_caches[index];
+      if (!invoke(cache, name, args_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      break;
+    }
+
+    case OP_GET_SUPER: {
+      ObjString *name = READ_STRING_LONG();
+      Value method;
+      if (!super_method(AS_CLASS(peek(0)), name, &method)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ObjBoundMethod *bound = new_bound_method(peek(1), method);
+      vm.stack_top -= 2;
+      push(OBJ_VAL(bound));
+      break;
+    }
+
+    case OP_SUPER_INVOKE: {
+      ObjString *name = READ_STRING_LONG();
+      int args_count = READ_BYTE();
+      Value method;
+      if (!super_method(AS_CLASS(pop()), name, &method) ||
+          !call_method(method, args_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
       break;
     }
 
     case OP_CALL: {
       int args_count = READ_BYTE();
-      if (!call_value(peek(args_count), args_count)) {
+      CallCache *cache = &frame->function->call_caches[READ_SHORT()];
+      if (!call_cached(cache, peek(args_count), args_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      break;
+    }
+
+    case OP_CALL_LONG: {
+      int args_count = READ_BYTE();
+      CallCache *cache = &frame->function->call_caches[READ_LONG()];
+      if (!call_cached(cache, peek(args_count), args_count)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      break;
+    }
+
+    case OP_CALL_0:
+    case OP_CALL_1:
+    case OP_CALL_2:
+    case OP_CALL_3: {
+      int args_count = instruction - OP_CALL_0;
+      CallCache *cache = &frame->function->call_caches[READ_SHORT()];
+      if (!call_cached(cache, peek(args_count), args_count)) {
         return INTERPRET_RUNTIME_ERROR;
       }
       frame = &vm.frames[vm.frame_count - 1];
       break;
     }
 
+    case OP_PEEK: {
+      uint8_t distance = READ_BYTE();
+      push(peek(distance));
+      break;
+    }
+
+    case OP_INLINE_GUARD: {
+      uint8_t args_count = READ_BYTE();
+      Value function = READ_CONSTANT_LONG();
+      uint16_t offset = READ_SHORT();
+      // the callee is still the inlined function, skip the call.
+      if (values_equal(peek(args_count), function)) {
+        frame->ip += offset;
+      }
+      break;
+    }
+
+    case OP_INLINE_RETURN: {
+      uint8_t count = READ_BYTE();
+      Value result = pop();
+      vm.stack_top -= count;
+      push(result);
+      break;
+    }
+
       // op_return instruction.
     case OP_RETURN: {
       Value result = pop();
+      close_upvalues(frame->slots);
+      remember_result(frame, result);
       vm.frame_count--;
       if (vm.frame_count == 0) {
         pop();
@@ -398,17 +1216,172 @@ static InterpretResult run() {
 
       vm.stack_top = frame->slots;
       push(result);
+      // a nested run started by call_and_run is done.
+      if (vm.frame_count == base_frame) {
+        return INTERPRET_OK;
+      }
       frame = &vm.frames[vm.frame_count - 1];
       break;
     }
+
+    case OP_RETURN_N: {
+      int count = READ_BYTE();
+      return_values(vm.stack_top - count, count);
+      if (vm.frame_count == 0 || vm.frame_count == base_frame) {
+        return INTERPRET_OK;
+      }
+      frame = &vm.frames[vm.frame_count - 1];
+      break;
+    }
+
+    case OP_UNPACK: {
+      int count = READ_BYTE();
+      unpack_values(vm.stack_top - 1, count);
+      break;
+    }
+
+    case OP_JUMP_TABLE:
+    case OP_JUMP_MAP: {
+      Chunk *chunk = &frame->function->chunk;
+      size_t offset = (size_t)(frame->ip - 1 - chunk->code);
+      int index = jump_table_index(chunk, offset, pop());
+      frame->ip = chunk->code + jump_table_target(chunk, offset, index);
+      break;
+    }
     }
   }
 
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_LONG
 #undef READ_CONSTANT
+#undef READ_CONSTANT_LONG
 #undef READ_STRING
+#undef READ_STRING_LONG
 #undef BINARY_OP
+#undef NUMERIC_OP
+}
+
+bool call_and_run(CallCache *cache, Value callee, int args_count) {
+  int frame_count = vm.frame_count;
+  if (!call_cached(cache, callee, args_count)) {
+    return false;
+  }
+
+  if (vm.frame_count > frame_count) {
+    return run(frame_count) == INTERPRET_OK;
+  }
+  return true;
+}
+
+bool native_call(NativeContext *context, Value callee, int arg_count,
+                 Value *args, Value *result) {
+  if (vm.stack_top + arg_count + 1 > vm.stack + MAX_STACK_SIZE) {
+    runtime_error("Stack overflow.");
+    return false;
+  }
+  push(callee);
+  for (int i = 0; i < arg_count; i++) {
+    push(args[i]);
+  }
+  if (!call_and_run(&context->cache, callee, arg_count)) {
+    return false;
+  }
+  *result = pop();
+  return true;
+}
+
+bool invoke_and_run(PropertyCache *cache, ObjString *name, int args_count) {
+  int frame_count = vm.frame_count;
+  if (!invoke(cache, name, args_count)) {
+    return false;
+  }
+
+  if (vm.frame_count > frame_count) {
+    return run(frame_count) == INTERPRET_OK;
+  }
+  return true;
+}
+
+void return_from_call(Value result) {
+  CallFrame *frame = &vm.frames[--vm.frame_count];
+  close_upvalues(frame->slots);
+  remember_result(frame, result);
+  vm.stack_top = frame->slots;
+  // the top level script doesn't leave a result behind.
+  if (vm.frame_count > 0) {
+    push(result);
+  }
+}
+
+void return_values(Value *values, int count) {
+  CallFrame *frame = &vm.frames[--vm.frame_count];
+  close_upvalues(frame->slots);
+  vm.stack_top = frame->slots;
+  if (vm.frame_count == 0) {
+    return;
+  }
+
+  // they take the callee's place and the slots above it, unless the caller
+  // only wants the first one.
+  CallFrame *caller = &vm.frames[vm.frame_count - 1];
+  if (*caller->ip == OP_UNPACK) {
+    memmove(frame->slots, values, sizeof(Value) * count);
+    vm.returned = frame->slots;
+    vm.returned_count = count;
+  } else {
+    frame->slots[0] = values[0];
+  }
+  vm.stack_top = frame->slots + 1;
+}
+
+void unpack_values(Value *result, int count) {
+  // natives, classes and functions returning one value left one.
+  int returned = vm.returned == result ? vm.returned_count : 1;
+  vm.returned = NULL;
+  for (int i = returned; i < count; i++) {
+    result[i] = NULL_VAL;
+  }
+  vm.stack_top = result + count;
+}
+
+int jump_table_index(Chunk *chunk, size_t offset, Value value) {
+  Value table = chunk->constants.values[name_operand(chunk, offset)];
+  int count = jump_table_count(chunk, offset);
+  if (chunk->code[offset] == OP_JUMP_MAP) {
+    Value index;
+    if (is_map_key(value) && map_get(AS_MAP(table), value, &index)) {
+      return (int)AS_INT(index);
+    }
+    return count;
+  }
+
+  // 2.0 matches case 2 as for `==`, dense case values fit in 32 bits so the
+  // float difference is exact.
+  if (IS_INT(value)) {
+    uint64_t index = (uint64_t)AS_INT(value) - (uint64_t)AS_INT(table);
+    return index < (uint64_t)count ? (int)index : count;
+  }
+  if (IS_NUMBER(value)) {
+    double index = AS_NUMBER(value) - (double)AS_INT(table);
+    if (index >= 0 && index < count && index == (double)(int)index) {
+      return (int)index;
+    }
+  }
+  return count;
+}
+
+InterpretResult interpret_function(ObjFunction *function) {
+  push(OBJ_VAL(function));
+  if (!call(function, 0)) {
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  // compiled scripts have already run to completion.
+  if (vm.frame_count == 0) {
+    return INTERPRET_OK;
+  }
+  return run(0);
 }
 
 /*
@@ -420,17 +1393,17 @@ InterpretResult interpret(const char *source) {
   clock_t before_com = clock();
 
   ObjFunction *function = compile(source);
-  if (function == NULL) {
+  if (function == NULL || !verify_function(function)) {
     return INTERPRET_COMPILE_ERROR;
   }
 
-  push(OBJ_VAL(function));
+  pack_functions(function);
 
   log_info("Compilation finished. Starting execution.\n\n");
   clock_t before_exec = clock();
 
-  call(function, 0);
-  InterpretResult result = run();
+  InterpretResult result = vm.register_vm ? interpret_registers(function)
+                                           : interpret_function(function);
 
   log_info("Compilation took : %ld", clock() - before_com);
   log_info("Execution took : %ld", clock() - before_exec);
@@ -3,7 +3,9 @@
 
 #include "chunk.h"
 #include "common.h"
+#include "jit.h"
 #include "object.h"
+#include "segment.h"
 #include "table.h"
 #include "value.h"
 #include <stdint.h>
@@ -11,10 +13,18 @@
 #define FRAMES_MAX 64
 #define MAX_STACK_SIZE (FRAMES_MAX * UINT8_COUNT)
 
-typedef struct {
+struct RegInstruction;
+
+typedef struct CallFrame {
   ObjFunction *function;
   uint8_t *ip;
   Value *slots;
+  // next instruction of a frame run by the register machine, ip then only
+  // points at the stack instruction of the latest call.
+  struct RegInstruction *pc;
+  // key the result of a `memo fn` call is remembered with on return, NULL
+  // if its arguments can't be a key.
+  ObjString *memo_key;
 } CallFrame;
 
 /*
@@ -34,10 +44,39 @@ typedef struct {
   Table globals;
   // all string objects in hash table.
   Table strings;
+  // regexes compiled by the regex natives, by their pattern.
+  Table regexes;
   // pointers to the head of dynamic objects created on the heap.
   struct Obj *objects;
+  // upvalues still pointing into the stack, the topmost slot first.
+  ObjUpvalue *open_upvalues;
+  // values an OP_RETURN_N left for the OP_UNPACK after its call, NULL once
+  // it took them.
+  Value *returned;
+  int returned_count;
+  // read-only segments holding packed bytecode of compiled scripts.
+  CodeSegment *segments;
+  // if hot functions get jit compiled.
+  bool jit_enabled;
+  // executable memory holding jit compiled functions.
+  JitBlock *jit_blocks;
+  // if an iteration of a hot loop is being recorded.
+  bool recording;
+  // if scripts run on the register machine instead, see regvm.h.
+  bool register_vm;
+#ifdef ZSPIE_COUNT_INSTRUCTIONS
+  // instructions run by either interpreter.
+  uint64_t instruction_count;
+#endif // ZSPIE_COUNT_INSTRUCTIONS
 } VM;
 
+// counts instructions for comparing the stack and register machines.
+#ifdef ZSPIE_COUNT_INSTRUCTIONS
+#define COUNT_INSTRUCTION() (vm.instruction_count++)
+#else
+#define COUNT_INSTRUCTION()
+#endif // ZSPIE_COUNT_INSTRUCTIONS
+
 /*
  * Possible outcomes of our interpreter.
  */
@@ -49,6 +88,16 @@ typedef enum {
 
 extern VM vm;
 
+/*
+ * Passed to natives defined with a NativeCallFn, calls they make back into
+ * zspie go through it.
+ */
+struct NativeContext {
+  // cache of the calls made with native_call, natives usually call the same
+  // function over and over.
+  CallCache cache;
+};
+
 /* Initialiser for our vm.
  *
  */
@@ -64,6 +113,141 @@ void free_vm();
  */
 InterpretResult interpret(const char *source);
 
+/*
+ * Runs an already compiled and verified top level function.
+ */
+InterpretResult interpret_function(ObjFunction *function);
+
+/*
+ * Reports a runtime error with a stack trace and resets the vm's stack.
+ */
+void runtime_error(const char *format, ...);
+
+/*
+ * Calls a value with its arguments on top of the stack. Interpreted
+ * functions only get their frame pushed.
+ * @return false after reporting a runtime error.
+ */
+bool call_value(Value callee, int args_count);
+
+/*
+ * call_value through the cache of a call site, repeated calls to the cached
+ * callee skip dispatching on its type and checking its arity.
+ * @return false after reporting a runtime error.
+ */
+bool call_cached(CallCache *cache, Value callee, int args_count);
+
+/*
+ * Calls a value with its arguments on top of the stack through the cache of
+ * its call site and runs it to completion, leaving the result in place of
+ * the callee.
+ * @return false after reporting a runtime error.
+ */
+bool call_and_run(CallCache *cache, Value callee, int args_count);
+
+/*
+ * Calls a value from a native with arg_count arguments and runs it to
+ * completion, the native may be running inside another such call.
+ * @return false after reporting a runtime error, which the native returns
+ * as well.
+ */
+bool native_call(NativeContext *context, Value callee, int arg_count,
+                 Value *args, Value *result);
+
+/*
+ * What OP_INVOKE does: calls the method or field named name of the receiver
+ * below args_count arguments on top of the stack, finding it through the
+ * cache of the site.
+ * @return false after reporting a runtime error.
+ */
+bool invoke(PropertyCache *cache, ObjString *name, int args_count);
+
+/*
+ * invoke, running the called method to completion like call_and_run.
+ * @return false after reporting a runtime error.
+ */
+bool invoke_and_run(PropertyCache *cache, ObjString *name, int args_count);
+
+/*
+ * Pops the current frame and leaves result in place of its callee, what
+ * OP_RETURN does.
+ */
+void return_from_call(Value result);
+
+/*
+ * Pops the current frame like return_from_call, for the count values from
+ * values on which `return a, b` returns, what OP_RETURN_N does.
+ */
+void return_values(Value *values, int count);
+
+/*
+ * Spreads the values the call leaving result returned over count slots from
+ * result on, what OP_UNPACK does.
+ */
+void unpack_values(Value *result, int count);
+
+/*
+ * Case of the OP_JUMP_TABLE or OP_JUMP_MAP at offset which value matches.
+ * @return its index, or the count of cases if it matches none.
+ */
+int jump_table_index(Chunk *chunk, size_t offset, Value value);
+
+/*
+ * What OP_CLOSURE does: makes a closure of function, taking its captures from
+ * the frame with those slots.
+ */
+ObjClosure *make_closure(ObjFunction *function, Value *slots);
+
+/*
+ * Moves the values of the stack slots from last upwards into the upvalues
+ * pointing at them.
+ */
+void close_upvalues(Value *last);
+
+/*
+ * zspie's truthiness, null, false and 0 are falsey.
+ */
+bool is_falsey(Value value);
+
+/*
+ * What OP_FOR_STEP does once its counter and limit are known to be numbers:
+ * adds step to the counter and compares it with the limit.
+ * @param mode - the instruction's mode operand.
+ * @return true if the loop goes on.
+ */
+static inline bool for_step(Value *counter, Value step, Value limit,
+                            uint8_t mode) {
+  *counter = add_values(*counter, step);
+  switch (mode & FOR_COMPARISON) {
+  case FOR_LESS:
+    return less_values(*counter, limit);
+  case FOR_LESS_EQUAL:
+    return !greater_values(*counter, limit);
+  case FOR_GREATER:
+    return greater_values(*counter, limit);
+  default:
+    return !less_values(*counter, limit);
+  }
+}
+
+/*
+ * Pops two strings and pushes their concatenation.
+ */
+void concatenate();
+
+/*
+ * What OP_CONCAT_N does: joins count values into one string.
+ * @param mode - CONCAT_FORMAT to write out numbers, booleans and null.
+ * @return NULL, or the runtime error to report.
+ */
+const char *concatenate_n(Value *parts, int count, uint8_t mode,
+                          Value *result);
+
+/*
+ * @return a new string holding a followed by b.
+ */
+ObjString *join_strings(ObjString *a, ObjString *b);
+
 /*
  * stack operations for our vm: pushing
  */
@@ -0,0 +1,36 @@
+# Differential test of the jit against the interpreter, runs an example with
+# and without --no-jit and fails unless both print the same and exit alike.
+#
+#   cmake -DZSPIE=<zspie binary> -DEXAMPLE=<example file> -P compare_jit.cmake
+#
+# Examples timing themselves with clock() print another time every run, so
+# in those the lines of a lone fractional number are masked.
+
+if(NOT ZSPIE OR NOT EXAMPLE)
+  message(FATAL_ERROR "ZSPIE and EXAMPLE must be given.")
+endif()
+
+file(READ ${EXAMPLE} source)
+string(FIND "${source}" "clock()" timed)
+
+function(run_example result_var)
+  execute_process(
+    COMMAND ${ZSPIE} ${ARGN} ${EXAMPLE}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output
+    RESULT_VARIABLE result
+    TIMEOUT 60)
+  if(NOT timed EQUAL -1)
+    string(REGEX REPLACE
+      "'-?[0-9]*\\.?[0-9]+(e[-+]?[0-9]+)?'\n" "'<time>'\n" output "${output}")
+  endif()
+  set(${result_var} "exit ${result}\n${output}" PARENT_SCOPE)
+endfunction()
+
+run_example(jit)
+run_example(interpreted --no-jit)
+
+if(NOT jit STREQUAL interpreted)
+  message(FATAL_ERROR
+    "${EXAMPLE} differs with the jit:\n${jit}\nwithout it:\n${interpreted}")
+endif()